@@ -0,0 +1,218 @@
+/**
+ * Checks that loading and the kernels stay within fixed heap allocation budgets:
+ *     VoxAllocCheck [--verbose]
+ *
+ * Every load path and kernel runs on the same generated scene, with the global operator new counting allocations and
+ * bytes. A check fails if it needs more allocations or bytes than its budget, so a missing reserve() or a Dictionary
+ * copied by value is caught when it is introduced. Paths which must not allocate at all have a budget of 0.
+ * Every check runs twice and the second run is counted, so one-time initialization (e.g. function statics) is not.
+ *
+ * The budgets are the counts of a release build with libstdc++ plus 15 % (rounded up), as headroom for other standard
+ * libraries. Debug builds of MSVC allocate for iterator debugging and exceed them. Whenever a path improves, lower its
+ * budget to the new count plus 15 %.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define JIM_VOXREADER_IMPLEMENTATION
+#include "VoxReader.hpp"
+#include "VoxWriter.hpp"
+#include "VoxCompiled.hpp"
+#include "VoxReload.hpp"
+#include "VoxInfo.hpp"
+#include "VoxValidate.hpp"
+#include "VoxExport.hpp"
+
+#define JIM_VOXTOOLS_COUNT_ALLOCATIONS
+#include "VoxTools.hpp"
+
+using namespace jim;
+
+//////////////////////////////////////////////////////////////////////////////
+// INPUT
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Four models of different sizes, each instanced twice below named transform nodes on two layers, eight materials
+ * and a palette. Fixed, so the budgets stay meaningful.
+ */
+static void generateInput(VoxReader &vox) {
+	generateScene(vox, { 8, 16, 32, 48 }, 0.25, 8, 2);
+
+	vox.palette = new std::vector<RGBA>(256);
+	for (uint32_t i = 0; i < 256; i++) {
+		(*vox.palette)[i] = RGBA(255, (uint8_t)i, (uint8_t)(255 - i), (uint8_t)(i * 7));
+	}
+
+	vox.layers[0].attributes.emplace_back("_name", "foreground");
+	vox.layers[1].attributes.emplace_back("_name", "background");
+	vox.layers[1].attributes.emplace_back("_hidden", "0");
+
+	vox.materials.resize(8);
+	for (uint32_t i = 0; i < 8; i++) {
+		Dictionary &properties = vox.materials[i].properties;
+		properties.emplace_back("_type", i % 2 ? "_metal" : "_diffuse");
+		properties.emplace_back("_weight", "1");
+		properties.emplace_back("_rough", "0.1");
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// CHECKS
+//////////////////////////////////////////////////////////////////////////////
+
+struct Check {
+	const char *name;
+	uint64_t maxAllocations;
+	uint64_t maxBytes;
+	std::function<void()> task;
+};
+
+int main(int argc, char **argv) {
+	bool verbose = false;
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--verbose")) verbose = true;
+		else {
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	// Inputs are prepared before counting:
+	VoxReader scene;
+	generateInput(scene);
+	std::string voxData;
+	{
+		std::ostringstream s;
+		VoxWriter(scene).save(s);
+		voxData = s.str();
+	}
+	const uint8_t *data = reinterpret_cast<const uint8_t *>(voxData.data());
+	const size_t size = voxData.size();
+
+	std::vector<uint64_t> compiledData;
+	size_t compiledSize;
+	{
+		VoxReader vox;
+		vox.load(data, size);
+		std::ostringstream s;
+		VoxCompiledWriter::save(vox, s);
+		std::string bytes = s.str();
+		compiledSize = bytes.size();
+		compiledData.resize((compiledSize + 7) / 8);
+		memcpy(compiledData.data(), bytes.data(), compiledSize);
+	}
+	const uint8_t *compiled = reinterpret_cast<const uint8_t *>(compiledData.data());
+
+	VoxReader loaded;
+	loaded.load(data, size);
+	std::vector<uint64_t> loadedHashes = VoxReloader::hashChunks(loaded, data, size);
+
+	NullBuffer nullBuffer;
+	std::ostream null(&nullBuffer);
+	std::istringstream stream;
+
+	const std::vector<Check> checks = {
+		// Load paths:
+		{ "load (memory)", 114, 189700, [&]() {
+			VoxReader vox;
+			vox.load(data, size);
+		} },
+		{ "load (stream)", 115, 363600, [&]() {
+			VoxReader vox;
+			vox.load(stream);
+		} },
+		{ "reload (into empty)", 218, 196300, [&]() {
+			VoxReader vox;
+			std::vector<uint64_t> hashes;
+			VoxReloader::reload(vox, hashes, data, size);
+		} },
+		{ "reload (unchanged)", 88, 15100, [&]() {
+			std::vector<uint64_t> hashes = loadedHashes;
+			VoxReloader::reload(loaded, hashes, data, size);
+		} },
+		{ "compiled (open)", 0, 0, [&]() {
+			VoxCompiledReader reader(compiled, compiledSize);
+			(void)reader;
+		} },
+		{ "compiled (to reader)", 98, 178600, [&]() {
+			VoxReader vox;
+			VoxCompiledReader(compiled, compiledSize).toReader(vox);
+		} },
+		{ "info scan", 34, 1800, [&]() {
+			VoxInfo info = VoxInfo::scan(data, size);
+			(void)info;
+		} },
+		{ "validate", 132, 5300, [&]() {
+			auto issues = VoxValidator::validate(data, size);
+			(void)issues;
+		} },
+
+		// Kernels:
+		{ "view2d", 57, 22600, [&]() {
+			auto view = loaded.view2d(VoxReader::XZ, 0, 3);
+			(void)view;
+		} },
+		{ "flatten", 10, 1400, [&]() {
+			auto instances = loaded.sceneGraph.Flatten();
+			(void)instances;
+		} },
+		{ "content hash", 0, 0, [&]() {
+			volatile uint64_t hash = loaded.models[3].contentHash();
+			(void)hash;
+		} },
+		{ "palette lookup", 0, 0, [&]() {
+			uint32_t sum = 0;
+			for (const Voxel &voxel : loaded.models[3].voxels) {
+				sum += loaded.getColor(voxel.colorIndex).r;
+			}
+			volatile uint32_t result = sum;
+			(void)result;
+		} },
+		{ "stats", 11, 800, [&]() {
+			VoxReader::Stats stats = loaded.stats();
+			(void)stats;
+		} },
+		{ "write", 2, 75400, [&]() {
+			VoxWriter(loaded).save(null);
+		} },
+		{ "mesh glTF", 150, 1585300, [&]() {
+			VoxExport(loaded).saveGltf(null);
+		} },
+		{ "mesh OBJ", 314, 1396500, [&]() {
+			VoxExport(loaded).saveObj(null);
+		} },
+	};
+
+	printf("%-22s %12s %12s %14s %14s\n", "check", "allocations", "budget", "bytes", "budget");
+	size_t failed = 0;
+	for (const Check &check : checks) {
+		uint64_t allocations = 0, bytes = 0;
+		for (int run = 0; run < 2; run++) {
+			stream.clear();
+			stream.str(voxData);
+			AllocationScope scope;
+			check.task();
+			allocations = scope.allocations();
+			bytes = scope.allocated();
+		}
+
+		const bool ok = allocations <= check.maxAllocations && bytes <= check.maxBytes;
+		if (!ok) failed++;
+		if (!ok || verbose) {
+			printf("%-22s %12llu %12llu %14llu %14llu%s\n", check.name, (unsigned long long)allocations,
+				(unsigned long long)check.maxAllocations, (unsigned long long)bytes, (unsigned long long)check.maxBytes,
+				ok ? "" : "  OVER BUDGET");
+		}
+	}
+
+	printf("%zu of %zu checks within budget\n", checks.size() - failed, checks.size());
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,786 @@
+#pragma once
+
+#include "VoxReader.hpp"
+
+// Coroutines need C++20 (e.g. -std=c++20 or /std:c++20), without them this header declares nothing:
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#define JIM_VOXASYNC
+#endif
+#endif
+
+#ifdef JIM_VOXASYNC
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace jim {
+
+	/**
+	 * Coroutine of an asynchronous operation. It is started by awaiting it (co_await) or by wait(), where its
+	 * exceptions are rethrown.
+	*/
+	class AsyncTask {
+	public:
+		struct promise_type;
+
+		AsyncTask(AsyncTask &&other) noexcept : handle(other.handle) { other.handle = nullptr; }
+		AsyncTask& operator=(AsyncTask &&other) noexcept;
+		~AsyncTask();
+
+		/**
+		 * Run the operation from code which is not a coroutine, blocks until it finished.
+		*/
+		void wait();
+
+		bool await_ready() const noexcept { return false; }
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept;
+		void await_resume();
+
+	private:
+		struct Waiter;
+
+		explicit AsyncTask(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+		std::coroutine_handle<promise_type> handle;
+	};
+
+	struct AsyncTask::promise_type {
+		struct FinalAwaiter {
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> finished) noexcept;
+			void await_resume() noexcept {}
+		};
+
+		AsyncTask get_return_object() { return AsyncTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { exception = std::current_exception(); }
+
+		std::exception_ptr exception;
+		std::coroutine_handle<> continuation; // the awaiting coroutine
+		Waiter *waiter = nullptr;             // if started by wait()
+	};
+
+	/**
+	 * Loads vox-files from coroutines without blocking the calling thread on file I/O.
+	 * Reads go through io_uring on Linux where the kernel allows it, otherwise they are made by a small pool of
+	 * threads. Suspended loads are resumed by the executor, which lets a server resume them on its own event loop.
+	 *     VoxAsyncLoader loader([&](std::coroutine_handle<> h) { eventLoop.post(h); });
+	 *     co_await loader.loadAsync(vox, "scene.vox");
+	*/
+	class VoxAsyncLoader {
+	public:
+
+		/**
+		 * Resumes the given suspended load, e.g. directly or by posting it to an event loop.
+		 * Called on the I/O threads of the loader and on the thread of a load which yields.
+		*/
+		using Executor = std::function<void(std::coroutine_handle<>)>;
+
+		/**
+		 * @param[in] executor Resumes loads once their reads completed and after they yielded. Without one, loads
+		 *                     are resumed on the threads of the loader.
+		 * @param[in] threads  Number of threads making the reads if io_uring is not used and resuming loads if there
+		 *                     is no executor.
+		 * @param[in] ioUring  Whether io_uring may be used. It is not if the kernel or a seccomp filter refuses it.
+		*/
+		explicit VoxAsyncLoader(Executor executor = nullptr, unsigned threads = 2, bool ioUring = true);
+
+		/**
+		 * All loads must have finished.
+		*/
+		~VoxAsyncLoader();
+
+		VoxAsyncLoader(const VoxAsyncLoader &) = delete;
+		VoxAsyncLoader& operator=(const VoxAsyncLoader &) = delete;
+
+		/**
+		 * Load the vox-file at the given path into the given reader, with the same result as VoxReader::load().
+		 * The file is read in blocks of the given size, the next block is read while the current one is decoded.
+		 * Chunks are decoded as soon as they are complete; after decoding at least one block the load yields to the
+		 * executor, so a thread running many loads is not held up by one large file. Opening the file blocks.
+		 * The reader must not be used until the load finished.
+		*/
+		AsyncTask loadAsync(VoxReader &vox, std::string path, size_t blockSize = 1024 * 1024);
+
+		/**
+		 * Returns whether reads go through io_uring. A read the ring refuses later (e.g. io_uring_enter failing
+		 * with ENOMEM) is made by the threads instead.
+		*/
+		bool usesIoUring() const { return ring != nullptr; }
+
+	private:
+		struct Read;
+		class Ring;
+		class ReadAwaiter;
+		class YieldAwaiter;
+		class ChunkFeed;
+
+		void submit(Read &read);
+		void submit(Read &read, int fd, uint8_t *buffer, size_t offset, size_t count);
+		void complete(Read &read, int64_t result);
+		void schedule(std::coroutine_handle<> handle);
+		void post(std::function<void()> task);
+
+		Executor executor;
+		std::unique_ptr<Ring> ring;       // NULL if io_uring is not used
+		std::thread reaper;               // waits for completions of the ring
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::deque<std::function<void()>> tasks; // reads and resumptions for the workers
+		bool stopping = false;
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <cerrno>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define JIM_VOXASYNC_IO_URING
+#endif
+#endif
+
+// The kernel orders a submission before its completion, ThreadSanitizer has to be told:
+#if defined(__SANITIZE_THREAD__)
+#define JIM_VOXASYNC_TSAN
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define JIM_VOXASYNC_TSAN
+#endif
+#endif
+#if defined(JIM_VOXASYNC_IO_URING) && defined(JIM_VOXASYNC_TSAN)
+extern "C" void __tsan_acquire(void *address);
+extern "C" void __tsan_release(void *address);
+#define JIM_VOXASYNC_TSAN_ACQUIRE(address) __tsan_acquire(address)
+#define JIM_VOXASYNC_TSAN_RELEASE(address) __tsan_release(address)
+#else
+#define JIM_VOXASYNC_TSAN_ACQUIRE(address)
+#define JIM_VOXASYNC_TSAN_RELEASE(address)
+#endif
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// ASYNC TASK
+	//////////////////////////////////////////////////////////////////////////////
+
+	struct AsyncTask::Waiter {
+		std::mutex mutex;
+		std::condition_variable finished;
+		bool done = false;
+	};
+
+	AsyncTask& AsyncTask::operator=(AsyncTask &&other) noexcept {
+		if (this != &other) {
+			if (handle) handle.destroy();
+			handle = other.handle;
+			other.handle = nullptr;
+		}
+		return *this;
+	}
+
+	AsyncTask::~AsyncTask() {
+		if (handle) handle.destroy();
+	}
+
+	void AsyncTask::wait() {
+		Waiter waiter;
+		handle.promise().waiter = &waiter;
+		handle.resume();
+		{
+			std::unique_lock<std::mutex> lock(waiter.mutex);
+			waiter.finished.wait(lock, [&]() { return waiter.done; });
+		}
+		await_resume();
+	}
+
+	std::coroutine_handle<> AsyncTask::await_suspend(std::coroutine_handle<> awaiting) noexcept {
+		handle.promise().continuation = awaiting;
+		return handle;
+	}
+
+	void AsyncTask::await_resume() {
+		if (handle.promise().exception) {
+			std::rethrow_exception(handle.promise().exception);
+		}
+	}
+
+	std::coroutine_handle<> AsyncTask::promise_type::FinalAwaiter::await_suspend(std::coroutine_handle<promise_type> finished) noexcept {
+		promise_type &promise = finished.promise();
+		if (promise.continuation) {
+			return promise.continuation;
+		}
+		// The waiting thread destroys the coroutine once it sees done, nothing may touch it after the notification:
+		if (Waiter *waiter = promise.waiter) {
+			std::lock_guard<std::mutex> lock(waiter->mutex);
+			waiter->done = true;
+			waiter->finished.notify_all();
+		}
+		return std::noop_coroutine();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// FILE ACCESS
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* File opened for reading at offsets, closed on destruction.
+	*/
+	class AsyncFile {
+	public:
+		explicit AsyncFile(const std::string &path) {
+#if defined(_WIN32)
+			fd = _open(path.c_str(), _O_RDONLY | _O_BINARY);
+			struct _stat64 info;
+			if (fd < 0 || _fstat64(fd, &info) != 0) {
+				if (fd >= 0) _close(fd);
+				throw VoxReader::Exception("Cannot open file: " + path);
+			}
+#else
+			fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+			struct stat info;
+			if (fd < 0 || ::fstat(fd, &info) != 0) {
+				if (fd >= 0) ::close(fd);
+				throw VoxReader::Exception("Cannot open file: " + path);
+			}
+#endif
+			size = (uint64_t)info.st_size;
+		}
+
+		~AsyncFile() {
+#if defined(_WIN32)
+			_close(fd);
+#else
+			::close(fd);
+#endif
+		}
+
+		AsyncFile(const AsyncFile &) = delete;
+		AsyncFile& operator=(const AsyncFile &) = delete;
+
+		int fd;
+		uint64_t size;
+	};
+
+	/**
+	* Blocking read at the given offset, returns the number of bytes read or -errno.
+	*/
+	static int64_t readAt(int fd, uint8_t *buffer, uint32_t size, uint64_t offset) {
+#if defined(_WIN32)
+		// There is no positional read on CRT file descriptors:
+		static std::mutex seekMutex;
+		std::lock_guard<std::mutex> lock(seekMutex);
+		if (_lseeki64(fd, (__int64)offset, SEEK_SET) < 0) return -errno;
+		int count = _read(fd, buffer, size);
+#else
+		ssize_t count;
+		do {
+			count = ::pread(fd, buffer, size, (off_t)offset);
+		} while (count < 0 && errno == EINTR);
+#endif
+		return count < 0 ? -(int64_t)errno : (int64_t)count;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// READS
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* A read in flight. Whichever comes second of its completion and the awaiting coroutine suspending resumes it.
+	*/
+	struct VoxAsyncLoader::Read {
+		enum State { PENDING, WAITING, DONE };
+
+		int fd = -1;
+		uint8_t *buffer = nullptr;
+		uint32_t size = 0;
+		uint64_t offset = 0;
+		bool inFlight = false;
+
+#ifdef JIM_VOXASYNC_IO_URING
+		iovec vector;
+#endif
+		int64_t result = 0; // bytes read or -errno
+		std::atomic<int> state{ PENDING };
+		std::coroutine_handle<> waiting;
+	};
+
+	class VoxAsyncLoader::ReadAwaiter {
+	public:
+		explicit ReadAwaiter(Read &read) : read(read) {}
+
+		bool await_ready() const noexcept {
+			return read.state.load(std::memory_order_acquire) == Read::DONE;
+		}
+
+		bool await_suspend(std::coroutine_handle<> awaiting) noexcept {
+			read.waiting = awaiting;
+			int expected = Read::PENDING;
+			return read.state.compare_exchange_strong(expected, Read::WAITING, std::memory_order_acq_rel);
+		}
+
+		int64_t await_resume() noexcept {
+			read.inFlight = false;
+			return read.result;
+		}
+
+	private:
+		Read &read;
+	};
+
+	class VoxAsyncLoader::YieldAwaiter {
+	public:
+		explicit YieldAwaiter(VoxAsyncLoader &loader) : loader(loader) {}
+
+		bool await_ready() const noexcept { return false; }
+		void await_suspend(std::coroutine_handle<> awaiting) { loader.schedule(awaiting); }
+		void await_resume() noexcept {}
+
+	private:
+		VoxAsyncLoader &loader;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////
+	// IO_URING
+	//////////////////////////////////////////////////////////////////////////////
+
+#ifdef JIM_VOXASYNC_IO_URING
+
+	/**
+	* Submission and completion queue of an io_uring, set up with the raw system calls (no liburing needed).
+	* Reads are submitted from any thread, completions are reaped by a single thread. The reaper waits on an eventfd
+	* the kernel signals for every completion, so waiting and stopping do not depend on io_uring_enter, which a
+	* seccomp filter may refuse after the ring was set up.
+	*/
+	class VoxAsyncLoader::Ring {
+	public:
+		explicit Ring(unsigned entries) {
+			io_uring_params params;
+			memset(&params, 0, sizeof(params));
+			fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+			if (fd < 0) {
+				throw VoxReader::Exception("io_uring is not available");
+			}
+
+			sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+			cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+			const bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+			if (single) sqSize = cqSize = std::max(sqSize, cqSize);
+			sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+			sq = map(sqSize, IORING_OFF_SQ_RING);
+			cq = single ? sq : map(cqSize, IORING_OFF_CQ_RING);
+			sqes = static_cast<io_uring_sqe *>(map(sqesSize, IORING_OFF_SQES));
+
+			// IORING_REGISTER_EVENTFD is available since 5.2:
+			completions = eventfd(0, EFD_CLOEXEC);
+			wakeup = eventfd(0, EFD_CLOEXEC);
+			if (sq == nullptr || cq == nullptr || sqes == nullptr || completions < 0 || wakeup < 0 ||
+				syscall(__NR_io_uring_register, fd, IORING_REGISTER_EVENTFD, &completions, 1) != 0) {
+				release();
+				throw VoxReader::Exception("io_uring is not available");
+			}
+
+			uint8_t *s = static_cast<uint8_t *>(sq), *c = static_cast<uint8_t *>(cq);
+			sqHead = reinterpret_cast<unsigned *>(s + params.sq_off.head);
+			sqTail = reinterpret_cast<unsigned *>(s + params.sq_off.tail);
+			sqMask = *reinterpret_cast<unsigned *>(s + params.sq_off.ring_mask);
+			sqEntries = params.sq_entries;
+			sqArray = reinterpret_cast<unsigned *>(s + params.sq_off.array);
+			cqHead = reinterpret_cast<unsigned *>(c + params.cq_off.head);
+			cqTail = reinterpret_cast<unsigned *>(c + params.cq_off.tail);
+			cqMask = *reinterpret_cast<unsigned *>(c + params.cq_off.ring_mask);
+			cqes = reinterpret_cast<io_uring_cqe *>(c + params.cq_off.cqes);
+		}
+
+		~Ring() {
+			release();
+		}
+
+		/**
+		* Queue the given read. Returns 0 or -errno, in which case the read was not submitted and never completes
+		* through the ring.
+		*/
+		int submit(Read &read) {
+			std::lock_guard<std::mutex> lock(submitMutex);
+			const unsigned tail = *sqTail;
+			if (tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries) {
+				return -EBUSY; // not possible while every entry is submitted right away
+			}
+
+			// IORING_OP_READV is available since the first io_uring kernel (5.1):
+			io_uring_sqe &sqe = sqes[tail & sqMask];
+			memset(&sqe, 0, sizeof(sqe));
+			read.vector.iov_base = read.buffer;
+			read.vector.iov_len = read.size;
+			sqe.opcode = IORING_OP_READV;
+			sqe.fd = read.fd;
+			sqe.addr = (uint64_t)(uintptr_t)&read.vector;
+			sqe.len = 1;
+			sqe.off = read.offset;
+			sqe.user_data = (uint64_t)(uintptr_t)&read;
+			JIM_VOXASYNC_TSAN_RELEASE(&read);
+			sqArray[tail & sqMask] = tail & sqMask;
+			__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+
+			int result;
+			while ((result = (int)syscall(__NR_io_uring_enter, fd, 1, 0, 0, nullptr, 0)) < 0 && errno == EINTR) {}
+			const int error = result < 0 ? errno : EAGAIN;
+
+			// An entry the kernel did not take is withdrawn, or the next submit would submit it as well:
+			if (__atomic_load_n(sqHead, __ATOMIC_ACQUIRE) != tail) {
+				return 0;
+			}
+			__atomic_store_n(sqTail, tail, __ATOMIC_RELEASE);
+			return -error;
+		}
+
+		/**
+		* Wait for completions or stop(), then call done(read, result) for every completion. Returns false after
+		* stop() was called.
+		*/
+		template <typename DONE>
+		bool reap(DONE done) {
+			pollfd fds[2] = { { completions, POLLIN, 0 }, { wakeup, POLLIN, 0 } };
+			while (poll(fds, 2, -1) < 0 && errno == EINTR) {}
+			if (fds[0].revents & POLLIN) {
+				uint64_t count;
+				ssize_t result = ::read(completions, &count, sizeof(count)); // resets the counter
+				(void)result;
+			}
+
+			unsigned head = *cqHead;
+			while (head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+				const io_uring_cqe cqe = cqes[head & cqMask];
+				__atomic_store_n(cqHead, ++head, __ATOMIC_RELEASE);
+				Read *read = reinterpret_cast<Read *>((uintptr_t)cqe.user_data);
+				JIM_VOXASYNC_TSAN_ACQUIRE(read);
+				done(*read, (int64_t)cqe.res);
+			}
+			return (fds[1].revents & POLLIN) == 0;
+		}
+
+		/**
+		* Make reap() return false. No read may be in flight.
+		*/
+		void stop() {
+			const uint64_t one = 1;
+			while (::write(wakeup, &one, sizeof(one)) < 0 && errno == EINTR) {}
+		}
+
+	private:
+		void *map(size_t size, uint64_t offset) {
+			void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, (off_t)offset);
+			return ptr == MAP_FAILED ? nullptr : ptr;
+		}
+
+		void release() {
+			if (sqes != nullptr) munmap(sqes, sqesSize);
+			if (cq != nullptr && cq != sq) munmap(cq, cqSize);
+			if (sq != nullptr) munmap(sq, sqSize);
+			if (completions >= 0) ::close(completions);
+			if (wakeup >= 0) ::close(wakeup);
+			::close(fd);
+		}
+
+		int fd;
+		int completions = -1; // signaled by the kernel for every completion
+		int wakeup = -1;      // signaled by stop()
+		void *sq = nullptr, *cq = nullptr;
+		io_uring_sqe *sqes = nullptr;
+		size_t sqSize, cqSize, sqesSize;
+		unsigned *sqHead, *sqTail, *sqArray, sqMask, sqEntries;
+		unsigned *cqHead, *cqTail, cqMask;
+		io_uring_cqe *cqes;
+		std::mutex submitMutex;
+	};
+
+#else
+
+	class VoxAsyncLoader::Ring {};
+
+#endif
+
+	//////////////////////////////////////////////////////////////////////////////
+	// ASYNC LOADER
+	//////////////////////////////////////////////////////////////////////////////
+
+	VoxAsyncLoader::VoxAsyncLoader(Executor executor, unsigned threads, bool ioUring) : executor(std::move(executor)) {
+#ifdef JIM_VOXASYNC_IO_URING
+		if (ioUring) {
+			try {
+				ring.reset(new Ring(256));
+				reaper = std::thread([this]() {
+					while (ring->reap([this](Read &read, int64_t result) { complete(read, result); })) {}
+				});
+			}
+			catch (const VoxReader::Exception &) {
+				ring.reset();
+			}
+		}
+#else
+		(void)ioUring;
+#endif
+		for (unsigned i = 0; i < std::max(1u, threads); i++) {
+			workers.emplace_back([this]() {
+				std::unique_lock<std::mutex> lock(mutex);
+				while (true) {
+					wake.wait(lock, [this]() { return stopping || !tasks.empty(); });
+					if (tasks.empty()) return;
+					std::function<void()> task = std::move(tasks.front());
+					tasks.pop_front();
+					lock.unlock();
+					task();
+					lock.lock();
+				}
+			});
+		}
+	}
+
+	VoxAsyncLoader::~VoxAsyncLoader() {
+#ifdef JIM_VOXASYNC_IO_URING
+		if (ring) {
+			ring->stop();
+			reaper.join();
+		}
+#endif
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread &worker : workers) {
+			worker.join();
+		}
+	}
+
+	void VoxAsyncLoader::post(std::function<void()> task) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			tasks.push_back(std::move(task));
+		}
+		wake.notify_one();
+	}
+
+	void VoxAsyncLoader::schedule(std::coroutine_handle<> handle) {
+		if (executor) executor(handle);
+		else post([handle]() { handle.resume(); });
+	}
+
+	void VoxAsyncLoader::complete(Read &read, int64_t result) {
+		read.result = result;
+		if (read.state.exchange(Read::DONE, std::memory_order_acq_rel) == Read::WAITING) {
+			schedule(read.waiting);
+		}
+	}
+
+	void VoxAsyncLoader::submit(Read &read) {
+		read.state.store(Read::PENDING, std::memory_order_relaxed);
+		read.inFlight = true;
+#ifdef JIM_VOXASYNC_IO_URING
+		// A read the ring refuses (e.g. io_uring_enter failing with ENOMEM or EAGAIN) is made by the threads:
+		if (ring && ring->submit(read) == 0) {
+			return;
+		}
+#endif
+		post([this, &read]() {
+			complete(read, readAt(read.fd, read.buffer, read.size, read.offset));
+		});
+	}
+
+	/**
+	* Cuts the top level chunks out of vox-data as it arrives and decodes them, with the checks of VoxReader::load().
+	*/
+	class VoxAsyncLoader::ChunkFeed {
+	public:
+		ChunkFeed(VoxReader &vox, const uint8_t *data, size_t size) : vox(vox), data(data), size(size) {}
+
+		/**
+		* Decode all chunks complete in the first available bytes.
+		* @return Bytes of the chunks decoded so far.
+		*/
+		size_t decode(size_t available) {
+			const uint64_t start = steadyNanoseconds();
+			if (!started) {
+				if (available < std::min<size_t>(size, 8 + 12)) return 0;
+				if (size < 8 || memcmp(data, "VOX ", 4) != 0) {
+					throw VoxReader::Exception("Magic string 'VOX ' is missing");
+				}
+				if (readInt(data + 4) != 150) {
+					throw VoxReader::Exception("Version is not 150");
+				}
+				if (size - 8 < 12) {
+					throw VoxReader::Exception("Chunk header exceeds the data");
+				}
+				const uint32_t contentSize = (uint32_t)readInt(data + 8 + 4);
+				const uint64_t mainSize = 12 + (uint64_t)contentSize + (uint32_t)readInt(data + 8 + 8);
+				if (mainSize > size - 8) {
+					throw VoxReader::Exception(std::string("Chunk '") + chunkId(8) + "' exceeds the data");
+				}
+				if (strcmp(chunkId(8).c_str(), "MAIN")) {
+					throw VoxReader::Exception("MAIN chunk is missing");
+				}
+				position = 8 + 12 + (size_t)contentSize;
+				end = 8 + (size_t)mainSize;
+				started = true;
+			}
+
+			while (position < end) {
+				if (end - position < 12) {
+					throw VoxReader::Exception("Chunk header exceeds the data");
+				}
+				if (available < position + 12) break;
+				const uint64_t chunkSize = 12 + (uint64_t)(uint32_t)readInt(data + position + 4) + (uint32_t)readInt(data + position + 8);
+				if (chunkSize > end - position) {
+					throw VoxReader::Exception("Chunk '" + chunkId(position) + "' exceeds the data");
+				}
+				if (available < position + chunkSize) break;
+				chunks.push_back(VoxReader::Chunk(data, data + position, data + end, 1));
+				position += (size_t)chunkSize;
+			}
+			vox.decodeTimings.index += steadyNanoseconds() - start;
+
+			decoded = vox.decodeChunks(data, chunks, decoded, position >= end);
+			return decoded < chunks.size() ? (size_t)chunks[decoded].offset : position;
+		}
+
+	private:
+		std::string chunkId(size_t offset) const {
+			char id[5] = {};
+			memcpy(id, data + offset, 4);
+			return id; // up to a NUL, like the messages of VoxReader
+		}
+
+		VoxReader &vox;
+		const uint8_t *data;
+		size_t size;
+		bool started = false;
+		size_t position = 0, end = 0; // of the next chunk and of the children of MAIN
+		std::vector<VoxReader::Chunk> chunks;
+		size_t decoded = 0;           // chunks
+	};
+
+	void VoxAsyncLoader::submit(Read &read, int fd, uint8_t *buffer, size_t offset, size_t count) {
+		read.fd = fd;
+		read.buffer = buffer + offset;
+		read.size = (uint32_t)count;
+		read.offset = offset;
+		submit(read);
+	}
+
+	AsyncTask VoxAsyncLoader::loadAsync(VoxReader &vox, std::string path, size_t blockSize) {
+		const uint64_t start = steadyNanoseconds();
+		AsyncFile file(path);
+		if (file.size > (uint64_t)SIZE_MAX) {
+			throw VoxReader::Exception("File does not fit into memory: " + path);
+		}
+		const size_t size = (size_t)file.size;
+		blockSize = std::min<size_t>(std::max<size_t>(blockSize, 4096), 1u << 30);
+
+		vox.clear();
+		vox.sourceSize = size;
+		std::vector<uint8_t> data(size);
+		ChunkFeed feed(vox, data.data(), size);
+
+		// Two reads alternate, the next block is read while the current one is decoded:
+		Read reads[2];
+		size_t requested = 0, available = 0, decoded = 0, yielded = 0;
+		int next = 0;
+
+		std::exception_ptr error;
+		try {
+			for (Read &read : reads) {
+				if (requested < size) {
+					const size_t count = std::min(blockSize, size - requested);
+					submit(read, file.fd, data.data(), requested, count);
+					requested += count;
+				}
+			}
+
+			while (available < size) {
+				Read &read = reads[next];
+				const uint64_t waitStart = steadyNanoseconds();
+				const int64_t result = co_await ReadAwaiter(read);
+				vox.decodeTimings.read += steadyNanoseconds() - waitStart;
+				if (result < 0) {
+					throw VoxReader::Exception("Reading failed: " + path + ": " + strerror((int)-result));
+				}
+				if (result == 0) {
+					throw VoxReader::Exception("Unexpected end of file: " + path);
+				}
+
+				available += (size_t)result;
+				if ((uint64_t)result < read.size) {
+					// Short read, the rest of the block comes next:
+					submit(read, file.fd, data.data(), available, read.size - (size_t)result);
+				}
+				else {
+					if (requested < size) {
+						const size_t count = std::min(blockSize, size - requested);
+						submit(read, file.fd, data.data(), requested, count);
+						requested += count;
+					}
+					next ^= 1;
+				}
+
+				decoded = feed.decode(available);
+				if (decoded - yielded >= blockSize && available < size) {
+					yielded = decoded;
+					co_await YieldAwaiter(*this);
+				}
+			}
+			feed.decode(available);
+			vox.sourceHash = hash64(data.data(), size);
+		}
+		catch (...) {
+			error = std::current_exception();
+		}
+
+		// The buffers live in this coroutine, reads still in flight must finish first:
+		for (Read &read : reads) {
+			if (read.inFlight) {
+				co_await ReadAwaiter(read);
+			}
+		}
+		if (error) {
+			std::rethrow_exception(error);
+		}
+		vox.decodeTimings.total = steadyNanoseconds() - start;
+	}
+
+} // namespace jim
+
+#endif
+
+#endif
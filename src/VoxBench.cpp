@@ -0,0 +1,252 @@
+/**
+ * Benchmarks loading vox-files, e.g. a corpus written by VoxGenerate:
+ *     VoxBench [--iterations=N] [--json] [file|directory]...
+ *
+ * For every file all load paths are timed (stream, memory, mapped file, compiled, reload into an empty reader),
+ * with throughput in MB/s and voxels/s, heap allocations and the peak of live heap bytes during a load.
+ * The phases of a memory load are the decode timings load() records (VoxReader::decodeTimings) of the fastest run:
+ * chunk index, models, palette, scene graph, layers, materials and chunks kept verbatim.
+ * Times are the minimum of all iterations. --json writes one object per file for regression tracking.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define JIM_VOXREADER_IMPLEMENTATION
+#include "VoxReader.hpp"
+#include "VoxCompiled.hpp"
+#include "VoxReload.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define JIM_VOXBENCH_POSIX
+#endif
+
+#define JIM_VOXTOOLS_COUNT_ALLOCATIONS
+#include "VoxTools.hpp"
+
+using namespace jim;
+
+//////////////////////////////////////////////////////////////////////////////
+// MEASUREMENT
+//////////////////////////////////////////////////////////////////////////////
+
+struct Measurement {
+	std::string name;
+	double seconds = 0;
+	uint64_t allocations = 0;
+	uint64_t allocated = 0;
+	uint64_t peak = 0;
+};
+
+/**
+ * Runs the task the given number of times, returns the fastest run and the allocations of the first run.
+ */
+template <typename TASK>
+static Measurement measure(const char *name, unsigned iterations, TASK task) {
+	Measurement m;
+	m.name = name;
+	m.seconds = 1e30;
+	for (unsigned i = 0; i < iterations; i++) {
+		AllocationScope scope;
+		auto start = std::chrono::steady_clock::now();
+		task();
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		m.seconds = std::min(m.seconds, seconds);
+		if (i == 0) {
+			m.allocations = scope.allocations();
+			m.allocated = scope.allocated();
+			m.peak = scope.peak();
+		}
+	}
+	return m;
+}
+
+/**
+ * @param[out] timings Decode timings of the fastest memory load.
+ */
+static std::vector<Measurement> measureModes(const std::string &path, const std::vector<uint8_t> &data, unsigned iterations,
+	VoxReader::DecodeTimings &timings) {
+	std::vector<Measurement> modes;
+
+	modes.push_back(measure("stream", iterations, [&]() {
+		std::ifstream file(path, std::ios::binary);
+		VoxReader vox;
+		vox.load(file);
+	}));
+
+	modes.push_back(measure("memory", iterations, [&]() {
+		VoxReader vox;
+		vox.load(data.data(), data.size());
+		if (timings.total == 0 || vox.decodeTimings.total < timings.total) {
+			timings = vox.decodeTimings;
+		}
+	}));
+
+	modes.push_back(measure("mapped file", iterations, [&]() {
+		MappedFile file(path);
+		VoxReader vox;
+		vox.load(file.data(), file.size());
+	}));
+
+	modes.push_back(measure("reload", iterations, [&]() {
+		VoxReader vox;
+		std::vector<uint64_t> chunkHashes;
+		VoxReloader::reload(vox, chunkHashes, data.data(), data.size());
+	}));
+
+	// The compiled form is written once, loading it is what is timed:
+	std::string compiled;
+	try {
+		VoxReader vox;
+		vox.load(data.data(), data.size());
+		std::ostringstream s;
+		VoxCompiledWriter::save(vox, s);
+		compiled = s.str();
+	}
+	catch (const VoxReader::Exception &) {
+		return modes;
+	}
+	std::vector<uint64_t> aligned((compiled.size() + 7) / 8);
+	memcpy(aligned.data(), compiled.data(), compiled.size());
+	modes.push_back(measure("compiled", iterations, [&]() {
+		VoxCompiledReader reader(reinterpret_cast<const uint8_t *>(aligned.data()), compiled.size());
+		VoxReader vox;
+		reader.toReader(vox);
+	}));
+
+	return modes;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// REPORT
+//////////////////////////////////////////////////////////////////////////////
+
+struct FileReport {
+	std::string path;
+	uint64_t size = 0;
+	uint64_t voxelCount = 0;
+	std::vector<Measurement> modes;
+	VoxReader::DecodeTimings timings;
+	std::string error;
+};
+
+struct Phase {
+	const char *name;
+	uint64_t nanoseconds;
+};
+
+static std::vector<Phase> phases(const VoxReader::DecodeTimings &t) {
+	return { { "index", t.index }, { "models", t.models }, { "palette", t.palette }, { "scene graph", t.sceneGraph },
+		{ "layers", t.layers }, { "materials", t.materials }, { "other", t.other } };
+}
+
+static void printJson(const FileReport &report) {
+	printf("{\"file\":%s,\"bytes\":%llu,\"voxels\":%llu", jsonString(report.path).c_str(),
+		(unsigned long long)report.size, (unsigned long long)report.voxelCount);
+	if (!report.error.empty()) {
+		printf(",\"error\":%s}\n", jsonString(report.error).c_str());
+		return;
+	}
+	auto printList = [&](const char *name, const std::vector<Measurement> &list) {
+		printf(",\"%s\":{", name);
+		for (size_t i = 0; i < list.size(); i++) {
+			const Measurement &m = list[i];
+			printf("%s%s:{\"seconds\":%.9f,\"mb_per_s\":%.3f,\"voxels_per_s\":%.0f,\"allocations\":%llu,\"allocated\":%llu,\"peak_heap\":%llu}",
+				i > 0 ? "," : "", jsonString(m.name).c_str(), m.seconds, report.size / m.seconds / 1e6, report.voxelCount / m.seconds,
+				(unsigned long long)m.allocations, (unsigned long long)m.allocated, (unsigned long long)m.peak);
+		}
+		printf("}");
+	};
+	printList("modes", report.modes);
+	printf(",\"phases\":{\"total\":%.9f", report.timings.total / 1e9);
+	for (const Phase &phase : phases(report.timings)) {
+		printf(",%s:%.9f", jsonString(phase.name).c_str(), phase.nanoseconds / 1e9);
+	}
+	printf("}}\n");
+}
+
+static void printText(const FileReport &report) {
+	printf("%s: %.2f MB, %llu voxels\n", report.path.c_str(), report.size / 1e6, (unsigned long long)report.voxelCount);
+	if (!report.error.empty()) {
+		printf("  %s\n", report.error.c_str());
+		return;
+	}
+	for (const Measurement &m : report.modes) {
+		printf("  %-22s %10.3f ms %10.1f MB/s %12.0f voxels/s %8llu allocs %12llu bytes %12llu peak\n", m.name.c_str(),
+			m.seconds * 1e3, report.size / m.seconds / 1e6, report.voxelCount / m.seconds,
+			(unsigned long long)m.allocations, (unsigned long long)m.allocated, (unsigned long long)m.peak);
+	}
+	printf("  phases of the fastest memory load (%.3f ms):\n", report.timings.total / 1e6);
+	for (const Phase &phase : phases(report.timings)) {
+		printf("  %-22s %10.3f ms %9.1f %%\n", phase.name, phase.nanoseconds / 1e6,
+			report.timings.total > 0 ? 100.0 * phase.nanoseconds / report.timings.total : 0.0);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MAIN
+//////////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char **argv) {
+	unsigned iterations = 5;
+	bool json = false;
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "--iterations=", 13)) iterations = std::max(1, atoi(argv[i] + 13));
+		else if (!strcmp(argv[i], "--json")) json = true;
+		else collect(argv[i], files);
+	}
+	if (files.empty()) {
+		files = { "chr_knight.vox" };
+	}
+
+	for (const std::string &path : files) {
+		FileReport report;
+		report.path = path;
+		try {
+			std::ifstream file(path, std::ios::binary);
+			if (!file) {
+				throw VoxReader::Exception("Cannot open '" + path + "'");
+			}
+			std::vector<uint8_t> data = VoxReader::readStream(file);
+			report.size = data.size();
+
+			VoxReader vox;
+			vox.load(data.data(), data.size());
+			for (const Model &model : vox.models) {
+				report.voxelCount += model.voxels.size();
+			}
+
+			report.modes = measureModes(path, data, iterations, report.timings);
+		}
+		catch (const VoxReader::Exception &e) {
+			report.error = e.what();
+		}
+
+		if (json) printJson(report);
+		else printText(report);
+		fflush(stdout);
+	}
+
+#ifdef JIM_VOXBENCH_POSIX
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef __APPLE__
+		long peakKilobytes = usage.ru_maxrss / 1024;
+#else
+		long peakKilobytes = usage.ru_maxrss;
+#endif
+		if (json) printf("{\"peak_rss_kb\":%ld}\n", peakKilobytes);
+		else printf("peak RSS: %ld KB\n", peakKilobytes);
+	}
+#endif
+	return EXIT_SUCCESS;
+}
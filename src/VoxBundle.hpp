@@ -0,0 +1,358 @@
+#pragma once
+
+#include "VoxReader.hpp"
+
+#include <memory>
+#include <ostream>
+
+namespace jim {
+
+	/**
+	 * A bundle stores many vox-files in a single file, so a whole catalog is opened with one open and one mmap
+	 * instead of one open/stat/read per asset.
+	 *
+	 * Layout (little endian, all offsets relative to the start of the bundle):
+	 *
+	 *	Offset | Size       | Content
+	 *	-------|------------|-------------------------------------------------------------------------
+	 *	0      | 4          | magic "VOXB"
+	 *	4      | 4          | version (1)
+	 *	8      | 4          | number of entries n
+	 *	12     | 4          | size of the name table
+	 *	16     | 40 * n     | entries sorted by name hash: name hash, offset, size, content hash (uint64 each),
+	 *	       |            | name offset and name length in the name table (uint32 each)
+	 *	       |            | name table
+	 *	       |            | payloads, each aligned to 8 bytes
+	*/
+	class VoxBundleWriter {
+	public:
+
+		/**
+		 * Add the given vox-data under the given name. Names must be unique, duplicates are reported by save().
+		*/
+		void add(const std::string &name, const uint8_t *data, size_t size);
+		void add(const std::string &name, std::vector<uint8_t> data);
+
+		/**
+		 * Add the file at the given path under the given name. The file is read immediately.
+		*/
+		void addFile(const std::string &name, const std::string &path);
+
+		/**
+		 * Write the bundle to the given output stream.
+		*/
+		void save(std::ostream &s) const;
+
+	private:
+
+		struct Source {
+			std::string name;
+			uint64_t nameHash;
+			std::vector<uint8_t> data;
+		};
+
+		std::vector<Source> sources;
+	};
+
+	/**
+	 * Opens a bundle written by VoxBundleWriter. Entries are looked up by name through the sorted index
+	 * and loaded straight from the mapped bundle, without copying the payload.
+	*/
+	class VoxBundleReader {
+	public:
+
+		/**
+		 * Map the bundle at the given path.
+		*/
+		explicit VoxBundleReader(const std::string &path);
+
+		/**
+		 * Use the bundle in the given memory, which must stay valid as long as the reader is used.
+		*/
+		VoxBundleReader(const uint8_t *data, size_t size);
+
+		/**
+		 * Returns the number of entries. All methods taking an entry index throw if it is not below this number.
+		*/
+		size_t size() const;
+
+		/**
+		 * Returns the name of the entry at the given index. Entries are ordered by the hash of their name.
+		*/
+		std::string name(size_t index) const;
+
+		/**
+		 * Returns the index of the entry with the given name or -1 if there is none.
+		*/
+		int64_t find(const std::string &name) const;
+
+		/**
+		 * Returns the vox-data of the entry at the given index.
+		*/
+		const uint8_t* data(size_t index, size_t &size) const;
+
+		/**
+		 * Returns the hash of the vox-data of the entry at the given index, see hash64().
+		*/
+		uint64_t contentHash(size_t index) const;
+
+		/**
+		 * Returns whether the vox-data of the entry at the given index still matches its content hash.
+		*/
+		bool verify(size_t index) const;
+
+		/**
+		 * Load the entry at the given index or with the given name into the given reader.
+		*/
+		void load(size_t index, VoxReader &vox) const;
+		void load(const std::string &name, VoxReader &vox) const;
+
+	private:
+
+		struct Entry {
+			uint64_t nameHash;
+			uint64_t offset;
+			uint64_t size;
+			uint64_t contentHash;
+			uint32_t nameOffset;
+			uint32_t nameLength;
+		};
+
+		void open();
+		Entry entry(size_t index) const;
+
+		std::unique_ptr<MappedFile> file;
+		const uint8_t *bytes;
+		size_t length;
+		uint32_t entryCount = 0;
+		const uint8_t *names = nullptr;
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace jim {
+
+	static const uint32_t BUNDLE_VERSION = 1;
+	static const size_t BUNDLE_HEADER_SIZE = 16;
+	static const size_t BUNDLE_ENTRY_SIZE = 40;
+
+	static uint64_t bundleAlign(uint64_t offset) {
+		return (offset + 7) & ~(uint64_t)7;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// BUNDLE WRITER
+	//////////////////////////////////////////////////////////////////////////////
+
+	void VoxBundleWriter::add(const std::string &name, const uint8_t *data, size_t size) {
+		add(name, std::vector<uint8_t>(data, data + size));
+	}
+
+	void VoxBundleWriter::add(const std::string &name, std::vector<uint8_t> data) {
+		Source source;
+		source.name = name;
+		source.nameHash = hash64(name.data(), name.size());
+		source.data = std::move(data);
+		sources.push_back(std::move(source));
+	}
+
+	void VoxBundleWriter::addFile(const std::string &name, const std::string &path) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			throw VoxReader::Exception("Cannot open '" + path + "'");
+		}
+		add(name, VoxReader::readStream(file));
+	}
+
+	void VoxBundleWriter::save(std::ostream &s) const {
+		if (!s) {
+			throw VoxReader::Exception("Cannot write to stream");
+		}
+
+		std::vector<const Source *> order;
+		order.reserve(sources.size());
+		for (const auto &source : sources) {
+			order.push_back(&source);
+		}
+		std::sort(order.begin(), order.end(), [](const Source *a, const Source *b) {
+			return a->nameHash != b->nameHash ? a->nameHash < b->nameHash : a->name < b->name;
+		});
+		for (size_t i = 1; i < order.size(); i++) {
+			if (order[i]->name == order[i - 1]->name) {
+				throw VoxReader::Exception("Bundle contains '" + order[i]->name + "' twice");
+			}
+		}
+
+		// Index and name table first, payloads follow at aligned offsets:
+		std::vector<uint8_t> index(BUNDLE_HEADER_SIZE + BUNDLE_ENTRY_SIZE * order.size());
+		std::string nameTable;
+		for (const Source *source : order) {
+			nameTable += source->name;
+		}
+		if (nameTable.size() > UINT32_MAX || order.size() > UINT32_MAX) {
+			throw VoxReader::Exception("Bundle is too large");
+		}
+
+		uint8_t *p = index.data();
+		const uint32_t header[4] = { 0, BUNDLE_VERSION, (uint32_t)order.size(), (uint32_t)nameTable.size() };
+		memcpy(p, header, sizeof(header));
+		memcpy(p, "VOXB", 4);
+		p += BUNDLE_HEADER_SIZE;
+
+		uint64_t offset = bundleAlign(index.size() + nameTable.size());
+		uint32_t nameOffset = 0;
+		for (const Source *source : order) {
+			const uint64_t values[4] = { source->nameHash, offset, source->data.size(), hash64(source->data.data(), source->data.size()) };
+			const uint32_t name[2] = { nameOffset, (uint32_t)source->name.size() };
+			memcpy(p, values, sizeof(values));
+			memcpy(p + sizeof(values), name, sizeof(name));
+			p += BUNDLE_ENTRY_SIZE;
+			nameOffset += (uint32_t)source->name.size();
+			offset = bundleAlign(offset + source->data.size());
+		}
+
+		s.write(reinterpret_cast<const char *>(index.data()), index.size());
+		s.write(nameTable.data(), nameTable.size());
+
+		static const char padding[8] = {};
+		uint64_t position = index.size() + nameTable.size();
+		for (const Source *source : order) {
+			s.write(padding, (std::streamsize)(bundleAlign(position) - position));
+			s.write(reinterpret_cast<const char *>(source->data.data()), source->data.size());
+			position = bundleAlign(position) + source->data.size();
+		}
+
+		if (!s) {
+			throw VoxReader::Exception("Writing to stream failed");
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// BUNDLE READER
+	//////////////////////////////////////////////////////////////////////////////
+
+	VoxBundleReader::VoxBundleReader(const std::string &path) : file(new MappedFile(path)) {
+		bytes = file->data();
+		length = file->size();
+		open();
+	}
+
+	VoxBundleReader::VoxBundleReader(const uint8_t *data, size_t size) : bytes(data), length(size) {
+		open();
+	}
+
+	void VoxBundleReader::open() {
+		if (length < BUNDLE_HEADER_SIZE || memcmp(bytes, "VOXB", 4) != 0) {
+			throw VoxReader::Exception("Magic string 'VOXB' is missing");
+		}
+		if ((uint32_t)readInt(bytes + 4) != BUNDLE_VERSION) {
+			throw VoxReader::Exception("Unsupported bundle version");
+		}
+		entryCount = (uint32_t)readInt(bytes + 8);
+		uint32_t nameTableSize = (uint32_t)readInt(bytes + 12);
+
+		uint64_t namesOffset = BUNDLE_HEADER_SIZE + (uint64_t)BUNDLE_ENTRY_SIZE * entryCount;
+		if (namesOffset + nameTableSize > length) {
+			throw VoxReader::Exception("Bundle index exceeds the data");
+		}
+		names = bytes + namesOffset;
+
+		// Every entry must lie within the data with its name within the name table, and the index must be sorted
+		// by name hash for the binary search in find(). Index ranges are still checked by entry():
+		for (size_t i = 0; i < entryCount; i++) {
+			Entry e = entry(i);
+			if (e.offset > length || e.size > length - e.offset || (uint64_t)e.nameOffset + e.nameLength > nameTableSize) {
+				throw VoxReader::Exception("Bundle entry exceeds the data");
+			}
+			if (i > 0 && entry(i - 1).nameHash > e.nameHash) {
+				throw VoxReader::Exception("Bundle index is not sorted");
+			}
+		}
+	}
+
+	VoxBundleReader::Entry VoxBundleReader::entry(size_t index) const {
+		if (index >= entryCount) {
+			throw VoxReader::Exception("Bundle entry index out of range");
+		}
+		const uint8_t *p = bytes + BUNDLE_HEADER_SIZE + BUNDLE_ENTRY_SIZE * index;
+		Entry e;
+		memcpy(&e.nameHash, p, 8);
+		memcpy(&e.offset, p + 8, 8);
+		memcpy(&e.size, p + 16, 8);
+		memcpy(&e.contentHash, p + 24, 8);
+		memcpy(&e.nameOffset, p + 32, 4);
+		memcpy(&e.nameLength, p + 36, 4);
+		return e;
+	}
+
+	size_t VoxBundleReader::size() const {
+		return entryCount;
+	}
+
+	std::string VoxBundleReader::name(size_t index) const {
+		Entry e = entry(index);
+		return std::string(reinterpret_cast<const char *>(names) + e.nameOffset, e.nameLength);
+	}
+
+	int64_t VoxBundleReader::find(const std::string &name) const {
+		uint64_t hash = hash64(name.data(), name.size());
+
+		// Binary search for the first entry with the hash, then compare names of equal hashes:
+		size_t low = 0, high = entryCount;
+		while (low < high) {
+			size_t middle = low + (high - low) / 2;
+			if (entry(middle).nameHash < hash) {
+				low = middle + 1;
+			}
+			else {
+				high = middle;
+			}
+		}
+		for (size_t i = low; i < entryCount; i++) {
+			Entry e = entry(i);
+			if (e.nameHash != hash) break;
+			if (e.nameLength == name.size() && memcmp(names + e.nameOffset, name.data(), name.size()) == 0) {
+				return (int64_t)i;
+			}
+		}
+		return -1;
+	}
+
+	const uint8_t* VoxBundleReader::data(size_t index, size_t &size) const {
+		Entry e = entry(index);
+		size = (size_t)e.size;
+		return bytes + e.offset;
+	}
+
+	uint64_t VoxBundleReader::contentHash(size_t index) const {
+		return entry(index).contentHash;
+	}
+
+	bool VoxBundleReader::verify(size_t index) const {
+		Entry e = entry(index);
+		return hash64(bytes + e.offset, (size_t)e.size) == e.contentHash;
+	}
+
+	void VoxBundleReader::load(size_t index, VoxReader &vox) const {
+		size_t size;
+		const uint8_t *data = this->data(index, size);
+		vox.load(data, size);
+	}
+
+	void VoxBundleReader::load(const std::string &name, VoxReader &vox) const {
+		int64_t index = find(name);
+		if (index < 0) {
+			throw VoxReader::Exception("Bundle does not contain '" + name + "'");
+		}
+		load((size_t)index, vox);
+	}
+
+} // namespace jim
+
+#endif
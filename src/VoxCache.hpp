@@ -0,0 +1,300 @@
+#pragma once
+
+#include "VoxReader.hpp"
+#include "VoxCompiled.hpp"
+
+#include <functional>
+#include <memory>
+
+namespace jim {
+
+	/**
+	 * Content addressed on-disk cache around VoxReader::load (requires C++17).
+	 * Vox-data is identified by its hash64() and size. On a hit the compiled representation (see VoxCompiledWriter)
+	 * is mapped instead of parsing the vox-data again; derived artifacts (meshes, LODs, thumbnails, ...) are stored
+	 * next to it under the same key. The cache directory is kept below a size limit by evicting the least recently
+	 * used files. Files are written to a temporary name and renamed, so concurrent processes never see partial files.
+	*/
+	class VoxCache {
+	public:
+
+		/**
+		 * @param[in] directory Cache directory, created if missing.
+		 * @param[in] maxBytes  Size limit of the cache directory, enforced whenever a file is added.
+		*/
+		VoxCache(const std::string &directory, uint64_t maxBytes);
+
+		/**
+		 * Key of vox-data: hash and size, formatted as file name stem.
+		*/
+		static std::string key(const uint8_t *data, size_t size);
+
+		/**
+		 * Load the vox-file at the given path into the given reader, from the cache if possible.
+		 * Returns the key of the file.
+		*/
+		std::string load(const std::string &path, VoxReader &vox);
+
+		/**
+		 * Load the given vox-data into the given reader, from the cache if possible. Returns the key of the data.
+		*/
+		std::string load(const uint8_t *data, size_t size, VoxReader &vox);
+
+		/**
+		 * Returns the compiled representation of the vox-file at the given path, compiling it on a miss.
+		 * On a hit the returned reader maps the cache file and stays valid even if the file gets evicted,
+		 * on a miss it holds the compiled data in memory.
+		*/
+		std::unique_ptr<VoxCompiledReader> open(const std::string &path);
+
+		/**
+		 * Returns the artifact of the given kind (e.g. "glb") stored for the given key, or calls produce on a miss
+		 * and stores its result.
+		*/
+		std::vector<uint8_t> artifact(const std::string &key, const std::string &kind, const std::function<std::vector<uint8_t>()> &produce);
+
+		/**
+		 * Returns whether an artifact of the given kind is stored for the given key and reads it.
+		*/
+		bool findArtifact(const std::string &key, const std::string &kind, std::vector<uint8_t> &data);
+
+		/**
+		 * Store an artifact of the given kind for the given key.
+		*/
+		void storeArtifact(const std::string &key, const std::string &kind, const uint8_t *data, size_t size);
+
+		/**
+		 * Remove least recently used files until the cache directory is below the size limit.
+		 * The file added last is never removed, even if it exceeds the limit on its own. Temporary files being
+		 * written are left alone, unless they are older than an hour and so left behind by a crashed process.
+		*/
+		void evict();
+
+		struct Stats {
+			uint64_t hits = 0;
+			uint64_t misses = 0;
+			uint64_t evictions = 0;
+		};
+
+		const Stats& stats() const { return counters; }
+
+	private:
+
+		std::string compiledPath(const std::string &key) const;
+		std::string artifactPath(const std::string &key, const std::string &kind) const;
+		static std::string key(uint64_t hash, size_t size);
+		std::unique_ptr<VoxCompiledReader> find(const std::string &key, uint64_t hash);
+		std::string compile(VoxReader &vox, const uint8_t *data, size_t size, const std::string &key, uint64_t hash);
+		void store(const std::string &path, const uint8_t *data, size_t size);
+		void evict(const std::string &keep);
+
+		std::string directory;
+		uint64_t maxBytes;
+		Stats counters;
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// VOX CACHE
+	//////////////////////////////////////////////////////////////////////////////
+
+	VoxCache::VoxCache(const std::string &directory, uint64_t maxBytes) : directory(directory), maxBytes(maxBytes) {
+		std::error_code error;
+		std::filesystem::create_directories(directory, error);
+		if (error) {
+			throw VoxReader::Exception("Cannot create cache directory '" + directory + "'");
+		}
+	}
+
+	std::string VoxCache::key(const uint8_t *data, size_t size) {
+		return key(hash64(data, size), size);
+	}
+
+	std::string VoxCache::key(uint64_t hash, size_t size) {
+		char text[40];
+		snprintf(text, sizeof(text), "%016llx-%llx", (unsigned long long)hash, (unsigned long long)size);
+		return text;
+	}
+
+	std::string VoxCache::compiledPath(const std::string &key) const {
+		return (std::filesystem::path(directory) / (key + ".voxc")).string();
+	}
+
+	std::string VoxCache::artifactPath(const std::string &key, const std::string &kind) const {
+		return (std::filesystem::path(directory) / (key + '.' + kind)).string();
+	}
+
+	std::unique_ptr<VoxCompiledReader> VoxCache::find(const std::string &key, uint64_t hash) {
+		std::string path = compiledPath(key);
+		std::error_code error;
+		if (!std::filesystem::exists(path, error)) {
+			return nullptr;
+		}
+		try {
+			std::unique_ptr<VoxCompiledReader> compiled(new VoxCompiledReader(path));
+			if (compiled->sourceHash() != hash) {
+				return nullptr;
+			}
+			// Mark as recently used:
+			std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+			return compiled;
+		}
+		catch (const VoxReader::Exception &) {
+			// Truncated or from an incompatible version, compile again
+			return nullptr;
+		}
+	}
+
+	std::string VoxCache::load(const std::string &path, VoxReader &vox) {
+		MappedFile file(path);
+		return load(file.data(), file.size(), vox);
+	}
+
+	std::string VoxCache::load(const uint8_t *data, size_t size, VoxReader &vox) {
+		uint64_t hash = hash64(data, size);
+		std::string k = key(hash, size);
+
+		if (std::unique_ptr<VoxCompiledReader> compiled = find(k, hash)) {
+			counters.hits++;
+			compiled->toReader(vox);
+		}
+		else {
+			compile(vox, data, size, k, hash);
+		}
+		return k;
+	}
+
+	std::unique_ptr<VoxCompiledReader> VoxCache::open(const std::string &path) {
+		MappedFile file(path);
+		uint64_t hash = hash64(file.data(), file.size());
+		std::string k = key(hash, file.size());
+
+		if (std::unique_ptr<VoxCompiledReader> compiled = find(k, hash)) {
+			counters.hits++;
+			return compiled;
+		}
+
+		// Not opened from the cache file, which another process may evict right after it was stored:
+		VoxReader vox;
+		std::string compiled = compile(vox, file.data(), file.size(), k, hash);
+		std::vector<uint64_t> aligned((compiled.size() + 7) / 8);
+		memcpy(aligned.data(), compiled.data(), compiled.size());
+		return std::unique_ptr<VoxCompiledReader>(new VoxCompiledReader(std::move(aligned), compiled.size()));
+	}
+
+	std::string VoxCache::compile(VoxReader &vox, const uint8_t *data, size_t size, const std::string &key, uint64_t hash) {
+		counters.misses++;
+		vox.load(data, size);
+		std::ostringstream s;
+		VoxCompiledWriter::save(vox, s, VoxCompiledWriter::FILE_ORDER, hash);
+		std::string compiled = s.str();
+		store(compiledPath(key), reinterpret_cast<const uint8_t *>(compiled.data()), compiled.size());
+		return compiled;
+	}
+
+	std::vector<uint8_t> VoxCache::artifact(const std::string &key, const std::string &kind, const std::function<std::vector<uint8_t>()> &produce) {
+		std::vector<uint8_t> data;
+		if (findArtifact(key, kind, data)) {
+			return data;
+		}
+		data = produce();
+		storeArtifact(key, kind, data.data(), data.size());
+		return data;
+	}
+
+	bool VoxCache::findArtifact(const std::string &key, const std::string &kind, std::vector<uint8_t> &data) {
+		std::string path = artifactPath(key, kind);
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			counters.misses++;
+			return false;
+		}
+		data = VoxReader::readStream(file);
+		std::error_code error;
+		std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+		counters.hits++;
+		return true;
+	}
+
+	void VoxCache::storeArtifact(const std::string &key, const std::string &kind, const uint8_t *data, size_t size) {
+		store(artifactPath(key, kind), data, size);
+	}
+
+	void VoxCache::store(const std::string &path, const uint8_t *data, size_t size) {
+		// Write under a unique temporary name and rename, so readers never see a partial file:
+		const uint64_t unique[2] = { (uint64_t)std::hash<std::thread::id>()(std::this_thread::get_id()), (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count() };
+		std::string temporary = path + ".tmp" + std::to_string(hash64(unique, sizeof(unique)));
+		{
+			std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+			file.write(reinterpret_cast<const char *>(data), size);
+			if (!file) {
+				throw VoxReader::Exception("Cannot write '" + temporary + "'");
+			}
+		}
+		std::error_code error;
+		std::filesystem::rename(temporary, path, error);
+		if (error) {
+			std::filesystem::remove(temporary, error);
+			throw VoxReader::Exception("Cannot write '" + path + "'");
+		}
+		evict(path);
+	}
+
+	void VoxCache::evict() {
+		evict(std::string());
+	}
+
+	void VoxCache::evict(const std::string &keep) {
+		struct Item {
+			std::filesystem::path path;
+			uint64_t size;
+			std::filesystem::file_time_type time;
+		};
+
+		std::vector<Item> items;
+		std::error_code error;
+		uint64_t total = keep.empty() ? 0 : (uint64_t)std::filesystem::file_size(keep, error);
+		const auto abandoned = std::filesystem::file_time_type::clock::now() - std::chrono::hours(1);
+		for (const auto &entry : std::filesystem::directory_iterator(directory, error)) {
+			std::error_code itemError;
+			if (!entry.is_regular_file(itemError) || entry.path() == keep) continue;
+			Item item{ entry.path(), (uint64_t)entry.file_size(itemError), entry.last_write_time(itemError) };
+			if (itemError) continue;
+			// Other processes rename their temporary files once written, see store():
+			if (entry.path().extension().string().compare(0, 4, ".tmp") == 0 && item.time > abandoned) continue;
+			total += item.size;
+			items.push_back(std::move(item));
+		}
+		if (total <= maxBytes) {
+			return;
+		}
+
+		std::sort(items.begin(), items.end(), [](const Item &a, const Item &b) {
+			return a.time < b.time;
+		});
+		for (const auto &item : items) {
+			if (total <= maxBytes) break;
+			if (std::filesystem::remove(item.path, error)) {
+				total -= item.size;
+				counters.evictions++;
+			}
+		}
+	}
+
+} // namespace jim
+
+#endif
@@ -0,0 +1,850 @@
+#pragma once
+
+#include "VoxReader.hpp"
+
+#include <memory>
+#include <ostream>
+
+namespace jim {
+
+	/**
+	 * Records of the compiled format. All records are little endian, naturally aligned and reference each other
+	 * by index, so a compiled file is used straight from memory (e.g. an mmap) without any deserialization.
+	*/
+	namespace compiled {
+
+		static const uint32_t NO_STRING = 0xFFFFFFFF;
+
+		/**
+		 * Range of key/value entries forming a dictionary.
+		*/
+		struct DictionaryRef {
+			uint32_t first; // index of the first entry
+			uint32_t count;
+		};
+
+		/**
+		 * Dictionary entry, key and value are indices into the string table.
+		*/
+		struct Entry {
+			uint32_t key;
+			uint32_t value;
+		};
+
+		struct Model {
+			uint32_t sizeX, sizeY, sizeZ;
+			uint32_t voxelCount;
+			uint64_t firstVoxel; // index into the voxels
+		};
+
+		/**
+		 * Decoded '_r' and '_t' of a frame, see SceneGraph::Transform.
+		*/
+		struct Transform {
+			int8_t rotation[3][3];
+			int8_t reserved[3];
+			int32_t translation[3];
+		};
+
+		struct Frame {
+			Transform transform;
+			DictionaryRef attributes;
+		};
+
+		struct ShapeModel {
+			uint32_t modelId;
+			DictionaryRef attributes;
+		};
+
+		/**
+		 * Scene graph node, stored at the index of its id.
+		*/
+		struct Node {
+			static const uint8_t NONE = 0xFF; // type of unused node ids
+
+			uint8_t type;      // SceneGraph::Node::Type or NONE
+			uint8_t hidden;    // '_hidden' of transform nodes
+			uint16_t reserved;
+			int32_t layerId;   // transform nodes, -1 otherwise
+			uint32_t name;     // '_name' or NO_STRING
+			uint32_t first;    // transform and group nodes: first child id in the children, shape nodes: first shape model
+			uint32_t count;
+			uint32_t firstFrame;
+			uint32_t frameCount;
+			DictionaryRef attributes;
+		};
+
+		struct Layer {
+			uint32_t name;     // '_name' or NO_STRING
+			uint32_t hidden;   // '_hidden'
+			DictionaryRef attributes;
+		};
+
+		/**
+		 * Material with its common properties decoded, stored at the index of its id.
+		*/
+		struct Material {
+			enum Type : uint32_t {
+				NONE, DIFFUSE, METAL, GLASS, EMIT, BLEND, MEDIA, UNKNOWN
+			};
+
+			uint32_t type;
+			float weight, rough, metal, spec, ior, att, flux, emit, ldr, alpha;
+			DictionaryRef properties;
+		};
+
+		/**
+		 * Flattened scene graph, see SceneGraph::Flatten().
+		*/
+		struct Instance {
+			int32_t shapeNodeId;
+			uint32_t modelId;
+			int32_t layerId;
+			Transform transform;
+		};
+
+	}
+
+	/**
+	 * Compiles the objects hold by a VoxReader into the compiled format read by VoxCompiledReader.
+	*/
+	class VoxCompiledWriter {
+	public:
+
+		enum VoxelOrder : uint32_t {
+			FILE_ORDER, // voxels as loaded
+			MORTON      // voxels of every model sorted along a Z-order curve, neighbours end up close in memory
+		};
+
+		/**
+		 * Write the compiled objects to the given stream.
+		 * @param[in] sourceHash Stored as is, e.g. the hash64() of the vox-data the objects were loaded from.
+		*/
+		static void save(const VoxReader &vox, std::ostream &s, VoxelOrder order = FILE_ORDER, uint64_t sourceHash = 0);
+	};
+
+	/**
+	 * Gives access to a compiled file. Opening checks all indices once, the accessors then read the records in place.
+	*/
+	class VoxCompiledReader {
+	public:
+
+		/**
+		 * Map the compiled file at the given path.
+		*/
+		explicit VoxCompiledReader(const std::string &path);
+
+		/**
+		 * Use the compiled data in the given memory, which must be 8 byte aligned and stay valid as long as the reader is used.
+		*/
+		VoxCompiledReader(const uint8_t *data, size_t size);
+
+		/**
+		 * Use the given compiled data of the given size in bytes, taking ownership of it.
+		*/
+		VoxCompiledReader(std::vector<uint64_t> data, size_t size);
+
+		VoxCompiledWriter::VoxelOrder voxelOrder() const;
+		uint64_t sourceHash() const;
+
+		size_t modelCount() const;
+		const compiled::Model& model(size_t index) const;
+		const Voxel* voxels(size_t modelIndex) const;
+
+		/**
+		 * Returns the color of the given color index, like VoxReader::getColor().
+		*/
+		RGBA getColor(uint8_t colorIndex) const;
+
+		/**
+		 * Returns the node with the given id or NULL if there is none.
+		*/
+		const compiled::Node* node(SceneGraph::NodeId id) const;
+		SceneGraph::NodeId nodeCount() const;
+		const uint32_t* children(const compiled::Node &node) const;
+		const compiled::ShapeModel* shapeModels(const compiled::Node &node) const;
+		const compiled::Frame* frames(const compiled::Node &node) const;
+
+		size_t layerCount() const;
+		const compiled::Layer& layer(size_t id) const;
+
+		size_t materialCount() const;
+		const compiled::Material& material(size_t id) const;
+
+		size_t instanceCount() const;
+		const compiled::Instance& instance(size_t index) const;
+
+		/**
+		 * Returns the interned string with the given index, zero terminated.
+		*/
+		const char* string(uint32_t index) const;
+		const compiled::Entry* entries(const compiled::DictionaryRef &dictionary) const;
+
+		/**
+		 * Returns the value stored for the given key or NULL when the dictionary does not contain it.
+		*/
+		const char* findValue(const compiled::DictionaryRef &dictionary, const char *key) const;
+
+		/**
+		 * Rebuild the objects in the given reader. Discards any objects currently hold.
+		*/
+		void toReader(VoxReader &vox) const;
+
+	private:
+
+		void open();
+		template <typename T> const T* section(int index) const;
+		template <typename T> size_t count(int index) const;
+
+		std::unique_ptr<MappedFile> file;
+		std::vector<uint64_t> owned; // 8 byte aligned
+		const uint8_t *bytes;
+		size_t length;
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+namespace jim {
+
+	static_assert(sizeof(compiled::Model) == 24, "compiled::Model layout");
+	static_assert(sizeof(compiled::Frame) == 32, "compiled::Frame layout");
+	static_assert(sizeof(compiled::ShapeModel) == 12, "compiled::ShapeModel layout");
+	static_assert(sizeof(compiled::Node) == 36, "compiled::Node layout");
+	static_assert(sizeof(compiled::Layer) == 16, "compiled::Layer layout");
+	static_assert(sizeof(compiled::Material) == 52, "compiled::Material layout");
+	static_assert(sizeof(compiled::Instance) == 36, "compiled::Instance layout");
+	static_assert(sizeof(Voxel) == 4 && sizeof(RGBA) == 4, "Voxel and RGBA must be stored as 4 bytes");
+
+	/**
+	 * Header: magic "VOXC", version, voxel order, flags, source hash, then offset and size in bytes of every section.
+	*/
+	enum CompiledSection {
+		SECTION_MODELS,
+		SECTION_VOXELS,
+		SECTION_PALETTE,      // 256 colors, in the order of VoxReader::palette
+		SECTION_NODES,
+		SECTION_CHILDREN,
+		SECTION_SHAPE_MODELS,
+		SECTION_FRAMES,
+		SECTION_LAYERS,
+		SECTION_MATERIALS,
+		SECTION_INSTANCES,
+		SECTION_ENTRIES,
+		SECTION_STRING_OFFSETS,
+		SECTION_STRINGS,
+		SECTION_UNKNOWN_CHUNKS,
+		SECTION_COUNT
+	};
+
+	static const uint32_t COMPILED_VERSION = 1;
+	static const uint32_t COMPILED_DEFAULT_PALETTE = 0x1;
+	static const size_t COMPILED_HEADER_SIZE = 24 + 16 * SECTION_COUNT;
+
+	static uint32_t mortonCode(const Voxel &v) {
+		uint32_t code = 0;
+		for (int bit = 0; bit < 8; bit++) {
+			code |= ((v.x >> bit) & 1u) << (3 * bit) | ((v.y >> bit) & 1u) << (3 * bit + 1) | ((v.z >> bit) & 1u) << (3 * bit + 2);
+		}
+		return code;
+	}
+
+	static compiled::Transform compileTransform(const SceneGraph::Transform &transform) {
+		compiled::Transform t;
+		memcpy(t.rotation, transform.rotation, sizeof(t.rotation));
+		memset(t.reserved, 0, sizeof(t.reserved));
+		memcpy(t.translation, transform.translation, sizeof(t.translation));
+		return t;
+	}
+
+	static compiled::Material::Type materialType(const std::string *type) {
+		static const char *names[] = { "_diffuse", "_metal", "_glass", "_emit", "_blend", "_media" };
+		if (type == nullptr) {
+			return compiled::Material::DIFFUSE;
+		}
+		for (int i = 0; i < 6; i++) {
+			if (*type == names[i]) {
+				return (compiled::Material::Type)(compiled::Material::DIFFUSE + i);
+			}
+		}
+		return compiled::Material::UNKNOWN;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// COMPILED WRITER
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* Collects the records of all sections and interns strings.
+	*/
+	class CompiledBuilder {
+	public:
+		std::vector<uint8_t> sections[SECTION_COUNT];
+
+		template <typename T>
+		void append(int section, const T &record) {
+			const uint8_t *p = reinterpret_cast<const uint8_t *>(&record);
+			sections[section].insert(sections[section].end(), p, p + sizeof(T));
+		}
+
+		template <typename T>
+		uint32_t count(int section) const {
+			return (uint32_t)(sections[section].size() / sizeof(T));
+		}
+
+		uint32_t string(const std::string &text) {
+			auto found = strings.find(text);
+			if (found != strings.end()) {
+				return found->second;
+			}
+			uint32_t index = count<uint32_t>(SECTION_STRING_OFFSETS);
+			append(SECTION_STRING_OFFSETS, (uint32_t)sections[SECTION_STRINGS].size());
+			sections[SECTION_STRINGS].insert(sections[SECTION_STRINGS].end(), text.begin(), text.end());
+			sections[SECTION_STRINGS].push_back(0);
+			strings.emplace(text, index);
+			return index;
+		}
+
+		uint32_t optionalString(const std::string *text) {
+			return text == nullptr ? compiled::NO_STRING : string(*text);
+		}
+
+		compiled::DictionaryRef dictionary(const Dictionary &dictionary) {
+			compiled::DictionaryRef ref = { count<compiled::Entry>(SECTION_ENTRIES), (uint32_t)dictionary.size() };
+			for (const auto &entry : dictionary) {
+				compiled::Entry e = { string(entry.first), string(entry.second) };
+				append(SECTION_ENTRIES, e);
+			}
+			return ref;
+		}
+
+	private:
+		std::unordered_map<std::string, uint32_t> strings;
+	};
+
+	static float materialValue(const Dictionary &properties, const char *key) {
+		const std::string *value = findValue(properties, key);
+		return value == nullptr ? 0.0f : (float)atof(value->c_str());
+	}
+
+	void VoxCompiledWriter::save(const VoxReader &vox, std::ostream &s, VoxelOrder order, uint64_t sourceHash) {
+		if (!s) {
+			throw VoxReader::Exception("Cannot write to stream");
+		}
+
+		CompiledBuilder b;
+
+		// Models:
+		uint64_t firstVoxel = 0;
+		std::vector<Voxel> sorted;
+		for (const auto &model : vox.models) {
+			compiled::Model record = { model.sizeX, model.sizeY, model.sizeZ, (uint32_t)model.voxels.size(), firstVoxel };
+			b.append(SECTION_MODELS, record);
+			firstVoxel += model.voxels.size();
+
+			const Voxel *voxels = model.voxels.data();
+			if (order == MORTON) {
+				sorted = model.voxels;
+				std::sort(sorted.begin(), sorted.end(), [](const Voxel &a, const Voxel &b) {
+					return mortonCode(a) < mortonCode(b);
+				});
+				voxels = sorted.data();
+			}
+			const uint8_t *p = reinterpret_cast<const uint8_t *>(voxels);
+			b.sections[SECTION_VOXELS].insert(b.sections[SECTION_VOXELS].end(), p, p + 4 * model.voxels.size());
+		}
+
+		// Palette:
+		uint32_t flags = 0;
+		const std::vector<RGBA> &palette = *vox.palette;
+		if (vox.palette == &VoxReader::DEFAULT_PALETTE) {
+			flags |= COMPILED_DEFAULT_PALETTE;
+		}
+		for (size_t i = 0; i < 256; i++) {
+			b.append(SECTION_PALETTE, i < palette.size() ? palette[i] : RGBA());
+		}
+
+		// Scene graph:
+		const SceneGraph &scene = vox.sceneGraph;
+		for (SceneGraph::NodeId id = 0; id < scene.GetNodeCount(); id++) {
+			compiled::Node record;
+			memset(&record, 0, sizeof(record));
+			record.type = compiled::Node::NONE;
+			record.layerId = -1;
+			record.name = compiled::NO_STRING;
+
+			if (const SceneGraph::Node *node = scene.GetNode(id)) {
+				record.type = (uint8_t)node->type;
+				record.name = b.optionalString(findValue(node->attributes, "_name"));
+				const std::string *hidden = findValue(node->attributes, "_hidden");
+				record.hidden = hidden != nullptr && *hidden == "1";
+				record.attributes = b.dictionary(node->attributes);
+
+				switch (node->type) {
+				case SceneGraph::Node::TRANSFORM: {
+					auto transform = static_cast<const SceneGraph::TransformNode *>(node);
+					record.layerId = transform->layerId;
+					record.first = b.count<uint32_t>(SECTION_CHILDREN);
+					record.count = 1;
+					b.append(SECTION_CHILDREN, (uint32_t)transform->childNodeId);
+					record.firstFrame = b.count<compiled::Frame>(SECTION_FRAMES);
+					record.frameCount = (uint32_t)transform->frame_attributes.size();
+					for (const auto &frame : transform->frame_attributes) {
+						compiled::Frame f;
+						f.transform = compileTransform(SceneGraph::Transform::Parse(frame));
+						f.attributes = b.dictionary(frame);
+						b.append(SECTION_FRAMES, f);
+					}
+					break;
+				}
+				case SceneGraph::Node::GROUP: {
+					auto group = static_cast<const SceneGraph::GroupNode *>(node);
+					record.first = b.count<uint32_t>(SECTION_CHILDREN);
+					record.count = (uint32_t)group->childNodeIds.size();
+					for (SceneGraph::NodeId child : group->childNodeIds) {
+						b.append(SECTION_CHILDREN, (uint32_t)child);
+					}
+					break;
+				}
+				case SceneGraph::Node::SHAPE: {
+					auto shape = static_cast<const SceneGraph::ShapeNode *>(node);
+					record.first = b.count<compiled::ShapeModel>(SECTION_SHAPE_MODELS);
+					record.count = (uint32_t)shape->models.size();
+					for (const auto &model : shape->models) {
+						compiled::ShapeModel m;
+						m.modelId = model.modelId;
+						m.attributes = b.dictionary(model.attributes);
+						b.append(SECTION_SHAPE_MODELS, m);
+					}
+					break;
+				}
+				}
+			}
+			b.append(SECTION_NODES, record);
+		}
+
+		for (const auto &instance : scene.Flatten()) {
+			compiled::Instance record = { instance.shapeNodeId, instance.modelId, instance.layerId, compileTransform(instance.transform) };
+			b.append(SECTION_INSTANCES, record);
+		}
+
+		// Layers and materials:
+		for (const auto &layer : vox.layers) {
+			compiled::Layer record;
+			record.name = b.optionalString(findValue(layer.attributes, "_name"));
+			const std::string *hidden = findValue(layer.attributes, "_hidden");
+			record.hidden = hidden != nullptr && *hidden == "1";
+			record.attributes = b.dictionary(layer.attributes);
+			b.append(SECTION_LAYERS, record);
+		}
+
+		for (const auto &material : vox.materials) {
+			const Dictionary &p = material.properties;
+			compiled::Material record;
+			record.type = p.empty() ? (uint32_t)compiled::Material::NONE : (uint32_t)materialType(findValue(p, "_type"));
+			record.weight = materialValue(p, "_weight");
+			record.rough = materialValue(p, "_rough");
+			record.metal = materialValue(p, "_metal");
+			record.spec = materialValue(p, "_spec");
+			record.ior = materialValue(p, "_ior");
+			record.att = materialValue(p, "_att");
+			record.flux = materialValue(p, "_flux");
+			record.emit = materialValue(p, "_emit");
+			record.ldr = materialValue(p, "_ldr");
+			record.alpha = findValue(p, "_alpha") != nullptr ? materialValue(p, "_alpha") : materialValue(p, "_trans");
+			record.properties = b.dictionary(p);
+			b.append(SECTION_MATERIALS, record);
+		}
+
+		for (const auto &chunk : vox.unknownChunks) {
+			b.sections[SECTION_UNKNOWN_CHUNKS].insert(b.sections[SECTION_UNKNOWN_CHUNKS].end(), chunk.bytes.begin(), chunk.bytes.end());
+		}
+
+		// Offset of the end of the string table terminates the last string:
+		b.append(SECTION_STRING_OFFSETS, (uint32_t)b.sections[SECTION_STRINGS].size());
+
+		// Header, then all sections at 8 byte aligned offsets:
+		std::vector<uint8_t> header(COMPILED_HEADER_SIZE);
+		memcpy(header.data(), "VOXC", 4);
+		const uint32_t fields[3] = { COMPILED_VERSION, (uint32_t)order, flags };
+		memcpy(header.data() + 4, fields, sizeof(fields));
+		memcpy(header.data() + 16, &sourceHash, 8);
+
+		uint64_t offset = header.size();
+		for (int i = 0; i < SECTION_COUNT; i++) {
+			offset = (offset + 7) & ~(uint64_t)7;
+			const uint64_t range[2] = { offset, b.sections[i].size() };
+			memcpy(header.data() + 24 + 16 * i, range, sizeof(range));
+			offset += b.sections[i].size();
+		}
+
+		static const char padding[8] = {};
+		s.write(reinterpret_cast<const char *>(header.data()), header.size());
+		uint64_t position = header.size();
+		for (int i = 0; i < SECTION_COUNT; i++) {
+			uint64_t aligned = (position + 7) & ~(uint64_t)7;
+			s.write(padding, (std::streamsize)(aligned - position));
+			s.write(reinterpret_cast<const char *>(b.sections[i].data()), b.sections[i].size());
+			position = aligned + b.sections[i].size();
+		}
+
+		if (!s) {
+			throw VoxReader::Exception("Writing to stream failed");
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// COMPILED READER
+	//////////////////////////////////////////////////////////////////////////////
+
+	VoxCompiledReader::VoxCompiledReader(const std::string &path) : file(new MappedFile(path)) {
+		bytes = file->data();
+		length = file->size();
+		open();
+	}
+
+	VoxCompiledReader::VoxCompiledReader(const uint8_t *data, size_t size) : bytes(data), length(size) {
+		if (reinterpret_cast<uintptr_t>(data) % 8 != 0) {
+			throw VoxReader::Exception("Compiled data must be 8 byte aligned");
+		}
+		open();
+	}
+
+	VoxCompiledReader::VoxCompiledReader(std::vector<uint64_t> data, size_t size) : owned(std::move(data)) {
+		if (size > 8 * owned.size()) {
+			throw VoxReader::Exception("Compiled data exceeds the buffer");
+		}
+		bytes = reinterpret_cast<const uint8_t *>(owned.data());
+		length = size;
+		open();
+	}
+
+	template <typename T>
+	const T* VoxCompiledReader::section(int index) const {
+		uint64_t offset;
+		memcpy(&offset, bytes + 24 + 16 * index, 8);
+		return reinterpret_cast<const T *>(bytes + offset);
+	}
+
+	template <typename T>
+	size_t VoxCompiledReader::count(int index) const {
+		uint64_t size;
+		memcpy(&size, bytes + 24 + 16 * index + 8, 8);
+		return (size_t)(size / sizeof(T));
+	}
+
+	void VoxCompiledReader::open() {
+		if (length < COMPILED_HEADER_SIZE || memcmp(bytes, "VOXC", 4) != 0) {
+			throw VoxReader::Exception("Magic string 'VOXC' is missing");
+		}
+		if ((uint32_t)readInt(bytes + 4) != COMPILED_VERSION) {
+			throw VoxReader::Exception("Unsupported compiled version");
+		}
+
+		static const size_t recordSizes[SECTION_COUNT] = {
+			sizeof(compiled::Model), sizeof(Voxel), sizeof(RGBA), sizeof(compiled::Node), sizeof(uint32_t), sizeof(compiled::ShapeModel),
+			sizeof(compiled::Frame), sizeof(compiled::Layer), sizeof(compiled::Material), sizeof(compiled::Instance), sizeof(compiled::Entry),
+			sizeof(uint32_t), 1, 1
+		};
+		for (int i = 0; i < SECTION_COUNT; i++) {
+			uint64_t range[2];
+			memcpy(range, bytes + 24 + 16 * i, sizeof(range));
+			if (range[0] % 8 != 0 || range[0] > length || range[1] > length - range[0] || range[1] % recordSizes[i] != 0) {
+				throw VoxReader::Exception("Compiled section exceeds the data");
+			}
+		}
+		if (count<RGBA>(SECTION_PALETTE) != 256 || count<uint32_t>(SECTION_STRING_OFFSETS) == 0) {
+			throw VoxReader::Exception("Compiled data is incomplete");
+		}
+
+		// Check every index once, so the accessors need no checks:
+		const size_t stringCount = count<uint32_t>(SECTION_STRING_OFFSETS) - 1;
+		const uint32_t *offsets = section<uint32_t>(SECTION_STRING_OFFSETS);
+		const char *strings = section<char>(SECTION_STRINGS);
+		const size_t stringsSize = count<char>(SECTION_STRINGS);
+		for (size_t i = 0; i < stringCount; i++) {
+			if (offsets[i] >= offsets[i + 1] || offsets[i + 1] > stringsSize || strings[offsets[i + 1] - 1] != 0) {
+				throw VoxReader::Exception("Compiled string table is invalid");
+			}
+		}
+
+		auto checkString = [&](uint32_t index, bool optional) {
+			if (index >= stringCount && !(optional && index == compiled::NO_STRING)) {
+				throw VoxReader::Exception("Compiled string index out of range");
+			}
+		};
+		auto checkRange = [&](uint64_t first, uint64_t size, size_t available) {
+			if (first > available || size > available - first) {
+				throw VoxReader::Exception("Compiled index out of range");
+			}
+		};
+
+		const compiled::Entry *allEntries = section<compiled::Entry>(SECTION_ENTRIES);
+		for (size_t i = 0; i < count<compiled::Entry>(SECTION_ENTRIES); i++) {
+			checkString(allEntries[i].key, false);
+			checkString(allEntries[i].value, false);
+		}
+		const size_t entryCount = count<compiled::Entry>(SECTION_ENTRIES);
+
+		for (size_t i = 0; i < modelCount(); i++) {
+			const compiled::Model &m = model(i);
+			checkRange(m.firstVoxel, m.voxelCount, count<Voxel>(SECTION_VOXELS));
+		}
+
+		for (SceneGraph::NodeId id = 0; id < nodeCount(); id++) {
+			const compiled::Node &n = section<compiled::Node>(SECTION_NODES)[id];
+			if (n.type == compiled::Node::NONE) continue;
+			if (n.type > SceneGraph::Node::SHAPE) {
+				throw VoxReader::Exception("Compiled node type is invalid");
+			}
+			checkString(n.name, true);
+			checkRange(n.attributes.first, n.attributes.count, entryCount);
+			checkRange(n.first, n.count, n.type == SceneGraph::Node::SHAPE ? count<compiled::ShapeModel>(SECTION_SHAPE_MODELS) : count<uint32_t>(SECTION_CHILDREN));
+			checkRange(n.firstFrame, n.frameCount, count<compiled::Frame>(SECTION_FRAMES));
+			if (n.type == SceneGraph::Node::TRANSFORM && n.count != 1) {
+				throw VoxReader::Exception("Compiled transform node needs one child");
+			}
+		}
+		for (size_t i = 0; i < count<compiled::ShapeModel>(SECTION_SHAPE_MODELS); i++) {
+			const compiled::ShapeModel &m = section<compiled::ShapeModel>(SECTION_SHAPE_MODELS)[i];
+			checkRange(m.attributes.first, m.attributes.count, entryCount);
+		}
+		for (size_t i = 0; i < count<compiled::Frame>(SECTION_FRAMES); i++) {
+			const compiled::Frame &f = section<compiled::Frame>(SECTION_FRAMES)[i];
+			checkRange(f.attributes.first, f.attributes.count, entryCount);
+		}
+		for (size_t i = 0; i < layerCount(); i++) {
+			checkString(layer(i).name, true);
+			checkRange(layer(i).attributes.first, layer(i).attributes.count, entryCount);
+		}
+		for (size_t i = 0; i < materialCount(); i++) {
+			checkRange(material(i).properties.first, material(i).properties.count, entryCount);
+		}
+		// References between records, node ids are checked after all nodes are known to be valid:
+		auto checkLayer = [&](int32_t layerId) {
+			if (layerId != -1 && (layerId < 0 || (size_t)layerId >= layerCount())) {
+				throw VoxReader::Exception("Compiled layer id out of range");
+			}
+		};
+		for (SceneGraph::NodeId id = 0; id < nodeCount(); id++) {
+			const compiled::Node *n = node(id);
+			if (n == nullptr) continue;
+			if (n->type == SceneGraph::Node::SHAPE) {
+				for (uint32_t i = 0; i < n->count; i++) {
+					if (shapeModels(*n)[i].modelId >= modelCount()) {
+						throw VoxReader::Exception("Compiled shape node references a missing model");
+					}
+				}
+				continue;
+			}
+			for (uint32_t i = 0; i < n->count; i++) {
+				if (node((SceneGraph::NodeId)children(*n)[i]) == nullptr || children(*n)[i] > (uint32_t)INT32_MAX) {
+					throw VoxReader::Exception("Compiled node references a missing node");
+				}
+			}
+			if (n->type == SceneGraph::Node::TRANSFORM) {
+				checkLayer(n->layerId);
+			}
+		}
+		for (size_t i = 0; i < instanceCount(); i++) {
+			const compiled::Instance &instance = this->instance(i);
+			if (instance.modelId >= modelCount()) {
+				throw VoxReader::Exception("Compiled instance references a missing model");
+			}
+			const compiled::Node *shape = node(instance.shapeNodeId);
+			if (shape == nullptr || shape->type != SceneGraph::Node::SHAPE) {
+				throw VoxReader::Exception("Compiled instance references a missing shape node");
+			}
+			checkLayer(instance.layerId);
+		}
+	}
+
+	VoxCompiledWriter::VoxelOrder VoxCompiledReader::voxelOrder() const {
+		return (VoxCompiledWriter::VoxelOrder)readInt(bytes + 8);
+	}
+
+	uint64_t VoxCompiledReader::sourceHash() const {
+		uint64_t hash;
+		memcpy(&hash, bytes + 16, 8);
+		return hash;
+	}
+
+	size_t VoxCompiledReader::modelCount() const {
+		return count<compiled::Model>(SECTION_MODELS);
+	}
+
+	const compiled::Model& VoxCompiledReader::model(size_t index) const {
+		return section<compiled::Model>(SECTION_MODELS)[index];
+	}
+
+	const Voxel* VoxCompiledReader::voxels(size_t modelIndex) const {
+		return section<Voxel>(SECTION_VOXELS) + model(modelIndex).firstVoxel;
+	}
+
+	RGBA VoxCompiledReader::getColor(uint8_t colorIndex) const {
+		const RGBA *palette = section<RGBA>(SECTION_PALETTE);
+		if (readInt(bytes + 12) & COMPILED_DEFAULT_PALETTE) {
+			return palette[colorIndex];
+		}
+		return colorIndex == 0 ? RGBA() : palette[colorIndex - 1];
+	}
+
+	const compiled::Node* VoxCompiledReader::node(SceneGraph::NodeId id) const {
+		if (id < 0 || id >= nodeCount()) {
+			return nullptr;
+		}
+		const compiled::Node *n = section<compiled::Node>(SECTION_NODES) + id;
+		return n->type == compiled::Node::NONE ? nullptr : n;
+	}
+
+	SceneGraph::NodeId VoxCompiledReader::nodeCount() const {
+		return (SceneGraph::NodeId)count<compiled::Node>(SECTION_NODES);
+	}
+
+	const uint32_t* VoxCompiledReader::children(const compiled::Node &node) const {
+		return section<uint32_t>(SECTION_CHILDREN) + node.first;
+	}
+
+	const compiled::ShapeModel* VoxCompiledReader::shapeModels(const compiled::Node &node) const {
+		return section<compiled::ShapeModel>(SECTION_SHAPE_MODELS) + node.first;
+	}
+
+	const compiled::Frame* VoxCompiledReader::frames(const compiled::Node &node) const {
+		return section<compiled::Frame>(SECTION_FRAMES) + node.firstFrame;
+	}
+
+	size_t VoxCompiledReader::layerCount() const {
+		return count<compiled::Layer>(SECTION_LAYERS);
+	}
+
+	const compiled::Layer& VoxCompiledReader::layer(size_t id) const {
+		return section<compiled::Layer>(SECTION_LAYERS)[id];
+	}
+
+	size_t VoxCompiledReader::materialCount() const {
+		return count<compiled::Material>(SECTION_MATERIALS);
+	}
+
+	const compiled::Material& VoxCompiledReader::material(size_t id) const {
+		return section<compiled::Material>(SECTION_MATERIALS)[id];
+	}
+
+	size_t VoxCompiledReader::instanceCount() const {
+		return count<compiled::Instance>(SECTION_INSTANCES);
+	}
+
+	const compiled::Instance& VoxCompiledReader::instance(size_t index) const {
+		return section<compiled::Instance>(SECTION_INSTANCES)[index];
+	}
+
+	const char* VoxCompiledReader::string(uint32_t index) const {
+		return section<char>(SECTION_STRINGS) + section<uint32_t>(SECTION_STRING_OFFSETS)[index];
+	}
+
+	const compiled::Entry* VoxCompiledReader::entries(const compiled::DictionaryRef &dictionary) const {
+		return section<compiled::Entry>(SECTION_ENTRIES) + dictionary.first;
+	}
+
+	const char* VoxCompiledReader::findValue(const compiled::DictionaryRef &dictionary, const char *key) const {
+		const compiled::Entry *e = entries(dictionary);
+		for (uint32_t i = 0; i < dictionary.count; i++) {
+			if (strcmp(string(e[i].key), key) == 0) {
+				return string(e[i].value);
+			}
+		}
+		return nullptr;
+	}
+
+	void VoxCompiledReader::toReader(VoxReader &vox) const {
+		vox.clear();
+
+		auto dictionary = [&](const compiled::DictionaryRef &ref) {
+			Dictionary d;
+			d.reserve(ref.count);
+			const compiled::Entry *e = entries(ref);
+			for (uint32_t i = 0; i < ref.count; i++) {
+				d.emplace_back(string(e[i].key), string(e[i].value));
+			}
+			return d;
+		};
+
+		vox.models.reserve(modelCount());
+		for (size_t i = 0; i < modelCount(); i++) {
+			const compiled::Model &m = model(i);
+			Model result(m.sizeX, m.sizeY, m.sizeZ);
+			result.voxels.assign(voxels(i), voxels(i) + m.voxelCount);
+			vox.models.push_back(std::move(result));
+		}
+
+		if (!(readInt(bytes + 12) & COMPILED_DEFAULT_PALETTE)) {
+			const RGBA *palette = section<RGBA>(SECTION_PALETTE);
+			vox.palette = new std::vector<RGBA>(palette, palette + 256);
+		}
+
+		for (SceneGraph::NodeId id = 0; id < nodeCount(); id++) {
+			const compiled::Node *n = node(id);
+			if (n == nullptr) continue;
+
+			switch (n->type) {
+			case SceneGraph::Node::TRANSFORM: {
+				auto &transform = vox.sceneGraph.AddTransformNode(id);
+				transform.attributes = dictionary(n->attributes);
+				transform.childNodeId = (SceneGraph::NodeId)children(*n)[0];
+				transform.layerId = n->layerId;
+				for (uint32_t f = 0; f < n->frameCount; f++) {
+					transform.frame_attributes.push_back(dictionary(frames(*n)[f].attributes));
+				}
+				break;
+			}
+			case SceneGraph::Node::GROUP: {
+				auto &group = vox.sceneGraph.AddGroupNode(id);
+				group.attributes = dictionary(n->attributes);
+				group.childNodeIds.assign(children(*n), children(*n) + n->count);
+				break;
+			}
+			case SceneGraph::Node::SHAPE: {
+				auto &shape = vox.sceneGraph.AddShapeNode(id);
+				shape.attributes = dictionary(n->attributes);
+				for (uint32_t m = 0; m < n->count; m++) {
+					const compiled::ShapeModel &model = shapeModels(*n)[m];
+					shape.models.push_back(SceneGraph::Model{ model.modelId, dictionary(model.attributes) });
+				}
+				break;
+			}
+			}
+		}
+
+		vox.layers.resize(layerCount());
+		for (size_t i = 0; i < layerCount(); i++) {
+			vox.layers[i].attributes = dictionary(layer(i).attributes);
+		}
+		vox.materials.resize(materialCount());
+		for (size_t i = 0; i < materialCount(); i++) {
+			vox.materials[i].properties = dictionary(material(i).properties);
+		}
+
+		// Unknown chunks are stored back to back, including their headers:
+		const uint8_t *chunk = section<uint8_t>(SECTION_UNKNOWN_CHUNKS);
+		const uint8_t *end = chunk + count<uint8_t>(SECTION_UNKNOWN_CHUNKS);
+		while (end - chunk >= 12) {
+			uint64_t size = 12 + (uint64_t)(uint32_t)readInt(chunk + 4) + (uint32_t)readInt(chunk + 8);
+			if (size > (uint64_t)(end - chunk)) {
+				throw VoxReader::Exception("Compiled unknown chunk exceeds the data");
+			}
+			VoxReader::RawChunk raw;
+			memcpy(raw.id, chunk, 4);
+			raw.id[4] = 0;
+			raw.bytes.assign(chunk, chunk + size);
+			vox.unknownChunks.push_back(std::move(raw));
+			chunk += size;
+		}
+	}
+
+} // namespace jim
+
+#endif
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "VoxReader.hpp"
+
+#include <unordered_map>
+
+namespace jim {
+
+	/**
+	 * Finds models with identical content (size and voxels, in any order), see Model::contentHash().
+	*/
+	class VoxDedup {
+	public:
+
+		/**
+		 * Remove duplicated models of the given reader, keeping the first of every set of identical models,
+		 * and rewrite the model ids of all shape nodes. Hashes are computed on up to the given number of
+		 * threads (0 = hardware concurrency). Returns the number of removed models.
+		*/
+		static size_t deduplicate(VoxReader &vox, unsigned threads = 0);
+	};
+
+	/**
+	 * Stores every distinct model once across any number of vox-files.
+	*/
+	class VoxModelCatalog {
+	public:
+
+		/**
+		 * Add the given model unless an identical one is stored already. Returns the catalog id of the model.
+		*/
+		uint32_t add(const Model &model);
+		uint32_t add(Model &&model);
+
+		/**
+		 * Add all models of the given reader. Returns the catalog id of every model, in order.
+		*/
+		std::vector<uint32_t> add(const VoxReader &vox, unsigned threads = 0);
+
+		/**
+		 * Returns the model with the given catalog id.
+		*/
+		const Model& get(uint32_t id) const { return models[id]; }
+
+		/**
+		 * Returns the number of distinct models.
+		*/
+		size_t size() const { return models.size(); }
+
+	private:
+
+		uint32_t add(const Model &model, uint64_t hash, Model *moved);
+
+		std::vector<Model> models;
+		std::unordered_multimap<uint64_t, uint32_t> ids; // content hash to catalog id
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// DEDUPLICATION
+	//////////////////////////////////////////////////////////////////////////////
+
+	static std::vector<uint64_t> contentHashes(const std::vector<Model> &models, unsigned threads) {
+		std::vector<uint64_t> hashes(models.size());
+		parallelFor(models.size(), threads, [&](size_t i) {
+			hashes[i] = models[i].contentHash();
+		});
+		return hashes;
+	}
+
+	size_t VoxDedup::deduplicate(VoxReader &vox, unsigned threads) {
+		std::vector<uint64_t> hashes = contentHashes(vox.models, threads);
+
+		// New index of every model, duplicates point to the kept model:
+		std::vector<uint32_t> remap(vox.models.size());
+		std::unordered_multimap<uint64_t, uint32_t> kept;
+		uint32_t keptCount = 0;
+		for (size_t i = 0; i < vox.models.size(); i++) {
+			remap[i] = UINT32_MAX;
+			auto range = kept.equal_range(hashes[i]);
+			for (auto candidate = range.first; candidate != range.second; ++candidate) {
+				if (vox.models[i].sameContent(vox.models[candidate->second])) {
+					remap[i] = remap[candidate->second];
+					break;
+				}
+			}
+			if (remap[i] == UINT32_MAX) {
+				remap[i] = keptCount++;
+				kept.emplace(hashes[i], (uint32_t)i);
+			}
+		}
+
+		size_t removed = vox.models.size() - keptCount;
+		if (removed == 0) {
+			return 0;
+		}
+
+		// Kept models keep their order, a kept model is the first one remapped to the next index:
+		std::vector<Model> models;
+		models.reserve(keptCount);
+		for (size_t i = 0; i < vox.models.size(); i++) {
+			if (remap[i] == models.size()) {
+				models.push_back(std::move(vox.models[i]));
+			}
+		}
+		vox.models = std::move(models);
+
+		for (SceneGraph::NodeId id = 0; id < vox.sceneGraph.GetNodeCount(); id++) {
+			SceneGraph::Node *node = vox.sceneGraph.GetNode(id);
+			if (node == nullptr || node->type != SceneGraph::Node::SHAPE) continue;
+			for (auto &model : static_cast<SceneGraph::ShapeNode *>(node)->models) {
+				if (model.modelId < remap.size()) {
+					model.modelId = remap[model.modelId];
+				}
+			}
+		}
+
+		return removed;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// MODEL CATALOG
+	//////////////////////////////////////////////////////////////////////////////
+
+	uint32_t VoxModelCatalog::add(const Model &model, uint64_t hash, Model *moved) {
+		auto range = ids.equal_range(hash);
+		for (auto candidate = range.first; candidate != range.second; ++candidate) {
+			if (model.sameContent(models[candidate->second])) {
+				return candidate->second;
+			}
+		}
+		uint32_t id = (uint32_t)models.size();
+		if (moved != nullptr) {
+			models.push_back(std::move(*moved));
+		}
+		else {
+			models.push_back(model);
+		}
+		ids.emplace(hash, id);
+		return id;
+	}
+
+	uint32_t VoxModelCatalog::add(const Model &model) {
+		return add(model, model.contentHash(), nullptr);
+	}
+
+	uint32_t VoxModelCatalog::add(Model &&model) {
+		return add(model, model.contentHash(), &model);
+	}
+
+	std::vector<uint32_t> VoxModelCatalog::add(const VoxReader &vox, unsigned threads) {
+		std::vector<uint64_t> hashes = contentHashes(vox.models, threads);
+		std::vector<uint32_t> result(vox.models.size());
+		for (size_t i = 0; i < vox.models.size(); i++) {
+			result[i] = add(vox.models[i], hashes[i], nullptr);
+		}
+		return result;
+	}
+
+} // namespace jim
+
+#endif
@@ -0,0 +1,405 @@
+#pragma once
+
+#include "VoxReader.hpp"
+
+#include <ostream>
+
+namespace jim {
+
+	/**
+	 * Writes the objects of a VoxReader as human readable text or as JSON, for diffing assets and inspection.
+	 * Output goes through a fixed size buffer with its own integer formatting, so dumping large models is not slowed
+	 * down by stream formatting. Colors are listed by color index (see VoxReader::getColor), so default and
+	 * loaded palettes compare equally.
+	*/
+	class VoxDump {
+	public:
+
+		/**
+		 * Only write the number of voxels of every model instead of the voxels.
+		*/
+		static const uint32_t NO_VOXELS = 0x1;
+
+		/**
+		 * Do not write the palette.
+		*/
+		static const uint32_t NO_PALETTE = 0x2;
+
+		/**
+		 * The dump keeps a reference to the given objects, they must outlive the dump.
+		*/
+		explicit VoxDump(const VoxReader &vox, uint32_t flags = 0);
+
+		/**
+		 * Write models, palette, scene graph, layers, materials and unknown chunks as text, one object per line.
+		*/
+		void saveText(std::ostream &s) const;
+
+		/**
+		 * Write the same as one JSON object, with one voxel per line.
+		*/
+		void saveJson(std::ostream &s) const;
+
+	private:
+
+		class Output;
+
+		const VoxReader &vox;
+		uint32_t flags;
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <cstring>
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// OUTPUT
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* Preallocated buffer in front of the output stream, flushed whenever it is full.
+	*/
+	class VoxDump::Output {
+	public:
+		static const size_t BUFFER_SIZE = 256 * 1024;
+
+		explicit Output(std::ostream &s) : s(s), buffer(new char[BUFFER_SIZE]) {}
+
+		~Output() {
+			flush();
+		}
+
+		void flush() {
+			s.write(buffer.get(), used);
+			used = 0;
+		}
+
+		char *reserve(size_t size) {
+			if (used + size > BUFFER_SIZE) {
+				flush();
+			}
+			char *ptr = buffer.get() + used;
+			used += size;
+			return ptr;
+		}
+
+		void bytes(const char *data, size_t size) {
+			if (size > BUFFER_SIZE) {
+				flush();
+				s.write(data, size);
+				return;
+			}
+			memcpy(reserve(size), data, size);
+		}
+
+		Output &operator<<(const char *text) {
+			bytes(text, strlen(text));
+			return *this;
+		}
+
+		Output &operator<<(char c) {
+			*reserve(1) = c;
+			return *this;
+		}
+
+		Output &operator<<(uint64_t value) {
+			char *ptr = reserve(20);
+			used -= 20 - (integer(ptr, value, 1) - ptr);
+			return *this;
+		}
+
+		Output &operator<<(int64_t value) {
+			char *ptr = reserve(21);
+			char *end = ptr;
+			if (value < 0) {
+				*end++ = '-';
+			}
+			end = integer(end, value < 0 ? 0 - (uint64_t)value : (uint64_t)value, 1);
+			used -= 21 - (end - ptr);
+			return *this;
+		}
+
+		/**
+		* Write the value with at least the given number of digits, padded with zeros.
+		*/
+		void padded(uint32_t value, int digits) {
+			char *ptr = reserve(10);
+			used -= 10 - (integer(ptr, value, digits) - ptr);
+		}
+
+		/**
+		* Write the value as 8 lower case hex digits.
+		*/
+		void hex(uint32_t value) {
+			static const char DIGITS[] = "0123456789abcdef";
+			char *ptr = reserve(8);
+			for (int i = 7; i >= 0; i--) {
+				ptr[i] = DIGITS[value & 0xF];
+				value >>= 4;
+			}
+		}
+
+		/**
+		* Write the string as JSON string including the quotes.
+		*/
+		void json(const std::string &str) {
+			static const char DIGITS[] = "0123456789abcdef";
+			*this << '"';
+			for (char c : str) {
+				switch (c) {
+				case '"': *this << "\\\""; break;
+				case '\\': *this << "\\\\"; break;
+				case '\n': *this << "\\n"; break;
+				case '\r': *this << "\\r"; break;
+				case '\t': *this << "\\t"; break;
+				default:
+					if ((unsigned char)c < 0x20) {
+						char *ptr = reserve(6);
+						memcpy(ptr, "\\u00", 4);
+						ptr[4] = DIGITS[(unsigned char)c >> 4];
+						ptr[5] = DIGITS[c & 0xF];
+					}
+					else {
+						*this << c;
+					}
+				}
+			}
+			*this << '"';
+		}
+
+	private:
+		static char *integer(char *ptr, uint64_t value, int digits) {
+			char reversed[20];
+			int count = 0;
+			do {
+				reversed[count++] = (char)('0' + value % 10);
+				value /= 10;
+			} while (value != 0 || count < digits);
+			while (count > 0) {
+				*ptr++ = reversed[--count];
+			}
+			return ptr;
+		}
+
+		std::ostream &s;
+		std::unique_ptr<char[]> buffer;
+		size_t used = 0;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////
+	// DUMP
+	//////////////////////////////////////////////////////////////////////////////
+
+	static const char *nodeTypeName(SceneGraph::Node::Type type) {
+		switch (type) {
+		case SceneGraph::Node::TRANSFORM: return "transform";
+		case SceneGraph::Node::GROUP: return "group";
+		default: return "shape";
+		}
+	}
+
+	VoxDump::VoxDump(const VoxReader &vox, uint32_t flags) : vox(vox), flags(flags) {}
+
+	void VoxDump::saveText(std::ostream &s) const {
+		Output out(s);
+
+		auto dictionary = [&](const Dictionary &d) {
+			out << '{';
+			for (size_t i = 0; i < d.size(); i++) {
+				out << (i > 0 ? ", " : "");
+				out.bytes(d[i].first.data(), d[i].first.size());
+				out << '=';
+				out.bytes(d[i].second.data(), d[i].second.size());
+			}
+			out << '}';
+		};
+
+		out << "VOXEL-OBJECT:\nNum models: " << (uint64_t)vox.models.size() << '\n';
+		for (const Model &model : vox.models) {
+			out << "Model:  size(" << (uint64_t)model.sizeX << ',' << (uint64_t)model.sizeY << ',' << (uint64_t)model.sizeZ << ')';
+			if (flags & NO_VOXELS) {
+				out << "  voxels=" << (uint64_t)model.voxels.size() << '\n';
+				continue;
+			}
+			out << '\n';
+			for (const Voxel &voxel : model.voxels) {
+				out << "   Voxel: ";
+				out.padded(voxel.x, 2);
+				out << ',';
+				out.padded(voxel.y, 2);
+				out << ',';
+				out.padded(voxel.z, 2);
+				out << ",   color=";
+				out.padded(voxel.colorIndex, 2);
+				out << '\n';
+			}
+		}
+
+		if (!(flags & NO_PALETTE)) {
+			out << "Palette: " << (vox.palette == &VoxReader::DEFAULT_PALETTE ? "(DEFAULT)" : "");
+			for (uint32_t i = 0; i < 256; i++) {
+				out << (i % 16 == 0 ? "\n   " : "  ");
+				out.hex(vox.getColor((uint8_t)i).pack());
+			}
+			out << '\n';
+		}
+
+		out << "Nodes: " << (int64_t)vox.sceneGraph.GetNodeCount() << '\n';
+		for (SceneGraph::NodeId id = 0; id < vox.sceneGraph.GetNodeCount(); id++) {
+			const SceneGraph::Node *node = vox.sceneGraph.GetNode(id);
+			if (node == nullptr) continue;
+			out << "   Node " << (int64_t)id << ": " << nodeTypeName(node->type) << ' ';
+			dictionary(node->attributes);
+			if (node->type == SceneGraph::Node::TRANSFORM) {
+				const auto &transform = static_cast<const SceneGraph::TransformNode &>(*node);
+				out << " child=" << (int64_t)transform.childNodeId << " layer=" << (int64_t)transform.layerId << " frames=";
+				for (const Dictionary &frame : transform.frame_attributes) {
+					dictionary(frame);
+				}
+			}
+			else if (node->type == SceneGraph::Node::GROUP) {
+				out << " children=";
+				const auto &group = static_cast<const SceneGraph::GroupNode &>(*node);
+				for (size_t i = 0; i < group.childNodeIds.size(); i++) {
+					out << (i > 0 ? "," : "") << (int64_t)group.childNodeIds[i];
+				}
+			}
+			else {
+				out << " models=";
+				for (const auto &model : static_cast<const SceneGraph::ShapeNode &>(*node).models) {
+					out << (int64_t)(int32_t)model.modelId; // stored as int32 in the file, so -1 prints as -1
+					dictionary(model.attributes);
+				}
+			}
+			out << '\n';
+		}
+
+		out << "Layers: " << (uint64_t)vox.layers.size() << '\n';
+		for (size_t i = 0; i < vox.layers.size(); i++) {
+			out << "   Layer " << (uint64_t)i << ": ";
+			dictionary(vox.layers[i].attributes);
+			out << '\n';
+		}
+
+		out << "Materials: " << (uint64_t)vox.materials.size() << '\n';
+		for (size_t i = 0; i < vox.materials.size(); i++) {
+			out << "   Material " << (uint64_t)i << ": ";
+			dictionary(vox.materials[i].properties);
+			out << '\n';
+		}
+
+		out << "Unknown chunks: " << (uint64_t)vox.unknownChunks.size() << '\n';
+		for (const VoxReader::RawChunk &raw : vox.unknownChunks) {
+			out << "   " << raw.id << ": " << (uint64_t)raw.bytes.size() << " bytes\n";
+		}
+	}
+
+	void VoxDump::saveJson(std::ostream &s) const {
+		Output out(s);
+
+		auto dictionary = [&](const Dictionary &d) {
+			out << '{';
+			for (size_t i = 0; i < d.size(); i++) {
+				out << (i > 0 ? "," : "");
+				out.json(d[i].first);
+				out << ':';
+				out.json(d[i].second);
+			}
+			out << '}';
+		};
+
+		out << "{\n\"models\":[";
+		for (size_t m = 0; m < vox.models.size(); m++) {
+			const Model &model = vox.models[m];
+			out << (m > 0 ? ",\n" : "\n") << "{\"size\":[" << (uint64_t)model.sizeX << ',' << (uint64_t)model.sizeY << ','
+				<< (uint64_t)model.sizeZ << "],\"voxelCount\":" << (uint64_t)model.voxels.size();
+			if (!(flags & NO_VOXELS)) {
+				out << ",\"voxels\":[";
+				for (size_t i = 0; i < model.voxels.size(); i++) {
+					const Voxel &voxel = model.voxels[i];
+					out << (i > 0 ? ",\n[" : "\n[") << (uint64_t)voxel.x << ',' << (uint64_t)voxel.y << ',' << (uint64_t)voxel.z
+						<< ',' << (uint64_t)voxel.colorIndex << ']';
+				}
+				out << ']';
+			}
+			out << '}';
+		}
+		out << "],\n";
+
+		if (!(flags & NO_PALETTE)) {
+			// ARGB as written by RGBA::print, by color index:
+			out << "\"defaultPalette\":" << (vox.palette == &VoxReader::DEFAULT_PALETTE ? "true" : "false") << ",\n\"palette\":[";
+			for (uint32_t i = 0; i < 256; i++) {
+				out << (i == 0 ? "\"" : i % 16 == 0 ? ",\n\"" : ",\"");
+				out.hex(vox.getColor((uint8_t)i).pack());
+				out << '"';
+			}
+			out << "],\n";
+		}
+
+		out << "\"nodes\":[";
+		bool first = true;
+		for (SceneGraph::NodeId id = 0; id < vox.sceneGraph.GetNodeCount(); id++) {
+			const SceneGraph::Node *node = vox.sceneGraph.GetNode(id);
+			if (node == nullptr) continue;
+			out << (first ? "\n" : ",\n") << "{\"id\":" << (int64_t)id << ",\"type\":\"" << nodeTypeName(node->type) << "\",\"attributes\":";
+			first = false;
+			dictionary(node->attributes);
+			if (node->type == SceneGraph::Node::TRANSFORM) {
+				const auto &transform = static_cast<const SceneGraph::TransformNode &>(*node);
+				out << ",\"child\":" << (int64_t)transform.childNodeId << ",\"layer\":" << (int64_t)transform.layerId << ",\"frames\":[";
+				for (size_t i = 0; i < transform.frame_attributes.size(); i++) {
+					out << (i > 0 ? "," : "");
+					dictionary(transform.frame_attributes[i]);
+				}
+				out << ']';
+			}
+			else if (node->type == SceneGraph::Node::GROUP) {
+				const auto &group = static_cast<const SceneGraph::GroupNode &>(*node);
+				out << ",\"children\":[";
+				for (size_t i = 0; i < group.childNodeIds.size(); i++) {
+					out << (i > 0 ? "," : "") << (int64_t)group.childNodeIds[i];
+				}
+				out << ']';
+			}
+			else {
+				const auto &shape = static_cast<const SceneGraph::ShapeNode &>(*node);
+				out << ",\"models\":[";
+				for (size_t i = 0; i < shape.models.size(); i++) {
+					out << (i > 0 ? "," : "") << "{\"model\":" << (int64_t)(int32_t)shape.models[i].modelId << ",\"attributes\":";
+					dictionary(shape.models[i].attributes);
+					out << '}';
+				}
+				out << ']';
+			}
+			out << '}';
+		}
+		out << "],\n";
+
+		out << "\"layers\":[";
+		for (size_t i = 0; i < vox.layers.size(); i++) {
+			out << (i > 0 ? ",\n" : "\n");
+			dictionary(vox.layers[i].attributes);
+		}
+		out << "],\n\"materials\":[";
+		for (size_t i = 0; i < vox.materials.size(); i++) {
+			out << (i > 0 ? ",\n" : "\n");
+			dictionary(vox.materials[i].properties);
+		}
+		out << "],\n\"unknownChunks\":[";
+		for (size_t i = 0; i < vox.unknownChunks.size(); i++) {
+			const VoxReader::RawChunk &raw = vox.unknownChunks[i];
+			out << (i > 0 ? ",\n" : "\n") << "{\"id\":";
+			out.json(raw.id);
+			out << ",\"size\":" << (uint64_t)raw.bytes.size() << '}';
+		}
+		out << "]\n}\n";
+	}
+
+} // namespace jim
+
+#endif
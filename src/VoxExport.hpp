@@ -0,0 +1,596 @@
+#pragma once
+
+#include "VoxReader.hpp"
+#include "VoxWorld.hpp"
+
+#include <ostream>
+
+namespace jim {
+
+	/**
+	 * Exports the models of a VoxReader as meshes (glTF 2.0 binary, OBJ, PLY) or voxel points as PLY point cloud.
+	 * Meshes contain one quad per visible voxel face, colored by the palette.
+	 * Nothing is built in memory up front: a counting pass sizes all headers, then the geometry is generated
+	 * model by model and streamed through a fixed size buffer.
+	*/
+	class VoxExport {
+	public:
+
+		/**
+		 * The exporter keeps a reference to the given objects, they must outlive the exporter.
+		*/
+		explicit VoxExport(const VoxReader &vox);
+
+		/**
+		 * Write a binary glTF 2.0 (.glb). Every model becomes a mesh, every visible instance of the scene graph
+		 * becomes a node referencing it. A root node converts from the Z-up vox space to the Y-up glTF space.
+		*/
+		void saveGltf(std::ostream &s) const;
+
+		/**
+		 * Write all visible instances as one mesh in world space as OBJ with vertex colors.
+		*/
+		void saveObj(std::ostream &s) const;
+
+		/**
+		 * Write all visible instances as one mesh in world space as binary PLY with vertex colors.
+		*/
+		void savePly(std::ostream &s) const;
+
+		/**
+		 * Write the voxels of the given world as binary PLY point cloud (voxel centers), colored by the palette.
+		*/
+		void savePoints(std::ostream &s, const VoxWorld &world) const;
+
+	private:
+
+		class Output;
+		struct MeshInfo;
+
+		std::vector<MeshInfo> countFaces() const;
+
+		const VoxReader &vox;
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// OUTPUT
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* Preallocated buffer in front of the output stream, flushed whenever it is full.
+	*/
+	class VoxExport::Output {
+	public:
+		static const size_t BUFFER_SIZE = 1024 * 1024;
+
+		explicit Output(std::ostream &s) : s(s), buffer(new char[BUFFER_SIZE]) {}
+
+		~Output() {
+			flush();
+		}
+
+		void flush() {
+			s.write(buffer.get(), used);
+			used = 0;
+		}
+
+		char *reserve(size_t size) {
+			if (used + size > BUFFER_SIZE) {
+				flush();
+			}
+			char *ptr = buffer.get() + used;
+			used += size;
+			return ptr;
+		}
+
+		void bytes(const void *data, size_t size) {
+			if (size > BUFFER_SIZE) {
+				flush();
+				s.write(reinterpret_cast<const char *>(data), size);
+				return;
+			}
+			memcpy(reserve(size), data, size);
+		}
+
+		void text(const std::string &str) {
+			bytes(str.data(), str.size());
+		}
+
+		template <typename T>
+		void value(T value) {
+			memcpy(reserve(sizeof(T)), &value, sizeof(T));
+		}
+
+		/**
+		* Write a multiple of 0.5 without going through printf.
+		*/
+		void half(float value) {
+			char *ptr = reserve(16);
+			char *start = ptr;
+			int32_t twice = (int32_t)(value * 2.0f);
+			if (twice < 0) {
+				*ptr++ = '-';
+				twice = -twice;
+			}
+			ptr = integer(ptr, (uint32_t)(twice / 2));
+			if (twice & 1) {
+				*ptr++ = '.';
+				*ptr++ = '5';
+			}
+			used -= 16 - (ptr - start);
+		}
+
+		void number(uint32_t value) {
+			char *ptr = reserve(10);
+			used -= 10 - (integer(ptr, value) - ptr);
+		}
+
+	private:
+		static char *integer(char *ptr, uint32_t value) {
+			char digits[10];
+			int count = 0;
+			do {
+				digits[count++] = (char)('0' + value % 10);
+				value /= 10;
+			} while (value != 0);
+			while (count > 0) {
+				*ptr++ = digits[--count];
+			}
+			return ptr;
+		}
+
+		std::ostream &s;
+		std::unique_ptr<char[]> buffer;
+		size_t used = 0;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////
+	// MESHING
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* Corners of the six faces of a unit cube, counter clockwise seen from outside: +X, -X, +Y, -Y, +Z, -Z
+	*/
+	static const uint8_t FACE_CORNERS[6][4][3] = {
+		{ { 1, 0, 0 }, { 1, 1, 0 }, { 1, 1, 1 }, { 1, 0, 1 } },
+		{ { 0, 0, 0 }, { 0, 0, 1 }, { 0, 1, 1 }, { 0, 1, 0 } },
+		{ { 0, 1, 0 }, { 0, 1, 1 }, { 1, 1, 1 }, { 1, 1, 0 } },
+		{ { 0, 0, 0 }, { 1, 0, 0 }, { 1, 0, 1 }, { 0, 0, 1 } },
+		{ { 0, 0, 1 }, { 1, 0, 1 }, { 1, 1, 1 }, { 0, 1, 1 } },
+		{ { 0, 0, 0 }, { 0, 1, 0 }, { 1, 1, 0 }, { 1, 0, 0 } }
+	};
+
+	static const int8_t FACE_NORMALS[6][3] = {
+		{ 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+	};
+
+	/**
+	* Calls face(voxel, faceIndex) for every voxel face which is not covered by a neighbour.
+	* The grid is scratch memory, reused between calls. Models above 256 voxels per axis are rejected, which also
+	* keeps the grid at 16 MiB.
+	*/
+	template <typename FACE>
+	static void forEachFace(const Model &model, std::vector<uint8_t> &grid, FACE face) {
+		if (model.sizeX > 256 || model.sizeY > 256 || model.sizeZ > 256) {
+			throw VoxReader::Exception("Model size exceeds 256 voxels per axis");
+		}
+		const size_t sx = model.sizeX, sy = model.sizeY, sz = model.sizeZ;
+		grid.assign(sx * sy * sz, 0);
+
+		auto inside = [&](const Voxel &v) {
+			return v.x < sx && v.y < sy && v.z < sz;
+		};
+
+		for (const auto &v : model.voxels) {
+			if (inside(v)) {
+				grid[(v.z * sy + v.y) * sx + v.x] = v.colorIndex;
+			}
+		}
+
+		auto filled = [&](size_t x, size_t y, size_t z) {
+			return x < sx && y < sy && z < sz && grid[(z * sy + y) * sx + x] != 0;
+		};
+
+		for (const auto &v : model.voxels) {
+			if (!inside(v) || v.colorIndex == 0) continue;
+			if (!filled(v.x + 1, v.y, v.z)) face(v, 0);
+			if (v.x == 0 || !filled(v.x - 1, v.y, v.z)) face(v, 1);
+			if (!filled(v.x, v.y + 1, v.z)) face(v, 2);
+			if (v.y == 0 || !filled(v.x, v.y - 1, v.z)) face(v, 3);
+			if (!filled(v.x, v.y, v.z + 1)) face(v, 4);
+			if (v.z == 0 || !filled(v.x, v.y, v.z - 1)) face(v, 5);
+		}
+	}
+
+	/**
+	* Maps model corners to world space: world[row] = offset[row] + sign[row] * corner[axis[row]].
+	* This matches VoxWorld::merge, the model center (size / 2) lands on the voxel boundary used by Magica Voxel.
+	*/
+	struct CornerTransform {
+		int axis[3];
+		float sign[3];
+		float offset[3];
+		bool mirrored; // negative determinant, the face winding has to be reversed
+
+		CornerTransform(const Model &model, const SceneGraph::Transform &transform) {
+			const uint32_t size[3] = { model.sizeX, model.sizeY, model.sizeZ };
+			int flips = 0;
+			for (int row = 0; row < 3; row++) {
+				axis[row] = 0;
+				while (axis[row] < 2 && transform.rotation[row][axis[row]] == 0) axis[row]++;
+				sign[row] = transform.rotation[row][axis[row]];
+				uint32_t extent = size[axis[row]];
+				offset[row] = transform.translation[row] + (extent % 2 ? 0.5f : 0.0f) - sign[row] * (extent / 2.0f);
+				if (sign[row] < 0) flips++;
+			}
+			// Permutations with an odd number of swaps mirror as well:
+			bool oddPermutation = (axis[0] == 1 && axis[1] == 0) || (axis[0] == 2 && axis[2] == 0) || (axis[1] == 2 && axis[2] == 1);
+			mirrored = ((flips % 2) == 1) != oddPermutation;
+		}
+	};
+
+	/**
+	* Face count and voxel bounds of a model, from the counting pass.
+	*/
+	struct VoxExport::MeshInfo {
+		uint64_t faces = 0;
+		uint32_t min[3] = { 0, 0, 0 };
+		uint32_t max[3] = { 0, 0, 0 }; // exclusive
+	};
+
+	//////////////////////////////////////////////////////////////////////////////
+	// VOX-EXPORT
+	//////////////////////////////////////////////////////////////////////////////
+
+	VoxExport::VoxExport(const VoxReader &vox) : vox(vox) {}
+
+	std::vector<VoxExport::MeshInfo> VoxExport::countFaces() const {
+		std::vector<MeshInfo> infos(vox.models.size());
+		std::vector<uint8_t> grid;
+
+		for (size_t m = 0; m < vox.models.size(); m++) {
+			MeshInfo &info = infos[m];
+			bool first = true;
+			forEachFace(vox.models[m], grid, [&](const Voxel &v, int) {
+				const uint32_t position[3] = { v.x, v.y, v.z };
+				for (int i = 0; i < 3; i++) {
+					if (first || position[i] < info.min[i]) info.min[i] = position[i];
+					if (first || position[i] + 1 > info.max[i]) info.max[i] = position[i] + 1;
+				}
+				first = false;
+				info.faces++;
+			});
+		}
+		return infos;
+	}
+
+	static std::string jsonFloat(float value) {
+		char text[32];
+		snprintf(text, sizeof(text), "%.9g", value);
+		return text;
+	}
+
+	void VoxExport::saveGltf(std::ostream &s) const {
+
+		if (!s) {
+			throw VoxReader::Exception("Cannot write to stream");
+		}
+
+		static const uint32_t VERTEX_STRIDE = 12 + 12 + 4; // position, normal, color
+		static const uint32_t GLB_JSON = 0x4E4F534A, GLB_BIN = 0x004E4942;
+
+		const std::vector<MeshInfo> infos = countFaces();
+		const std::vector<SceneGraph::Instance> instances = visibleInstances(vox);
+
+		// Layout of the binary chunk: per non-empty model its vertices followed by its indices
+		std::vector<int32_t> meshIndex(vox.models.size(), -1);
+		std::vector<uint64_t> vertexOffsets(vox.models.size(), 0);
+		uint64_t binSize = 0;
+		int32_t meshCount = 0;
+		for (size_t m = 0; m < vox.models.size(); m++) {
+			if (infos[m].faces == 0) continue;
+			meshIndex[m] = meshCount++;
+			vertexOffsets[m] = binSize;
+			binSize += infos[m].faces * 4 * VERTEX_STRIDE + infos[m].faces * 6 * 4;
+		}
+		if (binSize > UINT32_MAX) {
+			throw VoxReader::Exception("glTF binary chunk exceeds 4 GiB");
+		}
+
+		// JSON, its size only depends on the number of models and instances:
+		std::string nodes = "{\"rotation\":[-0.707106781,0,0,0.707106781],\"children\":[";
+		std::string children, instanceNodes;
+		uint32_t nodeCount = 1;
+		for (const auto &instance : instances) {
+			int32_t mesh = meshIndex[instance.modelId];
+			if (mesh < 0) continue;
+
+			CornerTransform corner(vox.models[instance.modelId], instance.transform);
+			const Model &model = vox.models[instance.modelId];
+			const float half[3] = { model.sizeX / 2.0f, model.sizeY / 2.0f, model.sizeZ / 2.0f };
+
+			// Mesh vertices are centered (corner - size / 2), the node carries rotation and translation:
+			float translation[3];
+			for (int row = 0; row < 3; row++) {
+				translation[row] = corner.offset[row] + corner.sign[row] * half[corner.axis[row]];
+			}
+
+			if (!children.empty()) children += ',';
+			children += std::to_string(nodeCount++);
+
+			instanceNodes += ",{\"mesh\":" + std::to_string(mesh) + ",\"matrix\":[";
+			for (int column = 0; column < 4; column++) {
+				for (int row = 0; row < 4; row++) {
+					float value;
+					if (column < 3) value = row < 3 ? instance.transform.rotation[row][column] : 0.0f;
+					else value = row < 3 ? translation[row] : 1.0f;
+					instanceNodes += jsonFloat(value);
+					if (column != 3 || row != 3) instanceNodes += ',';
+				}
+			}
+			instanceNodes += "]}";
+		}
+		nodes += children + "]}" + instanceNodes;
+
+		std::string meshes, accessors, bufferViews;
+		for (size_t m = 0; m < vox.models.size(); m++) {
+			if (meshIndex[m] < 0) continue;
+			const MeshInfo &info = infos[m];
+			const Model &model = vox.models[m];
+			const float half[3] = { model.sizeX / 2.0f, model.sizeY / 2.0f, model.sizeZ / 2.0f };
+			std::string view = std::to_string(2 * meshIndex[m]);
+			std::string indexView = std::to_string(2 * meshIndex[m] + 1);
+			std::string accessor = std::to_string(4 * meshIndex[m]);
+			std::string vertexCount = std::to_string(info.faces * 4);
+
+			if (!meshes.empty()) {
+				meshes += ',';
+				accessors += ',';
+				bufferViews += ',';
+			}
+
+			meshes += "{\"primitives\":[{\"attributes\":{\"POSITION\":" + accessor +
+				",\"NORMAL\":" + std::to_string(4 * meshIndex[m] + 1) +
+				",\"COLOR_0\":" + std::to_string(4 * meshIndex[m] + 2) +
+				"},\"indices\":" + std::to_string(4 * meshIndex[m] + 3) + ",\"mode\":4}]}";
+
+			accessors += "{\"bufferView\":" + view + ",\"byteOffset\":0,\"componentType\":5126,\"count\":" + vertexCount + ",\"type\":\"VEC3\",\"min\":[" +
+				jsonFloat(info.min[0] - half[0]) + ',' + jsonFloat(info.min[1] - half[1]) + ',' + jsonFloat(info.min[2] - half[2]) + "],\"max\":[" +
+				jsonFloat(info.max[0] - half[0]) + ',' + jsonFloat(info.max[1] - half[1]) + ',' + jsonFloat(info.max[2] - half[2]) + "]},";
+			accessors += "{\"bufferView\":" + view + ",\"byteOffset\":12,\"componentType\":5126,\"count\":" + vertexCount + ",\"type\":\"VEC3\"},";
+			accessors += "{\"bufferView\":" + view + ",\"byteOffset\":24,\"componentType\":5121,\"normalized\":true,\"count\":" + vertexCount + ",\"type\":\"VEC4\"},";
+			accessors += "{\"bufferView\":" + indexView + ",\"componentType\":5125,\"count\":" + std::to_string(info.faces * 6) + ",\"type\":\"SCALAR\"}";
+
+			uint64_t vertexBytes = info.faces * 4 * VERTEX_STRIDE;
+			bufferViews += "{\"buffer\":0,\"byteOffset\":" + std::to_string(vertexOffsets[m]) + ",\"byteLength\":" + std::to_string(vertexBytes) +
+				",\"byteStride\":" + std::to_string(VERTEX_STRIDE) + ",\"target\":34962},";
+			bufferViews += "{\"buffer\":0,\"byteOffset\":" + std::to_string(vertexOffsets[m] + vertexBytes) + ",\"byteLength\":" + std::to_string(info.faces * 6 * 4) +
+				",\"target\":34963}";
+		}
+
+		std::string json = "{\"asset\":{\"version\":\"2.0\",\"generator\":\"VoxReader\"},\"scene\":0,\"scenes\":[{\"nodes\":[0]}],\"nodes\":[" + nodes + "]";
+		if (meshCount > 0) {
+			json += ",\"meshes\":[" + meshes + "],\"accessors\":[" + accessors + "],\"bufferViews\":[" + bufferViews + "],\"buffers\":[{\"byteLength\":" + std::to_string(binSize) + "}]";
+		}
+		json += '}';
+		while (json.size() % 4 != 0) {
+			json += ' ';
+		}
+
+		Output out(s);
+
+		// Header and JSON chunk:
+		out.value<uint32_t>(0x46546C67); // "glTF"
+		out.value<uint32_t>(2);
+		out.value<uint32_t>((uint32_t)(12 + 8 + json.size() + (meshCount > 0 ? 8 + binSize : 0)));
+		out.value<uint32_t>((uint32_t)json.size());
+		out.value<uint32_t>(GLB_JSON);
+		out.text(json);
+
+		// Binary chunk, streamed model by model:
+		if (meshCount > 0) {
+			out.value<uint32_t>((uint32_t)binSize);
+			out.value<uint32_t>(GLB_BIN);
+
+			std::vector<uint8_t> grid;
+			for (size_t m = 0; m < vox.models.size(); m++) {
+				if (meshIndex[m] < 0) continue;
+				const Model &model = vox.models[m];
+				const float half[3] = { model.sizeX / 2.0f, model.sizeY / 2.0f, model.sizeZ / 2.0f };
+
+				forEachFace(model, grid, [&](const Voxel &v, int face) {
+					RGBA color = vox.getColor(v.colorIndex);
+					const uint8_t position[3] = { v.x, v.y, v.z };
+					for (int c = 0; c < 4; c++) {
+						float vertex[6];
+						for (int i = 0; i < 3; i++) {
+							vertex[i] = position[i] + FACE_CORNERS[face][c][i] - half[i];
+							vertex[3 + i] = FACE_NORMALS[face][i];
+						}
+						out.bytes(vertex, sizeof(vertex));
+						out.value(color);
+					}
+				});
+
+				uint32_t faces = (uint32_t)infos[m].faces;
+				for (uint32_t f = 0; f < faces; f++) {
+					const uint32_t index[6] = { 4 * f, 4 * f + 1, 4 * f + 2, 4 * f, 4 * f + 2, 4 * f + 3 };
+					out.bytes(index, sizeof(index));
+				}
+			}
+		}
+
+		out.flush();
+		if (!s) {
+			throw VoxReader::Exception("Writing to stream failed");
+		}
+	}
+
+	void VoxExport::saveObj(std::ostream &s) const {
+
+		if (!s) {
+			throw VoxReader::Exception("Cannot write to stream");
+		}
+
+		// Color suffix of the vertex lines, formatted once per color index:
+		std::vector<std::string> colors(256);
+		for (int i = 1; i < 256; i++) {
+			RGBA color = vox.getColor((uint8_t)i);
+			char text[32];
+			snprintf(text, sizeof(text), " %.4f %.4f %.4f\n", color.r / 255.0f, color.g / 255.0f, color.b / 255.0f);
+			colors[i] = text;
+		}
+
+		const std::vector<MeshInfo> infos = countFaces();
+		const std::vector<SceneGraph::Instance> instances = visibleInstances(vox);
+
+		uint64_t faces = 0;
+		for (const auto &instance : instances) {
+			faces += infos[instance.modelId].faces;
+		}
+		if (faces * 4 > UINT32_MAX) {
+			throw VoxReader::Exception("Too many vertices for 32-bit indices");
+		}
+
+		Output out(s);
+		out.text("# VoxReader\n");
+
+		std::vector<uint8_t> grid;
+		uint32_t vertexCount = 0;
+		for (const auto &instance : instances) {
+			const Model &model = vox.models[instance.modelId];
+			CornerTransform transform(model, instance.transform);
+
+			forEachFace(model, grid, [&](const Voxel &v, int face) {
+				const uint8_t position[3] = { v.x, v.y, v.z };
+				for (int c = 0; c < 4; c++) {
+					int corner = transform.mirrored ? 3 - c : c;
+					out.text("v");
+					for (int row = 0; row < 3; row++) {
+						int axis = transform.axis[row];
+						out.text(" ");
+						out.half(transform.offset[row] + transform.sign[row] * (position[axis] + FACE_CORNERS[face][corner][axis]));
+					}
+					out.text(colors[v.colorIndex]);
+				}
+				out.text("f ");
+				out.number(vertexCount + 1);
+				out.text(" ");
+				out.number(vertexCount + 2);
+				out.text(" ");
+				out.number(vertexCount + 3);
+				out.text(" ");
+				out.number(vertexCount + 4);
+				out.text("\n");
+				vertexCount += 4;
+			});
+		}
+
+		out.flush();
+		if (!s) {
+			throw VoxReader::Exception("Writing to stream failed");
+		}
+	}
+
+	void VoxExport::savePly(std::ostream &s) const {
+
+		if (!s) {
+			throw VoxReader::Exception("Cannot write to stream");
+		}
+
+		const std::vector<MeshInfo> infos = countFaces();
+		const std::vector<SceneGraph::Instance> instances = visibleInstances(vox);
+
+		uint64_t faces = 0;
+		for (const auto &instance : instances) {
+			faces += infos[instance.modelId].faces;
+		}
+		if (faces * 4 > UINT32_MAX) {
+			throw VoxReader::Exception("Too many vertices for 32-bit indices");
+		}
+
+		Output out(s);
+		out.text("ply\nformat binary_little_endian 1.0\ncomment VoxReader\n"
+			"element vertex " + std::to_string(faces * 4) + "\n"
+			"property float x\nproperty float y\nproperty float z\n"
+			"property uchar red\nproperty uchar green\nproperty uchar blue\nproperty uchar alpha\n"
+			"element face " + std::to_string(faces) + "\n"
+			"property list uchar uint vertex_indices\nend_header\n");
+
+		// All vertices first, then the faces (they only depend on the face count):
+		std::vector<uint8_t> grid;
+		for (const auto &instance : instances) {
+			const Model &model = vox.models[instance.modelId];
+			CornerTransform transform(model, instance.transform);
+
+			forEachFace(model, grid, [&](const Voxel &v, int face) {
+				RGBA color = vox.getColor(v.colorIndex);
+				const uint8_t position[3] = { v.x, v.y, v.z };
+				for (int c = 0; c < 4; c++) {
+					int corner = transform.mirrored ? 3 - c : c;
+					float vertex[3];
+					for (int row = 0; row < 3; row++) {
+						int axis = transform.axis[row];
+						vertex[row] = transform.offset[row] + transform.sign[row] * (position[axis] + FACE_CORNERS[face][corner][axis]);
+					}
+					out.bytes(vertex, sizeof(vertex));
+					out.value(color);
+				}
+			});
+		}
+
+		for (uint64_t f = 0; f < faces; f++) {
+			const uint32_t index[4] = { (uint32_t)(4 * f), (uint32_t)(4 * f + 1), (uint32_t)(4 * f + 2), (uint32_t)(4 * f + 3) };
+			out.value<uint8_t>(4);
+			out.bytes(index, sizeof(index));
+		}
+
+		out.flush();
+		if (!s) {
+			throw VoxReader::Exception("Writing to stream failed");
+		}
+	}
+
+	void VoxExport::savePoints(std::ostream &s, const VoxWorld &world) const {
+
+		if (!s) {
+			throw VoxReader::Exception("Cannot write to stream");
+		}
+
+		Output out(s);
+		out.text("ply\nformat binary_little_endian 1.0\ncomment VoxReader\n"
+			"element vertex " + std::to_string(world.voxels.size()) + "\n"
+			"property float x\nproperty float y\nproperty float z\n"
+			"property uchar red\nproperty uchar green\nproperty uchar blue\nproperty uchar alpha\nend_header\n");
+
+		RGBA colors[256];
+		for (int i = 0; i < 256; i++) {
+			colors[i] = vox.getColor((uint8_t)i);
+		}
+
+		for (const auto &voxel : world.voxels) {
+			const float point[3] = { voxel.x + 0.5f, voxel.y + 0.5f, voxel.z + 0.5f };
+			out.bytes(point, sizeof(point));
+			out.value(colors[voxel.colorIndex]);
+		}
+
+		out.flush();
+		if (!s) {
+			throw VoxReader::Exception("Writing to stream failed");
+		}
+	}
+
+} // namespace jim
+
+#endif
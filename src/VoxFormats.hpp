@@ -0,0 +1,637 @@
+#pragma once
+
+#include "VoxReader.hpp"
+#include "VoxWorld.hpp"
+
+#include <istream>
+#include <ostream>
+
+namespace jim {
+
+	/**
+	 * Readers and writers for other voxel formats, mapped onto models, voxels and palette of a VoxReader.
+	 * Like VoxReader::load, the readers parse in place from memory; stream overloads read the stream first.
+	 * Every reader discards the objects currently hold by the given VoxReader.
+	 *
+	 *	Format          | Read                                    | Write
+	 *	----------------|-----------------------------------------|-----------------------------------------------
+	 *	Qubicle (.qb)   | one model per matrix, colors quantized  | one RLE compressed matrix per visible instance
+	 *	                | into a palette                          |
+	 *	binvox          | one color index, split into 256^3 tiles | occupancy of the merged scene
+	 *	raw             | dense color indices, x fastest          | dense color indices of the merged scene
+	*/
+	class VoxFormats {
+	public:
+
+		/**
+		 * Read a Qubicle binary file (.qb). Matrices must not exceed 256 voxels per axis.
+		 * Every matrix becomes a model placed by its own transform node named after the matrix.
+		 * If there are more than 255 colors, the most frequent ones are kept and the others mapped to the nearest.
+		*/
+		static void loadQubicle(VoxReader &vox, const uint8_t *data, size_t size);
+		static void loadQubicle(VoxReader &vox, std::istream &s);
+
+		/**
+		 * Write a Qubicle binary file (.qb), one compressed matrix per visible instance in world space.
+		*/
+		static void saveQubicle(const VoxReader &vox, std::ostream &s);
+
+		/**
+		 * Read a binvox file. All voxels get the given color index, volumes above 256^3 are split into multiple models.
+		*/
+		static void loadBinvox(VoxReader &vox, const uint8_t *data, size_t size, uint8_t colorIndex = 1, unsigned threads = 0);
+		static void loadBinvox(VoxReader &vox, std::istream &s, uint8_t colorIndex = 1, unsigned threads = 0);
+
+		/**
+		 * Write the occupancy of all visible instances as binvox file. The run length encoding is produced from the
+		 * sorted voxels, so memory use is independent of the volume. The cubic volume is limited to 2^21 per axis.
+		*/
+		static void saveBinvox(const VoxReader &vox, std::ostream &s);
+
+		/**
+		 * Read a dense volume of color indices (0 = empty), x running fastest, then y, then z.
+		 * Volumes above 256^3 are split into multiple models.
+		 * @param[in] size Bytes of data, the volume must not exceed it.
+		*/
+		static void loadRaw(VoxReader &vox, const uint8_t *data, size_t size, uint32_t sizeX, uint32_t sizeY, uint32_t sizeZ, unsigned threads = 0);
+
+		/**
+		 * Write all visible instances as dense volume of color indices, x running fastest, then y, then z.
+		 * The volume is built in memory and limited to RAW_MAX_VOLUME bytes.
+		 * @param[out] origin World position of the first voxel.
+		 * @param[out] size   Size of the written volume.
+		*/
+		static void saveRaw(const VoxReader &vox, std::ostream &s, int32_t origin[3], uint32_t size[3]);
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// CONVERSION UTILITIES
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* Bounds checked reading from memory.
+	*/
+	class FormatCursor {
+	public:
+		FormatCursor(const uint8_t *data, size_t size, const char *format) : ptr(data), end(data + size), format(format) {}
+
+		void need(size_t size) const {
+			if ((size_t)(end - ptr) < size) {
+				throw VoxReader::Exception(std::string(format) + ": unexpected end of data");
+			}
+		}
+
+		uint32_t u32() {
+			need(4);
+			uint32_t value = (uint32_t)readInt(ptr);
+			ptr += 4;
+			return value;
+		}
+
+		uint8_t u8() {
+			need(1);
+			return *ptr++;
+		}
+
+		const uint8_t *bytes(size_t size) {
+			need(size);
+			const uint8_t *bytes = ptr;
+			ptr += size;
+			return bytes;
+		}
+
+		bool atEnd() const {
+			return ptr == end;
+		}
+
+		std::string line() {
+			const uint8_t *start = ptr;
+			while (ptr < end && *ptr != '\n') ptr++;
+			std::string text(start, ptr);
+			if (ptr < end) ptr++;
+			if (!text.empty() && text.back() == '\r') text.pop_back();
+			return text;
+		}
+
+	private:
+		const uint8_t *ptr, *end;
+		const char *format;
+	};
+
+	/**
+	* Builds a palette for true color voxels: up to 255 colors are kept exactly, beyond that the most frequent
+	* colors are kept and all others mapped to the nearest kept color.
+	*/
+	class PaletteBuilder {
+	public:
+		void add(uint32_t color) {
+			counts[color & 0x00FFFFFF]++;
+		}
+
+		/**
+		* Choose the palette and store it in the reader. Returns the color index for every added color.
+		*/
+		std::unordered_map<uint32_t, uint8_t> build(VoxReader &vox) {
+			std::vector<std::pair<uint32_t, uint64_t>> colors(counts.begin(), counts.end());
+			std::sort(colors.begin(), colors.end(), [](const std::pair<uint32_t, uint64_t> &a, const std::pair<uint32_t, uint64_t> &b) {
+				return a.second != b.second ? a.second > b.second : a.first < b.first;
+			});
+
+			size_t kept = std::min<size_t>(colors.size(), 255);
+			std::vector<RGBA> *palette = new std::vector<RGBA>(256);
+			std::unordered_map<uint32_t, uint8_t> indices;
+			for (size_t i = 0; i < kept; i++) {
+				uint32_t c = colors[i].first;
+				(*palette)[i] = RGBA(255, (uint8_t)c, (uint8_t)(c >> 8), (uint8_t)(c >> 16));
+				indices[c] = (uint8_t)(i + 1);
+			}
+
+			for (size_t i = kept; i < colors.size(); i++) {
+				uint32_t c = colors[i].first;
+				int best = 0;
+				int64_t bestDistance = INT64_MAX;
+				for (size_t k = 0; k < kept; k++) {
+					const RGBA &p = (*palette)[k];
+					int64_t dr = (int)p.r - (int)(c & 0xFF), dg = (int)p.g - (int)((c >> 8) & 0xFF), db = (int)p.b - (int)((c >> 16) & 0xFF);
+					int64_t distance = dr * dr + dg * dg + db * db;
+					if (distance < bestDistance) {
+						bestDistance = distance;
+						best = (int)k;
+					}
+				}
+				indices[c] = (uint8_t)(best + 1);
+			}
+
+			if (vox.palette != &VoxReader::DEFAULT_PALETTE) {
+				delete vox.palette;
+			}
+			vox.palette = palette;
+			return indices;
+		}
+
+	private:
+		std::unordered_map<uint32_t, uint64_t> counts; // 0x00BBGGRR
+	};
+
+	/**
+	* Model bounds and voxels of every visible instance in world space.
+	*/
+	struct PlacedInstance {
+		int32_t min[3], max[3]; // inclusive
+		std::vector<WorldVoxel> voxels;
+	};
+
+	static std::vector<PlacedInstance> placeInstances(const VoxReader &vox) {
+		std::vector<PlacedInstance> placed;
+		for (const auto &instance : visibleInstances(vox)) {
+			const Model &model = vox.models[instance.modelId];
+			if (model.voxels.empty()) continue;
+
+			PlacedInstance p;
+			p.voxels.resize(model.voxels.size());
+			transformVoxels(model, instance.transform, p.voxels.data());
+			for (int i = 0; i < 3; i++) {
+				p.min[i] = INT32_MAX;
+				p.max[i] = INT32_MIN;
+			}
+			for (const auto &v : p.voxels) {
+				const int32_t position[3] = { v.x, v.y, v.z };
+				for (int i = 0; i < 3; i++) {
+					p.min[i] = std::min(p.min[i], position[i]);
+					p.max[i] = std::max(p.max[i], position[i]);
+				}
+			}
+			placed.push_back(std::move(p));
+		}
+		return placed;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// QUBICLE
+	//////////////////////////////////////////////////////////////////////////////
+
+	static const uint32_t QB_CODEFLAG = 2;
+	static const uint32_t QB_NEXTSLICEFLAG = 6;
+
+	// Largest dense volume saveRaw builds in memory, in bytes:
+	static const uint64_t RAW_MAX_VOLUME = 1ull << 32;
+
+	// Qubicle is Y-up: qb (x, y, z) corresponds to vox (x, z, y)
+
+	void VoxFormats::loadQubicle(VoxReader &vox, const uint8_t *data, size_t size) {
+		vox.clear();
+
+		FormatCursor in(data, size, "Qubicle");
+		in.u32(); // version
+		uint32_t colorFormat = in.u32();
+		uint32_t zAxisOrientation = in.u32();
+		uint32_t compressed = in.u32();
+		in.u32(); // visibility mask encoded, any non-zero alpha is solid
+		uint32_t matrixCount = in.u32();
+
+		struct Matrix {
+			std::string name;
+			uint32_t size[3];
+			int32_t position[3];
+			std::vector<uint32_t> colors; // x + y * sizeX + z * sizeX * sizeY, in qb axes
+		};
+		std::vector<Matrix> matrices;
+
+		PaletteBuilder paletteBuilder;
+
+		for (uint32_t m = 0; m < matrixCount; m++) {
+			Matrix matrix;
+			uint8_t nameLength = in.u8();
+			const uint8_t *name = in.bytes(nameLength);
+			matrix.name.assign(name, name + nameLength);
+			for (int i = 0; i < 3; i++) matrix.size[i] = in.u32();
+			for (int i = 0; i < 3; i++) matrix.position[i] = (int32_t)in.u32();
+
+			if (matrix.size[0] > 256 || matrix.size[1] > 256 || matrix.size[2] > 256) {
+				throw VoxReader::Exception("Qubicle matrix '" + matrix.name + "' exceeds 256 voxels per axis");
+			}
+
+			const size_t sliceSize = (size_t)matrix.size[0] * matrix.size[1];
+			matrix.colors.assign(sliceSize * matrix.size[2], 0);
+
+			if (!compressed) {
+				const uint8_t *colors = in.bytes(4 * matrix.colors.size());
+				memcpy(matrix.colors.data(), colors, 4 * matrix.colors.size());
+			}
+			else {
+				for (uint32_t z = 0; z < matrix.size[2]; z++) {
+					uint32_t *slice = matrix.colors.data() + z * sliceSize;
+					size_t index = 0;
+					for (;;) {
+						uint32_t value = in.u32();
+						if (value == QB_NEXTSLICEFLAG) break;
+						uint32_t count = 1;
+						if (value == QB_CODEFLAG) {
+							count = in.u32();
+							value = in.u32();
+						}
+						if (count > sliceSize - index) {
+							throw VoxReader::Exception("Qubicle: run exceeds the matrix slice");
+						}
+						std::fill(slice + index, slice + index + count, value);
+						index += count;
+					}
+				}
+			}
+
+			// Normalize to 0x00BBGGRR, solid voxels have a non-zero alpha:
+			for (auto &color : matrix.colors) {
+				if ((color >> 24) == 0) {
+					color = 0;
+					continue;
+				}
+				if (colorFormat == 1) {
+					color = (color & 0xFF00FF00) | ((color >> 16) & 0xFF) | ((color & 0xFF) << 16);
+				}
+				paletteBuilder.add(color);
+				color |= 0xFF000000;
+			}
+
+			matrices.push_back(std::move(matrix));
+		}
+
+		std::unordered_map<uint32_t, uint8_t> indices = paletteBuilder.build(vox);
+
+		// Scene graph: T -> G -> (T -> S) per matrix
+		SceneGraph &scene = vox.sceneGraph;
+		auto &root = scene.AddTransformNode(0);
+		root.childNodeId = 1;
+		root.layerId = -1;
+		root.frame_attributes.resize(1);
+		auto &group = scene.AddGroupNode(1);
+
+		for (size_t m = 0; m < matrices.size(); m++) {
+			const Matrix &matrix = matrices[m];
+			const uint32_t sx = matrix.size[0], sy = matrix.size[1], sz = matrix.size[2];
+			bool rightHanded = zAxisOrientation == 1;
+
+			Model model(sx, sz, sy);
+			for (uint32_t z = 0; z < sz; z++) {
+				for (uint32_t y = 0; y < sy; y++) {
+					const uint32_t *row = matrix.colors.data() + ((size_t)z * sy + y) * sx;
+					for (uint32_t x = 0; x < sx; x++) {
+						if (row[x] == 0) continue;
+						uint8_t modelY = (uint8_t)(rightHanded ? sz - 1 - z : z);
+						model.voxels.push_back(Voxel((uint8_t)x, modelY, (uint8_t)y, indices[row[x] & 0x00FFFFFF]));
+					}
+				}
+			}
+
+			int32_t positionY = rightHanded ? -(matrix.position[2] + (int32_t)sz) : matrix.position[2];
+			SceneGraph::NodeId transformId = (SceneGraph::NodeId)(2 + 2 * m);
+			auto &transform = scene.AddTransformNode(transformId);
+			transform.childNodeId = transformId + 1;
+			transform.layerId = 0;
+			transform.attributes.emplace_back("_name", matrix.name);
+			transform.frame_attributes.resize(1);
+			transform.frame_attributes[0].emplace_back("_t",
+				std::to_string(matrix.position[0] + (int32_t)(model.sizeX / 2)) + ' ' +
+				std::to_string(positionY + (int32_t)(model.sizeY / 2)) + ' ' +
+				std::to_string(matrix.position[1] + (int32_t)(model.sizeZ / 2)));
+
+			auto &shape = scene.AddShapeNode(transformId + 1);
+			shape.models.resize(1);
+			shape.models[0].modelId = (uint32_t)vox.models.size();
+			group.childNodeIds.push_back(transformId);
+
+			vox.models.push_back(std::move(model));
+		}
+
+		vox.layers.resize(1);
+	}
+
+	void VoxFormats::loadQubicle(VoxReader &vox, std::istream &s) {
+		std::vector<uint8_t> data = VoxReader::readStream(s);
+		loadQubicle(vox, data.data(), data.size());
+	}
+
+	void VoxFormats::saveQubicle(const VoxReader &vox, std::ostream &s) {
+		if (!s) {
+			throw VoxReader::Exception("Cannot write to stream");
+		}
+
+		std::vector<PlacedInstance> placed = placeInstances(vox);
+		std::vector<uint8_t> out;
+
+		auto u32 = [&](uint32_t value) {
+			const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&value);
+			out.insert(out.end(), bytes, bytes + 4);
+		};
+
+		u32(0x00000101); // version 1.1.0.0
+		u32(0);          // RGBA
+		u32(0);          // left handed
+		u32(1);          // compressed
+		u32(0);          // no visibility mask
+		u32((uint32_t)placed.size());
+
+		for (size_t m = 0; m < placed.size(); m++) {
+			const PlacedInstance &p = placed[m];
+			const uint32_t sx = (uint32_t)(p.max[0] - p.min[0] + 1);
+			const uint32_t sy = (uint32_t)(p.max[2] - p.min[2] + 1); // qb y = vox z
+			const uint32_t sz = (uint32_t)(p.max[1] - p.min[1] + 1); // qb z = vox y
+
+			std::string name = "instance" + std::to_string(m);
+			out.push_back((uint8_t)name.size());
+			out.insert(out.end(), name.begin(), name.end());
+			u32(sx); u32(sy); u32(sz);
+			u32((uint32_t)p.min[0]); u32((uint32_t)p.min[2]); u32((uint32_t)p.min[1]);
+
+			std::vector<uint32_t> colors((size_t)sx * sy * sz, 0);
+			for (const auto &v : p.voxels) {
+				RGBA color = vox.getColor(v.colorIndex);
+				size_t x = v.x - p.min[0], y = v.z - p.min[2], z = v.y - p.min[1];
+				colors[(z * sy + y) * sx + x] = color.r | (color.g << 8) | (color.b << 16) | 0xFF000000u;
+			}
+
+			// Run length encoded per z slice:
+			const size_t sliceSize = (size_t)sx * sy;
+			for (uint32_t z = 0; z < sz; z++) {
+				const uint32_t *slice = colors.data() + z * sliceSize;
+				for (size_t i = 0; i < sliceSize; ) {
+					size_t run = 1;
+					while (i + run < sliceSize && slice[i + run] == slice[i]) run++;
+					if (run > 2) {
+						u32(QB_CODEFLAG);
+						u32((uint32_t)run);
+						u32(slice[i]);
+					}
+					else {
+						for (size_t r = 0; r < run; r++) u32(slice[i]);
+					}
+					i += run;
+				}
+				u32(QB_NEXTSLICEFLAG);
+			}
+		}
+
+		s.write(reinterpret_cast<const char *>(out.data()), out.size());
+		if (!s) {
+			throw VoxReader::Exception("Writing to stream failed");
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// BINVOX
+	//////////////////////////////////////////////////////////////////////////////
+
+	// binvox is Y-up, y runs fastest, then z, then x: binvox (x, y, z) corresponds to vox (x, z, y)
+
+	void VoxFormats::loadBinvox(VoxReader &vox, const uint8_t *data, size_t size, uint8_t colorIndex, unsigned threads) {
+		vox.clear();
+
+		FormatCursor in(data, size, "binvox");
+		if (in.line().compare(0, 7, "#binvox") != 0) {
+			throw VoxReader::Exception("binvox: header is missing");
+		}
+
+		uint32_t depth = 0, height = 0, width = 0;
+		for (;;) {
+			std::string line = in.line();
+			if (line == "data") break;
+			if (line.compare(0, 4, "dim ") == 0) {
+				if (sscanf(line.c_str() + 4, "%u %u %u", &depth, &height, &width) != 3) {
+					throw VoxReader::Exception("binvox: invalid dimensions");
+				}
+			}
+			if (in.atEnd()) {
+				throw VoxReader::Exception("binvox: data is missing");
+			}
+		}
+
+		const uint64_t total = (uint64_t)depth * height * width;
+		VoxWorld world;
+		uint64_t index = 0;
+		while (index < total) {
+			uint8_t value = in.u8();
+			uint8_t count = in.u8();
+			if (count > total - index) {
+				throw VoxReader::Exception("binvox: run exceeds the volume");
+			}
+			if (value != 0) {
+				for (uint64_t i = index; i < index + count; i++) {
+					int32_t y = (int32_t)(i % width);
+					int32_t z = (int32_t)((i / width) % height);
+					int32_t x = (int32_t)(i / ((uint64_t)width * height));
+					world.voxels.push_back(WorldVoxel{ x, z, y, colorIndex });
+				}
+			}
+			index += count;
+		}
+
+		world.split(vox, threads);
+	}
+
+	void VoxFormats::loadBinvox(VoxReader &vox, std::istream &s, uint8_t colorIndex, unsigned threads) {
+		std::vector<uint8_t> data = VoxReader::readStream(s);
+		loadBinvox(vox, data.data(), data.size(), colorIndex, threads);
+	}
+
+	void VoxFormats::saveBinvox(const VoxReader &vox, std::ostream &s) {
+		if (!s) {
+			throw VoxReader::Exception("Cannot write to stream");
+		}
+
+		VoxWorld world;
+		world.merge(vox);
+
+		int32_t min[3] = { 0, 0, 0 }, max[3] = { -1, -1, -1 };
+		for (size_t i = 0; i < world.voxels.size(); i++) {
+			const WorldVoxel &v = world.voxels[i];
+			const int32_t position[3] = { v.x, v.y, v.z };
+			for (int k = 0; k < 3; k++) {
+				if (i == 0 || position[k] < min[k]) min[k] = position[k];
+				if (i == 0 || position[k] > max[k]) max[k] = position[k];
+			}
+		}
+
+		// Cubic grid, as expected by most binvox tools. Its cube must fit 64 bits:
+		int64_t extent = 1;
+		for (int k = 0; k < 3; k++) {
+			extent = std::max(extent, (int64_t)max[k] - min[k] + 1);
+		}
+		if (extent > (1 << 21)) {
+			throw VoxReader::Exception("binvox: volume exceeds 2^21 voxels per axis");
+		}
+		const uint64_t dim = (uint64_t)extent;
+
+		// Positions in binvox order, x slowest and y fastest:
+		std::vector<uint64_t> indices;
+		indices.reserve(world.voxels.size());
+		for (const auto &v : world.voxels) {
+			indices.push_back(((uint64_t)(v.x - min[0]) * dim + (uint64_t)(v.y - min[1])) * dim + (uint64_t)(v.z - min[2]));
+		}
+		std::sort(indices.begin(), indices.end());
+		indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+		std::string header = "#binvox 1\ndim " + std::to_string(dim) + ' ' + std::to_string(dim) + ' ' + std::to_string(dim) +
+			"\ntranslate " + std::to_string(min[0]) + ' ' + std::to_string(min[2]) + ' ' + std::to_string(min[1]) +
+			"\nscale " + std::to_string(dim) + "\ndata\n";
+
+		// Runs of at most 255 equal values, written in blocks:
+		static const size_t BLOCK_SIZE = 64 * 1024;
+		std::vector<uint8_t> out(header.begin(), header.end());
+		auto flush = [&]() {
+			s.write(reinterpret_cast<const char *>(out.data()), out.size());
+			out.clear();
+		};
+		auto run = [&](uint8_t value, uint64_t count) {
+			while (count > 0) {
+				const uint8_t length = (uint8_t)std::min<uint64_t>(count, 255);
+				out.push_back(value);
+				out.push_back(length);
+				count -= length;
+				if (out.size() >= BLOCK_SIZE) flush();
+			}
+		};
+		uint64_t position = 0;
+		for (size_t i = 0; i < indices.size(); ) {
+			size_t last = i;
+			while (last + 1 < indices.size() && indices[last + 1] == indices[last] + 1) last++;
+			run(0, indices[i] - position);
+			run(1, last - i + 1);
+			position = indices[last] + 1;
+			i = last + 1;
+		}
+		run(0, dim * dim * dim - position);
+		flush();
+
+		if (!s) {
+			throw VoxReader::Exception("Writing to stream failed");
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// RAW
+	//////////////////////////////////////////////////////////////////////////////
+
+	void VoxFormats::loadRaw(VoxReader &vox, const uint8_t *data, size_t size, uint32_t sizeX, uint32_t sizeY, uint32_t sizeZ, unsigned threads) {
+		vox.clear();
+
+		// The product of two sizes fits 64 bits, the third is checked by division:
+		const uint64_t sliceSize = (uint64_t)sizeX * sizeY;
+		if (sizeZ != 0 && sliceSize > (uint64_t)size / sizeZ) {
+			throw VoxReader::Exception("raw: volume exceeds the data");
+		}
+		if (sizeX > INT32_MAX || sizeY > INT32_MAX || sizeZ > INT32_MAX) {
+			throw VoxReader::Exception("raw: volume exceeds the coordinate range");
+		}
+
+		VoxWorld world;
+		const uint8_t *value = data;
+		for (uint32_t z = 0; z < sizeZ; z++) {
+			for (uint32_t y = 0; y < sizeY; y++) {
+				for (uint32_t x = 0; x < sizeX; x++, value++) {
+					if (*value != 0) {
+						world.voxels.push_back(WorldVoxel{ (int32_t)x, (int32_t)y, (int32_t)z, *value });
+					}
+				}
+			}
+		}
+
+		world.split(vox, threads);
+	}
+
+	void VoxFormats::saveRaw(const VoxReader &vox, std::ostream &s, int32_t origin[3], uint32_t size[3]) {
+		if (!s) {
+			throw VoxReader::Exception("Cannot write to stream");
+		}
+
+		VoxWorld world;
+		world.merge(vox);
+
+		int32_t max[3] = { -1, -1, -1 };
+		for (int k = 0; k < 3; k++) origin[k] = 0;
+		for (size_t i = 0; i < world.voxels.size(); i++) {
+			const WorldVoxel &v = world.voxels[i];
+			const int32_t position[3] = { v.x, v.y, v.z };
+			for (int k = 0; k < 3; k++) {
+				if (i == 0 || position[k] < origin[k]) origin[k] = position[k];
+				if (i == 0 || position[k] > max[k]) max[k] = position[k];
+			}
+		}
+		// Extents of up to 2^32 each, their product is checked step by step so it cannot overflow:
+		uint64_t extent[3], volumeSize = 1;
+		for (int k = 0; k < 3; k++) {
+			extent[k] = world.voxels.empty() ? 0 : (uint64_t)((int64_t)max[k] - origin[k] + 1);
+			if (extent[k] > UINT32_MAX || (extent[k] != 0 && volumeSize > RAW_MAX_VOLUME / extent[k])) {
+				throw VoxReader::Exception("raw: volume exceeds " + std::to_string(RAW_MAX_VOLUME) + " bytes");
+			}
+			volumeSize *= extent[k];
+			size[k] = (uint32_t)extent[k];
+		}
+		if (volumeSize > SIZE_MAX) {
+			throw VoxReader::Exception("raw: volume does not fit into memory");
+		}
+
+		std::vector<uint8_t> volume((size_t)volumeSize, 0);
+		for (const auto &v : world.voxels) {
+			const uint64_t x = (uint64_t)((int64_t)v.x - origin[0]), y = (uint64_t)((int64_t)v.y - origin[1]), z = (uint64_t)((int64_t)v.z - origin[2]);
+			volume[(size_t)((z * extent[1] + y) * extent[0] + x)] = v.colorIndex;
+		}
+
+		s.write(reinterpret_cast<const char *>(volume.data()), volume.size());
+		if (!s) {
+			throw VoxReader::Exception("Writing to stream failed");
+		}
+	}
+
+} // namespace jim
+
+#endif
@@ -0,0 +1,238 @@
+/**
+ * Fuzzing and differential testing of the decode paths.
+ *
+ * Every decode path must produce the same objects as VoxReader::load() from memory, which is the reference.
+ * Objects are compared by what VoxWriter makes of them, so anything that would be written differently counts.
+ * Compared paths: load from a stream, load from a mapped file, the compiled format in file and Morton order,
+ * an incremental reload into an empty reader, the file writer and, built as C++20, the asynchronous loader
+ * with io_uring and with threads. VoxInfo and VoxValidator must agree with the reference as well.
+ *
+ * Built with -DJIM_VOXFUZZ_LIBFUZZER and -fsanitize=fuzzer this is a libFuzzer target, e.g.
+ *     clang++ -std=c++17 -g -O1 -fsanitize=fuzzer,address,undefined -DJIM_VOXFUZZ_LIBFUZZER VoxFuzz.cpp -o VoxFuzz
+ *     ./VoxFuzz corpus/
+ * Otherwise it is the differential tester, run on the given files and directories (e.g. the fuzz corpus) or on
+ * the bundled samples:
+ *     VoxFuzz [file|directory]...
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#define JIM_VOXREADER_IMPLEMENTATION
+#include "VoxReader.hpp"
+#include "VoxWriter.hpp"
+#include "VoxCompiled.hpp"
+#include "VoxReload.hpp"
+#include "VoxInfo.hpp"
+#include "VoxValidate.hpp"
+#include "VoxAsync.hpp"
+#include "VoxTools.hpp"
+
+using namespace jim;
+
+/**
+ * Result of one decode path: the written vox-data, or the error if decoding failed.
+ */
+struct Decoded {
+	bool failed = false;
+	std::string error;
+	std::string bytes;
+};
+
+/**
+ * @param[in] anyOrder Sort the voxels of every model first, for paths which may reorder voxels.
+ */
+static std::string serialize(VoxReader &vox, bool anyOrder) {
+	if (anyOrder) {
+		for (Model &model : vox.models) {
+			std::sort(model.voxels.begin(), model.voxels.end(), [](const Voxel &a, const Voxel &b) {
+				return std::make_tuple(a.x, a.y, a.z, a.colorIndex) < std::make_tuple(b.x, b.y, b.z, b.colorIndex);
+			});
+		}
+	}
+	std::ostringstream s;
+	VoxWriter(vox).save(s);
+	return s.str();
+}
+
+template <typename DECODE>
+static Decoded decode(DECODE decode, bool anyOrder = false) {
+	Decoded result;
+	try {
+		VoxReader vox;
+		decode(vox);
+		result.bytes = serialize(vox, anyOrder);
+	}
+	catch (const VoxReader::Exception &e) {
+		result.failed = true;
+		result.error = e.what();
+	}
+	return result;
+}
+
+/**
+ * Compares all decode paths of the given vox-data, returns a description of every mismatch.
+ * @param[in] path File the data was read from or empty, used for the mapped file and the file writer.
+ */
+static std::vector<std::string> compare(const uint8_t *data, size_t size, const std::string &path) {
+	std::vector<std::string> mismatches;
+
+	Decoded reference = decode([&](VoxReader &vox) {
+		vox.load(data, size);
+	});
+
+	auto check = [&](const char *name, const Decoded &decoded, const Decoded &reference) {
+		if (decoded.failed != reference.failed) {
+			mismatches.push_back(std::string(name) + (decoded.failed ? " failed: " + decoded.error : " succeeded") +
+				", reference " + (reference.failed ? "failed: " + reference.error : "succeeded"));
+		}
+		else if (decoded.bytes != reference.bytes) {
+			mismatches.push_back(std::string(name) + " decoded different objects");
+		}
+	};
+
+	check("stream", decode([&](VoxReader &vox) {
+		std::istringstream s(std::string(reinterpret_cast<const char *>(data), size));
+		vox.load(s);
+	}), reference);
+
+	if (!path.empty()) {
+		check("mapped file", decode([&](VoxReader &vox) {
+			MappedFile file(path);
+			vox.load(file.data(), file.size());
+		}), reference);
+	}
+
+#ifdef JIM_VOXASYNC
+	if (!path.empty()) {
+		// Small blocks, so chunks are decoded while the rest of the file is still being read:
+		static VoxAsyncLoader ioUring(nullptr, 2, true), threads(nullptr, 2, false);
+		for (VoxAsyncLoader *loader : { &ioUring, &threads }) {
+			check(loader->usesIoUring() ? "async (io_uring)" : "async (threads)", decode([&](VoxReader &vox) {
+				loader->loadAsync(vox, path, 4096).wait();
+			}), reference);
+		}
+	}
+#endif
+
+	check("reload", decode([&](VoxReader &vox) {
+		std::vector<uint64_t> chunkHashes;
+		VoxReloader::reload(vox, chunkHashes, data, size);
+	}), reference);
+
+	if (reference.failed) {
+		// The other paths start from decoded objects, only the scanners can be checked:
+		if (VoxValidator::validate(data, size).empty()) {
+			mismatches.push_back("VoxValidator found no issues, reference failed: " + reference.error);
+		}
+		return mismatches;
+	}
+
+	VoxReader vox;
+	vox.load(data, size);
+
+	auto compiled = [&](VoxCompiledWriter::VoxelOrder order) {
+		return [&vox, order](VoxReader &compiled) {
+			std::ostringstream s;
+			VoxCompiledWriter::save(vox, s, order);
+			std::string bytes = s.str();
+			std::vector<uint64_t> aligned((bytes.size() + 7) / 8);
+			memcpy(aligned.data(), bytes.data(), bytes.size());
+			VoxCompiledReader(reinterpret_cast<const uint8_t *>(aligned.data()), bytes.size()).toReader(compiled);
+		};
+	};
+	// The compiled format stores the flattened scene graph and parsed transforms, which load() does not check:
+	if (VoxValidator::validate(data, size).empty()) {
+		check("compiled", decode(compiled(VoxCompiledWriter::FILE_ORDER)), reference);
+		check("compiled (Morton order)", decode(compiled(VoxCompiledWriter::MORTON), true), decode([&](VoxReader &sorted) {
+			sorted.load(data, size);
+		}, true));
+	}
+
+	if (!path.empty()) {
+		std::string written = path + ".fuzz-written";
+		Decoded saved;
+		try {
+			VoxWriter(vox).save(written);
+			MappedFile file(written);
+			saved.bytes.assign(reinterpret_cast<const char *>(file.data()), file.size());
+		}
+		catch (const VoxReader::Exception &e) {
+			saved.failed = true;
+			saved.error = e.what();
+		}
+		std::remove(written.c_str());
+		check("file writer", saved, reference);
+	}
+
+	try {
+		VoxInfo info = VoxInfo::scan(data, size);
+		uint64_t voxelCount = 0;
+		for (const Model &model : vox.models) {
+			voxelCount += model.voxels.size();
+		}
+		if (info.models.size() != vox.models.size() || info.voxelCount != voxelCount) {
+			mismatches.push_back("VoxInfo counted different models or voxels");
+		}
+	}
+	catch (const VoxReader::Exception &e) {
+		mismatches.push_back(std::string("VoxInfo failed: ") + e.what());
+	}
+
+	return mismatches;
+}
+
+#ifdef JIM_VOXFUZZ_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	std::vector<std::string> mismatches = compare(data, size, std::string());
+	for (const std::string &mismatch : mismatches) {
+		fprintf(stderr, "%s\n", mismatch.c_str());
+	}
+	if (!mismatches.empty()) {
+		abort();
+	}
+	return 0;
+}
+
+#else
+
+int main(int argc, char **argv) {
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; i++) {
+		collect(argv[i], files);
+	}
+	if (files.empty()) {
+		files = { "chr_knight.vox", "3x3x3_palette.vox", "nested_chunks.vox" };
+	}
+
+	size_t failed = 0;
+	for (const std::string &path : files) {
+		std::vector<std::string> mismatches;
+		try {
+			MappedFile file(path);
+			mismatches = compare(file.data(), file.size(), path);
+		}
+		catch (const VoxReader::Exception &e) {
+			mismatches.push_back(e.what());
+		}
+
+		for (const std::string &mismatch : mismatches) {
+			printf("%s: %s\n", path.c_str(), mismatch.c_str());
+		}
+		if (!mismatches.empty()) {
+			failed++;
+		}
+	}
+
+	printf("%zu of %zu files decoded equally by all paths\n", files.size() - failed, files.size());
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#endif
@@ -0,0 +1,304 @@
+/**
+ * Writes synthetic vox-files for benchmarks and scaling tests.
+ *
+ * The output only depends on the options (not on the platform or the number of threads), so a workload is
+ * reproduced by its command line, from a few kilobytes to gigabytes:
+ *     VoxGenerate [options] output.vox
+ *
+ *     --models=N       number of models (1)
+ *     --size=X[,Y,Z]   model size, at most 256 (64)
+ *     --density=D      fraction of solid voxels, 0 to 1 (0.5)
+ *     --pattern=P      random, noise, terrain or sphere (noise)
+ *     --depth=D        levels of groups above the shapes, at most 64 (1)
+ *     --width=W        children of groups above other groups, the models are split evenly among them (2)
+ *     --layers=N       layers, assigned round robin to the shapes (1)
+ *     --materials=N    materials for the first N colors (0)
+ *     --seed=S         seed of all random choices (1)
+ *     --threads=N      threads generating models, 0 = hardware concurrency (0)
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#define JIM_VOXREADER_IMPLEMENTATION
+#include "VoxReader.hpp"
+#include "VoxWriter.hpp"
+#include "VoxTools.hpp"
+
+using namespace jim;
+
+struct Options {
+	uint32_t models = 1;
+	uint32_t size[3] = { 64, 64, 64 };
+	double density = 0.5;
+	std::string pattern = "noise";
+	uint32_t depth = 1;
+	uint32_t width = 2;
+	uint32_t layers = 1;
+	uint32_t materials = 0;
+	uint64_t seed = 1;
+	unsigned threads = 0;
+	std::string path;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// RANDOM
+//////////////////////////////////////////////////////////////////////////////
+
+static double unit(uint64_t x) {
+	return (double)(mix(x) >> 11) / (double)(1ull << 53);
+}
+
+static uint64_t key(uint64_t seed, int64_t x, int64_t y, int64_t z) {
+	return mix(seed ^ mix((uint64_t)x ^ mix((uint64_t)y ^ mix((uint64_t)z))));
+}
+
+static double smooth(double t) {
+	return t * t * (3 - 2 * t);
+}
+
+/**
+ * Value noise in [0, 1) with lattice cells of the given size.
+ */
+static double noise(uint64_t seed, double x, double y, double z, double cell) {
+	x /= cell; y /= cell; z /= cell;
+	const int64_t x0 = (int64_t)std::floor(x), y0 = (int64_t)std::floor(y), z0 = (int64_t)std::floor(z);
+	const double fx = smooth(x - x0), fy = smooth(y - y0), fz = smooth(z - z0);
+	double value = 0;
+	for (int corner = 0; corner < 8; corner++) {
+		const int dx = corner & 1, dy = (corner >> 1) & 1, dz = corner >> 2;
+		const double weight = (dx ? fx : 1 - fx) * (dy ? fy : 1 - fy) * (dz ? fz : 1 - fz);
+		value += weight * unit(key(seed, x0 + dx, y0 + dy, z0 + dz));
+	}
+	return value;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MODELS
+//////////////////////////////////////////////////////////////////////////////
+
+static Model generateModel(const Options &options, uint32_t index) {
+	const uint32_t sx = options.size[0], sy = options.size[1], sz = options.size[2];
+	const uint64_t seed = mix(options.seed) ^ mix(index);
+	const double density = options.density;
+	Model model(sx, sy, sz);
+
+	if (options.pattern == "random") {
+		for (uint32_t z = 0; z < sz; z++) for (uint32_t y = 0; y < sy; y++) for (uint32_t x = 0; x < sx; x++) {
+			uint64_t h = key(seed, x, y, z);
+			if (unit(h) < density) {
+				model.voxels.push_back(Voxel((uint8_t)x, (uint8_t)y, (uint8_t)z, (uint8_t)(1 + (h >> 8) % 255)));
+			}
+		}
+	}
+	else if (options.pattern == "noise") {
+		// Value noise is centered at 0.5, so thresholds around it give the wanted density only approximately:
+		const double cell = std::max(4.0, std::min(sx, std::min(sy, sz)) / 4.0);
+		for (uint32_t z = 0; z < sz; z++) for (uint32_t y = 0; y < sy; y++) for (uint32_t x = 0; x < sx; x++) {
+			double n = noise(seed, x, y, z, cell);
+			if (n < density) {
+				model.voxels.push_back(Voxel((uint8_t)x, (uint8_t)y, (uint8_t)z, (uint8_t)(1 + (uint32_t)(n / density * 254))));
+			}
+		}
+	}
+	else if (options.pattern == "terrain") {
+		// Height field of two octaves, colored by height like rock, grass and snow:
+		const double cell = std::max(4.0, std::min(sx, sy) / 3.0);
+		for (uint32_t y = 0; y < sy; y++) for (uint32_t x = 0; x < sx; x++) {
+			double n = 0.7 * noise(seed, x, y, 0, cell) + 0.3 * noise(seed + 1, x, y, 0, cell / 4);
+			uint32_t height = std::min(sz, (uint32_t)(2 * density * n * sz + 1));
+			for (uint32_t z = 0; z < height; z++) {
+				uint8_t color = z + 1 == height ? (z * 4 > sz * 3 ? 1 : 2) : 3;
+				model.voxels.push_back(Voxel((uint8_t)x, (uint8_t)y, (uint8_t)z, color));
+			}
+		}
+	}
+	else if (options.pattern == "sphere") {
+		// Solid ellipsoid filling the given fraction of the box: volume = pi / 6 * r^3 of the box
+		const double radius = std::min(1.0, std::cbrt(density * 6 / 3.14159265358979));
+		const uint8_t color = (uint8_t)(1 + index % 255);
+		for (uint32_t z = 0; z < sz; z++) for (uint32_t y = 0; y < sy; y++) for (uint32_t x = 0; x < sx; x++) {
+			double dx = (2.0 * x + 1) / sx - 1, dy = (2.0 * y + 1) / sy - 1, dz = (2.0 * z + 1) / sz - 1;
+			if (dx * dx + dy * dy + dz * dz < radius * radius) {
+				model.voxels.push_back(Voxel((uint8_t)x, (uint8_t)y, (uint8_t)z, color));
+			}
+		}
+	}
+	else {
+		throw VoxReader::Exception("Unknown pattern '" + options.pattern + "'");
+	}
+	return model;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// SCENE
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Adds a transform node with the given child and returns it, ids are handed out in order.
+ */
+static SceneGraph::TransformNode& addTransform(SceneGraph &scene, SceneGraph::NodeId &nextId, int32_t layerId) {
+	auto &transform = scene.AddTransformNode(nextId++);
+	transform.childNodeId = nextId;
+	transform.layerId = layerId;
+	transform.frame_attributes.resize(1);
+	return transform;
+}
+
+/**
+ * Adds a group of the models [first, last) below the given number of levels of groups.
+ */
+static void addGroup(VoxReader &vox, const Options &options, SceneGraph::NodeId &nextId, uint32_t first, uint32_t last, uint32_t depth) {
+	SceneGraph &scene = vox.sceneGraph;
+	const SceneGraph::NodeId groupId = nextId++;
+	scene.AddGroupNode(groupId);
+
+	std::vector<SceneGraph::NodeId> children;
+	if (depth <= 1) {
+		// Models are placed on a square grid in the XY plane:
+		const uint32_t columns = (uint32_t)std::ceil(std::sqrt((double)options.models));
+		for (uint32_t m = first; m < last; m++) {
+			children.push_back(nextId);
+			const Model &model = vox.models[m];
+			auto &transform = addTransform(scene, nextId, (int32_t)(m % options.layers));
+			transform.frame_attributes[0].emplace_back("_t",
+				std::to_string((m % columns) * options.size[0] + model.sizeX / 2) + ' ' +
+				std::to_string((m / columns) * options.size[1] + model.sizeY / 2) + ' ' +
+				std::to_string(model.sizeZ / 2));
+			auto &shape = scene.AddShapeNode(nextId++);
+			shape.models.resize(1);
+			shape.models[0].modelId = m;
+		}
+	}
+	else {
+		const uint32_t count = last - first;
+		const uint32_t parts = std::max(1u, std::min(count, options.width));
+		for (uint32_t p = 0; p < parts; p++) {
+			children.push_back(nextId);
+			addTransform(scene, nextId, -1);
+			addGroup(vox, options, nextId, first + (uint32_t)((uint64_t)count * p / parts), first + (uint32_t)((uint64_t)count * (p + 1) / parts), depth - 1);
+		}
+	}
+	static_cast<SceneGraph::GroupNode *>(scene.GetNode(groupId))->childNodeIds = std::move(children);
+}
+
+static void generateScene(VoxReader &vox, const Options &options) {
+	SceneGraph::NodeId nextId = 0;
+	addTransform(vox.sceneGraph, nextId, -1);
+	addGroup(vox, options, nextId, 0, options.models, options.depth);
+
+	vox.layers.resize(options.layers);
+	for (uint32_t l = 0; l < options.layers; l++) {
+		vox.layers[l].attributes.emplace_back("_name", "layer" + std::to_string(l));
+	}
+
+	static const char *const TYPES[] = { "_diffuse", "_metal", "_glass", "_emit" };
+	vox.materials.resize(std::min(options.materials, 256u));
+	for (uint32_t m = 0; m < vox.materials.size(); m++) {
+		Dictionary &properties = vox.materials[m].properties;
+		properties.emplace_back("_type", TYPES[mix(options.seed ^ m) % 4]);
+		properties.emplace_back("_rough", std::to_string(unit(options.seed ^ m ^ 0x5555)).substr(0, 4));
+	}
+}
+
+static void generatePalette(VoxReader &vox) {
+	// Hue wheel with varying brightness, color index i at position i - 1:
+	vox.palette = new std::vector<RGBA>(256);
+	for (int i = 0; i < 256; i++) {
+		double hue = i * 6.0 / 255, value = 0.5 + 0.5 * ((i * 7) % 16) / 15.0;
+		double f = hue - std::floor(hue);
+		double rgb[6][3] = { { 1, f, 0 }, { 1 - f, 1, 0 }, { 0, 1, f }, { 0, 1 - f, 1 }, { f, 0, 1 }, { 1, 0, 1 - f } };
+		const double *c = rgb[(int)hue % 6];
+		(*vox.palette)[i] = RGBA(255, (uint8_t)(255 * value * c[0]), (uint8_t)(255 * value * c[1]), (uint8_t)(255 * value * c[2]));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MAIN
+//////////////////////////////////////////////////////////////////////////////
+
+static Options parseOptions(int argc, char **argv) {
+	Options options;
+	for (int i = 1; i < argc; i++) {
+		const char *arg = argv[i];
+		const char *value = strchr(arg, '=');
+		std::string name = value != nullptr ? std::string(arg, value++) : std::string(arg);
+		auto number = [&]() -> uint64_t {
+			char *end = nullptr;
+			unsigned long long n = value != nullptr ? strtoull(value, &end, 10) : 0;
+			if (value == nullptr || *end != '\0') {
+				throw VoxReader::Exception("Option " + name + " needs a number");
+			}
+			return n;
+		};
+
+		if (name == "--models") options.models = (uint32_t)number();
+		else if (name == "--size") {
+			unsigned x = 0, y = 0, z = 0;
+			int count = value != nullptr ? sscanf(value, "%u,%u,%u", &x, &y, &z) : 0;
+			if (count == 1) y = z = x;
+			else if (count != 3) throw VoxReader::Exception("Option --size needs X or X,Y,Z");
+			options.size[0] = x; options.size[1] = y; options.size[2] = z;
+		}
+		else if (name == "--density" && value != nullptr) options.density = atof(value);
+		else if (name == "--pattern" && value != nullptr) options.pattern = value;
+		else if (name == "--depth") options.depth = (uint32_t)number();
+		else if (name == "--width") options.width = (uint32_t)number();
+		else if (name == "--layers") options.layers = (uint32_t)number();
+		else if (name == "--materials") options.materials = (uint32_t)number();
+		else if (name == "--seed") options.seed = number();
+		else if (name == "--threads") options.threads = (unsigned)number();
+		else if (arg[0] != '-' && options.path.empty()) options.path = arg;
+		else throw VoxReader::Exception("Unknown option '" + std::string(arg) + "'");
+	}
+
+	if (options.path.empty()) {
+		throw VoxReader::Exception("No output file given");
+	}
+	for (uint32_t size : options.size) {
+		if (size < 1 || size > 256) {
+			throw VoxReader::Exception("Model size must be within 1 to 256");
+		}
+	}
+	// Groups are added recursively, one level per call:
+	if (options.depth < 1 || options.depth > 64) {
+		throw VoxReader::Exception("Depth must be within 1 to 64");
+	}
+	if (options.models == 0 || options.layers == 0) {
+		throw VoxReader::Exception("At least one model and one layer are needed");
+	}
+	return options;
+}
+
+int main(int argc, char **argv) {
+	try {
+		Options options = parseOptions(argc, argv);
+
+		VoxReader vox;
+		vox.models.assign(options.models, Model(0, 0, 0));
+		parallelFor(options.models, options.threads, [&](size_t m) {
+			vox.models[m] = generateModel(options, (uint32_t)m);
+		});
+		generateScene(vox, options);
+		generatePalette(vox);
+
+		VoxWriter writer(vox);
+		writer.save(options.path);
+
+		uint64_t voxelCount = 0;
+		for (const Model &model : vox.models) {
+			voxelCount += model.voxels.size();
+		}
+		printf("%s: %u models, %llu voxels, %llu bytes\n", options.path.c_str(), options.models,
+			(unsigned long long)voxelCount, (unsigned long long)writer.size());
+	}
+	catch (const std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include "VoxReader.hpp"
+
+#include <istream>
+
+namespace jim {
+
+	/**
+	 * Facts about a vox-file gathered without decoding it: chunk headers are read and voxel payloads, the palette,
+	 * material and unknown chunks are skipped by seeking past them. Only node and layer chunks are read in full.
+	*/
+	class VoxInfo {
+	public:
+
+		/**
+		 * Also read the color index of every voxel to fill usedColors. This reads the voxel payloads.
+		*/
+		static const uint32_t SCAN_COLORS = 0x1;
+
+		struct ModelInfo {
+			uint32_t sizeX, sizeY, sizeZ;
+			uint32_t voxelCount;
+		};
+
+		/**
+		 * Scan the vox-data of the given stream, which must support seeking.
+		*/
+		static VoxInfo scan(std::istream &s, uint32_t flags = 0);
+
+		/**
+		 * Scan the vox-file at the given path.
+		*/
+		static VoxInfo scan(const std::string &path, uint32_t flags = 0);
+
+		/**
+		 * Scan the vox-data in the given memory.
+		*/
+		static VoxInfo scan(const uint8_t *data, size_t size, uint32_t flags = 0);
+
+		/**
+		 * Returns whether the given color index is used by any voxel. Requires SCAN_COLORS.
+		*/
+		bool usesColor(uint8_t colorIndex) const { return (usedColors[colorIndex / 64] >> (colorIndex % 64)) & 1; }
+
+		uint64_t size = 0;                                      // of the vox-data in bytes
+		std::vector<ModelInfo> models;
+		uint64_t voxelCount = 0;                                // of all models
+		bool hasPalette = false;                                // false if the default palette is used
+		uint64_t usedColors[4] = {};                            // bit set of color indices, see SCAN_COLORS
+		uint32_t nodeCount = 0;
+		std::vector<std::pair<SceneGraph::NodeId, std::string>> nodeNames; // '_name' of nodes
+		uint32_t layerCount = 0;
+		std::vector<std::pair<int32_t, std::string>> layerNames;           // '_name' of layers
+		uint32_t materialCount = 0;
+		uint32_t unknownChunkCount = 0;
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <cstring>
+#include <fstream>
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// SCAN SOURCES
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* Reads from a seekable stream, skipping by seeking.
+	*/
+	class StreamScanSource {
+	public:
+		explicit StreamScanSource(std::istream &s) : s(s) {}
+
+		void read(void *buffer, size_t size) {
+			if (!s.read(static_cast<char *>(buffer), (std::streamsize)size)) {
+				throw VoxReader::Exception("Unexpected end of vox-data");
+			}
+			position += size;
+		}
+
+		void skip(uint64_t size) {
+			if (!s.seekg((std::streamoff)size, std::ios::cur)) {
+				throw VoxReader::Exception("Unexpected end of vox-data");
+			}
+			position += size;
+		}
+
+		uint64_t position = 0;
+
+	private:
+		std::istream &s;
+	};
+
+	/**
+	* Reads from memory.
+	*/
+	class MemoryScanSource {
+	public:
+		MemoryScanSource(const uint8_t *data, size_t size) : data(data), end(size) {}
+
+		void read(void *buffer, size_t size) {
+			skipChecked(size);
+			memcpy(buffer, data + position - size, size);
+		}
+
+		void skip(uint64_t size) {
+			skipChecked(size);
+		}
+
+		uint64_t position = 0;
+
+	private:
+		void skipChecked(uint64_t size) {
+			if (size > end - position) {
+				throw VoxReader::Exception("Unexpected end of vox-data");
+			}
+			position += size;
+		}
+
+		const uint8_t *data;
+		uint64_t end;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////
+	// SCAN
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* Returns the '_name' of a dictionary at the given position of a chunk content, checking all bounds.
+	*/
+	static bool scanName(const std::vector<uint8_t> &content, size_t position, std::string &name) {
+		auto readInt32 = [&](size_t &p, uint32_t &value) {
+			if (content.size() - p < 4) return false;
+			value = (uint32_t)readInt(content.data() + p);
+			p += 4;
+			return true;
+		};
+
+		uint32_t entries;
+		if (position > content.size() || !readInt32(position, entries)) return false;
+		for (uint32_t i = 0; i < entries; i++) {
+			uint32_t keySize, valueSize;
+			if (!readInt32(position, keySize) || content.size() - position < keySize) return false;
+			size_t key = position;
+			position += keySize;
+			if (!readInt32(position, valueSize) || content.size() - position < valueSize) return false;
+			if (keySize == 5 && memcmp(content.data() + key, "_name", 5) == 0) {
+				name.assign(reinterpret_cast<const char *>(content.data()) + position, valueSize);
+				return true;
+			}
+			position += valueSize;
+		}
+		return false;
+	}
+
+	template <typename SOURCE>
+	static VoxInfo scanVox(SOURCE &source, uint64_t size, uint32_t flags) {
+		VoxInfo info;
+		info.size = size;
+
+		uint8_t header[12];
+		source.read(header, 8);
+		if (memcmp(header, "VOX ", 4) != 0) {
+			throw VoxReader::Exception("Magic string 'VOX ' is missing");
+		}
+		if (readInt(header + 4) != 150) {
+			throw VoxReader::Exception("Version is not 150");
+		}
+
+		source.read(header, 12);
+		if (memcmp(header, "MAIN", 4) != 0) {
+			throw VoxReader::Exception("MAIN chunk is missing");
+		}
+		source.skip((uint32_t)readInt(header + 4));
+		const uint64_t end = source.position + (uint32_t)readInt(header + 8);
+		if (end > size) {
+			throw VoxReader::Exception("MAIN chunk exceeds the data");
+		}
+
+		std::vector<uint8_t> content;
+		std::vector<uint8_t> voxels;
+
+		while (source.position < end) {
+			source.read(header, 12);
+			const uint64_t contentSize = (uint32_t)readInt(header + 4);
+			const uint64_t childrenSize = (uint32_t)readInt(header + 8);
+			if (contentSize + childrenSize > end - source.position) {
+				throw VoxReader::Exception("Chunk exceeds its parent");
+			}
+			uint64_t skip = contentSize + childrenSize;
+
+			if (!memcmp(header, "SIZE", 4) && contentSize >= 12) {
+				uint8_t sizes[12];
+				source.read(sizes, 12);
+				skip -= 12;
+				VoxInfo::ModelInfo model = { (uint32_t)readInt(sizes), (uint32_t)readInt(sizes + 4), (uint32_t)readInt(sizes + 8), 0 };
+				info.models.push_back(model);
+			}
+			else if (!memcmp(header, "XYZI", 4) && contentSize >= 4 && !info.models.empty()) {
+				uint8_t count[4];
+				source.read(count, 4);
+				skip -= 4;
+				uint32_t voxelCount = (uint32_t)readInt(count);
+				info.models.back().voxelCount = voxelCount;
+				info.voxelCount += voxelCount;
+
+				if ((flags & VoxInfo::SCAN_COLORS) && (uint64_t)voxelCount * 4 <= skip) {
+					voxels.resize((size_t)voxelCount * 4);
+					source.read(voxels.data(), voxels.size());
+					skip -= voxels.size();
+					for (size_t i = 3; i < voxels.size(); i += 4) {
+						info.usedColors[voxels[i] / 64] |= 1ull << (voxels[i] % 64);
+					}
+				}
+			}
+			else if (!memcmp(header, "RGBA", 4)) {
+				info.hasPalette = true;
+			}
+			else if (header[0] == 'n' || !memcmp(header, "LAYR", 4)) {
+				content.resize((size_t)contentSize);
+				source.read(content.data(), content.size());
+				skip -= contentSize;
+
+				int32_t id = content.size() >= 4 ? readInt(content.data()) : -1;
+				std::string name;
+				bool named = scanName(content, 4, name);
+				if (header[0] == 'n') {
+					info.nodeCount++;
+					if (named) info.nodeNames.emplace_back(id, name);
+				}
+				else {
+					info.layerCount++;
+					if (named) info.layerNames.emplace_back(id, name);
+				}
+			}
+			else if (!memcmp(header, "MATL", 4)) {
+				info.materialCount++;
+			}
+			else if (memcmp(header, "PACK", 4)) {
+				info.unknownChunkCount++;
+			}
+
+			source.skip(skip);
+		}
+
+		return info;
+	}
+
+	VoxInfo VoxInfo::scan(std::istream &s, uint32_t flags) {
+		if (!s) {
+			throw VoxReader::Exception("Cannot read from stream");
+		}
+		std::streampos start = s.tellg();
+		if (start == std::streampos(-1) || !s.seekg(0, std::ios::end)) {
+			throw VoxReader::Exception("Stream does not support seeking");
+		}
+		uint64_t size = (uint64_t)(s.tellg() - start);
+		s.seekg(start);
+
+		StreamScanSource source(s);
+		return scanVox(source, size, flags);
+	}
+
+	VoxInfo VoxInfo::scan(const std::string &path, uint32_t flags) {
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			throw VoxReader::Exception("Cannot open '" + path + "'");
+		}
+		return scan(file, flags);
+	}
+
+	VoxInfo VoxInfo::scan(const uint8_t *data, size_t size, uint32_t flags) {
+		MemoryScanSource source(data, size);
+		return scanVox(source, size, flags);
+	}
+
+} // namespace jim
+
+#endif
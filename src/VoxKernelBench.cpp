@@ -0,0 +1,281 @@
+/**
+ * Benchmarks the kernels working on loaded objects: 2D projections (view2d), meshing (glTF and OBJ export),
+ * scene graph flattening, content hashing, merging into and splitting a VoxWorld, and palette lookups.
+ *     VoxKernelBench [--iterations=N] [--json] [--sizes=32,64,128] [--densities=0.05,0.5,0.95]
+ *
+ * Every kernel runs on a generated model of every size and density, instanced 16 times (the world merge of 256^3
+ * at high density needs several GB). Besides the wall time, the hardware counters cycles, instructions, cache
+ * misses and branch misses are read with perf_event_open on Linux, which gives IPC and miss rates per benchmark.
+ * Where the counters are not available (other platforms, perf_event_paranoid, virtual machines) only the wall
+ * time is reported.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#define JIM_VOXREADER_IMPLEMENTATION
+#include "VoxReader.hpp"
+#include "VoxWorld.hpp"
+#include "VoxExport.hpp"
+#include "VoxTools.hpp"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define JIM_VOXKERNELBENCH_PERF
+#endif
+
+using namespace jim;
+
+//////////////////////////////////////////////////////////////////////////////
+// HARDWARE COUNTERS
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Cycles, instructions, cache misses and branch misses of the calling thread, read as one group.
+ */
+class PerfCounters {
+public:
+	static const int COUNT = 4;
+
+	PerfCounters() {
+#ifdef JIM_VOXKERNELBENCH_PERF
+		static const uint64_t CONFIGS[COUNT] = {
+			PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+		};
+		for (int i = 0; i < COUNT; i++) {
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = CONFIGS[i];
+			attr.disabled = i == 0;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+			fds[i] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds[0], 0);
+			if (fds[i] < 0) {
+				close();
+				return;
+			}
+		}
+		available = true;
+#endif
+	}
+
+	~PerfCounters() {
+		close();
+	}
+
+	bool isAvailable() const { return available; }
+
+	void start() {
+#ifdef JIM_VOXKERNELBENCH_PERF
+		if (!available) return;
+		ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+	}
+
+	/**
+	 * Stops counting and returns the counts since start(), scaled up if the counters were multiplexed.
+	 */
+	void stop(double values[COUNT]) {
+		std::fill(values, values + COUNT, 0.0);
+#ifdef JIM_VOXKERNELBENCH_PERF
+		if (!available) return;
+		ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+		struct {
+			uint64_t count;
+			uint64_t enabled;
+			uint64_t running;
+			uint64_t values[COUNT];
+		} group;
+		if (read(fds[0], &group, sizeof(group)) != (ssize_t)sizeof(group) || group.running == 0) return;
+		double scale = (double)group.enabled / group.running;
+		for (int i = 0; i < COUNT; i++) {
+			values[i] = group.values[i] * scale;
+		}
+#endif
+	}
+
+private:
+	void close() {
+#ifdef JIM_VOXKERNELBENCH_PERF
+		for (int i = COUNT - 1; i >= 0; i--) {
+			if (fds[i] >= 0) ::close(fds[i]);
+			fds[i] = -1;
+		}
+#endif
+		available = false;
+	}
+
+	int fds[COUNT] = { -1, -1, -1, -1 };
+	bool available = false;
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// MEASUREMENT
+//////////////////////////////////////////////////////////////////////////////
+
+struct Result {
+	std::string kernel;
+	uint32_t size;
+	double density;
+	uint64_t voxelCount;
+	double seconds;                      // fastest iteration
+	double counters[PerfCounters::COUNT]; // per iteration
+};
+
+static Result measure(PerfCounters &perf, const char *kernel, const VoxReader &vox, double density, unsigned iterations, const std::function<void()> &task) {
+	Result result;
+	result.kernel = kernel;
+	result.size = vox.models[0].sizeX;
+	result.density = density;
+	result.voxelCount = vox.models[0].voxels.size();
+	result.seconds = 1e30;
+
+	task(); // warm up
+	perf.start();
+	for (unsigned i = 0; i < iterations; i++) {
+		auto start = std::chrono::steady_clock::now();
+		task();
+		result.seconds = std::min(result.seconds, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	perf.stop(result.counters);
+	for (double &counter : result.counters) {
+		counter /= iterations;
+	}
+	return result;
+}
+
+static std::vector<Result> runKernels(PerfCounters &perf, const VoxReader &vox, double density, unsigned iterations) {
+	std::vector<Result> results;
+	NullBuffer nullBuffer;
+	std::ostream null(&nullBuffer);
+
+	static const char *const VIEWS[] = { "view2d XZ", "view2d XY", "view2d YZ" };
+	for (int viewport = VoxReader::XZ; viewport <= VoxReader::YZ; viewport++) {
+		results.push_back(measure(perf, VIEWS[viewport], vox, density, iterations, [&]() {
+			auto view = vox.view2d((VoxReader::Viewport2d)viewport);
+			(void)view;
+		}));
+	}
+
+	results.push_back(measure(perf, "mesh glTF", vox, density, iterations, [&]() {
+		VoxExport(vox).saveGltf(null);
+	}));
+	results.push_back(measure(perf, "mesh OBJ", vox, density, iterations, [&]() {
+		VoxExport(vox).saveObj(null);
+	}));
+
+	results.push_back(measure(perf, "flatten", vox, density, iterations, [&]() {
+		auto instances = vox.sceneGraph.Flatten();
+		(void)instances;
+	}));
+
+	results.push_back(measure(perf, "content hash", vox, density, iterations, [&]() {
+		volatile uint64_t hash = vox.models[0].contentHash();
+		(void)hash;
+	}));
+
+	results.push_back(measure(perf, "palette lookup", vox, density, iterations, [&]() {
+		uint32_t sum = 0;
+		for (const Voxel &voxel : vox.models[0].voxels) {
+			sum += vox.getColor(voxel.colorIndex).r;
+		}
+		volatile uint32_t result = sum;
+		(void)result;
+	}));
+
+	VoxWorld world;
+	results.push_back(measure(perf, "world merge", vox, density, iterations, [&]() {
+		world.merge(vox, VoxWorld::KEEP_LAST, 1);
+	}));
+	results.push_back(measure(perf, "world split", vox, density, iterations, [&]() {
+		VoxReader split;
+		world.split(split, 1);
+	}));
+
+	return results;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MAIN
+//////////////////////////////////////////////////////////////////////////////
+
+template <typename T>
+static std::vector<T> parseList(const char *text, T (*parse)(const char *)) {
+	std::vector<T> values;
+	while (*text != '\0') {
+		values.push_back(parse(text));
+		text += strcspn(text, ",");
+		if (*text == ',') text++;
+	}
+	return values;
+}
+
+static uint32_t parseSize(const char *text) { return (uint32_t)std::min(256, std::max(1, atoi(text))); }
+static double parseDensity(const char *text) { return std::min(1.0, std::max(0.0, atof(text))); }
+
+int main(int argc, char **argv) {
+	unsigned iterations = 5;
+	bool json = false;
+	std::vector<uint32_t> sizes = { 32, 64, 128 };
+	std::vector<double> densities = { 0.05, 0.5, 0.95 };
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "--iterations=", 13)) iterations = (unsigned)std::max(1, atoi(argv[i] + 13));
+		else if (!strcmp(argv[i], "--json")) json = true;
+		else if (!strncmp(argv[i], "--sizes=", 8)) sizes = parseList(argv[i] + 8, parseSize);
+		else if (!strncmp(argv[i], "--densities=", 12)) densities = parseList(argv[i] + 12, parseDensity);
+		else {
+			fprintf(stderr, "Unknown option '%s'\n", argv[i]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	PerfCounters perf;
+	if (!json) {
+		printf("%-16s %5s %7s %10s %12s %8s %14s %14s\n", "kernel", "size", "density", "voxels", "ms", "IPC", "cache misses", "branch misses");
+		if (!perf.isAvailable()) {
+			printf("(hardware counters are not available)\n");
+		}
+	}
+
+	for (uint32_t size : sizes) {
+		for (double density : densities) {
+			VoxReader vox;
+			generateScene(vox, { size }, density, 16, 1);
+			for (const Result &r : runKernels(perf, vox, density, iterations)) {
+				const double cycles = r.counters[0], instructions = r.counters[1];
+				if (json) {
+					printf("{\"kernel\":\"%s\",\"size\":%u,\"density\":%g,\"voxels\":%llu,\"seconds\":%.9f", r.kernel.c_str(),
+						r.size, r.density, (unsigned long long)r.voxelCount, r.seconds);
+					if (perf.isAvailable()) {
+						printf(",\"cycles\":%.0f,\"instructions\":%.0f,\"cache_misses\":%.0f,\"branch_misses\":%.0f",
+							cycles, instructions, r.counters[2], r.counters[3]);
+					}
+					printf("}\n");
+				}
+				else if (perf.isAvailable()) {
+					printf("%-16s %5u %7g %10llu %12.3f %8.2f %14.0f %14.0f\n", r.kernel.c_str(), r.size, r.density,
+						(unsigned long long)r.voxelCount, r.seconds * 1e3, cycles > 0 ? instructions / cycles : 0.0, r.counters[2], r.counters[3]);
+				}
+				else {
+					printf("%-16s %5u %7g %10llu %12.3f\n", r.kernel.c_str(), r.size, r.density, (unsigned long long)r.voxelCount, r.seconds * 1e3);
+				}
+				fflush(stdout);
+			}
+		}
+	}
+	return EXIT_SUCCESS;
+}
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <cstdint>
 #include <istream>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 namespace jim {
@@ -36,6 +41,92 @@ namespace jim {
 	using Dictionary = std::vector<std::pair<std::string, std::string>>; // may be unsorted!
 	class SceneGraph;
 
+	/**
+	 * Returns the value stored for the given key or NULL when the dictionary does not contain it.
+	*/
+	const std::string* findValue(const Dictionary &dictionary, const char *key);
+
+	/**
+	 * Fast non-cryptographic 64 bit hash of the given bytes (XXH64).
+	*/
+	uint64_t hash64(const void *data, size_t size, uint64_t seed = 0);
+
+	/**
+	 * Read-only view of a whole file. The file is memory mapped where available, otherwise read into memory.
+	*/
+	class MappedFile {
+	public:
+		explicit MappedFile(const std::string &path);
+		~MappedFile();
+
+		MappedFile(const MappedFile &) = delete;
+		MappedFile& operator=(const MappedFile &) = delete;
+
+		const uint8_t* data() const { return bytes; }
+		size_t size() const { return length; }
+
+	private:
+		const uint8_t *bytes = nullptr;
+		size_t length = 0;
+		bool mapped = false;
+		std::vector<uint8_t> buffer; // if the file is not mapped
+	};
+
+	/**
+	 * Receives the timed scopes of loading and writing, see setTraceSink().
+	 * Scopes are only compiled in when JIM_VOXREADER_TRACE is defined, otherwise they cost nothing.
+	*/
+	class TraceSink {
+	public:
+		virtual ~TraceSink() = default;
+
+		/**
+		 * Called at the end of every scope, on the thread which ran it and possibly on multiple threads at once.
+		 * @param[in] name     Name of the scope, only valid during the call.
+		 * @param[in] argName  Name of the argument of the scope (e.g. "offset") or NULL if it has none.
+		 * @param[in] arg      Value of the argument.
+		 * @param[in] start    Start time in nanoseconds of a steady clock.
+		 * @param[in] duration Duration in nanoseconds.
+		 * @param[in] threadId Small sequential id of the thread, 0 for the first thread which traced a scope.
+		*/
+		virtual void scope(const char *name, const char *argName, int64_t arg, uint64_t start, uint64_t duration, uint32_t threadId) = 0;
+	};
+
+	/**
+	 * Set the sink receiving all traced scopes, NULL to stop tracing. The sink must outlive all traced calls.
+	*/
+	void setTraceSink(TraceSink *sink);
+	TraceSink* getTraceSink();
+
+	/**
+	 * Times the enclosing block if a sink is set. Use through JIM_VOXREADER_TRACE_SCOPE.
+	*/
+	class TraceScope {
+	public:
+		explicit TraceScope(const char *name, const char *argName = nullptr, int64_t arg = 0);
+		~TraceScope();
+
+		TraceScope(const TraceScope &) = delete;
+		TraceScope& operator=(const TraceScope &) = delete;
+
+	private:
+		TraceSink *sink;
+		const char *name;
+		const char *argName;
+		int64_t arg;
+		uint64_t start;
+	};
+
+#define JIM_VOXREADER_TRACE_CONCAT2(a, b) a##b
+#define JIM_VOXREADER_TRACE_CONCAT(a, b) JIM_VOXREADER_TRACE_CONCAT2(a, b)
+#ifdef JIM_VOXREADER_TRACE
+#define JIM_VOXREADER_TRACE_SCOPE(name) jim::TraceScope JIM_VOXREADER_TRACE_CONCAT(traceScope, __LINE__)(name)
+#define JIM_VOXREADER_TRACE_SCOPE_ARG(name, argName, arg) jim::TraceScope JIM_VOXREADER_TRACE_CONCAT(traceScope, __LINE__)(name, argName, arg)
+#else
+#define JIM_VOXREADER_TRACE_SCOPE(name) ((void)0)
+#define JIM_VOXREADER_TRACE_SCOPE_ARG(name, argName, arg) ((void)0)
+#endif
+
 	/**
 	 * Represents a layer metadata
 	*/
@@ -74,6 +165,8 @@ namespace jim {
 	class SceneGraph {
 	public:
 		friend class VoxReader;
+		friend class VoxWriter;
+		friend class VoxReloader;
 
 		typedef int32_t NodeId;
 
@@ -96,6 +189,8 @@ namespace jim {
 				SHAPE
 			};
 
+			virtual ~Node() = default;
+
 			Type type;
 			Dictionary attributes;
 		};
@@ -137,17 +232,69 @@ namespace jim {
 		 * Returns node by its index or NULL when scene graph is no available or node can't be found
 		*/
 		const Node* GetNode(NodeId id) const;
+		Node* GetNode(NodeId id);
 
 		/**
 		 * Returns root node of scene graph or NULL when scene graph is no available
 		*/
 		inline const Node* GetRoot() const { return GetNode(0); }
 
+		/**
+		 * Returns the number of node ids in use (highest id + 1). Ids without a node return NULL from GetNode.
+		*/
+		inline NodeId GetNodeCount() const { return (NodeId)nodes.size(); }
+
+		/**
+		 * Add a new node with the given id. Throws if the id is already taken.
+		*/
+		TransformNode& AddTransformNode(NodeId id);
+		GroupNode& AddGroupNode(NodeId id);
+		ShapeNode& AddShapeNode(NodeId id);
+
+		/**
+		 * Remove all nodes.
+		*/
+		inline void Clear() { nodes.clear(); }
+
+		/**
+		 * Represents the transformation of a node as integer matrix and translation.
+		 * Applied to a model it maps the model center (size / 2) to world space.
+		*/
+		struct Transform {
+			int8_t rotation[3][3]; // signed permutation matrix, row major
+			int32_t translation[3];
+
+			/**
+			 * Parse '_r' and '_t' from the given frame attributes. Missing values result in identity.
+			*/
+			static Transform Parse(const Dictionary &frame);
+
+			/**
+			 * Returns this * other, i.e. other is applied first.
+			*/
+			Transform operator*(const Transform &other) const;
+		};
+
+		/**
+		 * Represents one placement of a model in the scene.
+		*/
+		struct Instance {
+			NodeId shapeNodeId;
+			uint32_t modelId;    // index into VoxReader::models
+			int32_t layerId;     // of the nearest transform node
+			Transform transform; // accumulated from the root, using the first frame of every transform
+		};
+
+		/**
+		 * Walk the scene graph from the root and return all model instances in depth-first order.
+		 * Subtrees below transform nodes marked '_hidden' are skipped.
+		*/
+		std::vector<Instance> Flatten() const;
+
 	protected:
-		// TODO: pass end of chunk ptr and check bounds 
-		void readTransformNode(const uint8_t* ptr);
-		void readGroupNode(const uint8_t* ptr);
-		void readShapeNode(const uint8_t* ptr);
+		void readTransformNode(const uint8_t* ptr, const uint8_t* end);
+		void readGroupNode(const uint8_t* ptr, const uint8_t* end);
+		void readShapeNode(const uint8_t* ptr, const uint8_t* end);
 		template <typename NODE> NODE& addNode(NodeId id);
 
 	private:
@@ -167,10 +314,78 @@ namespace jim {
 
 		struct Chunk;
 
+		/**
+		 * Deepest nesting of chunks accepted, MAIN is at depth 0. Deeper data is rejected instead of exhausting the stack.
+		*/
+		static const int MAX_CHUNK_DEPTH = 64;
+
+		/**
+		 * A chunk the reader does not interpret (e.g. rOBJ, rCAM, NOTE, IMAP, MATT).
+		 * It is kept byte for byte, including header and children, so it can be written back unchanged.
+		*/
+		struct RawChunk {
+			char id[5];
+			std::vector<uint8_t> bytes;
+		};
+
+		/**
+		 * Location of a top level chunk in the loaded data and the object it was decoded into.
+		*/
+		struct ChunkRef {
+			char id[5];
+			uint64_t offset; // of the chunk header, relative to the start of the data
+			uint64_t size;   // header, content and children
+			int32_t index;   // model index, node id, layer id, material id or index into unknownChunks; -1 for PACK and RGBA
+		};
+
+		/**
+		 * Time in nanoseconds spent decoding the loaded data, by the objects decoded.
+		*/
+		struct DecodeTimings {
+			uint64_t total = 0;      // the whole load, including reading the stream
+			uint64_t read = 0;       // reading the stream, 0 when loaded from memory
+			uint64_t index = 0;      // building the chunk tree
+			uint64_t models = 0;     // SIZE, XYZI and PACK chunks
+			uint64_t palette = 0;    // RGBA chunk
+			uint64_t sceneGraph = 0; // node chunks
+			uint64_t layers = 0;
+			uint64_t materials = 0;
+			uint64_t other = 0;      // chunks kept verbatim
+		};
+
+		/**
+		 * Heap memory in bytes held by the objects of a reader, by subsystem.
+		 * Counts the capacity of all containers and strings, not allocator overhead.
+		*/
+		struct MemoryUsage {
+			size_t models = 0;
+			size_t palette = 0;       // 0 for the default palette
+			size_t sceneGraph = 0;    // nodes including their dictionaries
+			size_t layers = 0;
+			size_t materials = 0;
+			size_t unknownChunks = 0;
+			size_t sourceChunks = 0;
+
+			size_t total() const { return models + palette + sceneGraph + layers + materials + unknownChunks + sourceChunks; }
+		};
+
+		/**
+		 * What was loaded and what it costs, see stats().
+		*/
+		struct Stats {
+			uint64_t bytesRead = 0;                      // size of the loaded data
+			std::map<std::string, uint32_t> chunkCounts; // top level chunks of the loaded data by id
+			size_t modelCount = 0;
+			uint64_t voxelCount = 0;
+			int32_t nodeCount = 0;                       // scene graph nodes
+			MemoryUsage memory;
+			DecodeTimings timings;
+		};
+
 		/**
 		 * All exceptions thrown by this library are of this type.
 		*/
-		class Exception : std::runtime_error {
+		class Exception : public std::runtime_error {
 			using std::runtime_error::runtime_error;
 		};
 
@@ -186,9 +401,25 @@ namespace jim {
 		void load(std::istream &s);
 
 		/**
-		 * Print the vox-reader's members to the given output stream.
+		 * Read the vox-data from the given memory and stores the read objects.
+		 * Discards any objects currently hold. The data only needs to be valid during the call.
+		*/
+		void load(const uint8_t *data, size_t size);
+
+		/**
+		 * Discards all objects currently hold.
+		*/
+		void clear();
+
+		/**
+		 * Read the remaining content of the given stream into memory.
 		*/
-		void print(std::ostream &s);
+		static std::vector<uint8_t> readStream(std::istream &s);
+
+		/**
+		 * Print the models and the palette to the given output stream. See VoxDump for all objects and JSON.
+		*/
+		void print(std::ostream &s) const;
 
 		static const uint8_t INVERT_UP = 0x1;
 		static const uint8_t FROM_BEHIND = 0x2;
@@ -209,7 +440,7 @@ namespace jim {
 		 *                       SWAP_AXIS   | The up and row axis are swapped.
 		 * @param[in] modelIndex Index of model which voxels to be looking at.
 		*/
-		std::vector<std::vector<Voxel *>> view2d(const Viewport2d viewport, uint8_t flags = 0, uint32_t modelIndex = 0) const;
+		std::vector<std::vector<const Voxel *>> view2d(const Viewport2d viewport, uint8_t flags = 0, uint32_t modelIndex = 0) const;
 
 		/**
 		 * If a vox-data does not specifiy a palette, this default palette is used.
@@ -217,6 +448,35 @@ namespace jim {
 		*/
 		static std::vector<RGBA> DEFAULT_PALETTE;
 
+		/**
+		 * Returns the color of the given color index (1-255).
+		 * Palettes read from a file store color index i at position i - 1, the default palette at position i.
+		*/
+		RGBA getColor(uint8_t colorIndex) const;
+
+		/**
+		 * Returns the sizes, counts, heap usage and decode timings of the currently hold objects.
+		 * Walks all objects, so it is linear in their number.
+		*/
+		Stats stats() const;
+
+		/**
+		 * Returns the heap memory held by the currently hold objects.
+		*/
+		MemoryUsage memoryUsage() const;
+
+	private:
+		friend class VoxAsyncLoader;
+
+		/**
+		 * Decode top level chunks of the data given to load(), starting at the given index, and store the objects.
+		 * Returns the index of the first chunk not decoded: a SIZE chunk is kept back if its XYZI chunk is not
+		 * in the given chunks yet, unless these are the last chunks of the data.
+		*/
+		size_t decodeChunks(const uint8_t *data, const std::vector<Chunk> &chunks, size_t first, bool last);
+
+	public:
+
 		//private:
 
 		std::vector<Model> models;
@@ -224,6 +484,11 @@ namespace jim {
 		SceneGraph sceneGraph; // no need for heap allocation, but because of nested classes there is no other option.
 		std::vector<Layer> layers;
 		std::vector<MaterialEx> materials;
+		std::vector<RawChunk> unknownChunks; // in the order they appeared
+		std::vector<ChunkRef> sourceChunks;  // top level chunks of the loaded data, in file order
+		uint64_t sourceSize = 0;             // size of the loaded data in bytes
+		uint64_t sourceHash = 0;             // hash64() of the loaded data
+		DecodeTimings decodeTimings;         // of the last load or reload
 
 	};
 
@@ -235,6 +500,21 @@ namespace jim {
 
 		Model(const VoxReader::Chunk &sizeChunk, const VoxReader::Chunk &xyziChunk);
 
+		/**
+		 * Creates an empty model of the given size. Voxels are added by the user.
+		*/
+		Model(uint32_t sizeX, uint32_t sizeY, uint32_t sizeZ);
+
+		/**
+		 * Returns a hash of size and voxels which does not depend on the order of the voxels.
+		*/
+		uint64_t contentHash() const;
+
+		/**
+		 * Returns whether both models have the same size and the same voxels, in any order.
+		*/
+		bool sameContent(const Model &other) const;
+
 		uint32_t sizeX, sizeY, sizeZ;
 		std::vector<Voxel> voxels;
 	};
@@ -243,8 +523,30 @@ namespace jim {
 
 #ifdef JIM_VOXREADER_IMPLEMENTATION
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
 #include <iostream>
 #include <iomanip>
+#include <mutex>
+#include <thread>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define JIM_VOXREADER_MMAP
+#endif
 
 namespace jim {
 
@@ -252,12 +554,6 @@ namespace jim {
 	// UTILITIES
 	//////////////////////////////////////////////////////////////////////////////
 
-	static int readInt(std::istream &s) {
-		uint32_t integer;
-		s.read(reinterpret_cast<char *>(&integer), 4);
-		return integer;
-	}
-
 	static int readInt(const uint8_t *bytearray) {
 		union {
 			uint32_t integer;
@@ -270,65 +566,155 @@ namespace jim {
 		return ret.integer;
 	}
 
+	static uint64_t steadyNanoseconds() {
+		return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// TRACING
+	//////////////////////////////////////////////////////////////////////////////
+
+	static std::atomic<TraceSink *> traceSink(nullptr);
+	static std::atomic<uint32_t> traceThreadCount(0);
+
+	void setTraceSink(TraceSink *sink) {
+		traceSink.store(sink, std::memory_order_release);
+	}
+
+	TraceSink* getTraceSink() {
+		return traceSink.load(std::memory_order_acquire);
+	}
+
+	static uint32_t traceThreadId() {
+		static thread_local uint32_t id = traceThreadCount.fetch_add(1);
+		return id;
+	}
+
+	TraceScope::TraceScope(const char *name, const char *argName, int64_t arg)
+		: sink(getTraceSink()), name(name), argName(argName), arg(arg), start(sink != nullptr ? steadyNanoseconds() : 0) {}
+
+	TraceScope::~TraceScope() {
+		if (sink != nullptr) {
+			sink->scope(name, argName, arg, start, steadyNanoseconds() - start, traceThreadId());
+		}
+	}
+
+	/**
+	* Runs task(i) for every i in [0, count) on up to the given number of threads (0 = hardware concurrency).
+	* Indices are handed out one by one, so items of uneven cost balance out.
+	* The first exception thrown by a task is rethrown on the calling thread.
+	*/
+	template <typename TASK>
+	static void parallelFor(size_t count, unsigned threads, TASK task) {
+		if (threads == 0) {
+			threads = std::thread::hardware_concurrency();
+		}
+		if (threads > count) {
+			threads = (unsigned)count;
+		}
+		if (threads <= 1) {
+			for (size_t i = 0; i < count; i++) {
+				task(i);
+			}
+			return;
+		}
+
+		std::atomic<size_t> next(0);
+		std::exception_ptr error;
+		std::mutex errorMutex;
+
+		auto worker = [&]() {
+			for (size_t i = next++; i < count; i = next++) {
+				try {
+					task(i);
+				}
+				catch (...) {
+					std::lock_guard<std::mutex> lock(errorMutex);
+					if (!error) error = std::current_exception();
+					next = count;
+				}
+			}
+		};
+
+		std::vector<std::thread> pool;
+		pool.reserve(threads - 1);
+		for (unsigned t = 1; t < threads; t++) {
+			pool.emplace_back(worker);
+		}
+		worker();
+		for (auto &thread : pool) {
+			thread.join();
+		}
+
+		if (error) {
+			std::rethrow_exception(error);
+		}
+	}
+
 	//////////////////////////////////////////////////////////////////////////////
 	// CHUNK
 	//////////////////////////////////////////////////////////////////////////////
 
 	/**
 	* Chunks are generated while loading voxel data and are discarded
-	* when loading is finished.
+	* when loading is finished. They do not copy their content but point
+	* into the data being loaded.
 	* Due to the reason that this class is not supposed to be used by the user,
 	* it is defined privately.
 	*/
 	struct VoxReader::Chunk {
-		Chunk(std::istream &s, int *byteOffset = nullptr);
+		Chunk(const uint8_t *begin, const uint8_t *ptr, const uint8_t *end, int depth = 0);
 
 		void print(int indent, std::ostream &s) const;
 
 		char id[5];
-		std::vector<uint8_t> content;
+		const uint8_t *content;
+		uint32_t contentSize;
+		uint64_t offset; // of the chunk header, relative to the start of the data
+		uint64_t size;   // header, content and children
 		std::vector<Chunk> children;
 	};
 
-	VoxReader::Chunk::Chunk(std::istream &s, int *byteOffset) {
-		int rootByte = 0;
-		if (byteOffset == nullptr) {
-			byteOffset = &rootByte;
+	VoxReader::Chunk::Chunk(const uint8_t *begin, const uint8_t *ptr, const uint8_t *end, int depth) {
+		if (depth > MAX_CHUNK_DEPTH) {
+			throw Exception("Chunks are nested too deeply");
+		}
+		if (end - ptr < 4 + 4 + 4) {
+			throw Exception("Chunk header exceeds the data");
 		}
 
-		s.read(id, 4);
+		memcpy(id, ptr, 4);
 		id[4] = '\0';
 
-		int contentSize = readInt(s);
-		int childrenSize = readInt(s);
+		contentSize = (uint32_t)readInt(ptr + 4);
+		uint32_t childrenSize = (uint32_t)readInt(ptr + 8);
 
-		*byteOffset += 4 + 4 + 4;
-
-		int startByte = *byteOffset;
-
-		*byteOffset += contentSize;
+		offset = ptr - begin;
+		size = 4 + 4 + 4 + (uint64_t)contentSize + childrenSize;
+		if ((uint64_t)(end - ptr) < size) {
+			throw Exception(std::string("Chunk '") + id + "' exceeds the data");
+		}
 
-		// Read content:
-		content.resize(contentSize);
-		s.read(reinterpret_cast<char *>(content.data()), content.size());
+		content = ptr + 4 + 4 + 4;
 
 		// Read children:
-		while (*byteOffset - startByte < childrenSize) {
-			children.push_back(Chunk(s, byteOffset));
+		const uint8_t *child = content + contentSize;
+		const uint8_t *childrenEnd = child + childrenSize;
+		while (child < childrenEnd) {
+			children.push_back(Chunk(begin, child, childrenEnd, depth + 1));
+			child += children.back().size;
 		}
-
-		*byteOffset += childrenSize;
 	}
 
 	void VoxReader::Chunk::print(int indent, std::ostream &s) const {
 		static const int INDENT_LENGTH = 4;
 		std::string tab(indent * INDENT_LENGTH, ' ');
 		s << tab.c_str() << '[' << id << ']' << std::endl;
-		s << tab.c_str() << "  Content size: " << std::hex << std::uppercase << std::showbase << content.size() << " bytes" << std::endl;
+		s << tab.c_str() << "  Content size: " << std::hex << std::uppercase << std::showbase << contentSize << " bytes" << std::endl;
 
 		// Print content:
 		s << tab.c_str() << "  Content:";
-		for (size_t i = 0; i < content.size(); i++) {
+		for (size_t i = 0; i < contentSize; i++) {
 			if (0 == i % 16) s << std::endl << tab.c_str() << "    ";
 			s << std::hex << std::noshowbase << std::setw(2) << std::setfill('0') << (unsigned)content[i] << ' ';
 		}
@@ -336,7 +722,7 @@ namespace jim {
 
 		// Print children:
 		s << tab.c_str() << "  Children: " << std::hex << std::uppercase << std::showbase << children.size() << std::endl;
-		for (const auto child : children) {
+		for (const auto &child : children) {
 			child.print(indent + 1, s);
 		}
 	}
@@ -344,34 +730,227 @@ namespace jim {
 	//////////////////////////////////////////////////////////////////////////////
 	// EXTEDNED FORMAT UTILITIES
 	//////////////////////////////////////////////////////////////////////////////
-	std::string readString(const uint8_t** input) {
-		int32_t size = readInt(*input);
-		*input += 4;
-		std::string str(*input, *input + size);
-		*input += size;
-		return str;
+
+	/**
+	* Bounds checked reading of chunk content. Checks are made once per field, strings and arrays are checked
+	* as a whole (e.g. a dictionary of n entries needs at least 8 * n bytes) instead of per byte.
+	*/
+	class ChunkCursor {
+	public:
+		ChunkCursor(const uint8_t *ptr, const uint8_t *end) : ptr(ptr), end(end) {}
+
+		void need(uint64_t size) const {
+			if ((uint64_t)(end - ptr) < size) {
+				throw VoxReader::Exception("Chunk content is truncated");
+			}
+		}
+
+		int32_t int32() {
+			need(4);
+			int32_t value = readInt(ptr);
+			ptr += 4;
+			return value;
+		}
+
+		/**
+		* Reads a count of items which need at least itemSize bytes each.
+		*/
+		uint32_t count(uint32_t itemSize) {
+			int32_t count = int32();
+			if (count < 0) {
+				throw VoxReader::Exception("Chunk content has a negative count");
+			}
+			need((uint64_t)count * itemSize);
+			return (uint32_t)count;
+		}
+
+		const uint8_t* bytes(uint32_t size) {
+			need(size);
+			const uint8_t *bytes = ptr;
+			ptr += size;
+			return bytes;
+		}
+
+		std::string string() {
+			uint32_t size = count(1);
+			const uint8_t *text = bytes(size);
+			return std::string(text, text + size);
+		}
+
+		Dictionary dictionary() {
+			uint32_t entries = count(8);
+			Dictionary dictionary;
+			dictionary.reserve(entries);
+			for (uint32_t i = 0; i < entries; ++i) {
+				std::string key = string();
+				std::string value = string();
+				dictionary.emplace_back(std::move(key), std::move(value));
+			}
+			return dictionary;
+		}
+
+		/**
+		* Checks a dictionary without decoding it.
+		*/
+		void skipDictionary() {
+			uint32_t entries = count(8);
+			for (uint32_t i = 0; i < 2 * entries; ++i) {
+				bytes(count(1));
+			}
+		}
+
+		const uint8_t *ptr, *end;
+	};
+
+	/**
+	* Returns the highest node, layer or material id vox-data of the given size can have with dense ids (one per chunk header).
+	*/
+	static int32_t maxObjectId(size_t size) {
+		return (int32_t)std::min<size_t>(size / 12, INT32_MAX);
 	}
 
-	std::vector < std::pair<std::string, std::string>> readDictionary(const uint8_t** ptr) {
-		int entries = readInt(*ptr);
-		*ptr += 4;
-		std::vector < std::pair<std::string, std::string>> dictionary;
-		dictionary.reserve(entries);
-		for (int i = 0; i < entries; ++i) {
-			std::string key = readString(ptr);
-			std::string value = readString(ptr);
-			dictionary.emplace_back(key, value);
+	Dictionary readDictionary(const uint8_t *ptr, const uint8_t *end) {
+		ChunkCursor cursor(ptr, end);
+		return cursor.dictionary();
+	}
+
+	const std::string* findValue(const Dictionary &dictionary, const char *key) {
+		for (const auto &entry : dictionary) {
+			if (entry.first == key) {
+				return &entry.second;
+			}
 		}
-		return dictionary;
+		return nullptr;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// HASH
+	//////////////////////////////////////////////////////////////////////////////
+
+	static const uint64_t XXH_PRIME1 = 11400714785074694791ULL;
+	static const uint64_t XXH_PRIME2 = 14029467366897019727ULL;
+	static const uint64_t XXH_PRIME3 = 1609587929392839161ULL;
+	static const uint64_t XXH_PRIME4 = 9650029242287828579ULL;
+	static const uint64_t XXH_PRIME5 = 2870177450012600261ULL;
+
+	static inline uint64_t rotateLeft(uint64_t value, int bits) {
+		return (value << bits) | (value >> (64 - bits));
+	}
+
+	static inline uint64_t read64(const uint8_t *p) {
+		uint64_t value;
+		memcpy(&value, p, 8);
+		return value;
+	}
+
+	static inline uint64_t xxhRound(uint64_t acc, uint64_t input) {
+		return rotateLeft(acc + input * XXH_PRIME2, 31) * XXH_PRIME1;
+	}
+
+	static inline uint64_t xxhMerge(uint64_t acc, uint64_t value) {
+		return (acc ^ xxhRound(0, value)) * XXH_PRIME1 + XXH_PRIME4;
+	}
+
+	uint64_t hash64(const void *data, size_t size, uint64_t seed) {
+		const uint8_t *p = static_cast<const uint8_t *>(data);
+		const uint8_t *end = p + size;
+		uint64_t h;
+
+		if (size >= 32) {
+			uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2, v2 = seed + XXH_PRIME2, v3 = seed, v4 = seed - XXH_PRIME1;
+			for (; end - p >= 32; p += 32) {
+				v1 = xxhRound(v1, read64(p));
+				v2 = xxhRound(v2, read64(p + 8));
+				v3 = xxhRound(v3, read64(p + 16));
+				v4 = xxhRound(v4, read64(p + 24));
+			}
+			h = rotateLeft(v1, 1) + rotateLeft(v2, 7) + rotateLeft(v3, 12) + rotateLeft(v4, 18);
+			h = xxhMerge(h, v1);
+			h = xxhMerge(h, v2);
+			h = xxhMerge(h, v3);
+			h = xxhMerge(h, v4);
+		}
+		else {
+			h = seed + XXH_PRIME5;
+		}
+
+		h += size;
+		for (; end - p >= 8; p += 8) {
+			h = rotateLeft(h ^ xxhRound(0, read64(p)), 27) * XXH_PRIME1 + XXH_PRIME4;
+		}
+		if (end - p >= 4) {
+			h = rotateLeft(h ^ (uint64_t)(uint32_t)readInt(p) * XXH_PRIME1, 23) * XXH_PRIME2 + XXH_PRIME3;
+			p += 4;
+		}
+		for (; p < end; p++) {
+			h = rotateLeft(h ^ *p * XXH_PRIME5, 11) * XXH_PRIME1;
+		}
+
+		h ^= h >> 33;
+		h *= XXH_PRIME2;
+		h ^= h >> 29;
+		h *= XXH_PRIME3;
+		h ^= h >> 32;
+		return h;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// MAPPED FILE
+	//////////////////////////////////////////////////////////////////////////////
+
+	MappedFile::MappedFile(const std::string &path) {
+#ifdef JIM_VOXREADER_MMAP
+		int fd = open(path.c_str(), O_RDONLY);
+		if (fd < 0) {
+			throw VoxReader::Exception("Cannot open '" + path + "'");
+		}
+		struct stat info;
+		if (fstat(fd, &info) != 0) {
+			close(fd);
+			throw VoxReader::Exception("Cannot stat '" + path + "'");
+		}
+		length = (size_t)info.st_size;
+		if (length > 0) {
+			void *address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (address == MAP_FAILED) {
+				close(fd);
+				throw VoxReader::Exception("Cannot map '" + path + "'");
+			}
+			bytes = static_cast<const uint8_t *>(address);
+			mapped = true;
+		}
+		close(fd);
+#else
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			throw VoxReader::Exception("Cannot open '" + path + "'");
+		}
+		buffer = VoxReader::readStream(file);
+		bytes = buffer.data();
+		length = buffer.size();
+#endif
+	}
+
+	MappedFile::~MappedFile() {
+#ifdef JIM_VOXREADER_MMAP
+		if (mapped) {
+			munmap(const_cast<uint8_t *>(bytes), length);
+		}
+#endif
 	}
 
 	//////////////////////////////////////////////////////////////////////////////
 	// VOX-READER
 	//////////////////////////////////////////////////////////////////////////////
 
+	// The spec lists the colors as they are stored in a RGBA chunk read as little endian integers (0xAABBGGRR):
+	static inline RGBA fromChunkOrder(uint32_t color) {
+		return RGBA((uint8_t)(color >> 24), (uint8_t)color, (uint8_t)(color >> 8), (uint8_t)(color >> 16));
+	}
+
 	template<typename... C>
 	static inline std::vector<RGBA> makePalette(C... colors) {
-		return std::vector<RGBA>{ (RGBA(colors))... };
+		return std::vector<RGBA>{ (fromChunkOrder(colors))... };
 	}
 
 	std::vector<RGBA> VoxReader::DEFAULT_PALETTE = makePalette(
@@ -401,141 +980,379 @@ namespace jim {
 
 	void VoxReader::load(std::istream &s) {
 
+		// Read the whole stream, chunks are parsed in place:
+		std::vector<uint8_t> data;
+		uint64_t start = steadyNanoseconds();
+		{
+			JIM_VOXREADER_TRACE_SCOPE("read stream");
+			data = readStream(s);
+		}
+		uint64_t read = steadyNanoseconds() - start;
+		load(data.data(), data.size());
+		decodeTimings.read = read;
+		decodeTimings.total += read;
+	}
+
+	std::vector<uint8_t> VoxReader::readStream(std::istream &s) {
+
 		if (!s) {
 			throw Exception("Cannot read from stream");
 		}
 
-		// Reset current state:
+		std::vector<uint8_t> data;
+		std::streampos start = s.tellg();
+		if (start != std::streampos(-1) && s.seekg(0, std::ios::end)) {
+			std::streamoff size = s.tellg() - start;
+			s.seekg(start);
+			data.resize((size_t)size);
+			s.read(reinterpret_cast<char *>(data.data()), size);
+			data.resize((size_t)s.gcount());
+		}
+		else {
+			s.clear();
+			char buffer[64 * 1024];
+			while (s.read(buffer, sizeof(buffer)) || s.gcount() > 0) {
+				data.insert(data.end(), buffer, buffer + s.gcount());
+			}
+		}
+
+		return data;
+	}
+
+	void VoxReader::clear() {
 		models.clear();
 		if (palette != &DEFAULT_PALETTE) {
 			delete palette;
+			palette = &DEFAULT_PALETTE;
 		}
+		sceneGraph.nodes.clear();
+		layers.clear();
+		materials.clear();
+		unknownChunks.clear();
+		sourceChunks.clear();
+		sourceSize = 0;
+		sourceHash = 0;
+		decodeTimings = DecodeTimings();
+	}
+
+	void VoxReader::load(const uint8_t *data, size_t size) {
+		JIM_VOXREADER_TRACE_SCOPE_ARG("load", "size", (int64_t)size);
+
+		// Reset current state:
+		clear();
+		const uint64_t start = steadyNanoseconds();
+		sourceSize = size;
+		sourceHash = hash64(data, size);
 
 		// Check for the magic string "VOX ":
-		char magic[4];
-		s.read(magic, 4);
-		if (!strcmp(magic, "VOX ")) {
+		if (size < 8 || memcmp(data, "VOX ", 4) != 0) {
 			throw Exception("Magic string 'VOX ' is missing");
 		}
 
 		// Check version of VOX file:
-		if (readInt(s) != 150) {
+		if (readInt(data + 4) != 150) {
 			throw Exception("Version is not 150");
 		}
 
 		// Read main chunk:
-		Chunk main(s);
+		Chunk main = [&]() {
+			JIM_VOXREADER_TRACE_SCOPE("chunk index");
+			return Chunk(data, data + 8, data + size);
+		}();
+		if (strcmp(main.id, "MAIN")) {
+			throw Exception("MAIN chunk is missing");
+		}
+		decodeTimings.index = steadyNanoseconds() - start;
 
 		// Create models based on chunk tree:
-		uint32_t modelCount;
-		auto iter = main.children.begin();
-		Chunk &pack = main.children[0];
+		sourceChunks.reserve(main.children.size());
+		decodeChunks(data, main.children, 0, true);
 
-		if (!strcmp(pack.id, "PACK")) {
-			modelCount = readInt(&pack.content[0]);
-			iter++;
-		}
-		else {
-			// Has no 'PACK' spec => 1 model:
-			modelCount = 1;
-		}
+		decodeTimings.total = steadyNanoseconds() - start;
+	}
 
-		while (iter != main.children.end()) {
+	size_t VoxReader::decodeChunks(const uint8_t *data, const std::vector<Chunk> &chunks, size_t first, bool last) {
+
+		// Node, layer and material ids index vectors, so an id beyond the number of chunks fitting into the data is corrupt:
+		const int32_t maxId = maxObjectId((size_t)sourceSize);
+
+		auto iter = chunks.begin() + first;
+		while (iter != chunks.end()) {
+			JIM_VOXREADER_TRACE_SCOPE_ARG(iter->id, "offset", (int64_t)iter->offset);
+			const uint64_t chunkStart = steadyNanoseconds();
+			uint64_t *timing = &decodeTimings.other;
+
+			ChunkRef ref;
+			memcpy(ref.id, iter->id, 5);
+			ref.offset = iter->offset;
+			ref.size = iter->size;
+			ref.index = -1;
+
+			// Pack (the model count is implied by the SIZE chunks):
+			if (!strcmp(iter->id, "PACK")) {
+				timing = &decodeTimings.models;
+				++iter;
+			}
 
 			// Model:
-			if (!strcmp(iter->id, "SIZE")) {
+			else if (!strcmp(iter->id, "SIZE")) {
 				auto sizeChunkIter = iter++;
+				if (iter == chunks.end() && !last) {
+					// The XYZI chunk is still to come:
+					return (size_t)(sizeChunkIter - chunks.begin());
+				}
+				if (iter == chunks.end() || strcmp(iter->id, "XYZI")) {
+					throw Exception("SIZE chunk is not followed by a XYZI chunk");
+				}
 				auto xyziChunkIter = iter++;
+				timing = &decodeTimings.models;
+				ref.index = (int32_t)models.size();
+				JIM_VOXREADER_TRACE_SCOPE_ARG("model", "index", ref.index);
 				models.push_back(Model(*sizeChunkIter, *xyziChunkIter));
+
+				// Both chunks refer to the same model:
+				sourceChunks.push_back(ref);
+				memcpy(ref.id, xyziChunkIter->id, 5);
+				ref.offset = xyziChunkIter->offset;
+				ref.size = xyziChunkIter->size;
+			}
+			else if (!strcmp(iter->id, "XYZI")) {
+				throw Exception("XYZI chunk is not preceded by a SIZE chunk");
 			}
 
 			// Palette:
 			else if (!strcmp(iter->id, "RGBA")) {
 				auto rgbaChunkIter = iter++;
-				palette = new std::vector<RGBA>;
+				timing = &decodeTimings.palette;
+				if (rgbaChunkIter->contentSize < 4 * 256) {
+					throw Exception("RGBA chunk is too small");
+				}
+				if (palette == &DEFAULT_PALETTE) {
+					palette = new std::vector<RGBA>;
+				}
 				palette->resize(256);
-				memcpy(&(*palette)[0], &rgbaChunkIter->content[0], 4 * 256);
+				memcpy(&(*palette)[0], rgbaChunkIter->content, 4 * 256);
 			}
 
 			// Node:
 			else if (iter->id[0] == 'n') {
+				timing = &decodeTimings.sceneGraph;
+				if (iter->contentSize >= 4 && readInt(iter->content) > maxId) {
+					throw Exception("Node id exceeds the data");
+				}
 
 				// Scene transform node:
 				if (!strcmp(iter->id, "nTRN")) {
-					sceneGraph.readTransformNode(iter++->content.data());
+					sceneGraph.readTransformNode(iter->content, iter->content + iter->contentSize);
 				}
 
 				// Scene group node:
 				else if (!strcmp(iter->id, "nGRP")) {
-					sceneGraph.readGroupNode(iter++->content.data());
+					sceneGraph.readGroupNode(iter->content, iter->content + iter->contentSize);
 				}
 
 				// Scene group node:
 				else if (!strcmp(iter->id, "nSHP")) {
-					sceneGraph.readShapeNode(iter->content.data());
+					sceneGraph.readShapeNode(iter->content, iter->content + iter->contentSize);
 				}
 				else throw Exception("Unknown node!");
 
+				ref.index = readInt(iter->content); // checked by the node readers
 				++iter; // chunk processed
 			}
 
 			// Layer:
 			else if (!strcmp(iter->id, "LAYR")) {
-				const uint8_t* ptr = &(iter++)->content[0];
-				int32 layerId = readInt(ptr);
-				ptr += 4;
-				if (layerId <= layers.size()) {
+				timing = &decodeTimings.layers;
+				ChunkCursor cursor(iter->content, iter->content + iter->contentSize);
+				++iter;
+				int32_t layerId = cursor.int32();
+				if (layerId < 0) {
+					throw Exception("Layer id is negative");
+				}
+				if (layerId > maxId) {
+					throw Exception("Layer id exceeds the data");
+				}
+				if (layerId >= (int32_t)layers.size()) {
 					layers.resize(layerId + 1);
 				}
-				layers[layerId].attributes = readDictionary(&ptr);
+				layers[layerId].attributes = cursor.dictionary();
+				ref.index = layerId;
 			}
 
 			// Material (extended):
 			else if (!strcmp(iter->id, "MATL")) {
-				const uint8_t* ptr = &(iter++)->content[0];
-				int32 matId = readInt(ptr);
-				ptr += 4;
-				if (matId <= materials.size()) {
+				timing = &decodeTimings.materials;
+				ChunkCursor cursor(iter->content, iter->content + iter->contentSize);
+				++iter;
+				int32_t matId = cursor.int32();
+				if (matId < 0) {
+					throw Exception("Material id is negative");
+				}
+				if (matId > maxId) {
+					throw Exception("Material id exceeds the data");
+				}
+				if (matId >= (int32_t)materials.size()) {
 					materials.resize(matId + 1);
 				}
-				materials[matId].properties = readDictionary(&ptr);
+				materials[matId].properties = cursor.dictionary();
+				ref.index = matId;
 			}
 
-			// throw to avoid infinite loop
+			// Keep everything else verbatim:
 			else {
-				//throw("Unknown chunk!");
+				RawChunk raw;
+				memcpy(raw.id, iter->id, 5);
+				const uint8_t *chunkBegin = data + iter->offset;
+				raw.bytes.assign(chunkBegin, chunkBegin + iter->size);
+				ref.index = (int32_t)unknownChunks.size();
+				unknownChunks.push_back(std::move(raw));
 				++iter;
 			}
+
+			sourceChunks.push_back(ref);
+			*timing += steadyNanoseconds() - chunkStart;
+		}
+
+		return chunks.size();
+	}
+
+	RGBA VoxReader::getColor(uint8_t colorIndex) const {
+		if (palette == nullptr || palette == &DEFAULT_PALETTE) {
+			return DEFAULT_PALETTE[colorIndex];
 		}
+		if (colorIndex == 0 || colorIndex > palette->size()) {
+			return RGBA();
+		}
+		return (*palette)[colorIndex - 1];
+	}
+
+	// Strings short enough for the small string optimization are stored inside the string object:
+	static size_t heapSize(const std::string &s) {
+		const char *inlineBegin = reinterpret_cast<const char *>(&s);
+		const char *inlineEnd = inlineBegin + sizeof(s);
+		return s.data() >= inlineBegin && s.data() < inlineEnd ? 0 : s.capacity() + 1;
+	}
+
+	static size_t heapSize(const Dictionary &dictionary) {
+		size_t size = dictionary.capacity() * sizeof(Dictionary::value_type);
+		for (const auto &entry : dictionary) {
+			size += heapSize(entry.first) + heapSize(entry.second);
+		}
+		return size;
 	}
 
-	void VoxReader::print(std::ostream & s) {
-		s << "VOXEL-OBJECT:" << std::endl;
+	VoxReader::MemoryUsage VoxReader::memoryUsage() const {
+		MemoryUsage memory;
 
-		s << "Num models: " << models.size() << std::endl;
-		for (const auto model : models) {
-			s << std::noshowbase << "Model:  size(" << model.sizeX << ',' << model.sizeY << ',' << model.sizeZ << ")" << std::endl;
-			for (const auto voxel : model.voxels) {
-				s << "   Voxel: ";
-				s << std::noshowbase << std::setw(2) << std::setfill('0') << (unsigned)voxel.x << ',';
-				s << std::noshowbase << std::setw(2) << std::setfill('0') << (unsigned)voxel.y << ',';
-				s << std::noshowbase << std::setw(2) << std::setfill('0') << (unsigned)voxel.z << ',';
-				s << "   color=" << std::noshowbase << std::setw(2) << std::setfill('0') << (unsigned)voxel.colorIndex << std::endl;
+		memory.models = models.capacity() * sizeof(Model);
+		for (const Model &model : models) {
+			memory.models += model.voxels.capacity() * sizeof(Voxel);
+		}
+
+		if (palette != nullptr && palette != &DEFAULT_PALETTE) {
+			memory.palette = sizeof(*palette) + palette->capacity() * sizeof(RGBA);
+		}
+
+		memory.sceneGraph = sceneGraph.nodes.capacity() * sizeof(sceneGraph.nodes[0]);
+		for (const auto &node : sceneGraph.nodes) {
+			if (!node) continue;
+			memory.sceneGraph += heapSize(node->attributes);
+			switch (node->type) {
+			case SceneGraph::Node::TRANSFORM: {
+				const auto &transform = static_cast<const SceneGraph::TransformNode &>(*node);
+				memory.sceneGraph += sizeof(transform) + transform.frame_attributes.capacity() * sizeof(Dictionary);
+				for (const Dictionary &frame : transform.frame_attributes) {
+					memory.sceneGraph += heapSize(frame);
+				}
+				break;
+			}
+			case SceneGraph::Node::GROUP: {
+				const auto &group = static_cast<const SceneGraph::GroupNode &>(*node);
+				memory.sceneGraph += sizeof(group) + group.childNodeIds.capacity() * sizeof(SceneGraph::NodeId);
+				break;
+			}
+			case SceneGraph::Node::SHAPE: {
+				const auto &shape = static_cast<const SceneGraph::ShapeNode &>(*node);
+				memory.sceneGraph += sizeof(shape) + shape.models.capacity() * sizeof(SceneGraph::Model);
+				for (const auto &model : shape.models) {
+					memory.sceneGraph += heapSize(model.attributes);
+				}
+				break;
+			}
 			}
 		}
 
-		s << "Palette: " << (palette == nullptr ? "(DEFAULT)" : "");
+		memory.layers = layers.capacity() * sizeof(Layer);
+		for (const Layer &layer : layers) {
+			memory.layers += heapSize(layer.attributes);
+		}
+
+		memory.materials = materials.capacity() * sizeof(MaterialEx);
+		for (const MaterialEx &material : materials) {
+			memory.materials += heapSize(material.properties);
+		}
+
+		memory.unknownChunks = unknownChunks.capacity() * sizeof(RawChunk);
+		for (const RawChunk &raw : unknownChunks) {
+			memory.unknownChunks += raw.bytes.capacity();
+		}
+
+		memory.sourceChunks = sourceChunks.capacity() * sizeof(ChunkRef);
+		return memory;
+	}
+
+	VoxReader::Stats VoxReader::stats() const {
+		Stats stats;
+		stats.bytesRead = sourceSize;
+		for (const ChunkRef &ref : sourceChunks) {
+			stats.chunkCounts[ref.id]++;
+		}
+		stats.modelCount = models.size();
+		for (const Model &model : models) {
+			stats.voxelCount += model.voxels.size();
+		}
+		for (const auto &node : sceneGraph.nodes) {
+			if (node) stats.nodeCount++;
+		}
+		stats.memory = memoryUsage();
+		stats.timings = decodeTimings;
+		return stats;
+	}
+
+	void VoxReader::print(std::ostream &s) const {
+
+		// Lines are formatted into a buffer, written in blocks and the format flags of the stream are left alone:
+		std::string out;
+		char line[64];
+		auto append = [&](int length) {
+			out.append(line, (size_t)length);
+			if (out.size() >= 64 * 1024) {
+				s.write(out.data(), (std::streamsize)out.size());
+				out.clear();
+			}
+		};
+
+		append(snprintf(line, sizeof(line), "VOXEL-OBJECT:\nNum models: %zu\n", models.size()));
+		for (const Model &model : models) {
+			append(snprintf(line, sizeof(line), "Model:  size(%u,%u,%u)\n", model.sizeX, model.sizeY, model.sizeZ));
+			for (const Voxel &voxel : model.voxels) {
+				append(snprintf(line, sizeof(line), "   Voxel: %02u,%02u,%02u,   color=%02u\n",
+					(unsigned)voxel.x, (unsigned)voxel.y, (unsigned)voxel.z, (unsigned)voxel.colorIndex));
+			}
+		}
+
+		append(snprintf(line, sizeof(line), "Palette: %s", palette == &DEFAULT_PALETTE ? "(DEFAULT)" : ""));
 		for (uint32_t i = 0; i < palette->size(); i++) {
-			if (0 == i % 16) std::cout << std::endl << "   ";
-			palette->data()[i].print(std::cout);
-			std::cout << "  ";
+			append(snprintf(line, sizeof(line), "%s%08x  ", i % 16 == 0 ? "\n   " : "", (*palette)[i].pack()));
 		}
-		std::cout << std::endl;
+		out += '\n';
+		s.write(out.data(), (std::streamsize)out.size());
 	}
 
-	std::vector<std::vector<Voxel *>> VoxReader::view2d(const Viewport2d viewport, uint8_t flags, uint32_t modelIndex) const {
+	std::vector<std::vector<const Voxel *>> VoxReader::view2d(const Viewport2d viewport, uint8_t flags, uint32_t modelIndex) const {
 
-		std::vector<std::vector<Voxel *>> view;
+		std::vector<std::vector<const Voxel *>> view;
 		const Model &model = models[modelIndex];
 
 		view.resize(model.sizeX);
@@ -555,9 +1372,10 @@ namespace jim {
 			}
 		};
 
-		for (auto voxel : model.voxels) {
+		// The view points into the model, so voxels must not be copied:
+		for (const Voxel &voxel : model.voxels) {
 
-			uint8_t vx, vy, vz, vzOther;
+			uint8_t vx, vy, vz, vzOther = 0;
 
 			auto invertUp = [&flags](uint32_t v, uint32_t max) {
 				return flags & INVERT_UP ? max - v - 1 : v;
@@ -618,7 +1436,7 @@ namespace jim {
 			}
 		}
 
-		return std::move(view);
+		return view;
 	}
 
 	//////////////////////////////////////////////////////////////////////////////
@@ -634,24 +1452,83 @@ namespace jim {
 
 	Model::Model(const VoxReader::Chunk &sizeChunk, const VoxReader::Chunk &xyziChunk) {
 
+		if (sizeChunk.contentSize < 12 || xyziChunk.contentSize < 4) {
+			throw VoxReader::Exception("SIZE or XYZI chunk is too small");
+		}
+
 		// Size:
-		sizeX = readInt(&sizeChunk.content[0]);
-		sizeY = readInt(&sizeChunk.content[4]);
-		sizeZ = readInt(&sizeChunk.content[8]);
+		sizeX = readInt(sizeChunk.content + 0);
+		sizeY = readInt(sizeChunk.content + 4);
+		sizeZ = readInt(sizeChunk.content + 8);
 
-		// Voxels:
+		// Voxels, the XYZI layout matches Voxel so they are copied in bulk:
 		uint32_t voxelCount;
-		voxelCount = readInt(&xyziChunk.content[0]);
+		voxelCount = readInt(xyziChunk.content);
+		if (voxelCount > (xyziChunk.contentSize - 4) / 4) {
+			throw VoxReader::Exception("XYZI voxel count exceeds the chunk");
+		}
+
+		static_assert(sizeof(Voxel) == 4, "Voxel must match the 4 byte XYZI layout");
+		const Voxel *first = reinterpret_cast<const Voxel *>(xyziChunk.content + 4);
+		voxels.assign(first, first + voxelCount);
+	}
+
+	Model::Model(uint32_t sizeX, uint32_t sizeY, uint32_t sizeZ)
+		: sizeX(sizeX), sizeY(sizeY), sizeZ(sizeZ) {}
+
+	// Every voxel is mixed on its own and the results are summed, so the order of the voxels does not matter:
+	static const uint64_t VOXEL_MIX1 = 0x9E3779B1;
+	static const uint64_t VOXEL_MIX2 = 0x85EBCA77;
+
+	static inline uint64_t mixVoxel(uint32_t voxel) {
+		uint64_t a = voxel * VOXEL_MIX1;
+		uint64_t b = (uint32_t)(a ^ (a >> 32)) * VOXEL_MIX2;
+		return b ^ (b >> 32);
+	}
+
+	uint64_t Model::contentHash() const {
+		const size_t count = voxels.size();
+		const uint8_t *p = reinterpret_cast<const uint8_t *>(voxels.data());
+		uint64_t sum = 0;
+		size_t i = 0;
+
+#ifdef __AVX2__
+		__m256i acc = _mm256_setzero_si256();
+		const __m256i mix1 = _mm256_set1_epi64x((long long)VOXEL_MIX1);
+		const __m256i mix2 = _mm256_set1_epi64x((long long)VOXEL_MIX2);
+		for (; i + 4 <= count; i += 4) {
+			__m256i v = _mm256_cvtepu32_epi64(_mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 4 * i)));
+			__m256i a = _mm256_mul_epu32(v, mix1);
+			__m256i b = _mm256_mul_epu32(_mm256_xor_si256(a, _mm256_srli_epi64(a, 32)), mix2);
+			acc = _mm256_add_epi64(acc, _mm256_xor_si256(b, _mm256_srli_epi64(b, 32)));
+		}
+		uint64_t lanes[4];
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), acc);
+		sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+		for (; i < count; i++) {
+			sum += mixVoxel((uint32_t)readInt(p + 4 * i));
+		}
 
-		for (uint32_t i = 1; i <= voxelCount; i++) {
-			uint32_t byte = i * 4;
-			voxels.push_back(Voxel(
-				xyziChunk.content[byte + 0],
-				xyziChunk.content[byte + 1],
-				xyziChunk.content[byte + 2],
-				xyziChunk.content[byte + 3]
-			));
+		const uint64_t key[5] = { sizeX, sizeY, sizeZ, count, sum };
+		return hash64(key, sizeof(key));
+	}
+
+	bool Model::sameContent(const Model &other) const {
+		if (sizeX != other.sizeX || sizeY != other.sizeY || sizeZ != other.sizeZ || voxels.size() != other.voxels.size()) {
+			return false;
+		}
+		if (memcmp(voxels.data(), other.voxels.data(), 4 * voxels.size()) == 0) {
+			return true;
 		}
+
+		std::vector<uint32_t> a(voxels.size()), b(voxels.size());
+		memcpy(a.data(), voxels.data(), 4 * a.size());
+		memcpy(b.data(), other.voxels.data(), 4 * b.size());
+		std::sort(a.begin(), a.end());
+		std::sort(b.begin(), b.end());
+		return a == b;
 	}
 
 	//////////////////////////////////////////////////////////////////////////////
@@ -674,10 +1551,12 @@ namespace jim {
 	}
 
 	RGBA::RGBA(uint8_t a, uint8_t r, uint8_t g, uint8_t b)
-		: a(a), r(r), g(g), b(b) {}
+		: r(r), g(g), b(b), a(a) {}
 
 	void RGBA::print(std::ostream & s) const {
-		s << std::hex << std::noshowbase << std::setw(8) << std::setfill('0') << pack();
+		char hex[9];
+		snprintf(hex, sizeof(hex), "%08x", pack());
+		s.write(hex, 8);
 	}
 
 	uint32_t RGBA::pack() const {
@@ -698,68 +1577,193 @@ namespace jim {
 
 	template <typename NODE>
 	NODE& SceneGraph::addNode(NodeId id) {
-		if (id >= nodes.size()) { nodes.resize(id + 1); }
+		if (id < 0) throw VoxReader::Exception("SceneGraph node id is negative!");
+		if (id >= (NodeId)nodes.size()) { nodes.resize(id + 1); }
 		if (nodes[id]) throw VoxReader::Exception("SceneGraph node duplicate!");
 		else nodes[id].reset(new NODE());
 		return static_cast<NODE&>(*nodes[id]);
 	}
 
+	SceneGraph::TransformNode& SceneGraph::AddTransformNode(NodeId id) {
+		return addNode<TransformNode>(id);
+	}
+
+	SceneGraph::GroupNode& SceneGraph::AddGroupNode(NodeId id) {
+		return addNode<GroupNode>(id);
+	}
+
+	SceneGraph::ShapeNode& SceneGraph::AddShapeNode(NodeId id) {
+		return addNode<ShapeNode>(id);
+	}
+
 	const SceneGraph::Node* SceneGraph::GetNode(NodeId id) const {
-		if (id < 0 || id >= nodes.size()) {
+		if (id < 0 || id >= (NodeId)nodes.size()) {
 			return nullptr;
 		}
 		return nodes[id].get();
 	}
 
-	void SceneGraph::readTransformNode(const uint8_t* ptr) {
-		auto& node = addNode<TransformNode>(readInt(ptr));
-		ptr += 4;
-		node.attributes = readDictionary(&ptr);
-		node.childNodeId = readInt(ptr);
-		ptr += 4;
-		if (readInt(ptr) != -1) {
+	SceneGraph::Node* SceneGraph::GetNode(NodeId id) {
+		return const_cast<Node *>(static_cast<const SceneGraph *>(this)->GetNode(id));
+	}
+
+	void SceneGraph::readTransformNode(const uint8_t* ptr, const uint8_t* end) {
+		ChunkCursor cursor(ptr, end);
+		auto& node = addNode<TransformNode>(cursor.int32());
+		node.attributes = cursor.dictionary();
+		node.childNodeId = cursor.int32();
+		if (cursor.int32() != -1) {
 			// reserved id (must be -1)
 			throw VoxReader::Exception("Expectation not met: reserved id must be -1 (v150 extended spec)");
 		}
-		ptr += 4;
-		node.layerId = readInt(ptr);
-		ptr += 4;
-		int numOfFrames = readInt(ptr);
-		ptr += 4;
+		node.layerId = cursor.int32();
+		uint32_t numOfFrames = cursor.count(4);
 		node.frame_attributes.resize(numOfFrames);
-		for (int i = 0; i < numOfFrames; ++i)
+		for (uint32_t i = 0; i < numOfFrames; ++i)
 		{
-			node.frame_attributes[i] = readDictionary(&ptr);
+			node.frame_attributes[i] = cursor.dictionary();
 		}
 	}
 
-	void SceneGraph::readGroupNode(const uint8_t* ptr) {
-		auto& node = addNode<GroupNode>(readInt(ptr));
-		ptr += 4;
-		node.attributes = readDictionary(&ptr);
-		int numOfChildren = readInt(ptr);
-		ptr += 4;
+	void SceneGraph::readGroupNode(const uint8_t* ptr, const uint8_t* end) {
+		ChunkCursor cursor(ptr, end);
+		auto& node = addNode<GroupNode>(cursor.int32());
+		node.attributes = cursor.dictionary();
+		uint32_t numOfChildren = cursor.count(4);
 		node.childNodeIds.resize(numOfChildren);
-		for (int i = 0; i < numOfChildren; ++i)
+		for (uint32_t i = 0; i < numOfChildren; ++i)
 		{
-			node.childNodeIds[i] = readInt(ptr);
-			ptr += 4;
+			node.childNodeIds[i] = cursor.int32();
 		}
 	}
 
-	void SceneGraph::readShapeNode(const uint8_t* ptr) {
-		auto& node = addNode<ShapeNode>(readInt(ptr));
-		ptr += 4;
-		node.attributes = readDictionary(&ptr);
-		int numOfModels = readInt(ptr);
-		ptr += 4;
+	void SceneGraph::readShapeNode(const uint8_t* ptr, const uint8_t* end) {
+		ChunkCursor cursor(ptr, end);
+		auto& node = addNode<ShapeNode>(cursor.int32());
+		node.attributes = cursor.dictionary();
+		uint32_t numOfModels = cursor.count(8);
 		node.models.resize(numOfModels);
-		for (int i = 0; i < numOfModels; ++i)
+		for (uint32_t i = 0; i < numOfModels; ++i)
 		{
-			node.models[i].modelId = readInt(ptr);
-			ptr += 4;
-			node.models[i].attributes = readDictionary(&ptr);
+			node.models[i].modelId = cursor.int32();
+			node.models[i].attributes = cursor.dictionary();
+		}
+	}
+
+	SceneGraph::Transform SceneGraph::Transform::Parse(const Dictionary &frame) {
+		Transform transform = {
+			{ { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } },
+			{ 0, 0, 0 }
+		};
+
+		if (const std::string *r = findValue(frame, "_r")) {
+			// Bits 0-1 and 2-3: column of the non-zero entry in the first and second row, bits 4-6: signs of the rows
+			int bits = atoi(r->c_str());
+			int column0 = bits & 3;
+			int column1 = (bits >> 2) & 3;
+			if (column0 > 2 || column1 > 2 || column0 == column1) {
+				throw VoxReader::Exception("Invalid rotation: " + *r);
+			}
+			int columns[3] = { column0, column1, 3 - column0 - column1 };
+			for (int row = 0; row < 3; row++) {
+				for (int column = 0; column < 3; column++) {
+					transform.rotation[row][column] = 0;
+				}
+				transform.rotation[row][columns[row]] = (bits >> (4 + row)) & 1 ? -1 : 1;
+			}
+		}
+
+		if (const std::string *t = findValue(frame, "_t")) {
+			long x = 0, y = 0, z = 0;
+			if (sscanf(t->c_str(), "%ld %ld %ld", &x, &y, &z) != 3) {
+				throw VoxReader::Exception("Invalid translation: " + *t);
+			}
+			transform.translation[0] = (int32_t)x;
+			transform.translation[1] = (int32_t)y;
+			transform.translation[2] = (int32_t)z;
+		}
+
+		return transform;
+	}
+
+	SceneGraph::Transform SceneGraph::Transform::operator*(const Transform &other) const {
+		Transform result;
+		for (int row = 0; row < 3; row++) {
+			int32_t translation = 0;
+			for (int k = 0; k < 3; k++) {
+				translation += rotation[row][k] * other.translation[k];
+			}
+			for (int column = 0; column < 3; column++) {
+				int value = 0;
+				for (int k = 0; k < 3; k++) {
+					value += rotation[row][k] * other.rotation[k][column];
+				}
+				result.rotation[row][column] = (int8_t)value;
+			}
+			result.translation[row] = translation + this->translation[row];
+		}
+		return result;
+	}
+
+	std::vector<SceneGraph::Instance> SceneGraph::Flatten() const {
+		std::vector<Instance> instances;
+		if (GetRoot() == nullptr) {
+			return instances;
+		}
+
+		struct Entry {
+			NodeId id;
+			int32_t layerId;
+			Transform transform;
+			size_t depth;
+		};
+
+		const Transform identity = Transform::Parse(Dictionary());
+		std::vector<Entry> stack;
+		stack.push_back(Entry{ 0, -1, identity, 0 });
+
+		while (!stack.empty()) {
+			Entry entry = stack.back();
+			stack.pop_back();
+
+			const Node *node = GetNode(entry.id);
+			if (node == nullptr) {
+				throw VoxReader::Exception("SceneGraph references a missing node");
+			}
+			if (entry.depth > nodes.size()) {
+				throw VoxReader::Exception("SceneGraph contains a cycle");
+			}
+
+			switch (node->type) {
+			case Node::TRANSFORM: {
+				const auto &transform = static_cast<const TransformNode &>(*node);
+				const std::string *hidden = findValue(transform.attributes, "_hidden");
+				if (hidden != nullptr && *hidden == "1") {
+					break;
+				}
+				Transform local = transform.frame_attributes.empty() ? identity : Transform::Parse(transform.frame_attributes[0]);
+				stack.push_back(Entry{ transform.childNodeId, transform.layerId, entry.transform * local, entry.depth + 1 });
+				break;
+			}
+			case Node::GROUP: {
+				// Pushed in reverse so the children are visited in their order:
+				const auto &group = static_cast<const GroupNode &>(*node);
+				for (auto child = group.childNodeIds.rbegin(); child != group.childNodeIds.rend(); ++child) {
+					stack.push_back(Entry{ *child, entry.layerId, entry.transform, entry.depth + 1 });
+				}
+				break;
+			}
+			case Node::SHAPE: {
+				const auto &shape = static_cast<const ShapeNode &>(*node);
+				for (const auto &model : shape.models) {
+					instances.push_back(Instance{ entry.id, model.modelId, entry.layerId, entry.transform });
+				}
+				break;
+			}
+			}
 		}
+
+		return instances;
 	}
 
 } // namespace jim
@@ -1,37 +1,624 @@
-#include <iostream>
+/**
+ * Command line tool working on many vox-files at once:
+ *     VoxReaderTool <command> [options] <file|directory|glob>...
+ *
+ * Commands:
+ *     info       model sizes, voxel counts, node and layer names, read without decoding the voxels
+ *     stats      bytes, chunk counts, voxels, heap usage and decode timings of a full load
+ *     validate   all structural issues, the exit code is 1 if any file has issues
+ *     dump       models, palette, scene graph, layers and materials as text (--json, --no-voxels, --no-palette)
+ *     convert    write every file as --to=vox|qb|binvox|raw|voxc
+ *     mesh       write the visible scene as mesh, --format=glb|obj|ply
+ *     thumbnail  render the visible scene as PPM image, --view=top|front|side, --size=N pixels
+ *     bench      time loading from memory, --iterations=N
+ *
+ * Options:
+ *     -j N, --jobs=N  number of files processed in parallel (default: hardware threads)
+ *     --json          one JSON object per file instead of text
+ *     --output=DIR    directory for written files (default: next to the input)
+ *
+ * Directories are searched recursively for .vox files, globs (e.g. a quoted "*.vox") are expanded when the shell
+ * did not. Besides .vox, convert, mesh and thumbnail read .qb, .binvox and compiled .voxc files.
+ * Results are written as soon as a file and all files before it are done, so the output is in input order.
+ * A file which fails to load is reported and processing continues; the exit code is 1 if any file failed.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <mutex>
+#include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
-#include <fstream>
 
 #define JIM_VOXREADER_IMPLEMENTATION
 #include "VoxReader.hpp"
+#include "VoxWriter.hpp"
+#include "VoxCompiled.hpp"
+#include "VoxInfo.hpp"
+#include "VoxValidate.hpp"
+#include "VoxDump.hpp"
+#include "VoxExport.hpp"
+#include "VoxFormats.hpp"
+#include "VoxWorld.hpp"
+#include "VoxTools.hpp"
+
+#ifdef JIM_VOXTOOLS_POSIX
+#include <glob.h>
+#endif
+
+using namespace jim;
+
+//////////////////////////////////////////////////////////////////////////////
+// OPTIONS
+//////////////////////////////////////////////////////////////////////////////
+
+struct Options {
+	std::string command;
+	std::vector<std::string> inputs;
+	unsigned jobs = 0;
+	bool json = false;
+	uint32_t dumpFlags = 0;
+	std::string to = "vox";
+	std::string format = "glb";
+	std::string view = "front";
+	uint32_t size = 128;
+	unsigned iterations = 5;
+	std::string output;
+};
+
+static const char *const USAGE =
+	"Usage: VoxReaderTool <command> [options] <file|directory|glob>...\n"
+	"Commands:\n"
+	"  info       model sizes, voxel counts, node and layer names, without decoding the voxels\n"
+	"  stats      bytes, chunk counts, voxels, heap usage and decode timings of a full load\n"
+	"  validate   all structural issues of the files\n"
+	"  dump       all objects as text, or JSON with --json; --no-voxels, --no-palette\n"
+	"  convert    write every file as --to=vox|qb|binvox|raw|voxc\n"
+	"  mesh       write the visible scene as --format=glb|obj|ply\n"
+	"  thumbnail  render the visible scene as PPM image, --view=top|front|side, --size=N\n"
+	"  bench      time loading from memory, --iterations=N\n"
+	"Options:\n"
+	"  -j N, --jobs=N  files processed in parallel (default: hardware threads)\n"
+	"  --json          JSON output\n"
+	"  --output=DIR    directory for written files (default: next to the input)\n";
+
+static bool isCommand(const std::string &command) {
+	static const char *const COMMANDS[] = { "info", "stats", "validate", "dump", "convert", "mesh", "thumbnail", "bench" };
+	for (const char *c : COMMANDS) {
+		if (command == c) return true;
+	}
+	return false;
+}
+
+/**
+ * Returns the value of an option of the form --name=value, or NULL if the argument is not this option.
+ */
+static const char *optionValue(const char *arg, const char *name) {
+	size_t length = strlen(name);
+	return !strncmp(arg, name, length) && arg[length] == '=' ? arg + length + 1 : nullptr;
+}
+
+static bool parseOptions(int argc, char **argv, Options &options) {
+	if (argc < 2 || !isCommand(argv[1])) {
+		return false;
+	}
+	options.command = argv[1];
+
+	for (int i = 2; i < argc; i++) {
+		const char *arg = argv[i], *value;
+		if (!strcmp(arg, "-j") && i + 1 < argc) options.jobs = (unsigned)std::max(1, atoi(argv[++i]));
+		else if (!strncmp(arg, "-j", 2) && arg[2] != '\0') options.jobs = (unsigned)std::max(1, atoi(arg + 2));
+		else if ((value = optionValue(arg, "--jobs"))) options.jobs = (unsigned)std::max(1, atoi(value));
+		else if (!strcmp(arg, "--json")) options.json = true;
+		else if (!strcmp(arg, "--no-voxels")) options.dumpFlags |= VoxDump::NO_VOXELS;
+		else if (!strcmp(arg, "--no-palette")) options.dumpFlags |= VoxDump::NO_PALETTE;
+		else if ((value = optionValue(arg, "--to"))) options.to = value;
+		else if ((value = optionValue(arg, "--format"))) options.format = value;
+		else if ((value = optionValue(arg, "--view"))) options.view = value;
+		else if ((value = optionValue(arg, "--size"))) options.size = (uint32_t)std::min(4096, std::max(1, atoi(value)));
+		else if ((value = optionValue(arg, "--iterations"))) options.iterations = (unsigned)std::max(1, atoi(value));
+		else if ((value = optionValue(arg, "--output"))) options.output = value;
+		else if (arg[0] == '-' && arg[1] != '\0') {
+			fprintf(stderr, "Unknown option '%s'\n", arg);
+			return false;
+		}
+		else options.inputs.push_back(arg);
+	}
+
+	static const char *const TARGETS[] = { "vox", "qb", "binvox", "raw", "voxc" };
+	if (std::find_if(std::begin(TARGETS), std::end(TARGETS), [&](const char *t) { return options.to == t; }) == std::end(TARGETS)) {
+		fprintf(stderr, "Unknown conversion target '%s'\n", options.to.c_str());
+		return false;
+	}
+	if (options.format != "glb" && options.format != "obj" && options.format != "ply") {
+		fprintf(stderr, "Unknown mesh format '%s'\n", options.format.c_str());
+		return false;
+	}
+	if (options.view != "top" && options.view != "front" && options.view != "side") {
+		fprintf(stderr, "Unknown view '%s'\n", options.view.c_str());
+		return false;
+	}
+	return !options.inputs.empty();
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// FILES
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Expands a glob pattern, returns false if the pattern matched nothing.
+ */
+static bool expandGlob(const std::string &pattern, std::vector<std::string> &files) {
+#if defined(JIM_VOXTOOLS_POSIX)
+	glob_t matches;
+	bool found = glob(pattern.c_str(), 0, nullptr, &matches) == 0;
+	if (found) {
+		for (size_t i = 0; i < matches.gl_pathc; i++) files.push_back(matches.gl_pathv[i]);
+	}
+	globfree(&matches);
+	return found;
+#elif defined(JIM_VOXTOOLS_WINDOWS)
+	// Wildcards are only supported in the last path component:
+	size_t slash = pattern.find_last_of("/\\");
+	std::string directory = slash == std::string::npos ? std::string() : pattern.substr(0, slash + 1);
+	std::vector<std::string> found;
+	_finddata64_t info;
+	intptr_t handle = _findfirst64(pattern.c_str(), &info);
+	if (handle != -1) {
+		do {
+			if (!(info.attrib & _A_SUBDIR)) found.push_back(directory + info.name);
+		} while (_findnext64(handle, &info) == 0);
+		_findclose(handle);
+	}
+	std::sort(found.begin(), found.end());
+	files.insert(files.end(), found.begin(), found.end());
+	return !found.empty();
+#else
+	(void)pattern;
+	(void)files;
+	return false;
+#endif
+}
+
+static std::vector<std::string> collectInputs(const std::vector<std::string> &inputs) {
+	std::vector<std::string> files;
+	for (const std::string &input : inputs) {
+		if (isDirectory(input)) collect(input, files, "vox");
+		else if (input.find_first_of("*?[") == std::string::npos || !expandGlob(input, files)) files.push_back(input);
+	}
+	return files;
+}
+
+/**
+ * Path of a file written for the given input: same name with the given extension, in --output or next to the input.
+ */
+static std::string outputPath(const Options &options, const std::string &input, const char *ext) {
+	size_t slash = input.find_last_of("/\\");
+	std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+	size_t dot = name.find_last_of('.');
+	if (dot != std::string::npos && dot > 0) name.resize(dot);
+	name += '.';
+	name += ext;
+	if (!options.output.empty()) return options.output + '/' + name;
+	return slash == std::string::npos ? name : input.substr(0, slash + 1) + name;
+}
+
+/**
+ * Load a vox-file, or any other format VoxFormats and VoxCompiledReader read, by its extension.
+ */
+static void loadAny(VoxReader &vox, const std::string &path) {
+	const std::string ext = extension(path);
+	if (ext == "voxc") {
+		VoxCompiledReader(path).toReader(vox);
+		return;
+	}
+	MappedFile file(path);
+	if (ext == "qb") VoxFormats::loadQubicle(vox, file.data(), file.size());
+	else if (ext == "binvox") VoxFormats::loadBinvox(vox, file.data(), file.size(), 1, 1);
+	else vox.load(file.data(), file.size());
+}
+
+template <typename WRITE>
+static void writeFile(const std::string &path, WRITE write) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		throw VoxReader::Exception("Cannot open file for writing: " + path);
+	}
+	write(file);
+	if (!file) {
+		throw VoxReader::Exception("Writing to file failed: " + path);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// OUTPUT
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Output of one file. Commands append lines with printf formatting.
+ */
+struct Result {
+	std::string text;
+	bool failed = false;
+
+	void printf(const char *format, ...)
+#ifdef __GNUC__
+		__attribute__((format(printf, 2, 3)))
+#endif
+	{
+		char line[1024];
+		va_list args;
+		va_start(args, format);
+		int length = vsnprintf(line, sizeof(line), format, args);
+		va_end(args);
+		if (length >= (int)sizeof(line)) {
+			std::vector<char> large((size_t)length + 1);
+			va_start(args, format);
+			vsnprintf(large.data(), large.size(), format, args);
+			va_end(args);
+			text.append(large.data(), (size_t)length);
+		}
+		else if (length > 0) {
+			text.append(line, (size_t)length);
+		}
+	}
+};
+
+//////////////////////////////////////////////////////////////////////////////
+// COMMANDS
+//////////////////////////////////////////////////////////////////////////////
+
+static void info(const Options &options, const std::string &path, Result &r) {
+	VoxInfo info = VoxInfo::scan(path);
+	if (options.json) {
+		r.printf("{\"file\":%s,\"size\":%llu,\"models\":[", jsonString(path).c_str(), (unsigned long long)info.size);
+		for (size_t i = 0; i < info.models.size(); i++) {
+			const VoxInfo::ModelInfo &m = info.models[i];
+			r.printf("%s{\"size\":[%u,%u,%u],\"voxels\":%u}", i > 0 ? "," : "", m.sizeX, m.sizeY, m.sizeZ, m.voxelCount);
+		}
+		r.printf("],\"voxels\":%llu,\"palette\":%s,\"nodes\":%u,\"layers\":%u,\"materials\":%u,\"unknownChunks\":%u,\"nodeNames\":{",
+			(unsigned long long)info.voxelCount, info.hasPalette ? "true" : "false", info.nodeCount, info.layerCount,
+			info.materialCount, info.unknownChunkCount);
+		for (size_t i = 0; i < info.nodeNames.size(); i++) {
+			r.printf("%s\"%d\":%s", i > 0 ? "," : "", info.nodeNames[i].first, jsonString(info.nodeNames[i].second).c_str());
+		}
+		r.printf("},\"layerNames\":{");
+		for (size_t i = 0; i < info.layerNames.size(); i++) {
+			r.printf("%s\"%d\":%s", i > 0 ? "," : "", info.layerNames[i].first, jsonString(info.layerNames[i].second).c_str());
+		}
+		r.printf("}}\n");
+		return;
+	}
+
+	r.printf("%s: %llu bytes, %zu models, %llu voxels, %s palette, %u nodes, %u layers, %u materials, %u unknown chunks\n",
+		path.c_str(), (unsigned long long)info.size, info.models.size(), (unsigned long long)info.voxelCount,
+		info.hasPalette ? "own" : "default", info.nodeCount, info.layerCount, info.materialCount, info.unknownChunkCount);
+	for (size_t i = 0; i < info.models.size(); i++) {
+		const VoxInfo::ModelInfo &m = info.models[i];
+		r.printf("  model %zu: %ux%ux%u, %u voxels\n", i, m.sizeX, m.sizeY, m.sizeZ, m.voxelCount);
+	}
+	for (const auto &name : info.nodeNames) {
+		r.printf("  node %d: %s\n", name.first, name.second.c_str());
+	}
+	for (const auto &name : info.layerNames) {
+		r.printf("  layer %d: %s\n", name.first, name.second.c_str());
+	}
+}
+
+static void stats(const Options &options, const std::string &path, Result &r) {
+	VoxReader vox;
+	MappedFile file(path);
+	vox.load(file.data(), file.size());
+	const VoxReader::Stats s = vox.stats();
+	const VoxReader::MemoryUsage &m = s.memory;
+	const VoxReader::DecodeTimings &t = s.timings;
+
+	std::string chunks;
+	for (const auto &count : s.chunkCounts) {
+		char entry[64];
+		if (options.json) snprintf(entry, sizeof(entry), "%s%s:%u", chunks.empty() ? "" : ",", jsonString(count.first).c_str(), count.second);
+		else snprintf(entry, sizeof(entry), " %s=%u", count.first.c_str(), count.second);
+		chunks += entry;
+	}
+
+	if (options.json) {
+		r.printf("{\"file\":%s,\"bytes\":%llu,\"chunks\":{%s},\"models\":%zu,\"voxels\":%llu,\"nodes\":%d,"
+			"\"memory\":{\"models\":%zu,\"palette\":%zu,\"sceneGraph\":%zu,\"layers\":%zu,\"materials\":%zu,\"unknownChunks\":%zu,\"sourceChunks\":%zu,\"total\":%zu},"
+			"\"timings\":{\"total\":%llu,\"index\":%llu,\"models\":%llu,\"palette\":%llu,\"sceneGraph\":%llu,\"layers\":%llu,\"materials\":%llu,\"other\":%llu}}\n",
+			jsonString(path).c_str(), (unsigned long long)s.bytesRead, chunks.c_str(), s.modelCount, (unsigned long long)s.voxelCount, s.nodeCount,
+			m.models, m.palette, m.sceneGraph, m.layers, m.materials, m.unknownChunks, m.sourceChunks, m.total(),
+			(unsigned long long)t.total, (unsigned long long)t.index, (unsigned long long)t.models, (unsigned long long)t.palette,
+			(unsigned long long)t.sceneGraph, (unsigned long long)t.layers, (unsigned long long)t.materials, (unsigned long long)t.other);
+		return;
+	}
+
+	r.printf("%s: %llu bytes, %zu models, %llu voxels, %d nodes\n", path.c_str(), (unsigned long long)s.bytesRead,
+		s.modelCount, (unsigned long long)s.voxelCount, s.nodeCount);
+	r.printf("  chunks:%s\n", chunks.c_str());
+	r.printf("  heap: %zu bytes (models %zu, palette %zu, scene graph %zu, layers %zu, materials %zu, unknown chunks %zu, chunk index %zu)\n",
+		m.total(), m.models, m.palette, m.sceneGraph, m.layers, m.materials, m.unknownChunks, m.sourceChunks);
+	r.printf("  decode: %.3f ms (index %.3f, models %.3f, palette %.3f, scene graph %.3f, layers %.3f, materials %.3f, other %.3f)\n",
+		t.total / 1e6, t.index / 1e6, t.models / 1e6, t.palette / 1e6, t.sceneGraph / 1e6, t.layers / 1e6, t.materials / 1e6, t.other / 1e6);
+}
+
+static void validate(const Options &options, const std::string &path, Result &r) {
+	MappedFile file(path);
+	std::vector<VoxValidator::Issue> issues = VoxValidator::validate(file.data(), file.size());
+	r.failed = !issues.empty();
+
+	if (options.json) {
+		r.printf("{\"file\":%s,\"valid\":%s,\"issues\":[", jsonString(path).c_str(), issues.empty() ? "true" : "false");
+		for (size_t i = 0; i < issues.size(); i++) {
+			r.printf("%s{\"offset\":%llu,\"message\":%s}", i > 0 ? "," : "", (unsigned long long)issues[i].offset,
+				jsonString(issues[i].message).c_str());
+		}
+		r.printf("]}\n");
+		return;
+	}
+
+	if (issues.empty()) {
+		r.printf("%s: ok\n", path.c_str());
+		return;
+	}
+	r.printf("%s: %zu issue%s\n", path.c_str(), issues.size(), issues.size() == 1 ? "" : "s");
+	for (const VoxValidator::Issue &issue : issues) {
+		r.printf("  at 0x%llx: %s\n", (unsigned long long)issue.offset, issue.message.c_str());
+	}
+}
+
+static void dump(const Options &options, const std::string &path, Result &r) {
+	VoxReader vox;
+	loadAny(vox, path);
+	std::ostringstream s;
+	if (options.json) {
+		s << "{\"file\":" << jsonString(path) << ",\"dump\":";
+		VoxDump(vox, options.dumpFlags).saveJson(s);
+		s << "}\n";
+	}
+	else {
+		s << "== " << path << '\n';
+		VoxDump(vox, options.dumpFlags).saveText(s);
+	}
+	r.text = s.str();
+}
 
-int main() {
-	using namespace jim;
+static void reportWritten(const Options &options, const std::string &path, const std::string &written, Result &r) {
+	if (options.json) r.printf("{\"file\":%s,\"output\":%s}\n", jsonString(path).c_str(), jsonString(written).c_str());
+	else r.printf("%s -> %s\n", path.c_str(), written.c_str());
+}
+
+static void convert(const Options &options, const std::string &path, Result &r) {
+	VoxReader vox;
+	loadAny(vox, path);
+	const std::string written = outputPath(options, path, options.to.c_str());
+	if (written == path) {
+		throw VoxReader::Exception("Output would overwrite the input, use --output");
+	}
+
+	if (options.to == "vox") {
+		writeFile(written, [&](std::ostream &s) { VoxWriter(vox).save(s); });
+	}
+	else if (options.to == "qb") {
+		writeFile(written, [&](std::ostream &s) { VoxFormats::saveQubicle(vox, s); });
+	}
+	else if (options.to == "binvox") {
+		writeFile(written, [&](std::ostream &s) { VoxFormats::saveBinvox(vox, s); });
+	}
+	else if (options.to == "voxc") {
+		writeFile(written, [&](std::ostream &s) { VoxCompiledWriter::save(vox, s); });
+	}
+	else {
+		// Raw volumes carry no header, the origin and size are reported instead:
+		int32_t origin[3];
+		uint32_t size[3];
+		writeFile(written, [&](std::ostream &s) { VoxFormats::saveRaw(vox, s, origin, size); });
+		if (options.json) {
+			r.printf("{\"file\":%s,\"output\":%s,\"origin\":[%d,%d,%d],\"size\":[%u,%u,%u]}\n", jsonString(path).c_str(),
+				jsonString(written).c_str(), origin[0], origin[1], origin[2], size[0], size[1], size[2]);
+		}
+		else {
+			r.printf("%s -> %s (origin %d,%d,%d, size %ux%ux%u)\n", path.c_str(), written.c_str(),
+				origin[0], origin[1], origin[2], size[0], size[1], size[2]);
+		}
+		return;
+	}
+	reportWritten(options, path, written, r);
+}
+
+static void mesh(const Options &options, const std::string &path, Result &r) {
+	VoxReader vox;
+	loadAny(vox, path);
+	const std::string written = outputPath(options, path, options.format.c_str());
+	writeFile(written, [&](std::ostream &s) {
+		if (options.format == "glb") VoxExport(vox).saveGltf(s);
+		else if (options.format == "obj") VoxExport(vox).saveObj(s);
+		else VoxExport(vox).savePly(s);
+	});
+	reportWritten(options, path, written, r);
+}
 
+/**
+ * Renders the visible scene as orthographic projection along one axis, the nearest voxel of every pixel wins.
+ * The longer image side has the given size; Z is up in the front and side views.
+ */
+static void thumbnail(const Options &options, const std::string &path, Result &r) {
 	VoxReader vox;
+	loadAny(vox, path);
+	VoxWorld world;
+	world.merge(vox, VoxWorld::KEEP_LAST, 1);
+	if (world.voxels.empty()) {
+		throw VoxReader::Exception("The scene has no visible voxels");
+	}
 
-	try {
-		vox.load(std::ifstream("chr_knight.vox", std::ios::binary));
-	} catch(const std::exception &e) {
-		std::cout << e.what() << std::endl;
+	// Image axes u (right) and v (up) and the depth axis, whose larger values are nearer:
+	int u = 0, v = 2, d = 1;
+	int32_t depthSign = -1; // the front view looks along +y
+	if (options.view == "top") { u = 0; v = 1; d = 2; depthSign = 1; }
+	else if (options.view == "side") { u = 1; v = 2; d = 0; depthSign = 1; }
+
+	int32_t low[3] = { INT32_MAX, INT32_MAX, INT32_MAX }, high[3] = { INT32_MIN, INT32_MIN, INT32_MIN };
+	for (const WorldVoxel &voxel : world.voxels) {
+		const int32_t p[3] = { voxel.x, voxel.y, voxel.z };
+		for (int a = 0; a < 3; a++) {
+			low[a] = std::min(low[a], p[a]);
+			high[a] = std::max(high[a], p[a]);
+		}
 	}
+	const uint64_t extentU = (uint64_t)((int64_t)high[u] - low[u] + 1), extentV = (uint64_t)((int64_t)high[v] - low[v] + 1);
+	const double scale = (double)options.size / (double)std::max(extentU, extentV);
+	const uint32_t width = std::max<uint32_t>(1, (uint32_t)(extentU * scale + 0.5));
+	const uint32_t height = std::max<uint32_t>(1, (uint32_t)(extentV * scale + 0.5));
 
-	vox.print(std::cout);
-	std::cout << std::endl << std::endl;
+	std::vector<int64_t> depth((size_t)width * height, INT64_MIN);
+	std::vector<uint8_t> pixels((size_t)width * height * 3, 0);
+	for (const WorldVoxel &voxel : world.voxels) {
+		const int32_t p[3] = { voxel.x, voxel.y, voxel.z };
+		const uint64_t iu = (uint64_t)((int64_t)p[u] - low[u]), iv = (uint64_t)((int64_t)high[v] - p[v]);
+		const int64_t z = (int64_t)depthSign * p[d];
+		const RGBA color = vox.getColor(voxel.colorIndex);
 
-	std::cout << "XZ-View:" << std::endl;
-	auto view = vox.view2d(VoxReader::XZ, VoxReader::SWAP_AXIS | VoxReader::INVERT_UP | VoxReader::FROM_BEHIND);
-	for(const auto &row : view) {
-		for(const auto *voxel : row) {
-			if(voxel != nullptr) {
-				std::cout << 'X';
-			} else {
-				std::cout << ' ';
+		// Every voxel covers at least one pixel:
+		const uint32_t u0 = std::min(width - 1, (uint32_t)(iu * scale)), v0 = std::min(height - 1, (uint32_t)(iv * scale));
+		const uint32_t u1 = std::max(u0 + 1, std::min(width, (uint32_t)((iu + 1) * scale)));
+		const uint32_t v1 = std::max(v0 + 1, std::min(height, (uint32_t)((iv + 1) * scale)));
+		for (uint32_t y = v0; y < v1; y++) {
+			for (uint32_t x = u0; x < u1; x++) {
+				const size_t i = (size_t)y * width + x;
+				if (z > depth[i]) {
+					depth[i] = z;
+					pixels[i * 3] = color.r;
+					pixels[i * 3 + 1] = color.g;
+					pixels[i * 3 + 2] = color.b;
+				}
 			}
 		}
-		std::cout << std::endl;
 	}
 
-	std::cin.ignore(10, '\n');
+	const std::string written = outputPath(options, path, "ppm");
+	writeFile(written, [&](std::ostream &s) {
+		s << "P6\n" << width << ' ' << height << "\n255\n";
+		s.write(reinterpret_cast<const char *>(pixels.data()), (std::streamsize)pixels.size());
+	});
+	reportWritten(options, path, written, r);
+}
+
+static void bench(const Options &options, const std::string &path, Result &r) {
+	MappedFile file(path);
+	double best = 1e30;
+	uint64_t voxelCount = 0;
+	for (unsigned i = 0; i < options.iterations; i++) {
+		VoxReader vox;
+		auto start = std::chrono::steady_clock::now();
+		vox.load(file.data(), file.size());
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+		voxelCount = vox.stats().voxelCount;
+	}
+
+	const double megabytes = file.size() / 1e6;
+	if (options.json) {
+		r.printf("{\"file\":%s,\"bytes\":%zu,\"voxels\":%llu,\"seconds\":%.9f,\"mbPerSecond\":%.1f,\"voxelsPerSecond\":%.0f}\n",
+			jsonString(path).c_str(), file.size(), (unsigned long long)voxelCount, best, megabytes / best, voxelCount / best);
+	}
+	else {
+		r.printf("%s: %.3f ms, %.1f MB/s, %.1f Mvoxels/s\n", path.c_str(), best * 1e3, megabytes / best, voxelCount / best / 1e6);
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// MAIN
+//////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Runs the command on all files with the given number of threads and writes every result to stdout as soon as it
+ * and all results before it are done. The work always runs on worker threads, so results are written while later
+ * files are processed even with one job. Returns the number of failed files.
+ */
+static size_t runAll(const Options &options, const std::vector<std::string> &files,
+	const std::function<void(const Options &, const std::string &, Result &)> &command) {
+
+	std::vector<Result> results(files.size());
+	std::vector<char> done(files.size(), 0);
+	std::mutex mutex;
+	std::condition_variable finished;
+	std::atomic<size_t> next(0);
+
+	auto work = [&]() {
+		for (size_t i = next++; i < files.size(); i = next++) {
+			Result &r = results[i];
+			try {
+				command(options, files[i], r);
+			}
+			catch (const std::exception &e) {
+				r.failed = true;
+				r.text.clear();
+				if (options.json) r.printf("{\"file\":%s,\"error\":%s}\n", jsonString(files[i]).c_str(), jsonString(e.what()).c_str());
+				else r.printf("%s: error: %s\n", files[i].c_str(), e.what());
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			done[i] = 1;
+			finished.notify_one();
+		}
+	};
+
+	unsigned jobs = options.jobs != 0 ? options.jobs : std::max(1u, std::thread::hardware_concurrency());
+	jobs = (unsigned)std::max<size_t>(1, std::min<size_t>(jobs, files.size()));
+	std::vector<std::thread> threads;
+	for (unsigned t = 0; t < jobs; t++) threads.emplace_back(work);
+
+	size_t failed = 0;
+	for (size_t i = 0; i < files.size(); i++) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			finished.wait(lock, [&]() { return done[i] != 0; });
+		}
+		fwrite(results[i].text.data(), 1, results[i].text.size(), stdout);
+		fflush(stdout);
+		if (results[i].failed) failed++;
+		std::string().swap(results[i].text);
+	}
+
+	for (std::thread &thread : threads) thread.join();
+	return failed;
+}
+
+int main(int argc, char **argv) {
+	Options options;
+	if (!parseOptions(argc, argv, options)) {
+		fputs(USAGE, stderr);
+		return 2;
+	}
+
+	std::vector<std::string> files = collectInputs(options.inputs);
+	if (files.empty()) {
+		fprintf(stderr, "No vox-files found\n");
+		return 2;
+	}
+
+	std::function<void(const Options &, const std::string &, Result &)> command;
+	if (options.command == "info") command = info;
+	else if (options.command == "stats") command = stats;
+	else if (options.command == "validate") command = validate;
+	else if (options.command == "dump") command = dump;
+	else if (options.command == "convert") command = convert;
+	else if (options.command == "mesh") command = mesh;
+	else if (options.command == "thumbnail") command = thumbnail;
+	else command = bench;
+
+	size_t failed = runAll(options, files, command);
+	if (failed > 0 && !options.json) {
+		fprintf(stderr, "%zu of %zu files failed\n", failed, files.size());
+	}
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
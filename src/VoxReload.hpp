@@ -0,0 +1,569 @@
+#pragma once
+
+#include "VoxReader.hpp"
+
+#include <functional>
+#include <map>
+#include <string>
+
+namespace jim {
+
+	/**
+	 * Reloads vox-files when they change on disk, decoding only what changed.
+	 * Every top level chunk is hashed; on reload the new chunk index is compared with the previous one and only
+	 * models, nodes, layers, materials and the palette whose chunks changed are decoded again. Unchanged nodes keep
+	 * their objects, unchanged models keep their voxel storage (and their address unless models were added).
+	 * Files are watched with inotify on Linux; elsewhere poll() compares the content hash of every watched file.
+	*/
+	class VoxReloader {
+	public:
+
+		/**
+		 * Describes one object that was added, changed or removed by a reload.
+		*/
+		struct Change {
+			enum Kind : uint8_t {
+				MODEL,    // index into VoxReader::models
+				NODE,     // scene graph node id
+				LAYER,    // layer id
+				MATERIAL, // material id
+				PALETTE,
+				OTHER     // index into VoxReader::unknownChunks
+			};
+
+			enum Action : uint8_t {
+				ADDED,
+				CHANGED,
+				REMOVED
+			};
+
+			Kind kind;
+			Action action;
+			int32_t index;
+		};
+
+		using Listener = std::function<void(const std::string &path, VoxReader &vox, const std::vector<Change> &changes)>;
+		using ErrorListener = std::function<void(const std::string &path, const std::exception &error)>;
+
+		VoxReloader();
+		~VoxReloader();
+
+		VoxReloader(const VoxReloader &) = delete;
+		VoxReloader& operator=(const VoxReloader &) = delete;
+
+		/**
+		 * Load the file at the given path into the given reader and watch it. The reader must outlive the watch.
+		 * The listener is called after every reload that changed something.
+		*/
+		void watch(const std::string &path, VoxReader &vox, Listener listener);
+
+		/**
+		 * Stop watching the file at the given path.
+		*/
+		void unwatch(const std::string &path);
+
+		/**
+		 * Called if a changed file cannot be loaded, e.g. while it is still being written. The reader keeps its
+		 * previous objects and the file is reloaded on its next change.
+		*/
+		void onError(ErrorListener listener);
+
+		/**
+		 * Reload watched files which changed. Waits up to the given number of milliseconds until a watched file
+		 * changed (0 = return immediately, -1 = wait forever), changes of other files in the same directories are
+		 * ignored. Returns the number of reloaded files.
+		*/
+		size_t poll(int timeout = 0);
+
+		/**
+		 * Returns the hashes of the chunks listed in vox.sourceChunks, for the data vox was loaded from.
+		*/
+		static std::vector<uint64_t> hashChunks(const VoxReader &vox, const uint8_t *data, size_t size);
+
+		/**
+		 * Update the given reader to the given vox-data, decoding only chunks whose hash changed.
+		 * @param[in,out] chunkHashes Hashes of vox.sourceChunks, see hashChunks(). Updated to the new data.
+		 * On error the reader is left unchanged.
+		*/
+		static std::vector<Change> reload(VoxReader &vox, std::vector<uint64_t> &chunkHashes, const uint8_t *data, size_t size);
+
+	private:
+
+		struct Watch {
+			VoxReader *vox;
+			Listener listener;
+			std::vector<uint64_t> chunkHashes;
+			uint64_t fileHash;
+			int descriptor; // of the watched directory
+		};
+
+		bool refresh(const std::string &path, Watch &watch);
+
+		std::map<std::string, Watch> watches;
+		ErrorListener errorListener;
+		int inotify = -1;
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#define JIM_VOXRELOAD_INOTIFY
+#endif
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// INCREMENTAL RELOAD
+	//////////////////////////////////////////////////////////////////////////////
+
+	static VoxReloader::Change::Kind chunkKind(const char *id) {
+		if (!strcmp(id, "SIZE") || !strcmp(id, "XYZI")) return VoxReloader::Change::MODEL;
+		if (id[0] == 'n') return VoxReloader::Change::NODE;
+		if (!strcmp(id, "LAYR")) return VoxReloader::Change::LAYER;
+		if (!strcmp(id, "MATL")) return VoxReloader::Change::MATERIAL;
+		if (!strcmp(id, "RGBA")) return VoxReloader::Change::PALETTE;
+		return VoxReloader::Change::OTHER;
+	}
+
+	/**
+	* Combined hash of the chunks of every object, keyed by kind and index. A model combines SIZE and XYZI.
+	*/
+	static std::map<std::pair<int, int32_t>, uint64_t> objectHashes(const std::vector<VoxReader::ChunkRef> &refs, const std::vector<uint64_t> &hashes) {
+		std::map<std::pair<int, int32_t>, uint64_t> objects;
+		for (size_t i = 0; i < refs.size() && i < hashes.size(); i++) {
+			if (!strcmp(refs[i].id, "PACK")) continue;
+			uint64_t &hash = objects[std::make_pair((int)chunkKind(refs[i].id), refs[i].index)];
+			hash = hash * 31 + hashes[i];
+		}
+		return objects;
+	}
+
+	std::vector<uint64_t> VoxReloader::hashChunks(const VoxReader &vox, const uint8_t *data, size_t size) {
+		std::vector<uint64_t> hashes;
+		hashes.reserve(vox.sourceChunks.size());
+		for (const auto &ref : vox.sourceChunks) {
+			if (ref.offset > size || ref.size > size - ref.offset) {
+				throw VoxReader::Exception("Chunk index does not match the data");
+			}
+			hashes.push_back(hash64(data + ref.offset, (size_t)ref.size));
+		}
+		return hashes;
+	}
+
+	std::vector<VoxReloader::Change> VoxReloader::reload(VoxReader &vox, std::vector<uint64_t> &chunkHashes, const uint8_t *data, size_t size) {
+		JIM_VOXREADER_TRACE_SCOPE_ARG("reload", "size", (int64_t)size);
+		if (size < 8 || memcmp(data, "VOX ", 4) != 0) {
+			throw VoxReader::Exception("Magic string 'VOX ' is missing");
+		}
+		if (readInt(data + 4) != 150) {
+			throw VoxReader::Exception("Version is not 150");
+		}
+
+		// Index the new chunks the same way load() does, without decoding them:
+		VoxReader::DecodeTimings timings;
+		const uint64_t start = steadyNanoseconds();
+		VoxReader::Chunk main(data, data + 8, data + size);
+		if (strcmp(main.id, "MAIN")) {
+			throw VoxReader::Exception("MAIN chunk is missing");
+		}
+		timings.index = steadyNanoseconds() - start;
+		const std::vector<VoxReader::Chunk> &chunks = main.children;
+
+		std::vector<VoxReader::ChunkRef> refs(chunks.size());
+		std::vector<uint64_t> hashes(chunks.size());
+		int32_t modelCount = 0, unknownCount = 0;
+		for (size_t i = 0; i < chunks.size(); i++) {
+			const VoxReader::Chunk &chunk = chunks[i];
+			VoxReader::ChunkRef &ref = refs[i];
+			memcpy(ref.id, chunk.id, 5);
+			ref.offset = chunk.offset;
+			ref.size = chunk.size;
+			ref.index = -1;
+
+			switch (chunkKind(chunk.id)) {
+			case Change::MODEL:
+				if (!strcmp(chunk.id, "SIZE")) {
+					if (i + 1 == chunks.size() || strcmp(chunks[i + 1].id, "XYZI")) {
+						throw VoxReader::Exception("SIZE chunk is not followed by a XYZI chunk");
+					}
+					ref.index = modelCount;
+				}
+				else {
+					if (i == 0 || strcmp(chunks[i - 1].id, "SIZE")) {
+						throw VoxReader::Exception("XYZI chunk is not preceded by a SIZE chunk");
+					}
+					ref.index = modelCount++;
+				}
+				break;
+			case Change::NODE:
+			case Change::LAYER:
+			case Change::MATERIAL:
+				if (chunk.contentSize < 4) {
+					throw VoxReader::Exception(std::string(chunk.id) + " chunk is too small");
+				}
+				ref.index = readInt(chunk.content);
+				if (ref.index < 0) {
+					throw VoxReader::Exception(std::string(chunk.id) + " id is negative");
+				}
+				if (ref.index > maxObjectId(size)) {
+					throw VoxReader::Exception(std::string(chunk.id) + " id exceeds the data");
+				}
+				break;
+			case Change::PALETTE:
+				if (chunk.contentSize < 4 * 256) {
+					throw VoxReader::Exception("RGBA chunk is too small");
+				}
+				break;
+			case Change::OTHER:
+				if (strcmp(chunk.id, "PACK")) {
+					ref.index = unknownCount++;
+				}
+				break;
+			}
+			hashes[i] = hash64(data + chunk.offset, (size_t)chunk.size);
+		}
+
+		// Compare objects:
+		std::map<std::pair<int, int32_t>, uint64_t> before = objectHashes(vox.sourceChunks, chunkHashes);
+		std::map<std::pair<int, int32_t>, uint64_t> after = objectHashes(refs, hashes);
+
+		std::vector<Change> changes;
+		for (const auto &object : after) {
+			auto previous = before.find(object.first);
+			if (previous == before.end()) {
+				changes.push_back(Change{ (Change::Kind)object.first.first, Change::ADDED, object.first.second });
+			}
+			else if (previous->second != object.second) {
+				changes.push_back(Change{ (Change::Kind)object.first.first, Change::CHANGED, object.first.second });
+			}
+		}
+		for (const auto &object : before) {
+			if (after.find(object.first) == after.end()) {
+				changes.push_back(Change{ (Change::Kind)object.first.first, Change::REMOVED, object.first.second });
+			}
+		}
+
+		// Decode added and changed objects into staging storage first, so errors leave the reader unchanged:
+		std::map<int32_t, Model> models;
+		SceneGraph nodes;
+		std::map<int32_t, Dictionary> layers, materials;
+		std::vector<RGBA> *palette = nullptr;
+		int32_t layerCount = 0, materialCount = 0;
+
+		std::map<std::pair<int, int32_t>, bool> decode;
+		for (const auto &change : changes) {
+			if (change.action != Change::REMOVED) {
+				decode[std::make_pair((int)change.kind, change.index)] = true;
+			}
+		}
+
+		try {
+			for (size_t i = 0; i < chunks.size(); i++) {
+				const VoxReader::Chunk &chunk = chunks[i];
+				Change::Kind kind = chunkKind(chunk.id);
+				if (kind == Change::LAYER) layerCount = std::max(layerCount, refs[i].index + 1);
+				if (kind == Change::MATERIAL) materialCount = std::max(materialCount, refs[i].index + 1);
+				if (!decode.count(std::make_pair((int)kind, refs[i].index))) continue;
+				JIM_VOXREADER_TRACE_SCOPE_ARG(chunk.id, "offset", (int64_t)chunk.offset);
+				const uint64_t chunkStart = steadyNanoseconds();
+				uint64_t *timing = &timings.other;
+
+				switch (kind) {
+				case Change::MODEL:
+					if (!strcmp(chunk.id, "SIZE")) {
+						models.emplace(refs[i].index, Model(chunk, chunks[i + 1]));
+					}
+					timing = &timings.models;
+					break;
+				case Change::NODE:
+					if (!strcmp(chunk.id, "nTRN")) nodes.readTransformNode(chunk.content, chunk.content + chunk.contentSize);
+					else if (!strcmp(chunk.id, "nGRP")) nodes.readGroupNode(chunk.content, chunk.content + chunk.contentSize);
+					else if (!strcmp(chunk.id, "nSHP")) nodes.readShapeNode(chunk.content, chunk.content + chunk.contentSize);
+					else throw VoxReader::Exception("Unknown node!");
+					timing = &timings.sceneGraph;
+					break;
+				case Change::LAYER:
+					layers[refs[i].index] = readDictionary(chunk.content + 4, chunk.content + chunk.contentSize);
+					timing = &timings.layers;
+					break;
+				case Change::MATERIAL:
+					materials[refs[i].index] = readDictionary(chunk.content + 4, chunk.content + chunk.contentSize);
+					timing = &timings.materials;
+					break;
+				case Change::PALETTE:
+					palette = new std::vector<RGBA>(256);
+					memcpy(&(*palette)[0], chunk.content, 4 * 256);
+					timing = &timings.palette;
+					break;
+				case Change::OTHER:
+					break;
+				}
+				*timing += steadyNanoseconds() - chunkStart;
+			}
+		}
+		catch (...) {
+			delete palette;
+			throw;
+		}
+
+		// Apply, nothing below throws except on allocation failure:
+		for (const auto &change : changes) {
+			switch (change.kind) {
+			case Change::MODEL:
+				if (change.action == Change::CHANGED) {
+					vox.models[change.index] = std::move(models.at(change.index));
+				}
+				break;
+			case Change::NODE:
+				if (change.action == Change::REMOVED) {
+					vox.sceneGraph.nodes[change.index].reset();
+				}
+				else {
+					if (change.index >= (int32_t)vox.sceneGraph.nodes.size()) {
+						vox.sceneGraph.nodes.resize(change.index + 1);
+					}
+					vox.sceneGraph.nodes[change.index] = std::move(nodes.nodes[change.index]);
+				}
+				break;
+			case Change::PALETTE:
+				if (vox.palette != &VoxReader::DEFAULT_PALETTE) {
+					delete vox.palette;
+				}
+				vox.palette = change.action == Change::REMOVED ? &VoxReader::DEFAULT_PALETTE : palette;
+				break;
+			default:
+				break;
+			}
+		}
+
+		// Models are numbered in file order, so added models follow all others:
+		if (modelCount < (int32_t)vox.models.size()) {
+			vox.models.erase(vox.models.begin() + modelCount, vox.models.end());
+		}
+		for (int32_t i = (int32_t)vox.models.size(); i < modelCount; i++) {
+			vox.models.push_back(std::move(models.at(i)));
+		}
+
+		while (!vox.sceneGraph.nodes.empty() && !vox.sceneGraph.nodes.back()) {
+			vox.sceneGraph.nodes.pop_back();
+		}
+
+		vox.layers.resize(layerCount);
+		for (auto &layer : layers) {
+			vox.layers[layer.first].attributes = std::move(layer.second);
+		}
+		vox.materials.resize(materialCount);
+		for (auto &material : materials) {
+			vox.materials[material.first].properties = std::move(material.second);
+		}
+		for (const auto &change : changes) {
+			if (change.action != Change::REMOVED) continue;
+			if (change.kind == Change::LAYER && change.index < layerCount) vox.layers[change.index].attributes.clear();
+			if (change.kind == Change::MATERIAL && change.index < materialCount) vox.materials[change.index].properties.clear();
+		}
+
+		// Unknown chunks are copied anyway:
+		const uint64_t otherStart = steadyNanoseconds();
+		vox.unknownChunks.clear();
+		for (size_t i = 0; i < chunks.size(); i++) {
+			if (chunkKind(chunks[i].id) == Change::OTHER && refs[i].index >= 0) {
+				VoxReader::RawChunk raw;
+				memcpy(raw.id, chunks[i].id, 5);
+				raw.bytes.assign(data + chunks[i].offset, data + chunks[i].offset + chunks[i].size);
+				vox.unknownChunks.push_back(std::move(raw));
+			}
+		}
+
+		timings.other += steadyNanoseconds() - otherStart;
+
+		vox.sourceChunks = std::move(refs);
+		vox.sourceSize = size;
+		vox.sourceHash = hash64(data, size);
+		timings.total = steadyNanoseconds() - start;
+		vox.decodeTimings = timings;
+		chunkHashes = std::move(hashes);
+		return changes;
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// WATCHING
+	//////////////////////////////////////////////////////////////////////////////
+
+#ifdef JIM_VOXRELOAD_INOTIFY
+	static std::string directoryOf(const std::string &path) {
+		size_t slash = path.find_last_of('/');
+		return slash == std::string::npos ? "." : path.substr(0, slash + 1);
+	}
+
+	static std::string fileNameOf(const std::string &path) {
+		size_t slash = path.find_last_of('/');
+		return slash == std::string::npos ? path : path.substr(slash + 1);
+	}
+#endif
+
+	VoxReloader::VoxReloader() {
+#ifdef JIM_VOXRELOAD_INOTIFY
+		inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (inotify < 0) {
+			throw VoxReader::Exception("Cannot initialize inotify");
+		}
+#endif
+	}
+
+	VoxReloader::~VoxReloader() {
+#ifdef JIM_VOXRELOAD_INOTIFY
+		close(inotify);
+#endif
+	}
+
+	void VoxReloader::watch(const std::string &path, VoxReader &vox, Listener listener) {
+		Watch watch;
+		watch.vox = &vox;
+		watch.listener = std::move(listener);
+		watch.descriptor = -1;
+
+#ifdef JIM_VOXRELOAD_INOTIFY
+		// Watch the directory, editors often save by writing a new file and renaming it over the old one.
+		// The watch comes first, so a change while loading is reported by the next poll():
+		watch.descriptor = inotify_add_watch(inotify, directoryOf(path).c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+		if (watch.descriptor < 0) {
+			throw VoxReader::Exception("Cannot watch '" + path + "'");
+		}
+#endif
+
+		try {
+			MappedFile file(path);
+			vox.load(file.data(), file.size());
+			watch.chunkHashes = hashChunks(vox, file.data(), file.size());
+			watch.fileHash = hash64(file.data(), file.size());
+		}
+		catch (...) {
+#ifdef JIM_VOXRELOAD_INOTIFY
+			bool used = false;
+			for (const auto &other : watches) {
+				used = used || other.second.descriptor == watch.descriptor;
+			}
+			if (!used) inotify_rm_watch(inotify, watch.descriptor);
+#endif
+			throw;
+		}
+
+		watches[path] = std::move(watch);
+	}
+
+	void VoxReloader::unwatch(const std::string &path) {
+		auto found = watches.find(path);
+		if (found == watches.end()) {
+			return;
+		}
+#ifdef JIM_VOXRELOAD_INOTIFY
+		int descriptor = found->second.descriptor;
+		watches.erase(found);
+		for (const auto &watch : watches) {
+			if (watch.second.descriptor == descriptor) return; // directory still in use
+		}
+		inotify_rm_watch(inotify, descriptor);
+#else
+		watches.erase(found);
+#endif
+	}
+
+	void VoxReloader::onError(ErrorListener listener) {
+		errorListener = std::move(listener);
+	}
+
+	bool VoxReloader::refresh(const std::string &path, Watch &watch) {
+		try {
+			MappedFile file(path);
+			uint64_t fileHash = hash64(file.data(), file.size());
+			if (fileHash == watch.fileHash) {
+				return false;
+			}
+			std::vector<Change> changes = reload(*watch.vox, watch.chunkHashes, file.data(), file.size());
+			watch.fileHash = fileHash;
+			if (!changes.empty() && watch.listener) {
+				watch.listener(path, *watch.vox, changes);
+			}
+			return true;
+		}
+		catch (const std::exception &error) {
+			if (errorListener) {
+				errorListener(path, error);
+			}
+			return false;
+		}
+	}
+
+	size_t VoxReloader::poll(int timeout) {
+		size_t reloaded = 0;
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
+
+		// Events of other files in the watched directories and unchanged content do not end the wait:
+		for (;;) {
+#ifdef JIM_VOXRELOAD_INOTIFY
+			int wait = timeout;
+			if (timeout > 0) {
+				const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now());
+				wait = (int)std::max<int64_t>(0, (int64_t)remaining.count() + 1);
+			}
+			struct pollfd descriptor = { inotify, POLLIN, 0 };
+			const int ready = ::poll(&descriptor, 1, wait);
+			if (ready < 0 && errno != EINTR) {
+				break;
+			}
+
+			std::map<std::string, bool> changed;
+			if (ready > 0) {
+				alignas(struct inotify_event) char buffer[16 * 1024];
+				ssize_t length;
+				while ((length = read(inotify, buffer, sizeof(buffer))) > 0) {
+					for (char *p = buffer; p < buffer + length; ) {
+						const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(p);
+						if (event->len > 0) {
+							for (const auto &watch : watches) {
+								if (watch.second.descriptor == event->wd && fileNameOf(watch.first) == event->name) {
+									changed[watch.first] = true;
+								}
+							}
+						}
+						p += sizeof(struct inotify_event) + event->len;
+					}
+				}
+			}
+
+			for (const auto &path : changed) {
+				auto found = watches.find(path.first);
+				if (found != watches.end() && refresh(found->first, found->second)) {
+					reloaded++;
+				}
+			}
+#else
+			for (auto &watch : watches) {
+				if (refresh(watch.first, watch.second)) {
+					reloaded++;
+				}
+			}
+#endif
+			if (reloaded > 0 || timeout == 0 || (timeout > 0 && std::chrono::steady_clock::now() >= deadline)) break;
+#ifndef JIM_VOXRELOAD_INOTIFY
+			std::this_thread::sleep_for(std::chrono::milliseconds(50));
+#endif
+		}
+
+		return reloaded;
+	}
+
+} // namespace jim
+
+#endif
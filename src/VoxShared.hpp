@@ -0,0 +1,336 @@
+#pragma once
+
+#include "VoxReader.hpp"
+#include "VoxCompiled.hpp"
+
+#include <map>
+#include <memory>
+#include <mutex>
+
+namespace jim {
+
+	/**
+	 * Shares compiled vox-data (see VoxCompiledWriter) between processes on the same host through POSIX shared memory.
+	 * The first process to open some vox-data compiles it and publishes it in a segment named after its hash;
+	 * every other process maps that segment read-only, so the decoded models exist once per host instead of once
+	 * per process. The compiled format is index based, so it is used at whatever address the segment is mapped.
+	 *
+	 * Segments outlive the processes, call unlink() to remove them. A publisher holds a lock on its segment until it
+	 * is complete; a segment left incomplete by a publisher which died is removed and published again. Where
+	 * shm_open is not available, or another process takes longer than the timeout to publish, every process
+	 * compiles into private memory instead.
+	*/
+	class VoxSharedCache {
+	public:
+
+		/**
+		 * A compiled vox-data, mapped from a shared segment or held in private memory.
+		*/
+		class Segment {
+		public:
+			~Segment();
+
+			const VoxCompiledReader& compiled() const { return *reader; }
+
+			/**
+			 * Returns whether the segment is mapped from shared memory rather than private memory.
+			*/
+			bool shared() const { return mapped != nullptr; }
+
+		private:
+			friend class VoxSharedCache;
+
+			void *mapped = nullptr;
+			size_t mappedSize = 0;
+			std::vector<uint64_t> local; // 8 byte aligned
+			std::unique_ptr<VoxCompiledReader> reader;
+		};
+
+		/**
+		 * @param[in] prefix  Prefix of the segment names, must start with '/'.
+		 * @param[in] timeout Milliseconds to wait for another process publishing the same vox-data.
+		*/
+		explicit VoxSharedCache(const std::string &prefix = "/jimvox", unsigned timeout = 10000);
+
+		/**
+		 * Returns the compiled vox-data of the file at the given path.
+		*/
+		std::shared_ptr<const Segment> open(const std::string &path);
+
+		/**
+		 * Returns the compiled form of the given vox-data.
+		*/
+		std::shared_ptr<const Segment> open(const uint8_t *data, size_t size);
+
+		/**
+		 * Remove the segment of the given vox-data from the host. Processes which mapped it keep their mapping.
+		*/
+		void unlink(const uint8_t *data, size_t size) const;
+
+	private:
+
+		std::string segmentName(uint64_t hash, size_t size) const;
+		std::shared_ptr<Segment> attach(const std::string &name, uint64_t hash) const;
+		static void reclaim(int fd, const std::string &name);
+		std::shared_ptr<Segment> publish(const std::string &name, const std::vector<uint8_t> &compiled) const;
+		static std::vector<uint8_t> compile(const uint8_t *data, size_t size, uint64_t hash);
+
+		std::string prefix;
+		unsigned timeout;
+		std::mutex mutex;                                       // guards segments only, not held while compiling
+		std::map<std::string, std::weak_ptr<Segment>> segments; // opened by this process
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define JIM_VOXSHARED_SHM
+#endif
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// SHARED CACHE
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* Every segment starts with this header, the compiled data follows at SHARED_HEADER_SIZE.
+	* The publisher sets ready last, with release semantics, after the compiled data is complete.
+	*/
+	struct SharedHeader {
+		std::atomic<uint32_t> ready;
+		uint32_t reserved;
+		uint64_t size;
+		uint64_t hash;
+	};
+
+	static const size_t SHARED_HEADER_SIZE = 64;
+	static_assert(sizeof(SharedHeader) <= SHARED_HEADER_SIZE, "SharedHeader must fit the reserved space");
+
+	VoxSharedCache::Segment::~Segment() {
+#ifdef JIM_VOXSHARED_SHM
+		if (mapped != nullptr) {
+			munmap(mapped, mappedSize);
+		}
+#endif
+	}
+
+	VoxSharedCache::VoxSharedCache(const std::string &prefix, unsigned timeout) : prefix(prefix), timeout(timeout) {}
+
+	std::string VoxSharedCache::segmentName(uint64_t hash, size_t size) const {
+		char text[40];
+		snprintf(text, sizeof(text), "-%016llx-%llx", (unsigned long long)hash, (unsigned long long)size);
+		return prefix + text;
+	}
+
+	std::vector<uint8_t> VoxSharedCache::compile(const uint8_t *data, size_t size, uint64_t hash) {
+		VoxReader vox;
+		vox.load(data, size);
+		std::ostringstream s;
+		VoxCompiledWriter::save(vox, s, VoxCompiledWriter::FILE_ORDER, hash);
+		std::string compiled = s.str();
+		return std::vector<uint8_t>(compiled.begin(), compiled.end());
+	}
+
+	std::shared_ptr<const VoxSharedCache::Segment> VoxSharedCache::open(const std::string &path) {
+		MappedFile file(path);
+		return open(file.data(), file.size());
+	}
+
+	std::shared_ptr<const VoxSharedCache::Segment> VoxSharedCache::open(const uint8_t *data, size_t size) {
+		uint64_t hash = hash64(data, size);
+		std::string name = segmentName(hash, size);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (std::shared_ptr<Segment> segment = segments[name].lock()) {
+				return segment;
+			}
+		}
+
+		// Waiting for another process and compiling take long, other threads of this process go on meanwhile.
+		// Threads opening the same vox-data at once end up with the same segment, the loser attaches to it:
+		std::shared_ptr<Segment> segment = attach(name, hash);
+		if (!segment) {
+			std::vector<uint8_t> compiled = compile(data, size, hash);
+			segment = publish(name, compiled);
+			if (!segment) {
+				// Another process is publishing or shared memory is not available:
+				segment = attach(name, hash);
+			}
+			if (!segment) {
+				segment = std::make_shared<Segment>();
+				segment->local.resize((compiled.size() + 7) / 8);
+				memcpy(segment->local.data(), compiled.data(), compiled.size());
+				segment->reader.reset(new VoxCompiledReader(reinterpret_cast<const uint8_t *>(segment->local.data()), compiled.size()));
+			}
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (std::shared_ptr<Segment> opened = segments[name].lock()) {
+			return opened;
+		}
+		segments[name] = segment;
+		return segment;
+	}
+
+	std::shared_ptr<VoxSharedCache::Segment> VoxSharedCache::attach(const std::string &name, uint64_t hash) const {
+#ifdef JIM_VOXSHARED_SHM
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if (fd < 0) {
+			return nullptr;
+		}
+
+		// Wait until the publisher has sized and filled the segment:
+		const auto start = std::chrono::steady_clock::now();
+		const auto deadline = start + std::chrono::milliseconds(timeout);
+		auto unlocked = start; // since when the segment is incomplete without a publisher holding its lock
+		bool wasUnlocked = false;
+		std::shared_ptr<Segment> segment;
+		for (;;) {
+			struct stat info;
+			if (fstat(fd, &info) == 0 && (size_t)info.st_size >= SHARED_HEADER_SIZE) {
+				void *address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+				if (address != MAP_FAILED) {
+					const SharedHeader *header = static_cast<const SharedHeader *>(address);
+					if (header->ready.load(std::memory_order_acquire) == 1 && header->hash == hash &&
+						header->size <= (uint64_t)info.st_size - SHARED_HEADER_SIZE) {
+						segment = std::make_shared<Segment>();
+						segment->mapped = address;
+						segment->mappedSize = (size_t)info.st_size;
+						break;
+					}
+					munmap(address, (size_t)info.st_size);
+				}
+			}
+
+			// The lock of a publisher is released when it dies. It takes the lock right after creating the
+			// segment and drops it right after finishing, so the lock must stay free a while to be sure:
+			const auto now = std::chrono::steady_clock::now();
+			if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+				if (!wasUnlocked) {
+					wasUnlocked = true;
+					unlocked = now;
+				}
+				else if (now - unlocked >= std::chrono::milliseconds(50)) {
+					reclaim(fd, name);
+					break;
+				}
+				flock(fd, LOCK_UN);
+			}
+			else {
+				wasUnlocked = false;
+			}
+
+			if (now >= deadline) break;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		close(fd);
+
+		if (segment) {
+			const SharedHeader *header = static_cast<const SharedHeader *>(segment->mapped);
+			const uint8_t *compiled = static_cast<const uint8_t *>(segment->mapped) + SHARED_HEADER_SIZE;
+			try {
+				segment->reader.reset(new VoxCompiledReader(compiled, (size_t)header->size));
+			}
+			catch (const VoxReader::Exception &) {
+				return nullptr;
+			}
+		}
+		return segment;
+#else
+		(void)name;
+		(void)hash;
+		return nullptr;
+#endif
+	}
+
+	void VoxSharedCache::reclaim(int fd, const std::string &name) {
+#ifdef JIM_VOXSHARED_SHM
+		// Another process may have reclaimed it already and published anew under the same name:
+		int current = shm_open(name.c_str(), O_RDONLY, 0);
+		if (current < 0) {
+			return;
+		}
+		struct stat stale, info;
+		if (fstat(fd, &stale) == 0 && fstat(current, &info) == 0 && stale.st_dev == info.st_dev && stale.st_ino == info.st_ino) {
+			shm_unlink(name.c_str());
+		}
+		close(current);
+#else
+		(void)fd;
+		(void)name;
+#endif
+	}
+
+	std::shared_ptr<VoxSharedCache::Segment> VoxSharedCache::publish(const std::string &name, const std::vector<uint8_t> &compiled) const {
+#ifdef JIM_VOXSHARED_SHM
+		// Only one process wins the exclusive create, all others attach:
+		int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+		if (fd < 0) {
+			return nullptr;
+		}
+		// Held until the segment is complete, tells attaching processes this one is alive:
+		flock(fd, LOCK_EX);
+
+		size_t size = SHARED_HEADER_SIZE + compiled.size();
+		void *address = MAP_FAILED;
+		if (ftruncate(fd, (off_t)size) == 0) {
+			address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		}
+		if (address == MAP_FAILED) {
+			shm_unlink(name.c_str());
+			close(fd);
+			return nullptr;
+		}
+
+		std::shared_ptr<Segment> segment = std::make_shared<Segment>();
+		segment->mapped = address;
+		segment->mappedSize = size;
+
+		uint8_t *bytes = static_cast<uint8_t *>(address);
+		memcpy(bytes + SHARED_HEADER_SIZE, compiled.data(), compiled.size());
+		segment->reader.reset(new VoxCompiledReader(bytes + SHARED_HEADER_SIZE, compiled.size()));
+
+		SharedHeader *header = static_cast<SharedHeader *>(address);
+		header->size = compiled.size();
+		header->hash = segment->reader->sourceHash();
+		header->ready.store(1, std::memory_order_release);
+		close(fd); // releases the lock
+
+		// Keep only a read-only view:
+		mprotect(address, size, PROT_READ);
+		return segment;
+#else
+		(void)name;
+		(void)compiled;
+		return nullptr;
+#endif
+	}
+
+	void VoxSharedCache::unlink(const uint8_t *data, size_t size) const {
+#ifdef JIM_VOXSHARED_SHM
+		shm_unlink(segmentName(hash64(data, size), size).c_str());
+#else
+		(void)data;
+		(void)size;
+#endif
+	}
+
+} // namespace jim
+
+#endif
@@ -0,0 +1,1702 @@
+/**
+ * Round trip tests of the library on the bundled samples:
+ *     VoxTests [sample directory] [scratch directory]
+ *
+ * The samples are chr_knight.vox, 3x3x3.vox and 3x3x3_palette.vox, read from the sample directory (default: the
+ * current directory), and a scene built by the tests. Files written by the tests go to the scratch directory
+ * (default: VoxTests.tmp), which is created and removed again. Objects are compared by what VoxWriter makes of them.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#define JIM_VOXREADER_IMPLEMENTATION
+#include "VoxReader.hpp"
+#include "VoxWriter.hpp"
+#include "VoxWorld.hpp"
+#include "VoxExport.hpp"
+#include "VoxFormats.hpp"
+#include "VoxBundle.hpp"
+#include "VoxCompiled.hpp"
+#include "VoxCache.hpp"
+#include "VoxShared.hpp"
+#include "VoxReload.hpp"
+#include "VoxDedup.hpp"
+#include "VoxInfo.hpp"
+#include "VoxValidate.hpp"
+#include "VoxTrace.hpp"
+#include "VoxDump.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace jim;
+
+static std::string samples = ".";
+static std::string scratch = "VoxTests.tmp";
+static size_t failures = 0;
+
+/**
+ * Unlike assert() also checked in release builds, a failed check is reported and the test goes on.
+ */
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+static bool check(bool condition, const char *text, const char *file, int line) {
+	if (!condition) {
+		printf("%s:%d: check failed: %s\n", file, line, text);
+		failures++;
+	}
+	return condition;
+}
+
+/**
+ * Expects the call to throw a VoxReader::Exception whose message contains the given text.
+ */
+#define CHECK_THROWS(call, text) checkThrows([&] { call; }, (text), #call, __FILE__, __LINE__)
+
+template <typename CALL>
+static void checkThrows(CALL call, const char *text, const char *callText, const char *file, int line) {
+	try {
+		call();
+	}
+	catch (const VoxReader::Exception &e) {
+		if (strstr(e.what(), text) == nullptr) {
+			printf("%s:%d: %s threw '%s', expected '%s'\n", file, line, callText, e.what(), text);
+			failures++;
+		}
+		return;
+	}
+	printf("%s:%d: %s did not throw\n", file, line, callText);
+	failures++;
+}
+
+static std::string sample(const char *name) {
+	return samples + '/' + name;
+}
+
+static std::string temporary(const char *name) {
+	return scratch + '/' + name;
+}
+
+static std::string readFile(const std::string &path) {
+	std::ifstream s(path, std::ios::binary);
+	if (!s) {
+		throw VoxReader::Exception("Cannot open " + path);
+	}
+	return std::string(std::istreambuf_iterator<char>(s), std::istreambuf_iterator<char>());
+}
+
+static void load(VoxReader &vox, const std::string &bytes) {
+	vox.load(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size());
+}
+
+static std::string serialize(const VoxReader &vox) {
+	std::ostringstream s;
+	VoxWriter(vox).save(s);
+	return s.str();
+}
+
+static const char *const VALID_SAMPLES[] = { "chr_knight.vox", "3x3x3.vox", "3x3x3_palette.vox" };
+
+//////////////////////////////////////////////////////////////////////////////
+// BUILT INPUT
+//////////////////////////////////////////////////////////////////////////////
+
+static void putInt(std::string &s, int32_t value) {
+	const uint8_t bytes[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+	s.append(reinterpret_cast<const char *>(bytes), 4);
+}
+
+static void putString(std::string &s, const std::string &text) {
+	putInt(s, (int32_t)text.size());
+	s += text;
+}
+
+static void putDictionary(std::string &s, const Dictionary &dictionary) {
+	putInt(s, (int32_t)dictionary.size());
+	for (const auto &entry : dictionary) {
+		putString(s, entry.first);
+		putString(s, entry.second);
+	}
+}
+
+static std::string chunk(const char *id, const std::string &content, const std::string &children = std::string()) {
+	std::string s(id, 4);
+	putInt(s, (int32_t)content.size());
+	putInt(s, (int32_t)children.size());
+	return s + content + children;
+}
+
+static std::string voxFile(const std::string &children) {
+	std::string s("VOX ");
+	putInt(s, 150);
+	return s + chunk("MAIN", std::string(), children);
+}
+
+static std::string modelChunks(int32_t sizeX, int32_t sizeY, int32_t sizeZ, const std::vector<Voxel> &voxels) {
+	std::string size, xyzi;
+	putInt(size, sizeX);
+	putInt(size, sizeY);
+	putInt(size, sizeZ);
+	putInt(xyzi, (int32_t)voxels.size());
+	for (const Voxel &v : voxels) {
+		xyzi += (char)v.x;
+		xyzi += (char)v.y;
+		xyzi += (char)v.z;
+		xyzi += (char)v.colorIndex;
+	}
+	return chunk("SIZE", size) + chunk("XYZI", xyzi);
+}
+
+static std::string transformChunk(int32_t id, const Dictionary &attributes, int32_t child, int32_t layer, const Dictionary &frame) {
+	std::string s;
+	putInt(s, id);
+	putDictionary(s, attributes);
+	putInt(s, child);
+	putInt(s, -1);
+	putInt(s, layer);
+	putInt(s, 1);
+	putDictionary(s, frame);
+	return chunk("nTRN", s);
+}
+
+static std::string groupChunk(int32_t id, const std::vector<int32_t> &children) {
+	std::string s;
+	putInt(s, id);
+	putDictionary(s, Dictionary());
+	putInt(s, (int32_t)children.size());
+	for (int32_t child : children) putInt(s, child);
+	return chunk("nGRP", s);
+}
+
+static std::string shapeChunk(int32_t id, int32_t modelId) {
+	std::string s;
+	putInt(s, id);
+	putDictionary(s, Dictionary());
+	putInt(s, 1);
+	putInt(s, modelId);
+	putDictionary(s, Dictionary());
+	return chunk("nSHP", s);
+}
+
+/**
+ * Two models, each instanced by a named transform node below a group, on two layers, with palette, material and
+ * chunks the reader does not interpret. The chunks are in the order VoxWriter writes them, so writing the loaded
+ * scene must reproduce it exactly.
+ */
+static std::string sceneFile() {
+	std::string s;
+	std::string pack;
+	putInt(pack, 2);
+	s += chunk("PACK", pack);
+	s += modelChunks(4, 4, 4, { Voxel(0, 0, 0, 1), Voxel(3, 0, 0, 2), Voxel(0, 3, 1, 3), Voxel(3, 3, 3, 255) });
+	s += modelChunks(2, 3, 1, { Voxel(1, 2, 0, 7), Voxel(0, 0, 0, 8) });
+	s += transformChunk(0, {}, 1, -1, {});
+	s += groupChunk(1, { 2, 4 });
+	s += transformChunk(2, { { "_name", "first" } }, 3, 0, { { "_t", "0 0 0" } });
+	s += shapeChunk(3, 0);
+	s += transformChunk(4, { { "_name", "second" }, { "_hidden", "0" } }, 5, 1, { { "_t", "10 -4 2" }, { "_r", "4" } });
+	s += shapeChunk(5, 1);
+	for (int32_t layer = 0; layer < 2; layer++) {
+		std::string content;
+		putInt(content, layer);
+		putDictionary(content, { { "_name", "layer " + std::to_string(layer) } });
+		putInt(content, -1);
+		s += chunk("LAYR", content);
+	}
+	std::string palette;
+	for (int32_t i = 0; i < 256; i++) putInt(palette, (int32_t)(0xFF000000u | (uint32_t)i * 0x010203u));
+	s += chunk("RGBA", palette);
+	std::string render;
+	putDictionary(render, { { "_type", "_bloom" }, { "_mix", "0.5" } });
+	s += chunk("rOBJ", render);
+	std::string note;
+	putInt(note, 1);
+	putString(note, "note");
+	s += chunk("NOTE", note);
+	std::string material;
+	putInt(material, 1);
+	putDictionary(material, { { "_type", "_metal" }, { "_rough", "0.5" } });
+	s += chunk("MATL", material);
+	return voxFile(s);
+}
+
+/**
+ * Many models of different sizes, so the models are serialized by several threads.
+ */
+static void generateModels(VoxReader &vox, uint32_t count) {
+	for (uint32_t m = 0; m < count; m++) {
+		const uint32_t size = 1 + m % 32;
+		Model model(size, size, size);
+		for (uint32_t i = 0; i < size * size; i++) {
+			model.voxels.push_back(Voxel((uint8_t)(i % size), (uint8_t)(i / size), (uint8_t)(m % size), (uint8_t)(1 + (i + m) % 255)));
+		}
+		vox.models.push_back(std::move(model));
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////////
+// TESTS
+//////////////////////////////////////////////////////////////////////////////
+
+static void testWriter() {
+	for (const char *name : VALID_SAMPLES) {
+		VoxReader vox;
+		load(vox, readFile(sample(name)));
+		const std::string written = serialize(vox);
+		CHECK(VoxWriter(vox).size() == written.size());
+
+		VoxReader reloaded;
+		load(reloaded, written);
+		CHECK(serialize(reloaded) == written);
+		CHECK(reloaded.models.size() == vox.models.size());
+		for (size_t i = 0; i < vox.models.size() && i < reloaded.models.size(); i++) {
+			CHECK(reloaded.models[i].voxels.size() == vox.models[i].voxels.size());
+		}
+	}
+
+	const std::string scene = sceneFile();
+	VoxReader vox;
+	load(vox, scene);
+	CHECK(vox.models.size() == 2);
+	CHECK(vox.layers.size() == 2);
+	CHECK(vox.materials.size() == 2 && vox.materials[1].properties.size() == 2);
+	CHECK(vox.palette->size() == 256 && (*vox.palette)[2].r == 6 && (*vox.palette)[2].b == 2);
+	CHECK(vox.unknownChunks.size() == 2);
+	const SceneGraph::Node *node = vox.sceneGraph.GetNode(4);
+	if (CHECK(node != nullptr && node->type == SceneGraph::Node::TRANSFORM)) {
+		const auto &transform = static_cast<const SceneGraph::TransformNode &>(*node);
+		CHECK(transform.childNodeId == 5 && transform.layerId == 1);
+		CHECK(transform.attributes.size() == 2 && transform.frame_attributes.size() == 1);
+	}
+	CHECK(serialize(vox) == scene);
+	CHECK(VoxWriter(vox).size() == scene.size());
+
+	// Without a palette, layers, materials or scene graph nothing of them is written:
+	VoxReader empty;
+	load(empty, voxFile(modelChunks(1, 1, 1, { Voxel(0, 0, 0, 1) })));
+	CHECK(serialize(empty) == voxFile(modelChunks(1, 1, 1, { Voxel(0, 0, 0, 1) })));
+
+	// Streams are read into memory and loaded the same:
+	VoxReader streamed;
+	std::istringstream s(scene);
+	streamed.load(s);
+	CHECK(serialize(streamed) == scene);
+
+	VoxReader broken;
+	CHECK_THROWS(load(broken, "VOX "), "");
+	CHECK_THROWS(load(broken, scene.substr(0, scene.size() - 1)), "");
+}
+
+static void testFileWriter() {
+	std::vector<std::string> inputs;
+	for (const char *name : VALID_SAMPLES) {
+		inputs.push_back(readFile(sample(name)));
+	}
+	inputs.push_back(sceneFile());
+
+	const std::string path = temporary("written.vox");
+	for (const std::string &input : inputs) {
+		VoxReader vox;
+		load(vox, input);
+		VoxWriter(vox).save(path);
+		CHECK(readFile(path) == serialize(vox));
+	}
+
+	VoxReader many;
+	generateModels(many, 300);
+	VoxWriter(many).save(path);
+	CHECK(readFile(path) == serialize(many));
+
+	CHECK_THROWS(VoxWriter(many).save(temporary("missing/written.vox")), "");
+}
+
+static void writeFile(const std::string &path, const std::string &bytes) {
+	std::ofstream s(path, std::ios::binary | std::ios::trunc);
+	s.write(bytes.data(), (std::streamsize)bytes.size());
+}
+
+static void testPatched() {
+	const std::string source = temporary("source.vox");
+	const std::string patched = temporary("patched.vox");
+	const std::string scene = sceneFile();
+	writeFile(source, scene);
+
+	VoxReader vox;
+	load(vox, readFile(source));
+	CHECK(vox.sourceChunks.size() == 17);
+
+	// Nothing changed, the source is copied:
+	VoxWriter(vox).savePatched(source, patched, VoxWriter::Changes());
+	CHECK(readFile(patched) == scene);
+
+	// One object of every kind changed and one model added:
+	vox.models[0].voxels[1].colorIndex = 9;
+	const_cast<SceneGraph::Node *>(vox.sceneGraph.GetNode(2))->attributes[0].second = "renamed";
+	vox.layers[1].attributes.emplace_back("_hidden", "1");
+	vox.materials[1].properties[1].second = "0.25";
+	(*vox.palette)[7].g = 99;
+	vox.models.emplace_back(1, 1, 1);
+	vox.models.back().voxels.push_back(Voxel(0, 0, 0, 4));
+	VoxWriter::Changes changes;
+	changes.models.push_back(0);
+	changes.nodes.push_back(2);
+	changes.layers.push_back(1);
+	changes.materials.push_back(1);
+	changes.palette = true;
+	VoxWriter(vox).savePatched(source, patched, changes);
+	CHECK(readFile(source) == scene);
+
+	VoxReader result;
+	load(result, readFile(patched));
+	CHECK(serialize(result) == serialize(vox));
+	CHECK(result.unknownChunks.size() == 2);
+
+	// Removed objects cannot be patched:
+	vox.layers.pop_back();
+	CHECK_THROWS(VoxWriter(vox).savePatched(source, patched, changes), "removed since loading");
+
+	VoxReader empty;
+	CHECK_THROWS(VoxWriter(empty).savePatched(source, patched, changes), "Nothing was loaded");
+
+	// Saving over the source replaces it once the patched file is complete, and leaves no temporary file behind:
+	VoxReader inPlace;
+	load(inPlace, readFile(source));
+	inPlace.models[1].voxels[0].colorIndex = 42;
+	VoxWriter::Changes modelChanged;
+	modelChanged.models.push_back(1);
+	VoxWriter(inPlace).savePatched(source, source, modelChanged);
+	CHECK(readFile(source) == serialize(inPlace));
+	size_t files = 0;
+	for (const auto &entry : std::filesystem::directory_iterator(scratch)) {
+		files += entry.path().filename().string().find("source.vox") != std::string::npos;
+	}
+	CHECK(files == 1);
+
+	// A source of another size than the loaded data is rejected, and the target left alone:
+	VoxReader fresh;
+	load(fresh, scene);
+	generateModels(inPlace, 1);
+	writeFile(source, serialize(inPlace));
+	writeFile(patched, scene);
+	CHECK_THROWS(VoxWriter(fresh).savePatched(source, patched, VoxWriter::Changes()), "Source file does not match the loaded data");
+	CHECK(readFile(patched) == scene);
+
+	// So is a source rewritten with other content of the same size, however soon after loading:
+	writeFile(source, scene);
+	load(fresh, readFile(source));
+	std::string recolored = scene;
+	recolored[recolored.size() - 1] ^= 1;
+	writeFile(source, recolored);
+	CHECK_THROWS(VoxWriter(fresh).savePatched(source, patched, VoxWriter::Changes()), "Source file was changed since loading");
+	CHECK(readFile(patched) == scene);
+	writeFile(source, scene);
+	VoxWriter(fresh).savePatched(source, patched, VoxWriter::Changes());
+	CHECK(readFile(patched) == scene);
+}
+
+namespace jim {
+
+	static bool operator<(const WorldVoxel &a, const WorldVoxel &b) {
+		return std::make_tuple(a.x, a.y, a.z, a.colorIndex) < std::make_tuple(b.x, b.y, b.z, b.colorIndex);
+	}
+
+	static bool operator==(const WorldVoxel &a, const WorldVoxel &b) {
+		return a.x == b.x && a.y == b.y && a.z == b.z && a.colorIndex == b.colorIndex;
+	}
+
+}
+
+/**
+ * Sparse voxels far apart, around the origin and on tile borders, some of them empty.
+ */
+static VoxWorld generateWorld() {
+	VoxWorld world;
+	for (int32_t i = 0; i < 5000; i++) {
+		const int32_t x = (i * 7919) % 1200 - 600, y = (i * 104729) % 700 - 350, z = (i * 31) % 300 - 150;
+		world.voxels.push_back(WorldVoxel{ x, y, z, (uint8_t)(i % 256) });
+	}
+	world.voxels.push_back(WorldVoxel{ 255, 255, 255, 1 });
+	world.voxels.push_back(WorldVoxel{ 256, 256, 256, 2 });
+	world.voxels.push_back(WorldVoxel{ -1000000, 2000000, -3000000, 3 });
+	// Positions are unique:
+	std::sort(world.voxels.begin(), world.voxels.end());
+	world.voxels.erase(std::unique(world.voxels.begin(), world.voxels.end(), [](const WorldVoxel &a, const WorldVoxel &b) {
+		return a.x == b.x && a.y == b.y && a.z == b.z;
+	}), world.voxels.end());
+	std::reverse(world.voxels.begin(), world.voxels.end());
+	return world;
+}
+
+/**
+ * Places the voxels of every shape node below the root group at the translation of its transform node.
+ */
+static std::vector<WorldVoxel> placedVoxels(const VoxReader &vox) {
+	std::vector<WorldVoxel> voxels;
+	const auto &group = static_cast<const SceneGraph::GroupNode &>(*vox.sceneGraph.GetNode(1));
+	for (SceneGraph::NodeId id : group.childNodeIds) {
+		const auto &transform = static_cast<const SceneGraph::TransformNode &>(*vox.sceneGraph.GetNode(id));
+		const auto &shape = static_cast<const SceneGraph::ShapeNode &>(*vox.sceneGraph.GetNode(transform.childNodeId));
+		const Model &model = vox.models[shape.models[0].modelId];
+		int32_t tx = 0, ty = 0, tz = 0;
+		std::istringstream(transform.frame_attributes[0][0].second) >> tx >> ty >> tz;
+		for (const Voxel &v : model.voxels) {
+			voxels.push_back(WorldVoxel{ tx - (int32_t)(model.sizeX / 2) + v.x, ty - (int32_t)(model.sizeY / 2) + v.y, tz - (int32_t)(model.sizeZ / 2) + v.z, v.colorIndex });
+		}
+	}
+	std::sort(voxels.begin(), voxels.end());
+	return voxels;
+}
+
+static void testWorldSplit() {
+	const VoxWorld world = generateWorld();
+	std::vector<WorldVoxel> expected;
+	for (const WorldVoxel &v : world.voxels) {
+		if (v.colorIndex != 0) expected.push_back(v);
+	}
+	std::sort(expected.begin(), expected.end());
+
+	for (uint32_t tileSize : { 256u, 100u, 1u }) {
+		std::string first;
+		for (unsigned threads : { 1u, 4u }) {
+			VoxReader vox;
+			world.split(vox, threads, tileSize);
+			CHECK(vox.layers.size() == 1);
+			for (const Model &model : vox.models) {
+				CHECK(model.sizeX <= tileSize && model.sizeY <= tileSize && model.sizeZ <= tileSize);
+				CHECK(!model.voxels.empty());
+			}
+			CHECK(placedVoxels(vox) == expected);
+
+			// The output does not depend on the number of threads, and can be written and loaded again:
+			const std::string written = serialize(vox);
+			if (first.empty()) first = written;
+			CHECK(written == first);
+			VoxReader reloaded;
+			load(reloaded, written);
+			CHECK(placedVoxels(reloaded) == expected);
+		}
+	}
+
+	// Replaces models and scene graph of a loaded file, but keeps its palette, layers and materials:
+	VoxReader vox;
+	load(vox, sceneFile());
+	world.split(vox, 2);
+	CHECK(vox.layers.size() == 2 && vox.materials.size() == 2 && vox.palette != &VoxReader::DEFAULT_PALETTE);
+	CHECK(placedVoxels(vox) == expected);
+
+	VoxReader empty;
+	VoxWorld().split(empty);
+	CHECK(empty.models.empty() && empty.sceneGraph.GetNodeCount() == 2);
+	CHECK_THROWS(world.split(empty, 1, 0), "Tile size must be between 1 and 256");
+	CHECK_THROWS(world.split(empty, 1, 257), "Tile size must be between 1 and 256");
+}
+
+/**
+ * Adds a transform node with the given id above a shape node of the given model to the group with id 1.
+ */
+static SceneGraph::TransformNode& addInstance(VoxReader &vox, SceneGraph::NodeId id, uint32_t modelId, int32_t layerId, const char *translation, const char *rotation = nullptr) {
+	auto &transform = vox.sceneGraph.AddTransformNode(id);
+	transform.childNodeId = id + 1;
+	transform.layerId = layerId;
+	transform.frame_attributes.resize(1);
+	transform.frame_attributes[0].emplace_back("_t", translation);
+	if (rotation != nullptr) transform.frame_attributes[0].emplace_back("_r", rotation);
+	auto &shape = vox.sceneGraph.AddShapeNode(id + 1);
+	shape.models.resize(1);
+	shape.models[0].modelId = modelId;
+	static_cast<SceneGraph::GroupNode &>(*const_cast<SceneGraph::Node *>(vox.sceneGraph.GetNode(1))).childNodeIds.push_back(id);
+	return transform;
+}
+
+static void testWorldMerge() {
+	// Splitting and merging again gives back the world:
+	const VoxWorld world = generateWorld();
+	std::vector<WorldVoxel> expected;
+	for (const WorldVoxel &v : world.voxels) {
+		if (v.colorIndex != 0) expected.push_back(v);
+	}
+	std::sort(expected.begin(), expected.end());
+	for (unsigned threads : { 1u, 4u }) {
+		VoxReader vox;
+		world.split(vox, threads, 64);
+		VoxWorld merged;
+		merged.merge(vox, VoxWorld::KEEP_LAST, threads);
+		CHECK(std::is_sorted(merged.voxels.begin(), merged.voxels.end(), [](const WorldVoxel &a, const WorldVoxel &b) {
+			return std::make_tuple(a.z, a.y, a.x) < std::make_tuple(b.z, b.y, b.x);
+		}));
+		std::sort(merged.voxels.begin(), merged.voxels.end());
+		CHECK(merged.voxels == expected);
+	}
+
+	// A model of two voxels, instanced rotated by 90 degrees around z, on a hidden layer, below a hidden
+	// transform and twice at the same position:
+	VoxReader vox;
+	vox.models.emplace_back(2, 1, 1);
+	vox.models[0].voxels = { Voxel(0, 0, 0, 1), Voxel(1, 0, 0, 2) };
+	vox.models.emplace_back(1, 1, 1);
+	vox.models[1].voxels = { Voxel(0, 0, 0, 3) };
+	vox.models.emplace_back(1, 1, 1);
+	vox.models[2].voxels = { Voxel(0, 0, 0, 4) };
+	auto &root = vox.sceneGraph.AddTransformNode(0);
+	root.childNodeId = 1;
+	root.layerId = -1;
+	root.frame_attributes.resize(1);
+	root.frame_attributes[0].emplace_back("_t", "100 0 0");
+	vox.sceneGraph.AddGroupNode(1);
+	addInstance(vox, 2, 0, 0, "5 5 5", "1");
+	addInstance(vox, 4, 0, 1, "0 0 0");
+	addInstance(vox, 6, 0, 0, "0 0 0").attributes.emplace_back("_hidden", "1");
+	addInstance(vox, 8, 1, 0, "-7 0 3");
+	addInstance(vox, 10, 2, 0, "-7 0 3");
+	vox.layers.resize(2);
+	vox.layers[1].attributes.emplace_back("_hidden", "1");
+
+	VoxWorld last, first;
+	last.merge(vox, VoxWorld::KEEP_LAST, 1);
+	first.merge(vox, VoxWorld::KEEP_FIRST, 3);
+	const std::vector<WorldVoxel> expectedLast = { { 93, 0, 3, 4 }, { 105, 4, 5, 1 }, { 105, 5, 5, 2 } };
+	const std::vector<WorldVoxel> expectedFirst = { { 93, 0, 3, 3 }, { 105, 4, 5, 1 }, { 105, 5, 5, 2 } };
+	std::sort(last.voxels.begin(), last.voxels.end());
+	std::sort(first.voxels.begin(), first.voxels.end());
+	CHECK(last.voxels == expectedLast);
+	CHECK(first.voxels == expectedFirst);
+
+	// Without a scene graph models keep their local coordinates:
+	VoxReader cube;
+	load(cube, readFile(sample("3x3x3.vox")));
+	VoxWorld local;
+	local.merge(cube);
+	CHECK(local.voxels.size() == cube.models[0].voxels.size());
+	for (const WorldVoxel &v : local.voxels) {
+		CHECK(v.x >= 0 && v.x < 3 && v.y >= 0 && v.y < 3 && v.z >= 0 && v.z < 3);
+	}
+
+	// References to missing models are rejected:
+	static_cast<SceneGraph::ShapeNode &>(*const_cast<SceneGraph::Node *>(vox.sceneGraph.GetNode(3))).models[0].modelId = 3;
+	CHECK_THROWS(last.merge(vox), "missing model");
+
+	// Instances reaching the end of the int32 coordinates are placed, beyond it rejected:
+	VoxReader edge;
+	edge.models.emplace_back(3, 1, 1);
+	edge.models[0].voxels = { Voxel(0, 0, 0, 1), Voxel(2, 0, 0, 2) };
+	auto &edgeRoot = edge.sceneGraph.AddTransformNode(0);
+	edgeRoot.childNodeId = 1;
+	edgeRoot.layerId = -1;
+	edgeRoot.frame_attributes.resize(1);
+	edge.sceneGraph.AddGroupNode(1);
+	auto &edgeInstance = addInstance(edge, 2, 0, 0, "2147483646 0 -2147483647");
+	edge.layers.resize(1);
+	VoxWorld placed;
+	placed.merge(edge);
+	std::sort(placed.voxels.begin(), placed.voxels.end());
+	const std::vector<WorldVoxel> expectedEdge = { { 2147483645, 0, -2147483647, 1 }, { 2147483647, 0, -2147483647, 2 } };
+	CHECK(placed.voxels == expectedEdge);
+	edgeInstance.frame_attributes[0][0].second = "2147483647 0 0";
+	CHECK_THROWS(placed.merge(edge), "Instance lies outside the int32 coordinate range");
+	// Mirrored along x, the voxel at x = 2 lands one below the translation:
+	edgeInstance.frame_attributes[0][0].second = "-2147483648 0 0";
+	edgeInstance.frame_attributes[0].emplace_back("_r", "20");
+	CHECK_THROWS(placed.merge(edge), "Instance lies outside the int32 coordinate range");
+}
+
+static size_t countLines(const std::string &text, const char *prefix) {
+	size_t count = 0;
+	std::istringstream s(text);
+	for (std::string line; std::getline(s, line); ) {
+		if (line.compare(0, strlen(prefix), prefix) == 0) count++;
+	}
+	return count;
+}
+
+/**
+ * Returns the number of the given element declared in the header of a PLY file, and the size of the header.
+ */
+static size_t plyElements(const std::string &ply, const char *element, size_t &headerSize) {
+	const std::string end = "end_header\n";
+	headerSize = ply.find(end) + end.size();
+	const std::string declaration = std::string("element ") + element + ' ';
+	size_t position = ply.find(declaration);
+	return position < headerSize ? (size_t)atoll(ply.c_str() + position + declaration.size()) : 0;
+}
+
+static void testExport() {
+	VoxReader vox;
+	vox.models.emplace_back(1, 1, 1);
+	vox.models[0].voxels = { Voxel(0, 0, 0, 1) };
+	vox.models.emplace_back(3, 3, 3);
+	for (uint8_t i = 0; i < 27; i++) {
+		vox.models[1].voxels.push_back(Voxel(i % 3, i / 3 % 3, i / 9, (uint8_t)(1 + i)));
+	}
+	vox.models.emplace_back(2, 1, 1);
+	vox.models[2].voxels = { Voxel(0, 0, 0, 5), Voxel(1, 0, 0, 6) };
+	vox.models.emplace_back(4, 4, 4); // empty
+
+	// Without a scene graph every model is exported in place, one quad per visible face:
+	const size_t faces = 6 + 54 + 10;
+	std::ostringstream obj, ply;
+	VoxExport(vox).saveObj(obj);
+	VoxExport(vox).savePly(ply);
+	CHECK(countLines(obj.str(), "v ") == 4 * faces);
+	CHECK(countLines(obj.str(), "f ") == faces);
+	size_t header;
+	CHECK(plyElements(ply.str(), "vertex", header) == 4 * faces);
+	CHECK(plyElements(ply.str(), "face", header) == faces);
+	CHECK(ply.str().size() == header + 4 * faces * 16 + faces * 17);
+
+	// OBJ and PLY hold the same vertices:
+	std::vector<float> objVertices, plyVertices;
+	std::istringstream lines(obj.str());
+	for (std::string line; std::getline(lines, line); ) {
+		if (line.compare(0, 2, "v ") != 0) continue;
+		float x, y, z;
+		if (sscanf(line.c_str(), "v %f %f %f", &x, &y, &z) == 3) objVertices.insert(objVertices.end(), { x, y, z });
+	}
+	for (size_t v = 0; v < 4 * faces; v++) {
+		float position[3];
+		memcpy(position, ply.str().data() + header + 16 * v, sizeof(position));
+		plyVertices.insert(plyVertices.end(), position, position + 3);
+	}
+	CHECK(objVertices == plyVertices);
+	CHECK(*std::min_element(objVertices.begin(), objVertices.end()) == 0.0f);
+	CHECK(*std::max_element(objVertices.begin(), objVertices.end()) == 3.0f);
+
+	// Instances on hidden layers are left out, every other one is exported:
+	auto &root = vox.sceneGraph.AddTransformNode(0);
+	root.childNodeId = 1;
+	root.layerId = -1;
+	root.frame_attributes.resize(1);
+	vox.sceneGraph.AddGroupNode(1);
+	addInstance(vox, 2, 1, 0, "0 0 0", "17");
+	addInstance(vox, 4, 1, 0, "10 0 0");
+	addInstance(vox, 6, 2, 1, "0 10 0");
+	addInstance(vox, 8, 3, 0, "0 0 10");
+	vox.layers.resize(2);
+	vox.layers[1].attributes.emplace_back("_hidden", "1");
+	std::ostringstream sceneObj, scenePly;
+	VoxExport(vox).saveObj(sceneObj);
+	VoxExport(vox).savePly(scenePly);
+	CHECK(countLines(sceneObj.str(), "f ") == 2 * 54);
+	CHECK(plyElements(scenePly.str(), "face", header) == 2 * 54);
+
+	// glb: header, a JSON and a binary chunk, one mesh per non-empty model and one node per visible instance:
+	std::ostringstream glbStream;
+	VoxExport(vox).saveGltf(glbStream);
+	const std::string glb = glbStream.str();
+	uint32_t words[5];
+	if (CHECK(glb.size() >= sizeof(words))) {
+		memcpy(words, glb.data(), sizeof(words));
+		CHECK(words[0] == 0x46546C67 && words[1] == 2 && words[2] == glb.size());
+		CHECK(words[3] % 4 == 0 && 20 + words[3] + 8 <= glb.size());
+		const std::string json = glb.substr(20, words[3]);
+		CHECK(json.find("\"meshes\"") != std::string::npos);
+		uint32_t binary[2];
+		memcpy(binary, glb.data() + 20 + words[3], sizeof(binary));
+		CHECK(binary[1] == 0x004E4942 && 20 + words[3] + 8 + binary[0] == glb.size());
+	}
+
+	// Points are the voxel centers:
+	VoxWorld world;
+	world.voxels = { { 0, 0, 0, 1 }, { -5, 7, 1000, 2 } };
+	std::ostringstream points;
+	VoxExport(vox).savePoints(points, world);
+	CHECK(plyElements(points.str(), "vertex", header) == 2);
+	CHECK(points.str().size() == header + 2 * 16);
+
+	// Colors come from the palette, file palettes store color index i at i - 1:
+	CHECK(vox.getColor(1).pack() == VoxReader::DEFAULT_PALETTE[1].pack());
+	VoxReader scene;
+	load(scene, sceneFile());
+	CHECK(scene.getColor(3).r == 6 && scene.getColor(3).b == 2);
+	VoxReader rewritten;
+	load(rewritten, serialize(vox));
+	for (int i = 1; i < 256; i++) {
+		CHECK(rewritten.getColor((uint8_t)i).pack() == vox.getColor((uint8_t)i).pack());
+	}
+
+	// A model size from the file is rejected before a grid of its volume is allocated:
+	VoxReader huge;
+	load(huge, voxFile(modelChunks(4194304, 4194304, 4194304, { Voxel(0, 0, 0, 1) })));
+	std::ostringstream hugeOut;
+	CHECK_THROWS(VoxExport(huge).saveObj(hugeOut), "Model size exceeds 256 voxels per axis");
+	CHECK_THROWS(VoxExport(huge).savePly(hugeOut), "Model size exceeds 256 voxels per axis");
+	CHECK_THROWS(VoxExport(huge).saveGltf(hugeOut), "Model size exceeds 256 voxels per axis");
+}
+
+/**
+ * World positions and colors of all visible voxels, sorted.
+ */
+static std::vector<std::tuple<int32_t, int32_t, int32_t, uint32_t>> mergedColors(const VoxReader &vox) {
+	VoxWorld world;
+	world.merge(vox);
+	std::vector<std::tuple<int32_t, int32_t, int32_t, uint32_t>> voxels;
+	for (const WorldVoxel &v : world.voxels) {
+		voxels.emplace_back(v.x, v.y, v.z, vox.getColor(v.colorIndex).pack() | 0xFF000000u);
+	}
+	std::sort(voxels.begin(), voxels.end());
+	return voxels;
+}
+
+static void testFormats() {
+	// Raw volumes round-trip when the corners are solid, volumes above 256 voxels per axis are split:
+	for (uint32_t sizeX : { 5u, 300u }) {
+		const uint32_t sizeY = 4, sizeZ = 3;
+		std::string raw(sizeX * sizeY * sizeZ, '\0');
+		for (size_t i = 0; i < raw.size(); i += 7) raw[i] = (char)(1 + i % 255);
+		raw.front() = 1;
+		raw.back() = 2;
+		VoxReader vox;
+		VoxFormats::loadRaw(vox, reinterpret_cast<const uint8_t *>(raw.data()), raw.size(), sizeX, sizeY, sizeZ, 2);
+		CHECK(vox.models.size() == (sizeX > 256 ? 2u : 1u));
+		std::ostringstream out;
+		int32_t origin[3];
+		uint32_t size[3];
+		VoxFormats::saveRaw(vox, out, origin, size);
+		CHECK(origin[0] == 0 && origin[1] == 0 && origin[2] == 0);
+		CHECK(size[0] == sizeX && size[1] == sizeY && size[2] == sizeZ);
+		CHECK(out.str() == raw);
+	}
+
+	// Qubicle keeps positions and colors of the visible scene, binvox the occupancy:
+	VoxReader scene;
+	load(scene, sceneFile());
+	const auto expected = mergedColors(scene);
+	std::ostringstream qb;
+	VoxFormats::saveQubicle(scene, qb);
+	VoxReader fromQb;
+	std::istringstream qbIn(qb.str());
+	VoxFormats::loadQubicle(fromQb, qbIn);
+	CHECK(mergedColors(fromQb) == expected);
+
+	std::ostringstream binvox;
+	VoxFormats::saveBinvox(scene, binvox);
+	CHECK(binvox.str().compare(0, 9, "#binvox 1") == 0);
+	VoxReader fromBinvox;
+	std::istringstream binvoxIn(binvox.str());
+	VoxFormats::loadBinvox(fromBinvox, binvoxIn, 7);
+	auto occupied = mergedColors(fromBinvox);
+	CHECK(occupied.size() == expected.size());
+	if (!occupied.empty() && !expected.empty()) {
+		// binvox positions start at the minimum corner, which the reader does not translate back:
+		int32_t min[3] = { INT32_MAX, INT32_MAX, INT32_MAX };
+		for (const auto &v : expected) {
+			min[0] = std::min(min[0], std::get<0>(v));
+			min[1] = std::min(min[1], std::get<1>(v));
+			min[2] = std::min(min[2], std::get<2>(v));
+		}
+		bool same = true;
+		for (size_t i = 0; i < occupied.size() && i < expected.size(); i++) {
+			same = same && std::get<0>(occupied[i]) + min[0] == std::get<0>(expected[i]) &&
+				std::get<1>(occupied[i]) + min[1] == std::get<1>(expected[i]) &&
+				std::get<2>(occupied[i]) + min[2] == std::get<2>(expected[i]) &&
+				std::get<3>(occupied[i]) == (fromBinvox.getColor(7).pack() | 0xFF000000u);
+		}
+		CHECK(same);
+	}
+
+	// Broken input:
+	VoxReader broken;
+	const std::string truncated = qb.str().substr(0, 30);
+	CHECK_THROWS(VoxFormats::loadQubicle(broken, reinterpret_cast<const uint8_t *>(truncated.data()), truncated.size()), "Qubicle: unexpected end of data");
+	const std::string noHeader = "dim 1 1 1\ndata\n";
+	CHECK_THROWS(VoxFormats::loadBinvox(broken, reinterpret_cast<const uint8_t *>(noHeader.data()), noHeader.size()), "binvox: header is missing");
+	const std::string longRun = "#binvox 1\ndim 2 2 2\ndata\n\x01\x09";
+	CHECK_THROWS(VoxFormats::loadBinvox(broken, reinterpret_cast<const uint8_t *>(longRun.data()), longRun.size()), "binvox: run exceeds the volume");
+	const uint8_t small[8] = {};
+	CHECK_THROWS(VoxFormats::loadRaw(broken, small, sizeof(small), 3, 3, 1), "raw: volume exceeds the data");
+	CHECK_THROWS(VoxFormats::loadRaw(broken, small, sizeof(small), 0xFFFFFFFFu, 0xFFFFFFFFu, 0xFFFFFFFFu), "raw: volume exceeds the data");
+
+	// Two voxels 2^21 apart would need a binvox cube of 2^63 voxels:
+	VoxReader far;
+	far.models.emplace_back(1, 1, 1);
+	far.models[0].voxels = { Voxel(0, 0, 0, 1) };
+	auto &root = far.sceneGraph.AddTransformNode(0);
+	root.childNodeId = 1;
+	root.layerId = -1;
+	root.frame_attributes.resize(1);
+	far.sceneGraph.AddGroupNode(1);
+	addInstance(far, 2, 0, 0, "0 0 0");
+	addInstance(far, 4, 0, 0, "2097152 0 0");
+	far.layers.resize(1);
+	std::ostringstream farBinvox;
+	CHECK_THROWS(VoxFormats::saveBinvox(far, farBinvox), "binvox: volume exceeds 2^21 voxels per axis");
+
+	// Extents of 2^22 per axis would need a raw volume of 2^66 bytes:
+	static_cast<SceneGraph::TransformNode &>(*far.sceneGraph.GetNode(4)).frame_attributes[0][0].second = "4194303 4194303 4194303";
+	std::ostringstream farRaw;
+	int32_t farOrigin[3];
+	uint32_t farSize[3];
+	CHECK_THROWS(VoxFormats::saveRaw(far, farRaw, farOrigin, farSize), "raw: volume exceeds");
+	CHECK(farRaw.str().empty());
+}
+
+static void testBundle() {
+	VoxBundleWriter writer;
+	for (const char *name : VALID_SAMPLES) {
+		writer.addFile(name, sample(name));
+	}
+	const std::string scene = sceneFile();
+	writer.add("scene.vox", reinterpret_cast<const uint8_t *>(scene.data()), scene.size());
+	std::ostringstream s;
+	writer.save(s);
+	const std::string bundled = s.str();
+	writeFile(temporary("samples.voxb"), bundled);
+
+	// In memory, 8 byte aligned like a mapped file, and mapped from disk:
+	std::vector<uint64_t> aligned((bundled.size() + 7) / 8);
+	memcpy(aligned.data(), bundled.data(), bundled.size());
+	VoxBundleReader inMemory(reinterpret_cast<const uint8_t *>(aligned.data()), bundled.size());
+	VoxBundleReader mapped(temporary("samples.voxb"));
+	for (const VoxBundleReader *bundle : { &inMemory, &mapped }) {
+		CHECK(bundle->size() == 4);
+		for (const char *name : VALID_SAMPLES) {
+			int64_t index = bundle->find(name);
+			if (!CHECK(index >= 0)) continue;
+			CHECK(bundle->name((size_t)index) == name);
+			CHECK(bundle->verify((size_t)index));
+			size_t size;
+			const uint8_t *data = bundle->data((size_t)index, size);
+			CHECK(std::string(reinterpret_cast<const char *>(data), size) == readFile(sample(name)));
+			CHECK(bundle->contentHash((size_t)index) == hash64(data, size));
+			VoxReader vox, expected;
+			bundle->load(name, vox);
+			load(expected, readFile(sample(name)));
+			CHECK(serialize(vox) == serialize(expected));
+		}
+		VoxReader vox;
+		bundle->load("scene.vox", vox);
+		CHECK(serialize(vox) == scene);
+		CHECK(bundle->find("missing.vox") == -1);
+		CHECK_THROWS(bundle->load("missing.vox", vox), "Bundle does not contain 'missing.vox'");
+		CHECK_THROWS(bundle->load(bundle->size(), vox), "Bundle entry index out of range");
+		size_t unused;
+		CHECK_THROWS(bundle->name(bundle->size()), "Bundle entry index out of range");
+		CHECK_THROWS(bundle->data(bundle->size(), unused), "Bundle entry index out of range");
+		CHECK_THROWS(bundle->contentHash(bundle->size()), "Bundle entry index out of range");
+		CHECK_THROWS(bundle->verify(bundle->size()), "Bundle entry index out of range");
+	}
+
+	VoxBundleWriter nestedWriter;
+	nestedWriter.addFile("nested_chunks.vox", sample("nested_chunks.vox"));
+	std::ostringstream nested;
+	nestedWriter.save(nested);
+	const std::string nestedBundle = nested.str();
+	std::vector<uint64_t> nestedAligned((nestedBundle.size() + 7) / 8);
+	memcpy(nestedAligned.data(), nestedBundle.data(), nestedBundle.size());
+	VoxReader deep;
+	CHECK_THROWS(VoxBundleReader(reinterpret_cast<const uint8_t *>(nestedAligned.data()), nestedBundle.size()).load("nested_chunks.vox", deep), "Chunks are nested too deeply");
+
+	// Entries are sorted by name hash:
+	for (size_t i = 1; i < inMemory.size(); i++) {
+		CHECK(hash64(inMemory.name(i - 1).data(), inMemory.name(i - 1).size()) <= hash64(inMemory.name(i).data(), inMemory.name(i).size()));
+	}
+
+	// Duplicated names are reported when saving, broken bundles when opening:
+	VoxBundleWriter duplicates;
+	duplicates.addFile("a.vox", sample("3x3x3.vox"));
+	duplicates.addFile("a.vox", sample("3x3x3.vox"));
+	std::ostringstream ignored;
+	CHECK_THROWS(duplicates.save(ignored), "Bundle contains 'a.vox' twice");
+	std::string broken = bundled;
+	broken[0] = 'X';
+	CHECK_THROWS(VoxBundleReader(reinterpret_cast<const uint8_t *>(broken.data()), broken.size()), "Magic string 'VOXB' is missing");
+	broken = bundled.substr(0, 16 + 40 * 2);
+	CHECK_THROWS(VoxBundleReader(reinterpret_cast<const uint8_t *>(broken.data()), broken.size()), "Bundle index exceeds the data");
+	broken = bundled;
+	std::swap_ranges(broken.begin() + 16, broken.begin() + 16 + 40, broken.begin() + 16 + 40);
+	CHECK_THROWS(VoxBundleReader(reinterpret_cast<const uint8_t *>(broken.data()), broken.size()), "Bundle index is not sorted");
+}
+
+/**
+ * Sorts the voxels of every model, for paths which may reorder them.
+ */
+static void sortVoxels(VoxReader &vox) {
+	for (Model &model : vox.models) {
+		std::sort(model.voxels.begin(), model.voxels.end(), [](const Voxel &a, const Voxel &b) {
+			return std::make_tuple(a.x, a.y, a.z, a.colorIndex) < std::make_tuple(b.x, b.y, b.z, b.colorIndex);
+		});
+	}
+}
+
+static void testCompiled() {
+	std::vector<std::string> inputs = { sceneFile() };
+	for (const char *name : VALID_SAMPLES) {
+		inputs.push_back(readFile(sample(name)));
+	}
+	for (const std::string &input : inputs) {
+		VoxReader vox;
+		load(vox, input);
+		sortVoxels(vox);
+		for (auto order : { VoxCompiledWriter::FILE_ORDER, VoxCompiledWriter::MORTON }) {
+			std::ostringstream s;
+			VoxCompiledWriter::save(vox, s, order, 42);
+			const std::string bytes = s.str();
+			std::vector<uint64_t> aligned((bytes.size() + 7) / 8);
+			memcpy(aligned.data(), bytes.data(), bytes.size());
+
+			VoxCompiledReader compiled(reinterpret_cast<const uint8_t *>(aligned.data()), bytes.size());
+			CHECK(compiled.voxelOrder() == order);
+			CHECK(compiled.sourceHash() == 42);
+			CHECK(compiled.modelCount() == vox.models.size());
+			for (size_t i = 0; i < compiled.modelCount() && i < vox.models.size(); i++) {
+				CHECK(compiled.model(i).voxelCount == vox.models[i].voxels.size());
+			}
+			for (int i = 1; i < 256; i++) {
+				CHECK(compiled.getColor((uint8_t)i).pack() == vox.getColor((uint8_t)i).pack());
+			}
+			VoxReader rebuilt;
+			compiled.toReader(rebuilt);
+			sortVoxels(rebuilt);
+			CHECK(serialize(rebuilt) == serialize(vox));
+		}
+	}
+
+	// Decoded scene, layers and materials:
+	VoxReader vox;
+	load(vox, sceneFile());
+	std::ostringstream s;
+	VoxCompiledWriter::save(vox, s);
+	writeFile(temporary("scene.voxc"), s.str());
+	VoxCompiledReader compiled(temporary("scene.voxc"));
+	CHECK(compiled.nodeCount() == 6);
+	const compiled::Node *second = compiled.node(4);
+	if (CHECK(second != nullptr && second->type == SceneGraph::Node::TRANSFORM && second->frameCount == 1)) {
+		CHECK(strcmp(compiled.string(second->name), "second") == 0);
+		CHECK(compiled.findValue(second->attributes, "_hidden") != nullptr);
+		const compiled::Transform &t = compiled.frames(*second)[0].transform;
+		CHECK(t.translation[0] == 10 && t.translation[1] == -4 && t.translation[2] == 2);
+	}
+	CHECK(compiled.instanceCount() == 2);
+	if (CHECK(compiled.instanceCount() > 1)) {
+		CHECK(compiled.instance(1).modelId == 1 && compiled.instance(1).layerId == 1);
+	}
+	CHECK(compiled.layerCount() == 2 && strcmp(compiled.string(compiled.layer(1).name), "layer 1") == 0);
+	if (CHECK(compiled.materialCount() > 1)) {
+		CHECK(compiled.material(1).type == compiled::Material::METAL && compiled.material(1).rough == 0.5f);
+	}
+
+	// References between records are checked when opened, so the accessors need no checks:
+	auto compile = [](const VoxReader &vox) {
+		std::ostringstream s;
+		VoxCompiledWriter::save(vox, s);
+		const std::string bytes = s.str();
+		std::vector<uint64_t> aligned((bytes.size() + 7) / 8);
+		memcpy(aligned.data(), bytes.data(), bytes.size());
+		VoxCompiledReader compiled(reinterpret_cast<const uint8_t *>(aligned.data()), bytes.size());
+	};
+	VoxReader missingModel;
+	load(missingModel, sceneFile());
+	static_cast<SceneGraph::ShapeNode *>(missingModel.sceneGraph.GetNode(5))->models[0].modelId = 2;
+	CHECK_THROWS(compile(missingModel), "missing model");
+	VoxReader missingLayer;
+	load(missingLayer, sceneFile());
+	static_cast<SceneGraph::TransformNode *>(missingLayer.sceneGraph.GetNode(4))->layerId = 7;
+	CHECK_THROWS(compile(missingLayer), "Compiled layer id out of range");
+
+	CHECK_THROWS(VoxCompiledReader(reinterpret_cast<const uint8_t *>(s.str().data()) + 1, 64), "Compiled data must be 8 byte aligned");
+	std::vector<uint64_t> owned((s.str().size() + 7) / 8);
+	memcpy(owned.data(), s.str().data(), s.str().size());
+	CHECK_THROWS(VoxCompiledReader(owned, 8 * owned.size() + 1), "Compiled data exceeds the buffer");
+	VoxReader fromOwned;
+	VoxCompiledReader(std::move(owned), s.str().size()).toReader(fromOwned);
+	CHECK(serialize(fromOwned) == serialize(vox));
+	std::vector<uint64_t> garbage(8, 0);
+	CHECK_THROWS(VoxCompiledReader(reinterpret_cast<const uint8_t *>(garbage.data()), 64), "Magic string 'VOXC' is missing");
+}
+
+static void testCache() {
+	const std::string directory = temporary("cache");
+	const std::string path = sample("chr_knight.vox");
+	VoxReader original;
+	load(original, readFile(path));
+	const std::string expected = serialize(original);
+	VoxCache cache(directory, 64 * 1024 * 1024);
+
+	VoxReader miss;
+	const std::string key = cache.load(path, miss);
+	CHECK(cache.stats().misses == 1 && cache.stats().hits == 0);
+	CHECK(serialize(miss) == expected);
+
+	VoxReader hit;
+	CHECK(cache.load(path, hit) == key);
+	CHECK(cache.stats().hits == 1);
+	CHECK(serialize(hit) == expected);
+
+	std::unique_ptr<VoxCompiledReader> compiled = cache.open(path);
+	CHECK(cache.stats().hits == 2);
+	VoxReader rebuilt;
+	compiled->toReader(rebuilt);
+	CHECK(serialize(rebuilt) == expected);
+
+	// The key only depends on the content:
+	const std::string bytes = readFile(path);
+	VoxReader fromMemory;
+	CHECK(cache.load(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size(), fromMemory) == key);
+	CHECK(VoxCache::key(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size()) == key);
+	CHECK(cache.stats().hits == 3 && cache.stats().misses == 1);
+
+	// Artifacts are produced once, another instance on the same directory finds them and the compiled data:
+	int produced = 0;
+	auto produce = [&produced]() { produced++; return std::vector<uint8_t>{ 1, 2, 3 }; };
+	const std::vector<uint8_t> artifact = cache.artifact(key, "bin", produce);
+	CHECK(cache.artifact(key, "bin", produce) == artifact && produced == 1);
+	VoxCache reopened(directory, 64 * 1024 * 1024);
+	VoxReader again;
+	reopened.load(path, again);
+	CHECK(reopened.stats().hits == 1 && reopened.stats().misses == 0);
+	std::vector<uint8_t> found;
+	CHECK(reopened.findArtifact(key, "bin", found) && found == artifact);
+	CHECK(!reopened.findArtifact(key, "glb", found));
+
+	VoxReader nested;
+	CHECK_THROWS(cache.load(sample("nested_chunks.vox"), nested), "Chunks are nested too deeply");
+
+	// On a miss open() holds the compiled data itself, so evicting the cache file right away does no harm:
+	const std::string other = temporary("3x3x3.vox");
+	writeFile(other, readFile(sample("3x3x3.vox")));
+	std::unique_ptr<VoxCompiledReader> missed = cache.open(other);
+	std::filesystem::remove_all(directory);
+	VoxReader fromMiss, expectedMiss;
+	missed->toReader(fromMiss);
+	load(expectedMiss, readFile(other));
+	CHECK(serialize(fromMiss) == serialize(expectedMiss));
+
+	// Eviction keeps the directory below the limit, but leaves temporary files of other writers alone:
+	const std::string small = temporary("small cache");
+	VoxCache limited(small, 4096);
+	const std::string writing = small + "/0123.voxc.tmp42";
+	writeFile(writing, std::string(1000, 'x'));
+	for (uint32_t count = 1; count <= 8; count++) {
+		VoxReader vox;
+		generateModels(vox, count);
+		const std::string data = serialize(vox);
+		VoxReader loaded;
+		limited.load(reinterpret_cast<const uint8_t *>(data.data()), data.size(), loaded);
+	}
+	uint64_t total = 0;
+	for (const auto &entry : std::filesystem::directory_iterator(small)) {
+		total += entry.file_size();
+	}
+	CHECK(limited.stats().misses == 8 && limited.stats().evictions > 0);
+	CHECK(std::filesystem::exists(writing));
+	CHECK(total <= 4096 + 1000);
+}
+
+static void testSharedCache() {
+	char prefix[64];
+#if defined(__unix__) || defined(__APPLE__)
+	snprintf(prefix, sizeof(prefix), "/jimvoxtests-%ld", (long)getpid());
+#else
+	snprintf(prefix, sizeof(prefix), "/jimvoxtests");
+#endif
+	const std::string path = sample("chr_knight.vox");
+	const std::string data = readFile(path);
+	VoxReader original;
+	load(original, data);
+	{
+		VoxSharedCache cache(prefix);
+		auto first = cache.open(path);
+		auto second = cache.open(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+		CHECK(first == second);
+		VoxReader rebuilt;
+		first->compiled().toReader(rebuilt);
+		CHECK(serialize(rebuilt) == serialize(original));
+		CHECK(first->compiled().sourceHash() == hash64(data.data(), data.size()));
+
+		// Another cache, as in another process, attaches to the published segment:
+		VoxSharedCache other(prefix);
+		auto attached = other.open(path);
+		CHECK(attached != first);
+		CHECK(attached->shared() == first->shared());
+		VoxReader fromAttached;
+		attached->compiled().toReader(fromAttached);
+		CHECK(serialize(fromAttached) == serialize(original));
+
+		const std::string truncated = data.substr(0, data.size() / 2);
+		CHECK_THROWS(cache.open(reinterpret_cast<const uint8_t *>(truncated.data()), truncated.size()), "");
+		CHECK_THROWS(cache.open(sample("nested_chunks.vox")), "Chunks are nested too deeply");
+	}
+	VoxSharedCache(prefix).unlink(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+
+#if defined(__unix__) || defined(__APPLE__)
+	// A segment left incomplete by a publisher which died is published again instead of waiting for the timeout:
+	char name[128];
+	snprintf(name, sizeof(name), "%s-%016llx-%llx", prefix, (unsigned long long)hash64(data.data(), data.size()), (unsigned long long)data.size());
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd >= 0) {
+		close(fd);
+		const auto start = std::chrono::steady_clock::now();
+		{
+			VoxSharedCache cache(prefix, 60000);
+			auto reclaimed = cache.open(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+			CHECK(reclaimed->shared());
+			VoxReader rebuilt;
+			reclaimed->compiled().toReader(rebuilt);
+			CHECK(serialize(rebuilt) == serialize(original));
+		}
+		CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+		VoxSharedCache(prefix).unlink(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+	}
+#endif
+}
+
+static bool hasChange(const std::vector<VoxReloader::Change> &changes, VoxReloader::Change::Kind kind, VoxReloader::Change::Action action, int32_t index) {
+	return std::any_of(changes.begin(), changes.end(), [&](const VoxReloader::Change &change) {
+		return change.kind == kind && change.action == action && change.index == index;
+	});
+}
+
+static void testReload() {
+	const std::string original = sceneFile();
+	const uint8_t *originalData = reinterpret_cast<const uint8_t *>(original.data());
+
+	// Reload of changed vox-data decodes the changed objects only:
+	VoxReader vox;
+	load(vox, original);
+	std::vector<uint64_t> hashes = VoxReloader::hashChunks(vox, originalData, original.size());
+	CHECK(hashes.size() == vox.sourceChunks.size());
+	const std::vector<Voxel> *unchanged = &vox.models[1].voxels;
+	const Voxel *unchangedVoxels = vox.models[1].voxels.data();
+
+	VoxReader edited;
+	load(edited, original);
+	edited.models[0].voxels[0].colorIndex = 200;
+	edited.layers[1].attributes.emplace_back("_hidden", "1");
+	const std::string changed = serialize(edited);
+	const uint8_t *changedData = reinterpret_cast<const uint8_t *>(changed.data());
+
+	std::vector<VoxReloader::Change> changes = VoxReloader::reload(vox, hashes, changedData, changed.size());
+	CHECK(serialize(vox) == changed);
+	CHECK(changes.size() == 2);
+	CHECK(hasChange(changes, VoxReloader::Change::MODEL, VoxReloader::Change::CHANGED, 0));
+	CHECK(hasChange(changes, VoxReloader::Change::LAYER, VoxReloader::Change::CHANGED, 1));
+	CHECK(&vox.models[1].voxels == unchanged && vox.models[1].voxels.data() == unchangedVoxels);
+	CHECK(VoxReloader::reload(vox, hashes, changedData, changed.size()).empty());
+
+	// Added and removed models:
+	VoxReader added;
+	load(added, changed);
+	generateModels(added, 2);
+	const std::string more = serialize(added);
+	changes = VoxReloader::reload(vox, hashes, reinterpret_cast<const uint8_t *>(more.data()), more.size());
+	CHECK(serialize(vox) == more);
+	CHECK(hasChange(changes, VoxReloader::Change::MODEL, VoxReloader::Change::ADDED, 2));
+	CHECK(hasChange(changes, VoxReloader::Change::MODEL, VoxReloader::Change::ADDED, 3));
+	changes = VoxReloader::reload(vox, hashes, changedData, changed.size());
+	CHECK(serialize(vox) == changed);
+	CHECK(hasChange(changes, VoxReloader::Change::MODEL, VoxReloader::Change::REMOVED, 3));
+
+	// On error the reader keeps its objects:
+	const std::string truncated = original.substr(0, original.size() - 10);
+	CHECK_THROWS(VoxReloader::reload(vox, hashes, reinterpret_cast<const uint8_t *>(truncated.data()), truncated.size()), "");
+	CHECK(serialize(vox) == changed);
+	const std::string nested = readFile(sample("nested_chunks.vox"));
+	CHECK_THROWS(VoxReloader::reload(vox, hashes, reinterpret_cast<const uint8_t *>(nested.data()), nested.size()), "Chunks are nested too deeply");
+	CHECK(serialize(vox) == changed);
+
+	// A watched file is reloaded by poll once it is replaced:
+	const std::string path = temporary("reloaded.vox");
+	writeFile(path, original);
+	VoxReloader reloader;
+	VoxReader watched;
+	size_t notified = 0;
+	reloader.watch(path, watched, [&](const std::string &, VoxReader &, const std::vector<VoxReloader::Change> &) { notified++; });
+	CHECK(serialize(watched) == original);
+	CHECK(reloader.poll(0) == 0);
+
+	// A file which fails to load is not watched and leaves the watch of its directory to the other files:
+	writeFile(temporary("broken.vox"), truncated);
+	VoxReader broken;
+	CHECK_THROWS(reloader.watch(temporary("broken.vox"), broken, nullptr), "");
+	CHECK_THROWS(reloader.watch(temporary("missing.vox"), broken, nullptr), "");
+
+	// Other files in the same directory neither reload nor end the wait:
+	const auto start = std::chrono::steady_clock::now();
+	writeFile(temporary("unwatched.vox"), changed);
+	CHECK(reloader.poll(200) == 0);
+	CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(190));
+	CHECK(notified == 0);
+
+	writeFile(temporary("reloaded.tmp"), changed);
+	std::filesystem::rename(temporary("reloaded.tmp"), path);
+	CHECK(reloader.poll(5000) == 1);
+	CHECK(notified == 1);
+	CHECK(serialize(watched) == changed);
+	reloader.unwatch(path);
+}
+
+static void testDedup() {
+	// The content hash ignores the voxel order, but not sizes or colors:
+	VoxReader knight;
+	load(knight, readFile(sample("chr_knight.vox")));
+	Model reversed = knight.models[0];
+	std::reverse(reversed.voxels.begin(), reversed.voxels.end());
+	CHECK(reversed.contentHash() == knight.models[0].contentHash());
+	CHECK(reversed.sameContent(knight.models[0]));
+	Model recolored = knight.models[0];
+	recolored.voxels.back().colorIndex ^= 1;
+	CHECK(recolored.contentHash() != knight.models[0].contentHash() && !recolored.sameContent(knight.models[0]));
+	Model resized = knight.models[0];
+	resized.sizeZ++;
+	CHECK(resized.contentHash() != knight.models[0].contentHash() && !resized.sameContent(knight.models[0]));
+
+	// A duplicate with the voxels in reverse order, referenced by the first instance, is removed again:
+	VoxReader vox;
+	load(vox, sceneFile());
+	const std::string expected = serialize(vox);
+	Model copy = vox.models[0];
+	std::reverse(copy.voxels.begin(), copy.voxels.end());
+	vox.models.push_back(std::move(copy));
+	static_cast<SceneGraph::ShapeNode *>(vox.sceneGraph.GetNode(3))->models[0].modelId = 2;
+	CHECK(VoxDedup::deduplicate(vox, 2) == 1);
+	CHECK(vox.models.size() == 2);
+	CHECK(serialize(vox) == expected);
+	CHECK(VoxDedup::deduplicate(vox, 2) == 0);
+
+	VoxModelCatalog catalog;
+	VoxReader cube, palette;
+	load(cube, readFile(sample("3x3x3.vox")));
+	load(palette, readFile(sample("3x3x3_palette.vox")));
+	std::vector<uint32_t> first = catalog.add(knight);
+	CHECK(catalog.add(knight) == first);
+	CHECK(catalog.add(reversed) == first[0]);
+	std::vector<uint32_t> cubes = catalog.add(cube);
+	CHECK(catalog.size() == knight.models.size() + cube.models.size());
+	for (size_t i = 0; i < cubes.size(); i++) {
+		CHECK(catalog.get(cubes[i]).sameContent(cube.models[i]));
+	}
+	catalog.add(palette);
+	CHECK(catalog.size() <= knight.models.size() + cube.models.size() + palette.models.size());
+}
+
+static void testInfo() {
+	// Scans agree with a full load, from memory, streams and files:
+	std::vector<std::string> paths = { temporary("scene.vox") };
+	writeFile(paths[0], sceneFile());
+	for (const char *name : VALID_SAMPLES) {
+		paths.push_back(sample(name));
+	}
+	for (const std::string &path : paths) {
+		const std::string bytes = readFile(path);
+		VoxReader vox;
+		load(vox, bytes);
+		std::istringstream stream(bytes);
+		const VoxInfo scans[] = {
+			VoxInfo::scan(reinterpret_cast<const uint8_t *>(bytes.data()), bytes.size(), VoxInfo::SCAN_COLORS),
+			VoxInfo::scan(stream, VoxInfo::SCAN_COLORS),
+			VoxInfo::scan(path, VoxInfo::SCAN_COLORS)
+		};
+		for (const VoxInfo &info : scans) {
+			CHECK(info.size == bytes.size());
+			CHECK(info.hasPalette == (vox.palette != &VoxReader::DEFAULT_PALETTE));
+			CHECK(info.nodeCount == vox.sceneGraph.GetNodeCount());
+			CHECK(info.layerCount == vox.layers.size());
+			if (!CHECK(info.models.size() == vox.models.size())) continue;
+			uint64_t voxelCount = 0;
+			bool used[256] = {};
+			for (size_t i = 0; i < vox.models.size(); i++) {
+				const Model &model = vox.models[i];
+				CHECK(info.models[i].sizeX == model.sizeX && info.models[i].sizeY == model.sizeY && info.models[i].sizeZ == model.sizeZ);
+				CHECK(info.models[i].voxelCount == model.voxels.size());
+				voxelCount += model.voxels.size();
+				for (const Voxel &v : model.voxels) used[v.colorIndex] = true;
+			}
+			CHECK(info.voxelCount == voxelCount);
+			bool sameColors = true;
+			for (int i = 0; i < 256; i++) {
+				sameColors = sameColors && info.usesColor((uint8_t)i) == used[i];
+			}
+			CHECK(sameColors);
+		}
+	}
+
+	const VoxInfo info = VoxInfo::scan(paths[0]);
+	CHECK(info.usedColors[0] == 0 && info.usedColors[3] == 0);
+	CHECK((info.nodeNames == std::vector<std::pair<SceneGraph::NodeId, std::string>>{ { 2, "first" }, { 4, "second" } }));
+	CHECK((info.layerNames == std::vector<std::pair<int32_t, std::string>>{ { 0, "layer 0" }, { 1, "layer 1" } }));
+	CHECK(info.materialCount == 1);
+	CHECK(info.unknownChunkCount == 2);
+
+	const std::string truncated = sceneFile().substr(0, 100);
+	CHECK_THROWS(VoxInfo::scan(reinterpret_cast<const uint8_t *>(truncated.data()), truncated.size()), "");
+	std::string foreign = "VOX ";
+	putInt(foreign, 200);
+	foreign += chunk("MAIN", "");
+	CHECK_THROWS(VoxInfo::scan(reinterpret_cast<const uint8_t *>(foreign.data()), foreign.size()), "Version is not 150");
+	CHECK_THROWS(VoxInfo::scan(temporary("missing.vox")), "Cannot open");
+}
+
+/**
+ * Returns whether the validator reports an issue containing the given message within the data.
+ */
+static bool reports(const std::string &data, const std::string &message) {
+	const std::vector<VoxValidator::Issue> issues = VoxValidator::validate(reinterpret_cast<const uint8_t *>(data.data()), data.size());
+	return std::any_of(issues.begin(), issues.end(), [&](const VoxValidator::Issue &issue) {
+		return issue.message.find(message) != std::string::npos && issue.offset < data.size();
+	});
+}
+
+static void testValidator() {
+	std::vector<std::string> valid = { sceneFile() };
+	for (const char *name : VALID_SAMPLES) {
+		valid.push_back(readFile(sample(name)));
+	}
+	for (const std::string &data : valid) {
+		CHECK(VoxValidator::isValid(reinterpret_cast<const uint8_t *>(data.data()), data.size()));
+		std::istringstream s(data);
+		CHECK(VoxValidator::validate(s).empty());
+	}
+
+	// Every issue of a file is reported, not just the first:
+	const std::string model = modelChunks(4, 4, 4, { Voxel(1, 1, 1, 1) });
+	const std::string broken = voxFile(
+		modelChunks(4, 4, 4, { Voxel(4, 0, 0, 1), Voxel(0, 0, 0, 0) }) +
+		modelChunks(0, 4, 4, {}) +
+		transformChunk(0, {}, 1, 7, {}) +
+		groupChunk(1, { 2, 0 }) +
+		shapeChunk(2, 5) +
+		shapeChunk(2, 0));
+	CHECK(reports(broken, "XYZI has voxels outside of SIZE"));
+	CHECK(reports(broken, "XYZI has voxels with color index 0"));
+	CHECK(reports(broken, "SIZE is not within 1 to 256"));
+	CHECK(reports(broken, "nTRN refers to missing layer 7"));
+	CHECK(reports(broken, "nSHP refers to missing model 5"));
+	CHECK(reports(broken, "Node id 2 is used twice"));
+	CHECK(reports(broken, "is part of a cycle"));
+	CHECK(reports(voxFile(chunk("SIZE", std::string(12, '\x04')) + chunk("RGBA", std::string(4, '\0'))), "SIZE chunk is not followed by a XYZI chunk"));
+	CHECK(reports(voxFile(model + chunk("RGBA", std::string(4, '\0'))), "RGBA chunk is too small"));
+	CHECK(reports(voxFile(model + transformChunk(0, {}, 1, -1, {}) + shapeChunk(1, 0) + transformChunk(2, {}, 0, -1, {})), "Node refers to node 0 of wrong type"));
+	CHECK(reports(voxFile(model + transformChunk(0, {}, 1, -1, {}) + groupChunk(1, { 2, 2 }) + transformChunk(2, {}, 3, -1, {}) + shapeChunk(3, 0)), "Node 2 has more than one parent"));
+
+	// A dictionary claiming more entries than its chunk holds is reported, and rejected by the loader:
+	std::string dictionary;
+	putInt(dictionary, 0);
+	putInt(dictionary, 1000);
+	const std::string truncatedLayer = voxFile(model + chunk("LAYR", dictionary));
+	CHECK(!VoxValidator::isValid(reinterpret_cast<const uint8_t *>(truncatedLayer.data()), truncatedLayer.size()));
+	VoxReader vox;
+	CHECK_THROWS(load(vox, truncatedLayer), "Chunk content is truncated");
+
+	// Every truncation of a valid file is reported, and rejected by the loader or loaded without crashing:
+	const std::string scene = sceneFile();
+	for (size_t size = 0; size < scene.size(); size++) {
+		CHECK(!VoxValidator::isValid(reinterpret_cast<const uint8_t *>(scene.data()), size));
+		try {
+			VoxReader truncated;
+			truncated.load(reinterpret_cast<const uint8_t *>(scene.data()), size);
+		}
+		catch (const VoxReader::Exception &) {}
+	}
+
+	// Chunks nested deeper than MAX_CHUNK_DEPTH are reported and rejected instead of recursing without bounds:
+	const std::string nested = readFile(sample("nested_chunks.vox"));
+	CHECK(!VoxValidator::isValid(reinterpret_cast<const uint8_t *>(nested.data()), nested.size()));
+	VoxReader deep;
+	CHECK_THROWS(load(deep, nested), "Chunks are nested too deeply");
+	std::istringstream nestedStream(nested);
+	CHECK_THROWS(deep.load(nestedStream), "Chunks are nested too deeply");
+	std::string nestable;
+	for (int depth = 0; depth < VoxReader::MAX_CHUNK_DEPTH; depth++) {
+		nestable = chunk("NEST", std::string(), nestable);
+	}
+	const std::string deepest = voxFile(model + nestable), tooDeep = voxFile(model + chunk("NEST", std::string(), nestable));
+	CHECK(VoxValidator::isValid(reinterpret_cast<const uint8_t *>(deepest.data()), deepest.size()));
+	load(deep, deepest);
+	CHECK(deep.unknownChunks.size() == 1);
+	CHECK(!VoxValidator::isValid(reinterpret_cast<const uint8_t *>(tooDeep.data()), tooDeep.size()));
+	CHECK_THROWS(load(deep, tooDeep), "Chunks are nested too deeply");
+
+	// Found by VoxFuzz, rejected by load(), reload and the validator alike:
+	std::string notMain = voxFile(model);
+	notMain.replace(8, 4, "MAIM");
+	std::string xyzi;
+	putInt(xyzi, 1);
+	xyzi += std::string("\x01\x01\x01\x01", 4);
+	const std::string looseXyzi = voxFile(chunk("XYZI", xyzi) + model);
+	for (const std::string &data : { notMain, looseXyzi }) {
+		const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.data());
+		CHECK(!VoxValidator::isValid(bytes, data.size()));
+		VoxReader rejected;
+		CHECK_THROWS(rejected.load(bytes, data.size()), data == notMain ? "MAIN chunk is missing" : "XYZI chunk is not preceded by a SIZE chunk");
+		std::vector<uint64_t> hashes;
+		CHECK_THROWS(VoxReloader::reload(rejected, hashes, bytes, data.size()), "");
+	}
+
+	// Ids index vectors, so ids beyond the number of chunks fitting into the data are rejected instead of allocated:
+	std::string layer;
+	putInt(layer, 0x7FFFFFF0);
+	putDictionary(layer, {});
+	putInt(layer, -1);
+	std::string material;
+	putInt(material, 0x7FFFFFF0);
+	putDictionary(material, {});
+	const std::pair<std::string, const char *> hugeIds[] = {
+		{ voxFile(model + transformChunk(0x7FFFFFF0, {}, 1, -1, {})), "Node id exceeds the data" },
+		{ voxFile(model + chunk("LAYR", layer)), "Layer id exceeds the data" },
+		{ voxFile(model + chunk("MATL", material)), "Material id exceeds the data" }
+	};
+	for (const auto &hugeId : hugeIds) {
+		CHECK(reports(hugeId.first, "id exceeding the data"));
+		VoxReader rejected;
+		CHECK_THROWS(load(rejected, hugeId.first), hugeId.second);
+	}
+}
+
+/**
+ * Records the traced scopes by name and argument.
+ */
+class RecordingSink : public TraceSink {
+public:
+	void scope(const char *name, const char *argName, int64_t arg, uint64_t, uint64_t, uint32_t) override {
+		std::lock_guard<std::mutex> lock(mutex);
+		scopes.emplace_back(name, argName != nullptr ? argName : "", arg);
+	}
+
+	size_t count(const std::string &name) const {
+		return (size_t)std::count_if(scopes.begin(), scopes.end(), [&](const std::tuple<std::string, std::string, int64_t> &scope) {
+			return std::get<0>(scope) == name;
+		});
+	}
+
+	std::mutex mutex;
+	std::vector<std::tuple<std::string, std::string, int64_t>> scopes;
+};
+
+static void testTrace() {
+	const std::string scene = sceneFile();
+	RecordingSink sink;
+	setTraceSink(&sink);
+	CHECK(getTraceSink() == &sink);
+	VoxReader vox;
+	load(vox, scene);
+	VoxWriter(vox).save(temporary("traced.vox"));
+	setTraceSink(nullptr);
+	load(vox, scene);
+
+#ifdef JIM_VOXREADER_TRACE
+	// One scope per load, per top level chunk with its offset (SIZE covers its XYZI) and per model, none after the sink was reset:
+	CHECK(sink.count("load") == 1 && sink.count("chunk index") == 1);
+	CHECK(std::find(sink.scopes.begin(), sink.scopes.end(), std::make_tuple(std::string("load"), std::string("size"), (int64_t)scene.size())) != sink.scopes.end());
+	CHECK(sink.count("SIZE") == 2 && sink.count("XYZI") == 0 && sink.count("nTRN") == 3 && sink.count("MATL") == 1);
+	CHECK(std::find(sink.scopes.begin(), sink.scopes.end(), std::make_tuple(std::string("PACK"), std::string("offset"), (int64_t)20)) != sink.scopes.end());
+	CHECK(sink.count("model") == 2);
+	CHECK(sink.count("save") == 1);
+#else
+	// Without JIM_VOXREADER_TRACE the scopes are not compiled in:
+	CHECK(sink.scopes.empty());
+#endif
+
+	// Names are escaped, arguments and threads kept:
+	ChromeTraceWriter trace;
+	trace.scope("quote\"d", "offset", 42, 0, 1500, 3);
+	trace.scope("plain", nullptr, 0, 0, 0, 0);
+	std::ostringstream json;
+	trace.save(json);
+	CHECK(json.str().compare(0, 15, "{\"traceEvents\":") == 0);
+	CHECK(json.str().find("\"name\":\"quote\\\"d\"") != std::string::npos);
+	CHECK(json.str().find("\"args\":{\"offset\":42}") != std::string::npos);
+	CHECK(json.str().find("\"dur\":1.500,\"pid\":1,\"tid\":3") != std::string::npos);
+	trace.clear();
+	std::ostringstream empty;
+	trace.save(empty);
+	CHECK(empty.str().find("\"name\"") == std::string::npos);
+}
+
+static void testStats() {
+	const std::string scene = sceneFile();
+	VoxReader vox;
+	std::istringstream s(scene);
+	vox.load(s);
+	const VoxReader::Stats stats = vox.stats();
+	CHECK(stats.bytesRead == scene.size());
+	const std::map<std::string, uint32_t> chunkCounts = {
+		{ "PACK", 1 }, { "SIZE", 2 }, { "XYZI", 2 }, { "nTRN", 3 }, { "nGRP", 1 }, { "nSHP", 2 },
+		{ "LAYR", 2 }, { "RGBA", 1 }, { "rOBJ", 1 }, { "NOTE", 1 }, { "MATL", 1 }
+	};
+	CHECK(stats.chunkCounts == chunkCounts);
+	CHECK(stats.modelCount == 2 && stats.voxelCount == 6 && stats.nodeCount == 6);
+
+	// Heap usage covers at least the payloads, memoryUsage() is the same without the rest:
+	CHECK(stats.memory.models >= 6 * sizeof(Voxel));
+	CHECK(stats.memory.palette >= 256 * sizeof(RGBA));
+	CHECK(stats.memory.sceneGraph > 0 && stats.memory.layers > 0 && stats.memory.materials > 0);
+	CHECK(stats.memory.unknownChunks > 0 && stats.memory.sourceChunks >= 17 * sizeof(VoxReader::ChunkRef));
+	CHECK(vox.memoryUsage().total() == stats.memory.total());
+	vox.models[0].voxels.reserve(100000);
+	CHECK(vox.memoryUsage().models >= 100000 * sizeof(Voxel));
+
+	// Timings of the last decode, reading the stream only counts for streams:
+	const VoxReader::DecodeTimings &timings = stats.timings;
+	CHECK(timings.total > 0 && timings.read > 0);
+	CHECK(timings.total >= timings.read + timings.index + timings.models + timings.palette + timings.sceneGraph + timings.layers + timings.materials + timings.other);
+	load(vox, scene);
+	CHECK(vox.stats().timings.read == 0 && vox.stats().timings.total > 0);
+
+	VoxReader defaultPalette;
+	load(defaultPalette, readFile(sample("3x3x3.vox")));
+	CHECK(defaultPalette.stats().memory.palette == 0);
+
+	vox.clear();
+	const VoxReader::Stats cleared = vox.stats();
+	CHECK(cleared.bytesRead == 0 && cleared.chunkCounts.empty() && cleared.modelCount == 0 && cleared.nodeCount == 0);
+	CHECK(cleared.memory.palette == 0 && cleared.timings.total == 0);
+	CHECK(VoxReader().memoryUsage().total() == 0);
+}
+
+static void testDump() {
+	std::string layer, material, note;
+	putInt(layer, 0);
+	putDictionary(layer, { { "_name", "L" } });
+	putInt(layer, -1);
+	putInt(material, 1);
+	putDictionary(material, { { "_type", "_metal" } });
+	putInt(note, 0);
+	VoxReader vox;
+	load(vox, voxFile(
+		modelChunks(2, 1, 1, { Voxel(0, 0, 0, 1), Voxel(1, 0, 0, 200) }) +
+		transformChunk(0, { { "_name", "a \"q\"" } }, 1, 0, { { "_t", "1 2 3" } }) +
+		shapeChunk(1, 0) +
+		chunk("LAYR", layer) + chunk("MATL", material) + chunk("NOTE", note)));
+
+	std::ostringstream text, json, summary;
+	VoxDump(vox, VoxDump::NO_PALETTE).saveText(text);
+	CHECK(text.str() ==
+		"VOXEL-OBJECT:\n"
+		"Num models: 1\n"
+		"Model:  size(2,1,1)\n"
+		"   Voxel: 00,00,00,   color=01\n"
+		"   Voxel: 01,00,00,   color=200\n"
+		"Nodes: 2\n"
+		"   Node 0: transform {_name=a \"q\"} child=1 layer=0 frames={_t=1 2 3}\n"
+		"   Node 1: shape {} models=0{}\n"
+		"Layers: 1\n"
+		"   Layer 0: {_name=L}\n"
+		"Materials: 2\n"
+		"   Material 0: {}\n"
+		"   Material 1: {_type=_metal}\n"
+		"Unknown chunks: 1\n"
+		"   NOTE: 16 bytes\n");
+	VoxDump(vox, VoxDump::NO_PALETTE).saveJson(json);
+	CHECK(json.str() ==
+		"{\n"
+		"\"models\":[\n"
+		"{\"size\":[2,1,1],\"voxelCount\":2,\"voxels\":[\n"
+		"[0,0,0,1],\n"
+		"[1,0,0,200]]}],\n"
+		"\"nodes\":[\n"
+		"{\"id\":0,\"type\":\"transform\",\"attributes\":{\"_name\":\"a \\\"q\\\"\"},\"child\":1,\"layer\":0,\"frames\":[{\"_t\":\"1 2 3\"}]},\n"
+		"{\"id\":1,\"type\":\"shape\",\"attributes\":{},\"models\":[{\"model\":0,\"attributes\":{}}]}],\n"
+		"\"layers\":[\n"
+		"{\"_name\":\"L\"}],\n"
+		"\"materials\":[\n"
+		"{},\n"
+		"{\"_type\":\"_metal\"}],\n"
+		"\"unknownChunks\":[\n"
+		"{\"id\":\"NOTE\",\"size\":16}]\n"
+		"}\n");
+
+	// Model ids are int32 in the file, so a missing model prints as -1:
+	VoxReader missing;
+	load(missing, serialize(vox));
+	static_cast<SceneGraph::ShapeNode &>(*missing.sceneGraph.GetNode(1)).models[0].modelId = (uint32_t)-1;
+	std::ostringstream missingText, missingJson;
+	VoxDump(missing, VoxDump::NO_PALETTE).saveText(missingText);
+	VoxDump(missing, VoxDump::NO_PALETTE).saveJson(missingJson);
+	CHECK(missingText.str().find("   Node 1: shape {} models=-1{}\n") != std::string::npos);
+	CHECK(missingJson.str().find("\"models\":[{\"model\":-1,") != std::string::npos);
+
+	VoxDump(vox, VoxDump::NO_VOXELS).saveText(summary);
+	CHECK(summary.str().find("Model:  size(2,1,1)  voxels=2\n") != std::string::npos);
+	CHECK(summary.str().find("Voxel:") == std::string::npos);
+	CHECK(summary.str().find("Palette: (DEFAULT)\n   00000000  ffffffff  ffffffcc") != std::string::npos);
+
+	// Large models go through the buffer in several blocks:
+	VoxReader large;
+	generateModels(large, 300);
+	std::ostringstream largeText;
+	VoxDump(large).saveText(largeText);
+	const std::string largeDump = largeText.str();
+	size_t voxelLines = 0, voxels = 0;
+	for (const Model &model : large.models) voxels += model.voxels.size();
+	for (size_t position = 0; (position = largeDump.find("   Voxel: ", position)) != std::string::npos; position++) voxelLines++;
+	CHECK(largeDump.size() > 256 * 1024 && voxelLines == voxels);
+
+	// print() writes the palette to the given stream and leaves its format flags alone:
+	std::ostringstream printed;
+	printed << std::dec;
+	vox.print(printed);
+	CHECK(printed.str().compare(0, 65, text.str().substr(0, 65)) == 0);
+	CHECK(printed.str().find("Palette: (DEFAULT)\n   00000000  ffffffff") != std::string::npos);
+	CHECK(printed.flags() == std::ostringstream().flags());
+}
+
+int main(int argc, char **argv) {
+	if (argc > 1) samples = argv[1];
+	if (argc > 2) scratch = argv[2];
+
+	std::error_code error;
+	std::filesystem::remove_all(scratch, error);
+	std::filesystem::create_directories(scratch, error);
+	if (error) {
+		fprintf(stderr, "Cannot create %s: %s\n", scratch.c_str(), error.message().c_str());
+		return EXIT_FAILURE;
+	}
+
+	struct Test {
+		const char *name;
+		void (*run)();
+	};
+	const Test tests[] = {
+		{ "writer", testWriter },
+		{ "file writer", testFileWriter },
+		{ "savePatched", testPatched },
+		{ "world split", testWorldSplit },
+		{ "world merge", testWorldMerge },
+		{ "export", testExport },
+		{ "formats", testFormats },
+		{ "bundle", testBundle },
+		{ "compiled", testCompiled },
+		{ "cache", testCache },
+		{ "shared cache", testSharedCache },
+		{ "reload", testReload },
+		{ "dedup", testDedup },
+		{ "info", testInfo },
+		{ "validator", testValidator },
+		{ "trace", testTrace },
+		{ "stats", testStats },
+		{ "dump", testDump }
+	};
+
+	size_t failed = 0;
+	for (const Test &test : tests) {
+		const size_t before = failures;
+		try {
+			test.run();
+		}
+		catch (const std::exception &e) {
+			printf("%s: unexpected exception: %s\n", test.name, e.what());
+			failures++;
+		}
+		printf("%s: %s\n", test.name, failures == before ? "passed" : "FAILED");
+		if (failures != before) failed++;
+	}
+
+	std::filesystem::remove_all(scratch, error);
+	printf("%zu of %zu tests passed\n", sizeof(tests) / sizeof(tests[0]) - failed, sizeof(tests) / sizeof(tests[0]));
+	return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
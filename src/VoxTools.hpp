@@ -0,0 +1,270 @@
+#pragma once
+
+/**
+ * Helpers shared by the command line tools (VoxReaderTool, VoxBench, VoxKernelBench, VoxAllocCheck, VoxGenerate,
+ * VoxFuzz), not part of the library. Include it after VoxReader.hpp in the one translation unit of a tool.
+ *
+ * With JIM_VOXTOOLS_COUNT_ALLOCATIONS defined before the include, the global operator new and delete are replaced
+ * by ones counting allocations, allocated bytes and live bytes, read through AllocationScope.
+ */
+
+#include "VoxReader.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <dirent.h>
+#include <sys/stat.h>
+#define JIM_VOXTOOLS_POSIX
+#elif defined(_WIN32)
+#include <io.h>
+#define JIM_VOXTOOLS_WINDOWS
+#endif
+
+#ifdef JIM_VOXTOOLS_COUNT_ALLOCATIONS
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#endif
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// ALLOCATION COUNTING
+	//////////////////////////////////////////////////////////////////////////////
+
+#ifdef JIM_VOXTOOLS_COUNT_ALLOCATIONS
+
+	// Every allocation is prefixed with its size, so live bytes are known on delete:
+	static const size_t ALLOCATION_HEADER = 16;
+
+	static std::atomic<uint64_t> allocationCount(0);
+	static std::atomic<uint64_t> allocatedBytes(0);
+	static std::atomic<int64_t> liveBytes(0);
+	static std::atomic<int64_t> peakLiveBytes(0);
+
+	/**
+	 * Allocations made between construction and a call of the accessors.
+	 */
+	class AllocationScope {
+	public:
+		AllocationScope() : count(allocationCount.load()), bytes(allocatedBytes.load()), live(liveBytes.load()) {
+			peakLiveBytes.store(live);
+		}
+
+		uint64_t allocations() const { return allocationCount.load() - count; }
+		uint64_t allocated() const { return allocatedBytes.load() - bytes; }
+		uint64_t peak() const { return (uint64_t)(peakLiveBytes.load() - live); }
+
+	private:
+		uint64_t count, bytes;
+		int64_t live;
+	};
+
+#endif
+
+	//////////////////////////////////////////////////////////////////////////////
+	// GENERATED INPUT
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	 * Stateless mixing of the input, so every voxel is decided independently of the order voxels are generated in.
+	 */
+	static inline uint64_t mix(uint64_t x) {
+		x += 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	/**
+	 * One cubic model per given size with randomly placed voxels, and the given number of instances of the models
+	 * in turn: a root transform node above a group of named transform nodes on a square grid, each above a shape
+	 * node. Every second instance is rotated, the instances are assigned to the layers in turn.
+	 */
+	static inline void generateScene(VoxReader &vox, const std::vector<uint32_t> &sizes, double density, uint32_t instances, uint32_t layers) {
+		const uint64_t threshold = (uint64_t)(density * 0xFFFFFFFFull);
+		for (uint32_t m = 0; m < sizes.size(); m++) {
+			const uint32_t size = sizes[m];
+			Model model(size, size, size);
+			for (uint32_t z = 0; z < size; z++) for (uint32_t y = 0; y < size; y++) for (uint32_t x = 0; x < size; x++) {
+				uint64_t h = mix(m | (uint64_t)x << 8 | (uint64_t)y << 16 | (uint64_t)z << 24);
+				if ((h & 0xFFFFFFFF) < threshold) {
+					model.voxels.push_back(Voxel((uint8_t)x, (uint8_t)y, (uint8_t)z, (uint8_t)(1 + (h >> 32) % 255)));
+				}
+			}
+			vox.models.push_back(std::move(model));
+		}
+
+		SceneGraph &scene = vox.sceneGraph;
+		auto &root = scene.AddTransformNode(0);
+		root.childNodeId = 1;
+		root.layerId = -1;
+		root.frame_attributes.resize(1);
+		auto &group = scene.AddGroupNode(1);
+		const uint32_t spacing = *std::max_element(sizes.begin(), sizes.end());
+		const uint32_t columns = (uint32_t)std::ceil(std::sqrt((double)instances));
+		for (uint32_t i = 0; i < instances; i++) {
+			SceneGraph::NodeId id = 2 + 2 * i;
+			const uint32_t modelId = i % (uint32_t)sizes.size();
+			auto &transform = scene.AddTransformNode(id);
+			transform.attributes.emplace_back("_name", "instance of model " + std::to_string(modelId));
+			transform.childNodeId = id + 1;
+			transform.layerId = (int32_t)(i % layers);
+			transform.frame_attributes.resize(1);
+			transform.frame_attributes[0].emplace_back("_t", std::to_string((i % columns) * spacing) + ' ' + std::to_string((i / columns) * spacing) + " 0");
+			transform.frame_attributes[0].emplace_back("_r", std::to_string(i % 2 ? 17 : 4));
+			auto &shape = scene.AddShapeNode(id + 1);
+			shape.models.resize(1);
+			shape.models[0].modelId = modelId;
+			group.childNodeIds.push_back(id);
+		}
+		vox.layers.resize(layers);
+	}
+
+	/**
+	 * Discards everything written, so writing and exporting are measured without I/O or the allocations of a string stream.
+	 */
+	class NullBuffer : public std::streambuf {
+	protected:
+		std::streamsize xsputn(const char *, std::streamsize count) override { return count; }
+		int_type overflow(int_type c) override { return traits_type::not_eof(c); }
+	};
+
+	//////////////////////////////////////////////////////////////////////////////
+	// FILES
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	 * Returns the extension of the file name in lower case, without the dot.
+	 */
+	static inline std::string extension(const std::string &path) {
+		size_t dot = path.find_last_of('.');
+		size_t slash = path.find_last_of("/\\");
+		if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) return std::string();
+		std::string ext = path.substr(dot + 1);
+		std::transform(ext.begin(), ext.end(), ext.begin(), [](char c) { return (char)tolower((unsigned char)c); });
+		return ext;
+	}
+
+	static inline bool isDirectory(const std::string &path) {
+#if defined(JIM_VOXTOOLS_POSIX)
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+#elif defined(JIM_VOXTOOLS_WINDOWS)
+		_finddata64_t info;
+		intptr_t handle = _findfirst64(path.c_str(), &info);
+		if (handle == -1) return false;
+		_findclose(handle);
+		return (info.attrib & _A_SUBDIR) != 0;
+#else
+		(void)path;
+		return false;
+#endif
+	}
+
+	/**
+	 * Adds the given path, or if it is a directory all files below it sorted by path. Files found in directories
+	 * are only added if they have the given extension, unless it is null.
+	 */
+	static inline void collect(const std::string &path, std::vector<std::string> &files, const char *ext = nullptr) {
+		if (!isDirectory(path)) {
+			files.push_back(path);
+			return;
+		}
+		std::vector<std::string> entries;
+#if defined(JIM_VOXTOOLS_POSIX)
+		if (DIR *directory = opendir(path.c_str())) {
+			while (dirent *entry = readdir(directory)) {
+				if (entry->d_name[0] != '.') entries.push_back(path + '/' + entry->d_name);
+			}
+			closedir(directory);
+		}
+#elif defined(JIM_VOXTOOLS_WINDOWS)
+		_finddata64_t info;
+		intptr_t handle = _findfirst64((path + "\\*").c_str(), &info);
+		if (handle != -1) {
+			do {
+				if (info.name[0] != '.') entries.push_back(path + '\\' + info.name);
+			} while (_findnext64(handle, &info) == 0);
+			_findclose(handle);
+		}
+#endif
+		std::sort(entries.begin(), entries.end());
+		for (const std::string &entry : entries) {
+			if (isDirectory(entry)) collect(entry, files, ext);
+			else if (ext == nullptr || extension(entry) == ext) files.push_back(entry);
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// OUTPUT
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	 * Returns the text as quoted JSON string.
+	 */
+	static inline std::string jsonString(const std::string &text) {
+		std::string json = "\"";
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				json += '\\';
+				json += c;
+			}
+			else if ((unsigned char)c < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)c);
+				json += escaped;
+			}
+			else json += c;
+		}
+		return json + '"';
+	}
+
+} // namespace jim
+
+#ifdef JIM_VOXTOOLS_COUNT_ALLOCATIONS
+
+// Inlined into callers GCC would warn about the offset pointers:
+#ifdef __GNUC__
+#define JIM_VOXTOOLS_NOINLINE __attribute__((noinline))
+#else
+#define JIM_VOXTOOLS_NOINLINE
+#endif
+
+JIM_VOXTOOLS_NOINLINE void* operator new(size_t size) {
+	uint8_t *block = static_cast<uint8_t *>(malloc(size + jim::ALLOCATION_HEADER));
+	if (block == nullptr) {
+		throw std::bad_alloc();
+	}
+	memcpy(block, &size, sizeof(size));
+	jim::allocationCount.fetch_add(1, std::memory_order_relaxed);
+	jim::allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+	int64_t live = jim::liveBytes.fetch_add((int64_t)size, std::memory_order_relaxed) + (int64_t)size;
+	int64_t peak = jim::peakLiveBytes.load(std::memory_order_relaxed);
+	while (live > peak && !jim::peakLiveBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+	return block + jim::ALLOCATION_HEADER;
+}
+
+JIM_VOXTOOLS_NOINLINE void operator delete(void *pointer) noexcept {
+	if (pointer == nullptr) return;
+	uint8_t *block = static_cast<uint8_t *>(pointer) - jim::ALLOCATION_HEADER;
+	size_t size;
+	memcpy(&size, block, sizeof(size));
+	jim::liveBytes.fetch_sub((int64_t)size, std::memory_order_relaxed);
+	free(block);
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete[](void *pointer) noexcept { operator delete(pointer); }
+void operator delete(void *pointer, size_t) noexcept { operator delete(pointer); }
+void operator delete[](void *pointer, size_t) noexcept { operator delete(pointer); }
+
+#endif
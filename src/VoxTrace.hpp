@@ -0,0 +1,132 @@
+#pragma once
+
+#include "VoxReader.hpp"
+
+#include <mutex>
+#include <ostream>
+
+namespace jim {
+
+	/**
+	 * Collects traced scopes (see TraceSink) and writes them in the Chrome trace event format, which can be opened
+	 * in chrome://tracing, Perfetto or Speedscope. Every thread which ran a scope gets its own track.
+	 *
+	 * Scopes are only traced when JIM_VOXREADER_TRACE is defined, e.g.
+	 *     ChromeTraceWriter trace;
+	 *     setTraceSink(&trace);
+	 *     vox.load(file);
+	 *     setTraceSink(nullptr);
+	 *     trace.save("load.json");
+	*/
+	class ChromeTraceWriter : public TraceSink {
+	public:
+		ChromeTraceWriter();
+
+		void scope(const char *name, const char *argName, int64_t arg, uint64_t start, uint64_t duration, uint32_t threadId) override;
+
+		/**
+		 * Write all scopes collected so far as JSON.
+		*/
+		void save(std::ostream &s) const;
+		void save(const std::string &path) const;
+
+		/**
+		 * Discard all scopes collected so far.
+		*/
+		void clear();
+
+	private:
+		struct Event {
+			char name[24];
+			const char *argName;
+			int64_t arg;
+			uint64_t start;
+			uint64_t duration;
+			uint32_t threadId;
+		};
+
+		uint64_t origin; // start of the trace
+		mutable std::mutex mutex;
+		std::vector<Event> events;
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// CHROME TRACE
+	//////////////////////////////////////////////////////////////////////////////
+
+	ChromeTraceWriter::ChromeTraceWriter()
+		: origin((uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count()) {}
+
+	void ChromeTraceWriter::scope(const char *name, const char *argName, int64_t arg, uint64_t start, uint64_t duration, uint32_t threadId) {
+		// Names are copied, chunk ids are only valid during the call:
+		Event event;
+		strncpy(event.name, name, sizeof(event.name) - 1);
+		event.name[sizeof(event.name) - 1] = '\0';
+		event.argName = argName;
+		event.arg = arg;
+		event.start = start;
+		event.duration = duration;
+		event.threadId = threadId;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		events.push_back(event);
+	}
+
+	void ChromeTraceWriter::save(std::ostream &s) const {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		// Timestamps are in microseconds, relative to the creation of the writer:
+		std::string json = "{\"traceEvents\":[";
+		char line[256];
+		for (size_t i = 0; i < events.size(); i++) {
+			const Event &e = events[i];
+			json += i > 0 ? ",\n" : "\n";
+			json += "{\"name\":\"";
+			for (const char *c = e.name; *c != '\0'; c++) {
+				if (*c == '"' || *c == '\\') json += '\\';
+				json += (unsigned char)*c < 0x20 ? '?' : *c;
+			}
+			int64_t start = (int64_t)(e.start - origin);
+			snprintf(line, sizeof(line), "\",\"cat\":\"vox\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u",
+				start / 1e3, e.duration / 1e3, e.threadId);
+			json += line;
+			if (e.argName != nullptr) {
+				snprintf(line, sizeof(line), ",\"args\":{\"%s\":%lld}", e.argName, (long long)e.arg);
+				json += line;
+			}
+			json += '}';
+		}
+		json += "\n],\"displayTimeUnit\":\"ms\"}\n";
+		s.write(json.data(), (std::streamsize)json.size());
+	}
+
+	void ChromeTraceWriter::save(const std::string &path) const {
+		std::ofstream file(path, std::ios::binary);
+		if (!file) {
+			throw VoxReader::Exception("Cannot open file for writing: " + path);
+		}
+		save(file);
+		if (!file) {
+			throw VoxReader::Exception("Writing to file failed: " + path);
+		}
+	}
+
+	void ChromeTraceWriter::clear() {
+		std::lock_guard<std::mutex> lock(mutex);
+		events.clear();
+	}
+
+} // namespace jim
+
+#endif
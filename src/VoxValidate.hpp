@@ -0,0 +1,383 @@
+#pragma once
+
+#include "VoxReader.hpp"
+
+#include <istream>
+
+namespace jim {
+
+	/**
+	 * Checks the structure of vox-data without building any objects: chunk sizes, dictionary lengths, node
+	 * references, voxel coordinates against the model size and palette indices. Unlike VoxReader::load() it
+	 * does not stop at the first problem but reports all problems found.
+	*/
+	class VoxValidator {
+	public:
+
+		struct Issue {
+			uint64_t offset;     // of the chunk header the issue was found in, relative to the start of the data
+			std::string message;
+		};
+
+		/**
+		 * Validate the vox-data in the given memory. Returns no issues for valid data.
+		*/
+		static std::vector<Issue> validate(const uint8_t *data, size_t size);
+
+		/**
+		 * Validate the vox-data read from the given stream.
+		*/
+		static std::vector<Issue> validate(std::istream &s);
+
+		/**
+		 * Returns whether the given vox-data has no issues.
+		*/
+		static bool isValid(const uint8_t *data, size_t size) { return validate(data, size).empty(); }
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <cstring>
+#include <unordered_map>
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// VALIDATION
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* What the validator remembers about a scene graph node to check the references between nodes afterwards.
+	*/
+	struct ValidatedNode {
+		SceneGraph::Node::Type type;
+		uint64_t offset;
+		int32_t layerId;               // of transform nodes
+		std::vector<int32_t> children; // node ids of transform and group nodes, model ids of shape nodes
+	};
+
+	class VoxValidation {
+	public:
+		VoxValidation(const uint8_t *data, size_t size) : data(data), size(size) {}
+
+		std::vector<VoxValidator::Issue> run() {
+			if (size < 8 || memcmp(data, "VOX ", 4) != 0) {
+				issue(0, "Magic string 'VOX ' is missing");
+				return issues;
+			}
+			if (readInt(data + 4) != 150) {
+				issue(0, "Version is not 150");
+			}
+			if (size < 20 || memcmp(data + 8, "MAIN", 4) != 0) {
+				issue(8, "MAIN chunk is missing");
+				return issues;
+			}
+
+			uint64_t mainContent = (uint32_t)readInt(data + 12);
+			uint64_t mainChildren = (uint32_t)readInt(data + 16);
+			uint64_t end = 20 + mainContent + mainChildren;
+			if (end > size) {
+				issue(8, "MAIN chunk exceeds the data");
+				end = size;
+			}
+
+			uint64_t offset = 20 + mainContent;
+			const uint8_t *pendingSize = nullptr;
+			uint64_t pendingSizeOffset = 0;
+			while (offset < end) {
+				if (end - offset < 12) {
+					issue(offset, "Chunk header exceeds the data");
+					break;
+				}
+				const uint8_t *header = data + offset;
+				char id[5];
+				memcpy(id, header, 4);
+				id[4] = '\0';
+				uint64_t contentSize = (uint32_t)readInt(header + 4);
+				uint64_t childrenSize = (uint32_t)readInt(header + 8);
+				if (12 + contentSize + childrenSize > end - offset) {
+					issue(offset, std::string("Chunk '") + id + "' exceeds the data");
+					break;
+				}
+				const uint8_t *content = header + 12;
+				validateChildren(offset + 12 + contentSize, offset + 12 + contentSize + childrenSize, 2);
+
+				if (pendingSize != nullptr && strcmp(id, "XYZI")) {
+					issue(pendingSizeOffset, "SIZE chunk is not followed by a XYZI chunk");
+					pendingSize = nullptr;
+				}
+
+				if (!strcmp(id, "SIZE")) {
+					if (contentSize < 12) {
+						issue(offset, "SIZE chunk is too small");
+					}
+					else {
+						pendingSize = content;
+						pendingSizeOffset = offset;
+					}
+				}
+				else if (!strcmp(id, "XYZI")) {
+					if (pendingSize == nullptr) {
+						issue(offset, "XYZI chunk does not follow a SIZE chunk");
+					}
+					else {
+						validateVoxels(pendingSize, pendingSizeOffset, content, contentSize, offset);
+						pendingSize = nullptr;
+					}
+				}
+				else if (!strcmp(id, "RGBA")) {
+					if (contentSize < 4 * 256) {
+						issue(offset, "RGBA chunk is too small");
+					}
+				}
+				else if (!strcmp(id, "nTRN") || !strcmp(id, "nGRP") || !strcmp(id, "nSHP")) {
+					validateNode(id, content, contentSize, offset);
+				}
+				else if (!strcmp(id, "LAYR") || !strcmp(id, "MATL")) {
+					validateIdDictionary(id, content, contentSize, offset);
+				}
+
+				offset += 12 + contentSize + childrenSize;
+			}
+			if (pendingSize != nullptr) {
+				issue(pendingSizeOffset, "SIZE chunk is not followed by a XYZI chunk");
+			}
+
+			validateSceneGraph();
+			return issues;
+		}
+
+	private:
+
+		void issue(uint64_t offset, std::string message) {
+			issues.push_back({ offset, std::move(message) });
+		}
+
+		/**
+		* Checks the chunks nested into a chunk as VoxReader::load() parses them, at most VoxReader::MAX_CHUNK_DEPTH deep.
+		*/
+		void validateChildren(uint64_t offset, uint64_t end, int depth) {
+			while (offset < end) {
+				if (depth > VoxReader::MAX_CHUNK_DEPTH) {
+					issue(offset, "Chunks are nested too deeply");
+					return;
+				}
+				if (end - offset < 12) {
+					issue(offset, "Chunk header exceeds the data");
+					return;
+				}
+				const uint8_t *header = data + offset;
+				char id[5];
+				memcpy(id, header, 4);
+				id[4] = '\0';
+				uint64_t contentSize = (uint32_t)readInt(header + 4);
+				uint64_t childrenSize = (uint32_t)readInt(header + 8);
+				if (12 + contentSize + childrenSize > end - offset) {
+					issue(offset, std::string("Chunk '") + id + "' exceeds the data");
+					return;
+				}
+				validateChildren(offset + 12 + contentSize, offset + 12 + contentSize + childrenSize, depth + 1);
+				offset += 12 + contentSize + childrenSize;
+			}
+		}
+
+		void validateVoxels(const uint8_t *sizeContent, uint64_t sizeOffset, const uint8_t *content, uint64_t contentSize, uint64_t offset) {
+			int32_t sizeX = readInt(sizeContent + 0);
+			int32_t sizeY = readInt(sizeContent + 4);
+			int32_t sizeZ = readInt(sizeContent + 8);
+			if (sizeX < 1 || sizeY < 1 || sizeZ < 1 || sizeX > 256 || sizeY > 256 || sizeZ > 256) {
+				issue(sizeOffset, "SIZE is not within 1 to 256");
+			}
+			modelCount++;
+
+			if (contentSize < 4) {
+				issue(offset, "XYZI chunk is too small");
+				return;
+			}
+			uint32_t voxelCount = (uint32_t)readInt(content);
+			if (voxelCount > (contentSize - 4) / 4) {
+				issue(offset, "XYZI voxel count exceeds the chunk");
+				return;
+			}
+
+			// Reduce first and compare once, so the loop has no branches:
+			uint8_t maxX = 0, maxY = 0, maxZ = 0, minColor = 255;
+			const uint8_t *voxel = content + 4;
+			for (uint32_t i = 0; i < voxelCount; i++, voxel += 4) {
+				maxX = std::max(maxX, voxel[0]);
+				maxY = std::max(maxY, voxel[1]);
+				maxZ = std::max(maxZ, voxel[2]);
+				minColor = std::min(minColor, voxel[3]);
+			}
+			if (voxelCount > 0 && (maxX >= sizeX || maxY >= sizeY || maxZ >= sizeZ)) {
+				issue(offset, "XYZI has voxels outside of SIZE");
+			}
+			if (voxelCount > 0 && minColor == 0) {
+				issue(offset, "XYZI has voxels with color index 0");
+			}
+		}
+
+		void validateNode(const char *id, const uint8_t *content, uint64_t contentSize, uint64_t offset) {
+			ValidatedNode node;
+			node.offset = offset;
+			node.layerId = -1;
+			int32_t nodeId;
+			try {
+				ChunkCursor cursor(content, content + contentSize);
+				nodeId = cursor.int32();
+				cursor.skipDictionary();
+
+				if (id[1] == 'T') {
+					node.type = SceneGraph::Node::TRANSFORM;
+					node.children.push_back(cursor.int32());
+					if (cursor.int32() != -1) {
+						issue(offset, "Reserved id of nTRN is not -1");
+					}
+					node.layerId = cursor.int32();
+					uint32_t frames = cursor.count(4);
+					for (uint32_t i = 0; i < frames; i++) {
+						try {
+							SceneGraph::Transform::Parse(cursor.dictionary());
+						}
+						catch (const VoxReader::Exception &e) {
+							issue(offset, std::string("nTRN frame: ") + e.what());
+						}
+					}
+				}
+				else if (id[1] == 'G') {
+					node.type = SceneGraph::Node::GROUP;
+					uint32_t children = cursor.count(4);
+					node.children.resize(children);
+					for (uint32_t i = 0; i < children; i++) {
+						node.children[i] = cursor.int32();
+					}
+				}
+				else {
+					node.type = SceneGraph::Node::SHAPE;
+					uint32_t models = cursor.count(8);
+					node.children.resize(models);
+					for (uint32_t i = 0; i < models; i++) {
+						node.children[i] = cursor.int32();
+						cursor.skipDictionary();
+					}
+				}
+			}
+			catch (const VoxReader::Exception &e) {
+				issue(offset, std::string(id) + ": " + e.what());
+				return;
+			}
+
+			if (nodeId < 0) {
+				issue(offset, std::string(id) + " has a negative node id");
+			}
+			else if (nodeId > maxObjectId(size)) {
+				issue(offset, std::string(id) + " has a node id exceeding the data");
+			}
+			else if (!nodes.emplace(nodeId, std::move(node)).second) {
+				issue(offset, "Node id " + std::to_string(nodeId) + " is used twice");
+			}
+		}
+
+		void validateIdDictionary(const char *id, const uint8_t *content, uint64_t contentSize, uint64_t offset) {
+			try {
+				ChunkCursor cursor(content, content + contentSize);
+				int32_t objectId = cursor.int32();
+				cursor.skipDictionary();
+				if (objectId < 0) {
+					issue(offset, std::string(id) + " has a negative id");
+				}
+				else if (objectId > maxObjectId(size)) {
+					issue(offset, std::string(id) + " has an id exceeding the data");
+				}
+				else if (id[0] == 'L' && !layerIds.emplace(objectId, offset).second) {
+					issue(offset, "Layer id " + std::to_string(objectId) + " is used twice");
+				}
+				else if (id[0] == 'M' && !materialIds.emplace(objectId, offset).second) {
+					issue(offset, "Material id " + std::to_string(objectId) + " is used twice");
+				}
+			}
+			catch (const VoxReader::Exception &e) {
+				issue(offset, std::string(id) + ": " + e.what());
+			}
+		}
+
+		void validateSceneGraph() {
+			if (nodes.empty()) {
+				return;
+			}
+			if (nodes.find(0) == nodes.end()) {
+				issue(0, "Scene graph has no root node 0");
+			}
+
+			std::unordered_map<int32_t, int32_t> parents;
+			for (const auto &entry : nodes) {
+				const ValidatedNode &node = entry.second;
+				if (node.type == SceneGraph::Node::SHAPE) {
+					for (int32_t modelId : node.children) {
+						if (modelId < 0 || (uint32_t)modelId >= modelCount) {
+							issue(node.offset, "nSHP refers to missing model " + std::to_string(modelId));
+						}
+					}
+					continue;
+				}
+
+				if (node.type == SceneGraph::Node::TRANSFORM && node.layerId != -1 && layerIds.find(node.layerId) == layerIds.end()) {
+					issue(node.offset, "nTRN refers to missing layer " + std::to_string(node.layerId));
+				}
+				for (int32_t childId : node.children) {
+					auto child = nodes.find(childId);
+					if (child == nodes.end()) {
+						issue(node.offset, "Node refers to missing node " + std::to_string(childId));
+						continue;
+					}
+					bool validType = node.type == SceneGraph::Node::TRANSFORM
+						? child->second.type != SceneGraph::Node::TRANSFORM
+						: child->second.type == SceneGraph::Node::TRANSFORM;
+					if (!validType) {
+						issue(node.offset, "Node refers to node " + std::to_string(childId) + " of wrong type");
+					}
+					if (!parents.emplace(childId, entry.first).second) {
+						issue(child->second.offset, "Node " + std::to_string(childId) + " has more than one parent");
+					}
+				}
+			}
+
+			// With at most one parent per node, a cycle is a chain of parents returning to its start:
+			std::unordered_map<int32_t, int32_t> visited; // node id to the start of the chain it was reached from
+			for (const auto &entry : nodes) {
+				int32_t id = entry.first;
+				while (visited.emplace(id, entry.first).second) {
+					auto parent = parents.find(id);
+					if (parent == parents.end()) break;
+					id = parent->second;
+				}
+				if (visited[id] == entry.first && parents.find(id) != parents.end()) {
+					issue(nodes[id].offset, "Node " + std::to_string(id) + " is part of a cycle");
+				}
+			}
+		}
+
+		const uint8_t *data;
+		size_t size;
+		uint32_t modelCount = 0;
+		std::unordered_map<int32_t, ValidatedNode> nodes;
+		std::unordered_map<int32_t, uint64_t> layerIds;    // to chunk offset
+		std::unordered_map<int32_t, uint64_t> materialIds; // to chunk offset
+		std::vector<VoxValidator::Issue> issues;
+	};
+
+	std::vector<VoxValidator::Issue> VoxValidator::validate(const uint8_t *data, size_t size) {
+		VoxValidation validation(data, size);
+		return validation.run();
+	}
+
+	std::vector<VoxValidator::Issue> VoxValidator::validate(std::istream &s) {
+		std::vector<uint8_t> data = VoxReader::readStream(s);
+		return validate(data.data(), data.size());
+	}
+
+} // namespace jim
+
+#endif
@@ -0,0 +1,393 @@
+#pragma once
+
+#include "VoxReader.hpp"
+
+namespace jim {
+
+	/**
+	 * Represents a single voxel in world space.
+	*/
+	struct WorldVoxel {
+		int32_t x, y, z;
+		uint8_t colorIndex;
+	};
+
+	/**
+	 * A sparse set of voxels with 32-bit coordinates, not limited by the 256 per axis model size of the vox-format.
+	*/
+	class VoxWorld {
+	public:
+
+		/**
+		 * Split the world into models of at most tileSize voxels per axis and store them in the given reader,
+		 * so they can be written with VoxWriter.
+		 * The world is cut into a grid of tileSize^3 tiles, empty tiles are dropped and every model is shrunk to
+		 * the bounds of its voxels. Models and scene graph of the reader are replaced: a root transform and a group
+		 * holding one transform/shape node pair per model, placing it at its world position (layer 0, which is
+		 * created if missing). Palette, materials and other layers are kept.
+		 * Voxels with color index 0 (empty) are skipped. Positions should be unique.
+		 * @param[out] vox       Receives models and scene graph.
+		 * @param[in]  threads   Number of threads to use (0 = hardware concurrency).
+		 * @param[in]  tileSize  Edge length of the tiles, 1 to 256.
+		*/
+		void split(VoxReader &vox, unsigned threads = 0, uint32_t tileSize = 256) const;
+
+		/**
+		 * Decides which voxel is kept when multiple instances cover the same position.
+		 * The order is the depth-first order of SceneGraph::Flatten.
+		*/
+		enum Overlap {
+			KEEP_LAST,
+			KEEP_FIRST
+		};
+
+		/**
+		 * Replace the voxels by all voxels of the given scene in world space.
+		 * Every instance of the flattened scene graph is rotated and translated into world space, instances
+		 * on hidden layers are skipped. Files without a scene graph contribute their models untransformed.
+		 * The result holds one voxel per position and is sorted by z, y, x.
+		 * @param[in] vox      Scene to be merged.
+		 * @param[in] overlap  Which voxel to keep where instances overlap.
+		 * @param[in] threads  Number of threads to use (0 = hardware concurrency).
+		*/
+		void merge(const VoxReader &vox, Overlap overlap = KEEP_LAST, unsigned threads = 0);
+
+		std::vector<WorldVoxel> voxels;
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// TILES
+	//////////////////////////////////////////////////////////////////////////////
+
+	struct TileKey {
+		int32_t x, y, z;
+
+		bool operator==(const TileKey &other) const {
+			return x == other.x && y == other.y && z == other.z;
+		}
+
+		bool operator<(const TileKey &other) const {
+			if (z != other.z) return z < other.z;
+			if (y != other.y) return y < other.y;
+			return x < other.x;
+		}
+	};
+
+	struct TileKeyHash {
+		size_t operator()(const TileKey &key) const {
+			uint64_t h = (uint32_t)key.x * 0x9E3779B97F4A7C15ull;
+			h ^= (uint32_t)key.y * 0xC2B2AE3D27D4EB4Full + (h << 6) + (h >> 2);
+			h ^= (uint32_t)key.z * 0x165667B19E3779F9ull + (h << 6) + (h >> 2);
+			return (size_t)h;
+		}
+	};
+
+	using TileMap = std::unordered_map<TileKey, uint32_t, TileKeyHash>;
+
+	static inline int32_t floorDiv(int32_t value, int32_t divisor) {
+		int32_t quotient = value / divisor;
+		return (value % divisor != 0 && value < 0) ? quotient - 1 : quotient;
+	}
+
+	static inline TileKey tileOf(const WorldVoxel &voxel, int32_t tileSize) {
+		return TileKey{ floorDiv(voxel.x, tileSize), floorDiv(voxel.y, tileSize), floorDiv(voxel.z, tileSize) };
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// VOX-WORLD
+	//////////////////////////////////////////////////////////////////////////////
+
+	void VoxWorld::split(VoxReader &vox, unsigned threads, uint32_t tileSize) const {
+
+		if (tileSize == 0 || tileSize > 256) {
+			throw VoxReader::Exception("Tile size must be between 1 and 256");
+		}
+		const int32_t size = (int32_t)tileSize;
+
+		// Voxels are processed in blocks, each block counts its voxels per tile:
+		static const size_t BLOCK_SIZE = 64 * 1024;
+		const size_t blockCount = (voxels.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		std::vector<TileMap> blockTiles(blockCount);
+
+		parallelFor(blockCount, threads, [&](size_t block) {
+			TileMap &counts = blockTiles[block];
+			size_t end = std::min(voxels.size(), (block + 1) * BLOCK_SIZE);
+			for (size_t i = block * BLOCK_SIZE; i < end; i++) {
+				if (voxels[i].colorIndex != 0) {
+					counts[tileOf(voxels[i], size)]++;
+				}
+			}
+		});
+
+		// Non-empty tiles in a deterministic order:
+		std::vector<TileKey> tiles;
+		TileMap tileIndices;
+		for (const auto &counts : blockTiles) {
+			for (const auto &entry : counts) {
+				if (tileIndices.emplace(entry.first, 0).second) {
+					tiles.push_back(entry.first);
+				}
+			}
+		}
+		std::sort(tiles.begin(), tiles.end());
+
+		std::vector<uint32_t> tileBegin(tiles.size() + 1, 0);
+		for (size_t t = 0; t < tiles.size(); t++) {
+			tileIndices[tiles[t]] = (uint32_t)t;
+		}
+		for (const auto &counts : blockTiles) {
+			for (const auto &entry : counts) {
+				tileBegin[tileIndices[entry.first] + 1] += entry.second;
+			}
+		}
+		for (size_t t = 0; t < tiles.size(); t++) {
+			tileBegin[t + 1] += tileBegin[t];
+		}
+
+		// Turn the per block counts into the position each block starts writing a tile at:
+		std::vector<uint32_t> cursor(tileBegin.begin(), tileBegin.end() - 1);
+		for (auto &counts : blockTiles) {
+			for (auto &entry : counts) {
+				uint32_t &position = cursor[tileIndices[entry.first]];
+				uint32_t count = entry.second;
+				entry.second = position;
+				position += count;
+			}
+		}
+
+		// Scatter voxel indices by tile, keeping their input order inside each tile:
+		std::vector<uint32_t> order(tileBegin.back());
+		parallelFor(blockCount, threads, [&](size_t block) {
+			TileMap &positions = blockTiles[block];
+			size_t end = std::min(voxels.size(), (block + 1) * BLOCK_SIZE);
+			TileKey lastKey = { 0, 0, 0 };
+			uint32_t *lastPosition = nullptr;
+			for (size_t i = block * BLOCK_SIZE; i < end; i++) {
+				if (voxels[i].colorIndex == 0) continue;
+				TileKey key = tileOf(voxels[i], size);
+				if (lastPosition == nullptr || !(key == lastKey)) {
+					lastKey = key;
+					lastPosition = &positions[key];
+				}
+				order[(*lastPosition)++] = (uint32_t)i;
+			}
+		});
+
+		// One model per tile, shrunk to the bounds of its voxels:
+		std::vector<Model> models(tiles.size(), Model(0, 0, 0));
+		std::vector<WorldVoxel> origins(tiles.size());
+
+		parallelFor(tiles.size(), threads, [&](size_t t) {
+			const uint32_t *first = order.data() + tileBegin[t];
+			const uint32_t *last = order.data() + tileBegin[t + 1];
+
+			WorldVoxel min = voxels[*first], max = voxels[*first];
+			for (const uint32_t *i = first; i != last; i++) {
+				const WorldVoxel &v = voxels[*i];
+				min.x = std::min(min.x, v.x); max.x = std::max(max.x, v.x);
+				min.y = std::min(min.y, v.y); max.y = std::max(max.y, v.y);
+				min.z = std::min(min.z, v.z); max.z = std::max(max.z, v.z);
+			}
+
+			Model &model = models[t];
+			model.sizeX = (uint32_t)(max.x - min.x + 1);
+			model.sizeY = (uint32_t)(max.y - min.y + 1);
+			model.sizeZ = (uint32_t)(max.z - min.z + 1);
+			model.voxels.reserve(last - first);
+			for (const uint32_t *i = first; i != last; i++) {
+				const WorldVoxel &v = voxels[*i];
+				model.voxels.push_back(Voxel((uint8_t)(v.x - min.x), (uint8_t)(v.y - min.y), (uint8_t)(v.z - min.z), v.colorIndex));
+			}
+			origins[t] = min;
+		});
+
+		vox.models = std::move(models);
+
+		// Scene graph: T -> G -> (T -> S) per model
+		SceneGraph &scene = vox.sceneGraph;
+		scene.Clear();
+
+		auto &root = scene.AddTransformNode(0);
+		root.childNodeId = 1;
+		root.layerId = -1;
+		root.frame_attributes.resize(1);
+
+		auto &group = scene.AddGroupNode(1);
+		group.childNodeIds.reserve(tiles.size());
+
+		for (size_t t = 0; t < tiles.size(); t++) {
+			const Model &model = vox.models[t];
+			SceneGraph::NodeId transformId = (SceneGraph::NodeId)(2 + 2 * t);
+
+			// Magica Voxel places the center of a model (size / 2) at the translation:
+			auto &transform = scene.AddTransformNode(transformId);
+			transform.childNodeId = transformId + 1;
+			transform.layerId = 0;
+			transform.frame_attributes.resize(1);
+			transform.frame_attributes[0].emplace_back("_t",
+				std::to_string(origins[t].x + (int32_t)(model.sizeX / 2)) + ' ' +
+				std::to_string(origins[t].y + (int32_t)(model.sizeY / 2)) + ' ' +
+				std::to_string(origins[t].z + (int32_t)(model.sizeZ / 2)));
+
+			auto &shape = scene.AddShapeNode(transformId + 1);
+			shape.models.resize(1);
+			shape.models[0].modelId = (uint32_t)t;
+
+			group.childNodeIds.push_back(transformId);
+		}
+
+		if (vox.layers.empty()) {
+			vox.layers.resize(1);
+		}
+	}
+
+	/**
+	* Transform all voxels of a model into world space.
+	* Rotations are signed permutations, so every world axis is an offset plus or minus one model axis.
+	* The model center is floor(size / 2), flipped axes mirror around it: world = t + floor(R * (2v + 1 - size) / 2).
+	* Positions are computed in 64 bits, an instance reaching outside the int32 coordinates is rejected.
+	*/
+	static void transformVoxels(const Model &model, const SceneGraph::Transform &transform, WorldVoxel *out) {
+		const uint32_t size[3] = { model.sizeX, model.sizeY, model.sizeZ };
+		int64_t base[3], sign[3];
+		int axis[3];
+
+		for (int row = 0; row < 3; row++) {
+			axis[row] = 0;
+			while (axis[row] < 2 && transform.rotation[row][axis[row]] == 0) axis[row]++;
+			sign[row] = transform.rotation[row][axis[row]];
+			int64_t extent = (int64_t)size[axis[row]];
+			base[row] = (int64_t)transform.translation[row] + (sign[row] > 0 ? -(extent / 2) : (extent - 1) / 2);
+		}
+
+		// Plain loop over the XYZI bytes, the range is checked once after it:
+		const uint8_t *src = reinterpret_cast<const uint8_t *>(model.voxels.data());
+		const size_t count = model.voxels.size();
+		const int ax = axis[0], ay = axis[1], az = axis[2];
+		const int64_t bx = base[0], by = base[1], bz = base[2];
+		const int64_t sx = sign[0], sy = sign[1], sz = sign[2];
+		bool outside = false;
+		for (size_t i = 0; i < count; i++) {
+			const uint8_t *v = src + 4 * i;
+			const int64_t x = bx + sx * v[ax], y = by + sy * v[ay], z = bz + sz * v[az];
+			outside |= x != (int32_t)x || y != (int32_t)y || z != (int32_t)z;
+			out[i].x = (int32_t)x;
+			out[i].y = (int32_t)y;
+			out[i].z = (int32_t)z;
+			out[i].colorIndex = v[3];
+		}
+		if (outside) {
+			throw VoxReader::Exception("Instance lies outside the int32 coordinate range");
+		}
+	}
+
+	static inline bool positionLess(const WorldVoxel &a, const WorldVoxel &b) {
+		if (a.z != b.z) return a.z < b.z;
+		if (a.y != b.y) return a.y < b.y;
+		return a.x < b.x;
+	}
+
+	/**
+	* Stable sort by position: sorted runs per thread, merged pairwise in parallel.
+	*/
+	static void sortByPosition(std::vector<WorldVoxel> &voxels, unsigned threads) {
+		if (threads == 0) {
+			threads = std::thread::hardware_concurrency();
+		}
+		size_t runs = std::max<size_t>(1, std::min<size_t>(threads, voxels.size() / 4096));
+		std::vector<size_t> bounds(runs + 1);
+		for (size_t r = 0; r <= runs; r++) {
+			bounds[r] = voxels.size() * r / runs;
+		}
+
+		parallelFor(runs, threads, [&](size_t r) {
+			std::stable_sort(voxels.begin() + bounds[r], voxels.begin() + bounds[r + 1], positionLess);
+		});
+
+		std::vector<WorldVoxel> buffer(voxels.size());
+		for (size_t width = 1; width < runs; width *= 2) {
+			size_t pairs = (runs + 2 * width - 1) / (2 * width);
+			parallelFor(pairs, threads, [&](size_t p) {
+				size_t first = bounds[2 * width * p];
+				size_t middle = bounds[std::min(runs, 2 * width * p + width)];
+				size_t last = bounds[std::min(runs, 2 * width * p + 2 * width)];
+				std::merge(voxels.begin() + first, voxels.begin() + middle, voxels.begin() + middle, voxels.begin() + last,
+					buffer.begin() + first, positionLess);
+			});
+			voxels.swap(buffer);
+		}
+	}
+
+	/**
+	* Returns the instances of the scene which are not on a hidden layer.
+	* Without a scene graph every model is placed once at its local coordinates.
+	*/
+	static std::vector<SceneGraph::Instance> visibleInstances(const VoxReader &vox) {
+		std::vector<SceneGraph::Instance> instances;
+		if (vox.sceneGraph.GetRoot() != nullptr) {
+			for (const auto &instance : vox.sceneGraph.Flatten()) {
+				if (instance.layerId >= 0 && instance.layerId < (int32_t)vox.layers.size()) {
+					const std::string *hidden = findValue(vox.layers[instance.layerId].attributes, "_hidden");
+					if (hidden != nullptr && *hidden == "1") continue;
+				}
+				if (instance.modelId >= vox.models.size()) {
+					throw VoxReader::Exception("Shape node references a missing model");
+				}
+				instances.push_back(instance);
+			}
+		}
+		else {
+			// No scene graph: models keep their local coordinates
+			for (uint32_t i = 0; i < vox.models.size(); i++) {
+				const Model &model = vox.models[i];
+				SceneGraph::Instance instance = { -1, i, -1, SceneGraph::Transform::Parse(Dictionary()) };
+				instance.transform.translation[0] = (int32_t)(model.sizeX / 2);
+				instance.transform.translation[1] = (int32_t)(model.sizeY / 2);
+				instance.transform.translation[2] = (int32_t)(model.sizeZ / 2);
+				instances.push_back(instance);
+			}
+		}
+		return instances;
+	}
+
+	void VoxWorld::merge(const VoxReader &vox, Overlap overlap, unsigned threads) {
+
+		std::vector<SceneGraph::Instance> instances = visibleInstances(vox);
+
+		std::vector<size_t> offsets(instances.size() + 1, 0);
+		for (size_t i = 0; i < instances.size(); i++) {
+			offsets[i + 1] = offsets[i] + vox.models[instances[i].modelId].voxels.size();
+		}
+
+		voxels.resize(offsets.back());
+		parallelFor(instances.size(), threads, [&](size_t i) {
+			transformVoxels(vox.models[instances[i].modelId], instances[i].transform, voxels.data() + offsets[i]);
+		});
+
+		// Stable sort keeps instance order among equal positions, then one voxel per position is kept:
+		sortByPosition(voxels, threads);
+
+		size_t kept = 0;
+		for (size_t i = 0; i < voxels.size(); ) {
+			size_t end = i + 1;
+			while (end < voxels.size() && !positionLess(voxels[i], voxels[end])) end++;
+			voxels[kept++] = voxels[overlap == KEEP_LAST ? end - 1 : i];
+			i = end;
+		}
+		voxels.resize(kept);
+	}
+
+} // namespace jim
+
+#endif
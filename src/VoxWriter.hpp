@@ -0,0 +1,845 @@
+#pragma once
+
+#include "VoxReader.hpp"
+
+#include <ostream>
+
+namespace jim {
+
+	/**
+	 * Serializes the objects hold by a VoxReader (models, palette, scene graph, layers and materials)
+	 * into a version 150 vox-file.
+	 * All chunk sizes are computed up front, so the output is produced in a single pass without seeking.
+	*/
+	class VoxWriter {
+	public:
+
+		/**
+		 * The writer keeps a reference to the given objects, they must outlive the writer.
+		*/
+		explicit VoxWriter(const VoxReader &vox);
+
+		/**
+		 * Write the vox-data to the given output stream.
+		*/
+		void save(std::ostream &s) const;
+
+		/**
+		 * Write the vox-data to the file at the given path.
+		 * Only the chunk headers and the scene are serialized, the voxels are written straight from the models with
+		 * scatter-gather writes where available.
+		*/
+		void save(const std::string &path) const;
+
+		/**
+		 * Objects changed since loading, see savePatched().
+		*/
+		struct Changes {
+			std::vector<uint32_t> models;              // indices into VoxReader::models
+			std::vector<SceneGraph::NodeId> nodes;     // scene graph node ids
+			std::vector<int32_t> layers;               // layer ids
+			std::vector<int32_t> materials;            // material ids
+			bool palette = false;
+		};
+
+		/**
+		 * Write the vox-data to the file at the given path by patching the file it was loaded from.
+		 * Only the chunks of the given changed objects are serialized again, all other chunks are copied
+		 * verbatim from the source (with copy_file_range where available), so the cost is proportional to the edit.
+		 * Objects added since loading are appended. Removing objects is not supported, use save() instead.
+		 * The output is written to a temporary file which then replaces path, so path may be the source itself.
+		 * @param[in] sourcePath File the objects were loaded from. It is rejected if its size or hash64() differs from
+		 *                       the loaded data (see VoxReader::sourceSize and sourceHash).
+		 * @param[in] path       File to be written.
+		 * @param[in] changes    Objects which were modified since loading.
+		*/
+		void savePatched(const std::string &sourcePath, const std::string &path, const Changes &changes) const;
+
+		/**
+		 * Returns the number of bytes save() is going to write.
+		*/
+		uint64_t size() const;
+
+	private:
+
+		class Output;
+		struct Piece;
+
+		uint32_t childrenSize() const;
+		void writeHeader(Output &out) const;
+		void writeModel(Output &out, const Model &model) const;
+		void writeModelHeader(Output &out, const Model &model) const;
+		void writeScene(Output &out) const;
+		void writeNode(Output &out, SceneGraph::NodeId id) const;
+		void writeLayer(Output &out, int32_t id) const;
+		void writePalette(Output &out) const;
+		void writeMaterial(Output &out, int32_t id) const;
+		void checkSource(const std::string &sourcePath) const;
+		void writePieces(const std::string &sourcePath, const std::string &path, const std::vector<uint8_t> &header, const std::vector<Piece> &pieces) const;
+
+		const VoxReader &vox;
+	};
+
+}
+
+#ifdef JIM_VOXREADER_IMPLEMENTATION
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define JIM_VOXWRITER_WRITEV
+#endif
+
+namespace jim {
+
+	//////////////////////////////////////////////////////////////////////////////
+	// OUTPUT
+	//////////////////////////////////////////////////////////////////////////////
+
+	static_assert(sizeof(Voxel) == 4, "Voxel must match the 4 byte XYZI layout to be written in bulk");
+	static_assert(sizeof(RGBA) == 4, "RGBA must match the 4 byte RGBA layout to be written in bulk");
+
+	/**
+	* Small write-combining buffer in front of the output stream.
+	* Large payloads (voxels) bypass the buffer and are handed to the stream directly.
+	* Without a stream everything is collected in the buffer, which can then be taken with release().
+	*/
+	class VoxWriter::Output {
+	public:
+		static const size_t BUFFER_SIZE = 64 * 1024;
+
+		explicit Output(std::ostream &s) : s(&s) {
+			buffer.reserve(BUFFER_SIZE);
+		}
+
+		explicit Output(size_t reserve) : s(nullptr) {
+			buffer.reserve(reserve);
+		}
+
+		~Output() {
+			flush();
+		}
+
+		void flush() {
+			if (s != nullptr && !buffer.empty()) {
+				s->write(reinterpret_cast<const char *>(buffer.data()), buffer.size());
+				buffer.clear();
+			}
+		}
+
+		std::vector<uint8_t> release() {
+			return std::move(buffer);
+		}
+
+		void bytes(const void *data, size_t size) {
+			if (s != nullptr && size >= BUFFER_SIZE) {
+				flush();
+				s->write(reinterpret_cast<const char *>(data), size);
+				return;
+			}
+			if (s != nullptr && buffer.size() + size > BUFFER_SIZE) {
+				flush();
+			}
+			const uint8_t *ptr = reinterpret_cast<const uint8_t *>(data);
+			buffer.insert(buffer.end(), ptr, ptr + size);
+		}
+
+		void int32(int32_t value) {
+			bytes(&value, 4);
+		}
+
+		void string(const std::string &str) {
+			int32((int32_t)str.size());
+			bytes(str.data(), str.size());
+		}
+
+		void dictionary(const Dictionary &dictionary) {
+			int32((int32_t)dictionary.size());
+			for (const auto &entry : dictionary) {
+				string(entry.first);
+				string(entry.second);
+			}
+		}
+
+		void chunk(const char *id, uint32_t contentSize, uint32_t childrenSize = 0) {
+			bytes(id, 4);
+			int32(contentSize);
+			int32(childrenSize);
+		}
+
+	private:
+		std::ostream *s;
+		std::vector<uint8_t> buffer;
+	};
+
+	//////////////////////////////////////////////////////////////////////////////
+	// CHUNK SIZES
+	//////////////////////////////////////////////////////////////////////////////
+
+	static const uint32_t CHUNK_HEADER_SIZE = 4 + 4 + 4;
+	static const uint32_t MODEL_HEADER_SIZE = CHUNK_HEADER_SIZE + 12 + CHUNK_HEADER_SIZE + 4; // SIZE and XYZI up to the voxels
+
+	static uint32_t dictionarySize(const Dictionary &dictionary) {
+		uint32_t size = 4;
+		for (const auto &entry : dictionary) {
+			size += 4 + (uint32_t)entry.first.size() + 4 + (uint32_t)entry.second.size();
+		}
+		return size;
+	}
+
+	static uint32_t nodeContentSize(const SceneGraph::Node &node) {
+		uint32_t size = 4 + dictionarySize(node.attributes);
+		switch (node.type) {
+		case SceneGraph::Node::TRANSFORM: {
+			const auto &transform = static_cast<const SceneGraph::TransformNode &>(node);
+			size += 4 + 4 + 4 + 4;
+			for (const auto &frame : transform.frame_attributes) {
+				size += dictionarySize(frame);
+			}
+			break;
+		}
+		case SceneGraph::Node::GROUP: {
+			const auto &group = static_cast<const SceneGraph::GroupNode &>(node);
+			size += 4 + 4 * (uint32_t)group.childNodeIds.size();
+			break;
+		}
+		case SceneGraph::Node::SHAPE: {
+			const auto &shape = static_cast<const SceneGraph::ShapeNode &>(node);
+			size += 4;
+			for (const auto &model : shape.models) {
+				size += 4 + dictionarySize(model.attributes);
+			}
+			break;
+		}
+		}
+		return size;
+	}
+
+	static const char *nodeChunkId(const SceneGraph::Node &node) {
+		switch (node.type) {
+		case SceneGraph::Node::TRANSFORM: return "nTRN";
+		case SceneGraph::Node::GROUP: return "nGRP";
+		default: return "nSHP";
+		}
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// VOX-WRITER
+	//////////////////////////////////////////////////////////////////////////////
+
+	VoxWriter::VoxWriter(const VoxReader &vox) : vox(vox) {}
+
+	uint64_t VoxWriter::size() const {
+		// Magic, version and main chunk:
+		return 4 + 4 + CHUNK_HEADER_SIZE + childrenSize();
+	}
+
+	uint32_t VoxWriter::childrenSize() const {
+		uint64_t size = 0;
+
+		if (vox.models.size() > 1) {
+			size += CHUNK_HEADER_SIZE + 4;
+		}
+
+		for (const auto &model : vox.models) {
+			size += CHUNK_HEADER_SIZE + 12;
+			size += CHUNK_HEADER_SIZE + 4 + 4 * (uint64_t)model.voxels.size();
+		}
+
+		for (const auto &node : vox.sceneGraph.nodes) {
+			if (node) {
+				size += CHUNK_HEADER_SIZE + nodeContentSize(*node);
+			}
+		}
+
+		for (const auto &layer : vox.layers) {
+			size += CHUNK_HEADER_SIZE + 4 + dictionarySize(layer.attributes) + 4;
+		}
+
+		if (vox.palette != nullptr && vox.palette != &VoxReader::DEFAULT_PALETTE) {
+			size += CHUNK_HEADER_SIZE + 4 * 256;
+		}
+
+		for (const auto &raw : vox.unknownChunks) {
+			size += raw.bytes.size();
+		}
+
+		for (const auto &material : vox.materials) {
+			if (!material.properties.empty()) {
+				size += CHUNK_HEADER_SIZE + 4 + dictionarySize(material.properties);
+			}
+		}
+
+		if (size > UINT32_MAX) {
+			throw VoxReader::Exception("Vox-data exceeds the 4 GiB chunk size limit");
+		}
+		return (uint32_t)size;
+	}
+
+	void VoxWriter::save(std::ostream &s) const {
+
+		if (!s) {
+			throw VoxReader::Exception("Cannot write to stream");
+		}
+
+		Output out(s);
+
+		writeHeader(out);
+		for (const auto &model : vox.models) {
+			writeModel(out, model);
+		}
+		writeScene(out);
+
+		out.flush();
+		if (!s) {
+			throw VoxReader::Exception("Writing to stream failed");
+		}
+	}
+
+	void VoxWriter::save(const std::string &path) const {
+		JIM_VOXREADER_TRACE_SCOPE("save");
+
+#ifdef JIM_VOXWRITER_WRITEV
+		// Only the headers are serialized, the voxels are written from the models:
+		Output header(4 + 4 + CHUNK_HEADER_SIZE + CHUNK_HEADER_SIZE + 4);
+		writeHeader(header);
+		const std::vector<uint8_t> headerBytes = header.release();
+
+		Output modelHeaders(MODEL_HEADER_SIZE * vox.models.size());
+		for (const auto &model : vox.models) {
+			writeModelHeader(modelHeaders, model);
+		}
+		const std::vector<uint8_t> modelHeaderBytes = modelHeaders.release();
+
+		Output scene(Output::BUFFER_SIZE);
+		writeScene(scene);
+		const std::vector<uint8_t> sceneBytes = scene.release();
+
+		// writev does not write to the buffers, iovec just has no const variant:
+		std::vector<iovec> iov;
+		iov.reserve(2 * vox.models.size() + 2);
+		auto add = [&iov](const void *data, size_t size) {
+			if (size > 0) {
+				iovec entry;
+				entry.iov_base = const_cast<void *>(data);
+				entry.iov_len = size;
+				iov.push_back(entry);
+			}
+		};
+		add(headerBytes.data(), headerBytes.size());
+		for (size_t i = 0; i < vox.models.size(); i++) {
+			add(modelHeaderBytes.data() + i * MODEL_HEADER_SIZE, MODEL_HEADER_SIZE);
+			add(vox.models[i].voxels.data(), 4 * vox.models[i].voxels.size());
+		}
+		add(sceneBytes.data(), sceneBytes.size());
+
+		int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0) {
+			throw VoxReader::Exception("Cannot open file for writing: " + path);
+		}
+
+		// writev takes at most IOV_MAX entries, may write partially and may be interrupted by a signal:
+		iovec *pending = iov.data();
+		size_t pendingCount = iov.size();
+		while (pendingCount > 0) {
+			int batch = (int)(pendingCount < IOV_MAX ? pendingCount : IOV_MAX);
+			ssize_t written = ::writev(fd, pending, batch);
+			if (written < 0) {
+				if (errno == EINTR) continue;
+				::close(fd);
+				throw VoxReader::Exception("Writing to file failed: " + path);
+			}
+			while (pendingCount > 0 && (size_t)written >= pending->iov_len) {
+				written -= pending->iov_len;
+				pending++;
+				pendingCount--;
+			}
+			if (written > 0) {
+				pending->iov_base = static_cast<uint8_t *>(pending->iov_base) + written;
+				pending->iov_len -= written;
+			}
+		}
+
+		if (::close(fd) != 0) {
+			throw VoxReader::Exception("Writing to file failed: " + path);
+		}
+#else
+		std::ofstream file(path, std::ios::binary);
+		if (!file) {
+			throw VoxReader::Exception("Cannot open file for writing: " + path);
+		}
+		save(file);
+#endif
+	}
+
+	void VoxWriter::writeHeader(Output &out) const {
+		out.bytes("VOX ", 4);
+		out.int32(150);
+		out.chunk("MAIN", 0, childrenSize());
+
+		// Pack (only needed for multiple models):
+		if (vox.models.size() > 1) {
+			out.chunk("PACK", 4);
+			out.int32((int32_t)vox.models.size());
+		}
+	}
+
+	void VoxWriter::writeModel(Output &out, const Model &model) const {
+		writeModelHeader(out, model);
+		out.bytes(model.voxels.data(), 4 * model.voxels.size());
+	}
+
+	/**
+	* The SIZE chunk and the XYZI chunk up to its voxels, MODEL_HEADER_SIZE bytes.
+	*/
+	void VoxWriter::writeModelHeader(Output &out, const Model &model) const {
+		out.chunk("SIZE", 12);
+		out.int32(model.sizeX);
+		out.int32(model.sizeY);
+		out.int32(model.sizeZ);
+
+		out.chunk("XYZI", 4 + 4 * (uint32_t)model.voxels.size());
+		out.int32((int32_t)model.voxels.size());
+	}
+
+	void VoxWriter::writeScene(Output &out) const {
+
+		// Scene graph, nodes are written in the order of their ids:
+		for (size_t id = 0; id < vox.sceneGraph.nodes.size(); id++) {
+			if (vox.sceneGraph.nodes[id]) {
+				writeNode(out, (SceneGraph::NodeId)id);
+			}
+		}
+
+		// Layers:
+		for (size_t i = 0; i < vox.layers.size(); i++) {
+			writeLayer(out, (int32_t)i);
+		}
+
+		// Palette (the default one is implied when missing):
+		if (vox.palette != nullptr && vox.palette != &VoxReader::DEFAULT_PALETTE) {
+			writePalette(out);
+		}
+
+		// Chunks the reader did not interpret:
+		for (const auto &raw : vox.unknownChunks) {
+			out.bytes(raw.bytes.data(), raw.bytes.size());
+		}
+
+		// Materials, slots which were never filled are skipped:
+		for (size_t i = 0; i < vox.materials.size(); i++) {
+			if (!vox.materials[i].properties.empty()) {
+				writeMaterial(out, (int32_t)i);
+			}
+		}
+	}
+
+	void VoxWriter::writeNode(Output &out, SceneGraph::NodeId id) const {
+		const SceneGraph::Node &node = *vox.sceneGraph.nodes[id];
+		out.chunk(nodeChunkId(node), nodeContentSize(node));
+		out.int32(id);
+		out.dictionary(node.attributes);
+
+		switch (node.type) {
+		case SceneGraph::Node::TRANSFORM: {
+			const auto &transform = static_cast<const SceneGraph::TransformNode &>(node);
+			out.int32(transform.childNodeId);
+			out.int32(-1); // reserved id
+			out.int32(transform.layerId);
+			out.int32((int32_t)transform.frame_attributes.size());
+			for (const auto &frame : transform.frame_attributes) {
+				out.dictionary(frame);
+			}
+			break;
+		}
+		case SceneGraph::Node::GROUP: {
+			const auto &group = static_cast<const SceneGraph::GroupNode &>(node);
+			out.int32((int32_t)group.childNodeIds.size());
+			out.bytes(group.childNodeIds.data(), 4 * group.childNodeIds.size());
+			break;
+		}
+		case SceneGraph::Node::SHAPE: {
+			const auto &shape = static_cast<const SceneGraph::ShapeNode &>(node);
+			out.int32((int32_t)shape.models.size());
+			for (const auto &model : shape.models) {
+				out.int32(model.modelId);
+				out.dictionary(model.attributes);
+			}
+			break;
+		}
+		}
+	}
+
+	void VoxWriter::writeLayer(Output &out, int32_t id) const {
+		const Layer &layer = vox.layers[id];
+		out.chunk("LAYR", 4 + dictionarySize(layer.attributes) + 4);
+		out.int32(id);
+		out.dictionary(layer.attributes);
+		out.int32(-1); // reserved id
+	}
+
+	void VoxWriter::writePalette(Output &out) const {
+		RGBA colors[256];
+		if (vox.palette != nullptr && vox.palette != &VoxReader::DEFAULT_PALETTE) {
+			size_t count = vox.palette->size() < 256 ? vox.palette->size() : 256;
+			memcpy(colors, vox.palette->data(), 4 * count);
+		}
+		else {
+			// The chunk stores color index i at position i - 1, the default palette at position i:
+			for (int i = 0; i < 255; i++) {
+				colors[i] = VoxReader::DEFAULT_PALETTE[i + 1];
+			}
+		}
+		out.chunk("RGBA", 4 * 256);
+		out.bytes(colors, 4 * 256);
+	}
+
+	void VoxWriter::writeMaterial(Output &out, int32_t id) const {
+		const MaterialEx &material = vox.materials[id];
+		out.chunk("MATL", 4 + dictionarySize(material.properties));
+		out.int32(id);
+		out.dictionary(material.properties);
+	}
+
+	//////////////////////////////////////////////////////////////////////////////
+	// PATCHING
+	//////////////////////////////////////////////////////////////////////////////
+
+	/**
+	* A part of the patched output: either a byte range copied from the source or newly serialized bytes.
+	*/
+	struct VoxWriter::Piece {
+		bool copy;
+		uint64_t offset; // in the source, when copied
+		uint64_t size;
+		std::vector<uint8_t> bytes;
+	};
+
+	static void markChanged(std::vector<bool> &changed, int64_t index) {
+		if (index < 0) {
+			throw VoxReader::Exception("Negative index in changes");
+		}
+		if (index >= (int64_t)changed.size()) {
+			changed.resize((size_t)index + 1);
+		}
+		changed[(size_t)index] = true;
+	}
+
+	static bool isChanged(const std::vector<bool> &changed, int32_t index) {
+		return index >= 0 && index < (int32_t)changed.size() && changed[index];
+	}
+
+	void VoxWriter::savePatched(const std::string &sourcePath, const std::string &path, const Changes &changes) const {
+
+		if (vox.sourceChunks.empty()) {
+			throw VoxReader::Exception("Nothing was loaded, there is no source to patch");
+		}
+
+		std::vector<bool> changedModels, changedNodes, changedLayers, changedMaterials;
+		for (auto index : changes.models) markChanged(changedModels, index);
+		for (auto index : changes.nodes) markChanged(changedNodes, index);
+		for (auto index : changes.layers) markChanged(changedLayers, index);
+		for (auto index : changes.materials) markChanged(changedMaterials, index);
+
+		std::vector<bool> sourceNodes, sourceLayers, sourceMaterials;
+		size_t sourceModelCount = 0, sourceUnknownCount = 0;
+		bool sourcePalette = false;
+
+		std::vector<Piece> pieces;
+		pieces.reserve(vox.sourceChunks.size());
+
+		auto removed = [](const char *what) {
+			return VoxReader::Exception(std::string(what) + " was removed since loading, patching is not possible");
+		};
+
+		auto copy = [&](const VoxReader::ChunkRef &ref) {
+			if (!pieces.empty() && pieces.back().copy && pieces.back().offset + pieces.back().size == ref.offset) {
+				pieces.back().size += ref.size;
+			}
+			else {
+				pieces.push_back(Piece{ true, ref.offset, ref.size, {} });
+			}
+		};
+
+		auto serialized = [&](Output &out) {
+			std::vector<uint8_t> bytes = out.release();
+			uint64_t size = bytes.size();
+			pieces.push_back(Piece{ false, 0, size, std::move(bytes) });
+		};
+
+		// Walk the source chunks in file order, rewriting only what was changed:
+		for (const auto &ref : vox.sourceChunks) {
+			Output out(CHUNK_HEADER_SIZE);
+
+			if (!strcmp(ref.id, "PACK")) {
+				// The model count may have changed, the chunk is tiny:
+				out.chunk("PACK", 4);
+				out.int32((int32_t)vox.models.size());
+				serialized(out);
+			}
+			else if (!strcmp(ref.id, "SIZE") || !strcmp(ref.id, "XYZI")) {
+				if (ref.index >= (int32_t)vox.models.size()) throw removed("Model");
+				if (ref.id[0] == 'S') sourceModelCount++;
+
+				if (!isChanged(changedModels, ref.index)) copy(ref);
+				else if (ref.id[0] == 'S') {
+					writeModel(out, vox.models[ref.index]);
+					serialized(out);
+				}
+			}
+			else if (ref.id[0] == 'n') {
+				const auto &nodes = vox.sceneGraph.nodes;
+				if (ref.index >= (int32_t)nodes.size() || !nodes[ref.index] || strcmp(nodeChunkId(*nodes[ref.index]), ref.id)) {
+					throw removed("Scene graph node");
+				}
+				markChanged(sourceNodes, ref.index);
+
+				if (!isChanged(changedNodes, ref.index)) copy(ref);
+				else {
+					writeNode(out, ref.index);
+					serialized(out);
+				}
+			}
+			else if (!strcmp(ref.id, "LAYR")) {
+				if (ref.index >= (int32_t)vox.layers.size()) throw removed("Layer");
+				markChanged(sourceLayers, ref.index);
+
+				if (!isChanged(changedLayers, ref.index)) copy(ref);
+				else {
+					writeLayer(out, ref.index);
+					serialized(out);
+				}
+			}
+			else if (!strcmp(ref.id, "MATL")) {
+				if (ref.index >= (int32_t)vox.materials.size() || vox.materials[ref.index].properties.empty()) throw removed("Material");
+				markChanged(sourceMaterials, ref.index);
+
+				if (!isChanged(changedMaterials, ref.index)) copy(ref);
+				else {
+					writeMaterial(out, ref.index);
+					serialized(out);
+				}
+			}
+			else if (!strcmp(ref.id, "RGBA")) {
+				sourcePalette = true;
+
+				if (!changes.palette) copy(ref);
+				else {
+					writePalette(out);
+					serialized(out);
+				}
+			}
+			else {
+				if (ref.index >= (int32_t)vox.unknownChunks.size()) throw removed("Chunk");
+				sourceUnknownCount++;
+				copy(ref);
+			}
+		}
+
+		// Append everything added since loading:
+		Output added(Output::BUFFER_SIZE);
+		for (size_t i = sourceModelCount; i < vox.models.size(); i++) {
+			writeModel(added, vox.models[i]);
+		}
+		for (size_t id = 0; id < vox.sceneGraph.nodes.size(); id++) {
+			if (vox.sceneGraph.nodes[id] && !isChanged(sourceNodes, (int32_t)id)) {
+				writeNode(added, (SceneGraph::NodeId)id);
+			}
+		}
+		for (size_t i = 0; i < vox.layers.size(); i++) {
+			if (!isChanged(sourceLayers, (int32_t)i)) {
+				writeLayer(added, (int32_t)i);
+			}
+		}
+		if (!sourcePalette && (changes.palette || vox.palette != &VoxReader::DEFAULT_PALETTE)) {
+			writePalette(added);
+		}
+		for (size_t i = sourceUnknownCount; i < vox.unknownChunks.size(); i++) {
+			added.bytes(vox.unknownChunks[i].bytes.data(), vox.unknownChunks[i].bytes.size());
+		}
+		for (size_t i = 0; i < vox.materials.size(); i++) {
+			if (!vox.materials[i].properties.empty() && !isChanged(sourceMaterials, (int32_t)i)) {
+				writeMaterial(added, (int32_t)i);
+			}
+		}
+		serialized(added);
+
+		// The main chunk header is the only thing depending on all pieces:
+		uint64_t childrenSize = 0;
+		for (const auto &piece : pieces) {
+			childrenSize += piece.size;
+		}
+		if (childrenSize > UINT32_MAX) {
+			throw VoxReader::Exception("Vox-data exceeds the 4 GiB chunk size limit");
+		}
+
+		Output header(4 + 4 + CHUNK_HEADER_SIZE);
+		header.bytes("VOX ", 4);
+		header.int32(150);
+		header.chunk("MAIN", 0, (uint32_t)childrenSize);
+		std::vector<uint8_t> headerBytes = header.release();
+
+		writePieces(sourcePath, path, headerBytes, pieces);
+	}
+
+	/**
+	* Unique name next to the given path, so renaming it over the path stays on the same file system.
+	*/
+	static std::string temporaryPath(const std::string &path) {
+		static std::atomic<uint32_t> counter(0);
+#ifdef JIM_VOXWRITER_WRITEV
+		const uint64_t process = (uint64_t)::getpid();
+#else
+		const uint64_t process = (uint64_t)std::hash<std::thread::id>()(std::this_thread::get_id());
+#endif
+		return path + ".tmp" + std::to_string(process) + "." + std::to_string(counter.fetch_add(1));
+	}
+
+	void VoxWriter::checkSource(const std::string &sourcePath) const {
+		// File times can lag or be set back, only the content tells whether the chunk offsets still apply:
+		MappedFile source(sourcePath);
+		if (source.size() != vox.sourceSize) {
+			throw VoxReader::Exception("Source file does not match the loaded data: " + sourcePath);
+		}
+		if (hash64(source.data(), source.size()) != vox.sourceHash) {
+			throw VoxReader::Exception("Source file was changed since loading: " + sourcePath);
+		}
+	}
+
+	void VoxWriter::writePieces(const std::string &sourcePath, const std::string &path, const std::vector<uint8_t> &header, const std::vector<Piece> &pieces) const {
+		checkSource(sourcePath);
+
+		// The output is written under a temporary name and renamed over the path, so the source can be the
+		// path itself and a failed save never leaves a partial file behind.
+		const std::string temporary = temporaryPath(path);
+
+#ifdef JIM_VOXWRITER_WRITEV
+		int in = ::open(sourcePath.c_str(), O_RDONLY);
+		if (in < 0) {
+			throw VoxReader::Exception("Cannot open source file: " + sourcePath);
+		}
+		int out = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (out < 0) {
+			::close(in);
+			throw VoxReader::Exception("Cannot open file for writing: " + temporary);
+		}
+
+		auto fail = [&](const std::string &message) {
+			::close(in);
+			::close(out);
+			::unlink(temporary.c_str());
+			return VoxReader::Exception(message);
+		};
+
+		auto writeAll = [&](const uint8_t *data, uint64_t size) {
+			while (size > 0) {
+				ssize_t written = ::write(out, data, (size_t)size);
+				if (written < 0 && errno == EINTR) continue;
+				if (written <= 0) throw fail("Writing to file failed: " + path);
+				data += written;
+				size -= written;
+			}
+		};
+
+		writeAll(header.data(), header.size());
+
+		for (const auto &piece : pieces) {
+			if (!piece.copy) {
+				writeAll(piece.bytes.data(), piece.size);
+				continue;
+			}
+
+			off_t offset = (off_t)piece.offset;
+			uint64_t remaining = piece.size;
+#ifdef __linux__
+			// Let the kernel copy (or reflink) the unchanged range:
+			while (remaining > 0) {
+				ssize_t copied = ::copy_file_range(in, &offset, out, nullptr, (size_t)remaining, 0);
+				if (copied <= 0) break; // not supported for these files, fall back below
+				remaining -= copied;
+			}
+#endif
+			std::vector<uint8_t> buffer;
+			while (remaining > 0) {
+				buffer.resize(remaining < Output::BUFFER_SIZE * 16 ? (size_t)remaining : Output::BUFFER_SIZE * 16);
+				ssize_t count = ::pread(in, buffer.data(), buffer.size(), offset);
+				if (count < 0 && errno == EINTR) continue;
+				if (count <= 0) throw fail("Reading source file failed: " + sourcePath);
+				writeAll(buffer.data(), count);
+				offset += count;
+				remaining -= count;
+			}
+		}
+
+		::close(in);
+		if (::close(out) != 0) {
+			::unlink(temporary.c_str());
+			throw VoxReader::Exception("Writing to file failed: " + path);
+		}
+		if (::rename(temporary.c_str(), path.c_str()) != 0) {
+			::unlink(temporary.c_str());
+			throw VoxReader::Exception("Cannot replace file: " + path);
+		}
+#else
+		{
+			std::ifstream in(sourcePath, std::ios::binary | std::ios::ate);
+			if (!in) {
+				throw VoxReader::Exception("Cannot open source file: " + sourcePath);
+			}
+			std::ofstream out(temporary, std::ios::binary);
+			if (!out) {
+				throw VoxReader::Exception("Cannot open file for writing: " + temporary);
+			}
+
+			out.write(reinterpret_cast<const char *>(header.data()), header.size());
+
+			std::vector<char> buffer(Output::BUFFER_SIZE * 16);
+			for (const auto &piece : pieces) {
+				if (!piece.copy) {
+					out.write(reinterpret_cast<const char *>(piece.bytes.data()), piece.size);
+					continue;
+				}
+				in.seekg(piece.offset);
+				uint64_t remaining = piece.size;
+				while (remaining > 0 && in) {
+					std::streamsize count = (std::streamsize)(remaining < buffer.size() ? remaining : buffer.size());
+					in.read(buffer.data(), count);
+					out.write(buffer.data(), in.gcount());
+					remaining -= in.gcount();
+				}
+				if (remaining > 0) {
+					out.close();
+					std::remove(temporary.c_str());
+					throw VoxReader::Exception("Reading source file failed: " + sourcePath);
+				}
+			}
+
+			out.close();
+			if (!out) {
+				std::remove(temporary.c_str());
+				throw VoxReader::Exception("Writing to file failed: " + path);
+			}
+		}
+		// Both files are closed, renaming over an existing file is not possible on Windows:
+		std::remove(path.c_str());
+		if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+			std::remove(temporary.c_str());
+			throw VoxReader::Exception("Cannot replace file: " + path);
+		}
+#endif
+	}
+
+} // namespace jim
+
+#endif